@@ -0,0 +1,524 @@
+/**********************************************************************
+ * vanessa_logger_bench.c                                  October 2026
+ * Simon Horman                                      horms@verge.net.au
+ *
+ * vanessa_logger
+ * Generic logging layer
+ * Copyright (C) 2000-2008  Simon Horman <horms@verge.net.au>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307 USA
+ *
+ **********************************************************************/
+
+#include <vanessa_logger.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DEFAULT_THREADS  8
+#define DEFAULT_MESSAGES 100000
+#define DEFAULT_OUTPUT   "/dev/null"
+#define DEFAULT_SYSLOG_OUTPUT "/tmp/vanessa_logger_bench.sock"
+
+/* What each thread logs */
+typedef struct {
+	int priority;
+	int prefix;
+	const char *payload;
+} bench_msg_t;
+
+typedef struct {
+	vanessa_logger_t *vl;
+	unsigned long messages;
+	const bench_msg_t *msg;
+	int id;
+} bench_arg_t;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void *bench_thread(void *data)
+{
+	bench_arg_t *arg = (bench_arg_t *)data;
+	unsigned long i;
+
+	for (i = 0; i < arg->messages; i++) {
+		if (arg->msg->prefix) {
+			_vanessa_logger_log_prefix(arg->vl,
+					arg->msg->priority, __func__,
+					"bench thread %d message %lu of %lu%s",
+					arg->id, i, arg->messages,
+					arg->msg->payload);
+		}
+		else {
+			vanessa_logger_log(arg->vl, arg->msg->priority,
+					"bench thread %d message %lu of %lu%s",
+					arg->id, i, arg->messages,
+					arg->msg->payload);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Log messages from nthreads threads at once and print the results
+ * as a line of key=value pairs, after those in label
+ */
+
+static int bench_threads(vanessa_logger_t *vl, int nthreads,
+		unsigned long messages, const bench_msg_t *msg,
+		const char *label)
+{
+	pthread_t *thread;
+	bench_arg_t *arg;
+	double start, secs;
+	int i;
+
+	thread = (pthread_t *)malloc(nthreads * sizeof(*thread));
+	arg = (bench_arg_t *)malloc(nthreads * sizeof(*arg));
+	if (!thread || !arg) {
+		perror("bench_threads: malloc");
+		free(thread);
+		free(arg);
+		return -1;
+	}
+
+	start = now();
+	for (i = 0; i < nthreads; i++) {
+		arg[i].vl = vl;
+		arg[i].messages = messages;
+		arg[i].msg = msg;
+		arg[i].id = i;
+		if (pthread_create(thread + i, NULL, bench_thread, arg + i)) {
+			perror("bench_threads: pthread_create");
+			exit(-1);
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(thread[i], NULL);
+	}
+	secs = now() - start;
+
+	printf("%s%sthreads=%d messages=%lu seconds=%.6f msgs_per_sec=%.0f "
+	       "ns_per_msg=%.1f\n", label, *label ? " " : "",
+	       nthreads, messages * nthreads, secs,
+	       messages * nthreads / secs,
+	       secs * 1e9 / (messages * nthreads));
+	fflush(stdout);
+
+	free(thread);
+	free(arg);
+	return 0;
+}
+
+/*
+ * Stand-in for a syslog daemon, counts the datagrams sent to it
+ */
+
+typedef struct {
+	int fd;
+	unsigned long received;
+	pthread_t thread;
+} bench_syslogd_t;
+
+static void *bench_syslogd_thread(void *data)
+{
+	bench_syslogd_t *syslogd = (bench_syslogd_t *)data;
+	char buf[2048];
+
+	while (recv(syslogd->fd, buf, sizeof(buf), 0) > 0) {
+		syslogd->received++;
+	}
+
+	return NULL;
+}
+
+static int bench_syslogd_start(bench_syslogd_t *syslogd, const char *path)
+{
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	unlink(path);
+
+	syslogd->received = 0;
+	syslogd->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (syslogd->fd < 0) {
+		perror("bench_syslogd_start: socket");
+		return -1;
+	}
+	if (bind(syslogd->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bench_syslogd_start: bind");
+		return -1;
+	}
+	if (pthread_create(&syslogd->thread, NULL, bench_syslogd_thread,
+				syslogd)) {
+		perror("bench_syslogd_start: pthread_create");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void bench_syslogd_stop(bench_syslogd_t *syslogd, const char *path)
+{
+	shutdown(syslogd->fd, SHUT_RDWR);
+	pthread_join(syslogd->thread, NULL);
+	close(syslogd->fd);
+	unlink(path);
+
+	printf("syslog datagrams received=%lu\n", syslogd->received);
+}
+
+static void print_sync_stats(vanessa_logger_t *vl)
+{
+	static vanessa_logger_sync_stats_t last;
+	vanessa_logger_sync_stats_t stats;
+	unsigned long commits;
+
+	if (vanessa_logger_get_sync_stats(vl, &stats) < 0) {
+		return;
+	}
+
+	commits = stats.commits - last.commits;
+	printf("  syncs=%lu sync_errors=%lu commits=%lu "
+	       "commits_per_sync=%.1f commit_usec_avg=%.1f "
+	       "commit_usec_max=%lu\n",
+	       stats.syncs - last.syncs,
+	       stats.sync_errors - last.sync_errors, commits,
+	       stats.syncs == last.syncs ? 0.0 :
+	       (double)commits / (stats.syncs - last.syncs),
+	       commits ? (double)(stats.commit_usec_total -
+		       last.commit_usec_total) / commits : 0.0,
+	       stats.commit_usec_max);
+	fflush(stdout);
+
+	last = stats;
+}
+
+/*
+ * Suite: every sink, with and without a timestamp and prefix,
+ * for a range of message sizes and 1 to max_threads threads.
+ * Also the cost of a message rejected by max_priority.
+ */
+
+static const char *bench_sinks[] = {
+	"filehandle", "filename", "syslog", "function", NULL
+};
+
+static const size_t bench_sizes[] = { 0, 64, 256, 1024, 4000 };
+
+static void bench_function(int priority, const char *fmt, va_list ap)
+{
+	char buf[4096];
+
+	(void) priority;
+
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+}
+
+static vanessa_logger_t *bench_open(const char *sink, const char *output,
+		const char *syslog_path, int max_priority, int flag,
+		FILE **fh)
+{
+	const char *ident = "vanessa_logger_bench";
+
+	*fh = NULL;
+	if (!strcmp(sink, "filehandle")) {
+		*fh = fopen(output, "a");
+		if (!*fh) {
+			perror("bench_open: fopen");
+			return NULL;
+		}
+		return vanessa_logger_openlog_filehandle(*fh, ident,
+				max_priority, flag);
+	}
+	if (!strcmp(sink, "filename")) {
+		return vanessa_logger_openlog_filename(output, ident,
+				max_priority, flag);
+	}
+	if (!strcmp(sink, "syslog")) {
+		return vanessa_logger_openlog_syslog_path(syslog_path,
+				LOG_USER, ident, max_priority, 0, flag);
+	}
+	return vanessa_logger_openlog_function(bench_function, ident,
+			max_priority, flag);
+}
+
+static void bench_close(vanessa_logger_t *vl, FILE *fh)
+{
+	vanessa_logger_closelog(vl);
+	if (fh) {
+		fclose(fh);
+	}
+}
+
+static int bench_suite(const char *output, int max_threads,
+		unsigned long messages, int flag)
+{
+	vanessa_logger_t *vl;
+	bench_syslogd_t syslogd;
+	bench_msg_t msg;
+	char label[128];
+	char *payload;
+	FILE *fh;
+	int sink, timestamp, size, nthreads;
+	int status = -1;
+
+	payload = (char *)malloc(bench_sizes[sizeof(bench_sizes) /
+			sizeof(*bench_sizes) - 1] + 1);
+	if (!payload) {
+		perror("bench_suite: malloc");
+		return -1;
+	}
+	if (bench_syslogd_start(&syslogd, DEFAULT_SYSLOG_OUTPUT) < 0) {
+		free(payload);
+		return -1;
+	}
+
+	flag &= ~VANESSA_LOGGER_F_TIMESTAMP;
+	for (sink = 0; bench_sinks[sink]; sink++) {
+		for (timestamp = 0; timestamp < 2; timestamp++) {
+			vl = bench_open(bench_sinks[sink], output,
+					DEFAULT_SYSLOG_OUTPUT, LOG_DEBUG,
+					flag | (timestamp ?
+						VANESSA_LOGGER_F_TIMESTAMP :
+						0), &fh);
+			if (!vl) {
+				fprintf(stderr, "Error: bench_open %s\n",
+						bench_sinks[sink]);
+				goto out;
+			}
+			for (msg.prefix = 0; msg.prefix < 2; msg.prefix++) {
+				for (size = 0; size < (int)(sizeof(bench_sizes)/
+						sizeof(*bench_sizes)); size++) {
+					memset(payload, 'x', bench_sizes[size]);
+					payload[bench_sizes[size]] = '\0';
+					msg.priority = LOG_INFO;
+					msg.payload = payload;
+					snprintf(label, sizeof(label),
+						"sink=%s timestamp=%d "
+						"prefix=%d payload=%lu",
+						bench_sinks[sink], timestamp,
+						msg.prefix, (unsigned long)
+						bench_sizes[size]);
+					for (nthreads = 1;
+							nthreads <= max_threads;
+							nthreads++) {
+						if (bench_threads(vl, nthreads,
+								messages, &msg,
+								label) < 0) {
+							bench_close(vl, fh);
+							goto out;
+						}
+					}
+				}
+			}
+			bench_close(vl, fh);
+		}
+	}
+
+	/* Rejected by max_priority: should cost next to nothing */
+	vl = bench_open("filehandle", output, NULL, LOG_INFO,
+			flag | VANESSA_LOGGER_F_TIMESTAMP, &fh);
+	if (!vl) {
+		fprintf(stderr, "Error: bench_open filehandle\n");
+		goto out;
+	}
+	msg.priority = LOG_DEBUG;
+	msg.prefix = 0;
+	msg.payload = "";
+	for (nthreads = 1; nthreads <= max_threads; nthreads++) {
+		if (bench_threads(vl, nthreads, messages, &msg,
+					"sink=filtered timestamp=1 prefix=0 "
+					"payload=0") < 0) {
+			break;
+		}
+	}
+	bench_close(vl, fh);
+	status = nthreads > max_threads ? 0 : -1;
+
+out:
+	bench_syslogd_stop(&syslogd, DEFAULT_SYSLOG_OUTPUT);
+	free(payload);
+	return status;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-a] [-f flag] [-p flush_policy flush_value] "
+		"[-s window_usec] [-y] [-S]\n"
+		"       [-r rotate_bytes] [-t max_threads] "
+		"[-n messages_per_thread] [-o output_file]\n"
+		"Measures throughput of a filename logger shared by\n"
+		"1 to max_threads threads. Defaults: -t %d -n %d -o %s\n"
+		"  -a: open the logger with VANESSA_LOGGER_F_ASYNC\n"
+		"  -f: flags to open the logger with, "
+		"default VANESSA_LOGGER_F_TIMESTAMP\n"
+		"  -p: flush policy and value, as per "
+		"vanessa_logger_openlog_filename_flush()\n"
+		"  -s: make every message durable using group commit\n"
+		"      with the given commit window\n"
+		"  -r: rotate output_file every rotate_bytes bytes,\n"
+		"      keeping two rotated files\n"
+		"  -y: log to a syslog logger instead, through a stand-in\n"
+		"      syslog daemon listening on output_file\n"
+		"  -S: run the suite: each sink (filehandle, filename,\n"
+		"      syslog and function) with timestamps and prefixes\n"
+		"      on and off, growing payload sizes and 1 to\n"
+		"      max_threads threads, then messages filtered out by\n"
+		"      max_priority. One line of key=value pairs per run\n",
+		name, DEFAULT_THREADS, DEFAULT_MESSAGES, DEFAULT_OUTPUT);
+	exit(-1);
+}
+
+/**********************************************************************
+ * Muriel the main function
+ **********************************************************************/
+
+int main(int argc, char **argv)
+{
+	vanessa_logger_t *vl;
+	const char *output = NULL;
+	unsigned long messages = DEFAULT_MESSAGES;
+	int max_threads = DEFAULT_THREADS;
+	int flag = VANESSA_LOGGER_F_TIMESTAMP;
+	int flush = VANESSA_LOGGER_FLUSH_LINE;
+	unsigned long flush_value = 0;
+	long window = -1;
+	unsigned long long rotate = 0;
+	bench_syslogd_t syslogd;
+	bench_msg_t msg;
+	int syslog = 0;
+	int suite = 0;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "af:p:r:s:t:n:o:ySh")) != -1) {
+		switch (c) {
+		case 'a':
+			flag |= VANESSA_LOGGER_F_ASYNC;
+			break;
+		case 'f':
+			flag = (flag & VANESSA_LOGGER_F_ASYNC) | 
+				strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			flush = atoi(optarg);
+			if (optind >= argc) {
+				usage(argv[0]);
+			}
+			flush_value = strtoul(argv[optind++], NULL, 0);
+			break;
+		case 'r':
+			rotate = strtoull(optarg, NULL, 10);
+			break;
+		case 's':
+			window = strtol(optarg, NULL, 10);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'n':
+			messages = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'y':
+			syslog = 1;
+			break;
+		case 'S':
+			suite = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (max_threads < 1 || !messages) {
+		usage(argv[0]);
+	}
+	if (!output) {
+		output = syslog ? DEFAULT_SYSLOG_OUTPUT : DEFAULT_OUTPUT;
+	}
+
+	if (suite) {
+		return bench_suite(output, max_threads, messages, flag);
+	}
+
+	if (syslog) {
+		if (bench_syslogd_start(&syslogd, output) < 0) {
+			exit(-1);
+		}
+		vl = vanessa_logger_openlog_syslog_path(output, LOG_USER,
+				"vanessa_logger_bench", LOG_DEBUG, 0, flag);
+		if (!vl) {
+			fprintf(stderr, 
+				"Error: vanessa_logger_openlog_syslog_path\n");
+			exit(-1);
+		}
+	}
+	else {
+		vl = vanessa_logger_openlog_filename_flush(output,
+				"vanessa_logger_bench", LOG_DEBUG, flag, flush,
+				flush_value);
+		if (!vl) {
+			fprintf(stderr, "Error: "
+				"vanessa_logger_openlog_filename_flush\n");
+			exit(-1);
+		}
+	}
+	if (window >= 0 && vanessa_logger_set_sync(vl, LOG_INFO, window) < 0) {
+		fprintf(stderr, "Error: vanessa_logger_set_sync\n");
+		exit(-1);
+	}
+	if (rotate && vanessa_logger_set_rotate(vl, rotate, 0,
+				VANESSA_LOGGER_ROTATE_NUMBER, 2) < 0) {
+		fprintf(stderr, "Error: vanessa_logger_set_rotate\n");
+		exit(-1);
+	}
+
+	msg.priority = LOG_INFO;
+	msg.prefix = 0;
+	msg.payload = "";
+	for (i = 1; i <= max_threads; i++) {
+		if (bench_threads(vl, i, messages, &msg, "") < 0) {
+			exit(-1);
+		}
+		if (window >= 0) {
+			print_sync_stats(vl);
+		}
+	}
+
+	vanessa_logger_closelog(vl);
+	if (syslog) {
+		bench_syslogd_stop(&syslogd, output);
+	}
+
+	return 0;
+}
@@ -0,0 +1,500 @@
+/**********************************************************************
+ * vanessa_logger_perf.c                                   October 2026
+ * Simon Horman                                      horms@verge.net.au
+ *
+ * vanessa_logger
+ * Generic logging layer
+ * Copyright (C) 2000-2008  Simon Horman <horms@verge.net.au>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307 USA
+ *
+ **********************************************************************/
+
+/*
+ * Counts the user space instructions, cache misses and branch misses
+ * retired by fixed workloads and compares them with a baseline.
+ * Unlike wall clock time these counts barely move from run to run,
+ * even on a busy machine, so small regressions show up.
+ *
+ * Exit status: 0 if no counter regressed, 1 if one did, 77 (skipped,
+ * as understood by automake) if the counters can't be used or there is
+ * no baseline to compare with.
+ *
+ * Run by make check, which gives the baseline in
+ * VANESSA_LOGGER_PERF_BASELINE.
+ */
+
+#include <vanessa_logger.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define DEFAULT_ITERATIONS 10000
+#define DEFAULT_RUNS       5
+#define DEFAULT_BASELINE   "vanessa_logger_perf.baseline"
+#define DEFAULT_TOLERANCE  5.0
+
+#define EXIT_REGRESSION    1
+#define EXIT_SKIP          77
+
+/* Counters */
+
+typedef struct {
+	const char *name;
+	unsigned long long config;
+	double tolerance;  /* Default, percent. 0: report only */
+	int fd;
+} perf_counter_t;
+
+static perf_counter_t perf_counter[] = {
+	{ "instructions",  PERF_COUNT_HW_INSTRUCTIONS,  DEFAULT_TOLERANCE, -1 },
+	{ "cache_misses",  PERF_COUNT_HW_CACHE_MISSES,  0.0, -1 },
+	{ "branch_misses", PERF_COUNT_HW_BRANCH_MISSES, 0.0, -1 },
+	{ NULL, 0, 0.0, -1 }
+};
+
+#define NCOUNTER (sizeof(perf_counter) / sizeof(*perf_counter) - 1)
+
+/*
+ * Open each counter on its own, not as a group, so that a machine
+ * that lacks one, as virtual machines often lack cache misses,
+ * still reports the others.
+ * Return the number of counters opened
+ */
+
+static int perf_open(void)
+{
+	struct perf_event_attr attr;
+	int i, n = 0;
+
+	for (i = 0; perf_counter[i].name; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = perf_counter[i].config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		perf_counter[i].fd = syscall(SYS_perf_event_open, &attr, 0,
+				-1, -1, 0);
+		if (perf_counter[i].fd < 0) {
+			fprintf(stderr, "perf_open: %s: %s\n",
+					perf_counter[i].name, strerror(errno));
+			continue;
+		}
+		n++;
+	}
+
+	return n;
+}
+
+static void perf_close(void)
+{
+	int i;
+
+	for (i = 0; perf_counter[i].name; i++) {
+		if (perf_counter[i].fd >= 0) {
+			close(perf_counter[i].fd);
+		}
+	}
+}
+
+static void perf_start(void)
+{
+	int i;
+
+	for (i = 0; perf_counter[i].name; i++) {
+		if (perf_counter[i].fd >= 0) {
+			ioctl(perf_counter[i].fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(perf_counter[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+}
+
+static void perf_stop(unsigned long long *count)
+{
+	int i;
+
+	for (i = 0; perf_counter[i].name; i++) {
+		if (perf_counter[i].fd >= 0) {
+			ioctl(perf_counter[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+		}
+	}
+	for (i = 0; perf_counter[i].name; i++) {
+		count[i] = 0;
+		if (perf_counter[i].fd >= 0 && read(perf_counter[i].fd,
+					count + i, sizeof(*count)) !=
+				sizeof(*count)) {
+			count[i] = 0;
+		}
+	}
+}
+
+/* Workloads */
+
+static vanessa_logger_t *perf_vl;
+static char perf_dump_in[256];
+static char perf_dump_out[VANESSA_LOGGER_STR_DUMP_LEN(256, 0)];
+
+static void perf_format(unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++) {
+		vanessa_logger_log(perf_vl, LOG_INFO,
+				"format %lu of %lu: %s %d %x", i, n,
+				"string", 12345, 0xbeef);
+	}
+}
+
+static void perf_header(unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++) {
+		_vanessa_logger_log_prefix(perf_vl, LOG_INFO, __func__,
+				"header");
+	}
+}
+
+static void perf_str_dump(unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++) {
+		vanessa_logger_str_dump_r(perf_vl, perf_dump_in,
+				sizeof(perf_dump_in),
+				i & 1 ? VANESSA_LOGGER_STR_DUMP_HEX :
+				VANESSA_LOGGER_STR_DUMP_OCT,
+				perf_dump_out, sizeof(perf_dump_out));
+	}
+}
+
+static void perf_filtered(unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++) {
+		vanessa_logger_log(perf_vl, LOG_DEBUG, "filtered %lu", i);
+	}
+}
+
+typedef struct {
+	const char *name;
+	int flag;
+	int recorder;	/* Record filtered messages */
+	void (*run)(unsigned long n);
+} perf_workload_t;
+
+static perf_workload_t perf_workload[] = {
+	{ "format",   VANESSA_LOGGER_F_NO_IDENT_PID, 0, perf_format },
+	{ "header",   VANESSA_LOGGER_F_TIMESTAMP, 0, perf_header },
+	{ "str_dump", VANESSA_LOGGER_F_NONE, 0, perf_str_dump },
+	{ "filtered", VANESSA_LOGGER_F_NONE, 0, perf_filtered },
+	{ "recorded", VANESSA_LOGGER_F_NONE, 1, perf_filtered },
+	{ NULL, 0, 0, NULL }
+};
+
+/*
+ * Run a workload several times, keeping the lowest count of each
+ * counter, as a run can only be disturbed upwards.
+ * Counts are per call.
+ */
+
+static int perf_measure(perf_workload_t *w, FILE *output,
+		unsigned long iterations, int runs, double *result)
+{
+	unsigned long long count[NCOUNTER], best[NCOUNTER];
+	int i, run;
+
+	perf_vl = vanessa_logger_openlog_filehandle(output,
+			"vanessa_logger_perf", LOG_INFO, w->flag);
+	if (!perf_vl) {
+		fprintf(stderr, "perf_measure: "
+				"vanessa_logger_openlog_filehandle\n");
+		return -1;
+	}
+	if (w->recorder && vanessa_logger_set_recorder(perf_vl, LOG_DEBUG,
+				0, 0, -1) < 0) {
+		fprintf(stderr, "perf_measure: "
+				"vanessa_logger_set_recorder\n");
+		vanessa_logger_closelog(perf_vl);
+		return -1;
+	}
+
+	/* Warm up caches, lazy initialisation and the stdio buffer */
+	w->run(iterations);
+
+	for (run = 0; run < runs; run++) {
+		perf_start();
+		w->run(iterations);
+		perf_stop(count);
+		for (i = 0; i < (int)NCOUNTER; i++) {
+			if (!run || count[i] < best[i]) {
+				best[i] = count[i];
+			}
+		}
+	}
+	for (i = 0; i < (int)NCOUNTER; i++) {
+		result[i] = (double)best[i] / iterations;
+	}
+
+	vanessa_logger_closelog(perf_vl);
+	perf_vl = NULL;
+	return 0;
+}
+
+/* Baseline */
+
+typedef struct perf_baseline_t_struct perf_baseline_t;
+struct perf_baseline_t_struct {
+	char workload[32];
+	char counter[32];
+	double value;
+	double tolerance;
+	perf_baseline_t *next;
+};
+
+/*
+ * Read lines of "workload counter per_call tolerance_percent".
+ * Blank lines and lines starting with # are ignored.
+ */
+
+static perf_baseline_t *perf_baseline_read(const char *path)
+{
+	perf_baseline_t *head = NULL, *b;
+	char line[256];
+	FILE *fh;
+	int lineno = 0;
+
+	fh = fopen(path, "r");
+	if (!fh) {
+		fprintf(stderr, "perf_baseline_read: fopen: %s: %s\n", path,
+				strerror(errno));
+		return NULL;
+	}
+	while (fgets(line, sizeof(line), fh)) {
+		lineno++;
+		if (*line == '#' || *line == '\n') {
+			continue;
+		}
+		b = (perf_baseline_t *)malloc(sizeof(*b));
+		if (!b) {
+			perror("perf_baseline_read: malloc");
+			break;
+		}
+		if (sscanf(line, "%31s %31s %lf %lf", b->workload,
+					b->counter, &b->value,
+					&b->tolerance) != 4) {
+			fprintf(stderr, "perf_baseline_read: %s:%d: "
+					"malformed line\n", path, lineno);
+			free(b);
+			continue;
+		}
+		b->next = head;
+		head = b;
+	}
+	fclose(fh);
+
+	return head;
+}
+
+static perf_baseline_t *perf_baseline_find(perf_baseline_t *head,
+		const char *workload, const char *counter)
+{
+	for (; head; head = head->next) {
+		if (!strcmp(head->workload, workload) &&
+				!strcmp(head->counter, counter)) {
+			return head;
+		}
+	}
+
+	return NULL;
+}
+
+static void perf_baseline_free(perf_baseline_t *head)
+{
+	perf_baseline_t *next;
+
+	for (; head; head = next) {
+		next = head->next;
+		free(head);
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-b baseline] [-w] [-n iterations] [-r runs] "
+		"[-o output_file]\n"
+		"Counts the instructions, cache misses and branch misses\n"
+		"per call of fixed workloads and compares them against\n"
+		"baseline. Defaults: -b $VANESSA_LOGGER_PERF_BASELINE or\n"
+		"%s -n %d -r %d -o /dev/null\n"
+		"  -w: write the counts to baseline instead of comparing,\n"
+		"      with a tolerance of %.0f%% for instructions and\n"
+		"      0, report only, for the others\n"
+		"Exits 1 if a counter rose past the baseline by more than\n"
+		"its tolerance, 77 if performance counters are unavailable\n"
+		"or baseline holds no counts\n",
+		name, DEFAULT_BASELINE, DEFAULT_ITERATIONS, DEFAULT_RUNS,
+		DEFAULT_TOLERANCE);
+	exit(-1);
+}
+
+/**********************************************************************
+ * Muriel the main function
+ **********************************************************************/
+
+int main(int argc, char **argv)
+{
+	const char *baseline_path;
+	const char *output_path = "/dev/null";
+	unsigned long iterations = DEFAULT_ITERATIONS;
+	int runs = DEFAULT_RUNS;
+	int write_baseline = 0;
+	perf_baseline_t *baseline = NULL, *b;
+	double result[NCOUNTER], drift;
+	FILE *output, *out;
+	int status = 0;
+	int c, i, j;
+
+	baseline_path = getenv("VANESSA_LOGGER_PERF_BASELINE");
+	if (!baseline_path || !*baseline_path) {
+		baseline_path = DEFAULT_BASELINE;
+	}
+
+	while ((c = getopt(argc, argv, "b:wn:r:o:h")) != -1) {
+		switch (c) {
+		case 'b':
+			baseline_path = optarg;
+			break;
+		case 'w':
+			write_baseline = 1;
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		case 'o':
+			output_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!iterations || runs < 1) {
+		usage(argv[0]);
+	}
+
+	if (!perf_open()) {
+		printf("SKIP: performance counters are not available, "
+		       "see /proc/sys/kernel/perf_event_paranoid\n");
+		return EXIT_SKIP;
+	}
+
+	if (write_baseline) {
+		out = fopen(baseline_path, "w");
+		if (!out) {
+			perror("fopen");
+			exit(-1);
+		}
+		fprintf(out, "# workload counter per_call "
+				"tolerance_percent\n"
+				"# Written by vanessa_logger_perf -w, "
+				"%lu iterations\n", iterations);
+	}
+	else {
+		out = stdout;
+		baseline = perf_baseline_read(baseline_path);
+		/* Nothing to compare with, so nothing is checked */
+		if (!baseline) {
+			printf("SKIP: no counts in %s, write them with -w, "
+			       "or make perfbaseline\n", baseline_path);
+			return EXIT_SKIP;
+		}
+	}
+
+	output = fopen(output_path, "w");
+	if (!output) {
+		perror("fopen");
+		exit(-1);
+	}
+	for (i = 0; i < (int)sizeof(perf_dump_in); i++) {
+		perf_dump_in[i] = i * 7;
+	}
+
+	for (i = 0; perf_workload[i].name; i++) {
+		if (perf_measure(perf_workload + i, output, iterations, runs,
+					result) < 0) {
+			exit(-1);
+		}
+		for (j = 0; perf_counter[j].name; j++) {
+			if (perf_counter[j].fd < 0) {
+				continue;
+			}
+			if (write_baseline) {
+				fprintf(out, "%s %s %.2f %.0f\n",
+						perf_workload[i].name,
+						perf_counter[j].name,
+						result[j],
+						perf_counter[j].tolerance);
+				continue;
+			}
+
+			b = perf_baseline_find(baseline,
+					perf_workload[i].name,
+					perf_counter[j].name);
+			printf("workload=%s counter=%s per_call=%.2f",
+					perf_workload[i].name,
+					perf_counter[j].name, result[j]);
+			if (!b) {
+				printf(" baseline=none\n");
+				continue;
+			}
+			drift = b->value ? (result[j] - b->value) * 100.0 /
+				b->value : 0.0;
+			printf(" baseline=%.2f drift_percent=%+.1f",
+					b->value, drift);
+			if (b->tolerance > 0.0 && drift > b->tolerance) {
+				printf(" result=REGRESSION\n");
+				status = EXIT_REGRESSION;
+			}
+			else if (b->tolerance > 0.0 && -drift > b->tolerance) {
+				printf(" result=improved\n");
+			}
+			else {
+				printf(" result=ok\n");
+			}
+		}
+	}
+
+	fclose(output);
+	if (write_baseline) {
+		fclose(out);
+	}
+	perf_baseline_free(baseline);
+	perf_close();
+
+	return status;
+}
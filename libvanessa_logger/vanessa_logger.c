@@ -23,6 +23,9 @@
  *
  **********************************************************************/
 
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
 
 #include <stdlib.h>
 #include <string.h>
@@ -30,14 +33,31 @@
 #include <unistd.h>
 #include <netdb.h>
 #include <time.h>
+#include <limits.h>
+#include <math.h>
+#include <strings.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <wchar.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define SYSLOG_NAMES
 #include <syslog.h>
 
-#ifdef HAVE_CONFIG_H
-#include "../config.h"
-#endif
-
 
 /**********************************************************************
  * Sun Solaris, AIX and probably others don't to define facilitynames 
@@ -101,23 +121,142 @@ vanessa_logger_t *__vanessa_logger_vl;
  * Internal data structures
  **********************************************************************/
 
+typedef struct __vanessa_logger_struct __vanessa_logger_t;
+
+typedef struct {
+	unsigned long long size;
+	unsigned long interval;
+	int naming;
+	unsigned int keep;
+	unsigned long long bytes;
+	int full;
+	int pending;
+	time_t deadline;
+	time_t retry;
+	int fd;
+	int next;
+	int old;
+	char *tmp;
+	char *name;
+	int stop;
+	int running;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} __vanessa_logger_rotate_t;
+
 typedef struct {
-	FILE *filehandle;
+	int fd;
 	char *filename;
+	__vanessa_logger_t *vl;
+	int flush;
+	unsigned long flush_value;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char *buffer;
+	size_t buffer_size;
+	size_t used;
+	unsigned long count;
+	struct timespec first;
+	int stop;
+	int flusher_running;
+	pthread_t flusher;
+	int sync_priority;
+	unsigned long sync_window;
+	pthread_mutex_t sync_lock;
+	pthread_cond_t sync_cond;
+	unsigned long requested;
+	unsigned long synced;
+	int syncing;
+	vanessa_logger_sync_stats_t stats;
+	char *preamble;
+	size_t preamble_len;
+	unsigned int generation;
+	__vanessa_logger_rotate_t *rotate;
 } __vanessa_logger_filename_data_t;
 
+typedef struct {
+	const char *filename;
+	int flush;
+	unsigned long flush_value;
+} __vanessa_logger_filename_opt_t;
+
+typedef struct {
+	char magic[8];
+	uint64_t offset;
+} __vanessa_logger_segment_hdr_t;
+
+typedef struct {
+	uint32_t len;
+	uint32_t crc;
+} __vanessa_logger_record_t;
+
+typedef struct {
+	char *map;
+	size_t size;
+	int fd;
+	unsigned long index;
+	int writers;
+} __vanessa_logger_segment_t;
+
+typedef struct {
+	char *filename;
+	size_t size;
+	__vanessa_logger_segment_t seg[2];
+	__vanessa_logger_segment_t *current;
+	pthread_mutex_t lock;
+} __vanessa_logger_mmap_data_t;
+
+typedef struct {
+	const char *filename;
+	size_t segment_size;
+} __vanessa_logger_mmap_opt_t;
+
+typedef struct {
+	int facility;
+	int fd;
+	int stream;
+	struct sockaddr_un addr;
+	socklen_t addr_len;
+	unsigned int ts_flag;
+	char *tag;
+	size_t tag_len;
+	size_t ident_len;
+	pthread_mutex_t lock;
+} __vanessa_logger_syslog_data_t;
+
+typedef struct {
+	const char *path;
+	int facility;
+	unsigned int flag;
+} __vanessa_logger_syslog_opt_t;
+
+typedef struct {
+	__vanessa_logger_t **child;
+	int n;
+} __vanessa_logger_fanout_data_t;
+
+typedef struct {
+	vanessa_logger_t **child;
+	int n;
+} __vanessa_logger_fanout_opt_t;
+
 typedef union {
 	void *d_any;
 	FILE *d_filehandle;
 	__vanessa_logger_filename_data_t *d_filename;
-	int *d_syslog;
+	__vanessa_logger_mmap_data_t *d_mmap;
+	__vanessa_logger_syslog_data_t *d_syslog;
+	__vanessa_logger_fanout_data_t *d_fanout;
 	vanessa_logger_log_function_va_t d_function;
 } __vanessa_logger_data_t;
 
 typedef enum {
 	__vanessa_logger_filehandle,
 	__vanessa_logger_filename,
+	__vanessa_logger_mmap,
 	__vanessa_logger_syslog,
+	__vanessa_logger_fanout,
 	__vanessa_logger_function,
 	__vanessa_logger_none
 } __vanessa_logger_type_t;
@@ -127,17 +266,113 @@ typedef enum {
 	__vanessa_logger_false
 } __vanessa_logger_bool_t;
 
+typedef struct __vanessa_logger_async_struct __vanessa_logger_async_t;
+
+#define __VANESSA_LOGGER_BINARY_FORMATS (size_t)4096 /* Must be a power of 2 */
+#define __VANESSA_LOGGER_BINARY_ARGS 32
+#define __VANESSA_LOGGER_BINARY_FORMAT_LEN 512
+
+typedef struct {
+	const char *fmt;
+	char *copy;                 /* Contents of fmt when it was added */
+	uint32_t id;
+	unsigned int generation;
+	int nargs;
+	unsigned char arg[__VANESSA_LOGGER_BINARY_ARGS];
+} __vanessa_logger_fmt_t;
+
+typedef struct __vanessa_logger_trie_struct __vanessa_logger_trie_t;
+
+struct __vanessa_logger_trie_struct {
+	char *name;
+	int level;
+	int below;
+	__vanessa_logger_trie_t *child;
+	__vanessa_logger_trie_t *sibling;
+};
+
+typedef struct {
+	__vanessa_logger_fmt_t fmt[__VANESSA_LOGGER_BINARY_FORMATS];
+	size_t used;
+	pthread_mutex_t lock;
+} __vanessa_logger_binary_t;
+
+#define __VANESSA_LOGGER_STATS_SHARDS 16 /* Must be a power of 2 */
+
+enum {
+	__VANESSA_LOGGER_STAT_WRITTEN,
+	__VANESSA_LOGGER_STAT_BYTES,
+	__VANESSA_LOGGER_STAT_DROPPED,
+	__VANESSA_LOGGER_STAT_TRUNCATED,
+	__VANESSA_LOGGER_STAT_WRITE_ERRORS,
+	__VANESSA_LOGGER_STATS
+};
+
+/* Counters bumped by the threads that share a shard, on a line of
+ * their own. Histogram counts are worked out from the buckets when
+ * read. */
+typedef struct {
+	unsigned long long count[__VANESSA_LOGGER_STATS];
+	vanessa_logger_histogram_t format;
+	vanessa_logger_histogram_t write;
+} __attribute__ ((aligned(64))) __vanessa_logger_shard_t;
+
+typedef struct {
+	__vanessa_logger_shard_t shard[__VANESSA_LOGGER_STATS_SHARDS];
+	int enabled;
+} __vanessa_logger_stats_t;
+
+/* Ring of a thread that records messages. Records are binary message
+ * records, as written by binary loggers. head and tail are only moved
+ * by the thread that owns the ring. */
+typedef struct __vanessa_logger_ring_struct __vanessa_logger_ring_t;
+
+struct __vanessa_logger_ring_struct {
+	unsigned long long head;   /* end of the newest record */
+	unsigned long long tail;   /* start of the oldest record */
+	unsigned long long dumped; /* end of the last record dumped */
+	void *owner;               /* per-thread state of its thread */
+	char *data;
+	__vanessa_logger_ring_t *next;
+};
+
 typedef struct {
+	int priority;
+	int trigger;
+	unsigned int seconds;
+	int pending;
+	size_t size;                      /* of each ring */
+	unsigned long long id;
+	__vanessa_logger_ring_t *ring;
+	__vanessa_logger_fmt_t fmt[__VANESSA_LOGGER_BINARY_FORMATS];
+	char *copy[__VANESSA_LOGGER_BINARY_FORMATS / 2 + 1]; /* by id */
+	size_t used;
+	pthread_mutex_t lock;      /* rings and formats */
+	pthread_mutex_t dump_lock;
+} __vanessa_logger_recorder_t;
+
+struct __vanessa_logger_struct {
 	__vanessa_logger_type_t type;
 	__vanessa_logger_data_t data;
 	__vanessa_logger_bool_t ready;
 	char *ident;
-	char *buffer;
-	size_t buffer_len;
+	char *header;
+	size_t header_len;
 	int max_priority;
 	unsigned int flag;
 	int option;
-} __vanessa_logger_t;
+	size_t max_len;
+	pid_t pid;
+	__vanessa_logger_async_t *async;
+	__vanessa_logger_binary_t *binary;
+	__vanessa_logger_stats_t *stats;
+	__vanessa_logger_recorder_t *recorder;
+	vanessa_logger_category_t *category;
+	__vanessa_logger_trie_t *rules;
+	int reopen;	/* Set by vanessa_logger_reopen_signal() */
+	__vanessa_logger_t *prev;
+	__vanessa_logger_t *next;
+};
 
 
 /**********************************************************************
@@ -145,6 +380,142 @@ typedef struct {
  **********************************************************************/
 
 #define __VANESSA_LOGGER_BUF_SIZE (size_t)1024
+#define __VANESSA_LOGGER_KEEP_SIZE (size_t)65536 /* Largest long-line
+						    buffer kept by a thread */
+#define __VANESSA_LOGGER_TRUNCATED "...[truncated]"
+#define __VANESSA_LOGGER_HEADER_PID_LEN (size_t)24 /* "[", pid, "] " */
+#define __VANESSA_LOGGER_FLUSH_BUF_SIZE (size_t)65536
+
+/**********************************************************************
+ * List of open loggers
+ *
+ * Every logger that has been set up is on this list so that the
+ * pthread_atfork(3) child handler can fix up per-process state,
+ * such as the pid in the ident[pid] header, in a forked child.
+ **********************************************************************/
+
+static pthread_mutex_t __vanessa_logger_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static __vanessa_logger_t *__vanessa_logger_list = NULL;
+static pthread_once_t __vanessa_logger_fork_once = PTHREAD_ONCE_INIT;
+
+/* Protects the categories and level rules of all loggers */
+static pthread_mutex_t __vanessa_logger_category_lock = 
+	PTHREAD_MUTEX_INITIALIZER;
+
+/* Protects the list of call sites with counts to report */
+static pthread_mutex_t __vanessa_logger_site_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**********************************************************************
+ * Registered call site descriptors
+ *
+ * Each programme or shared object that uses the convenience macros
+ * registers the array of pointers to the descriptors of its sites
+ * when it is loaded.
+ **********************************************************************/
+
+typedef struct __vanessa_logger_desc_module_struct
+		__vanessa_logger_desc_module_t;
+
+struct __vanessa_logger_desc_module_struct {
+	vanessa_logger_desc_t **start;
+	vanessa_logger_desc_t **stop;
+	__vanessa_logger_desc_module_t *next;
+};
+
+static pthread_mutex_t __vanessa_logger_desc_lock = PTHREAD_MUTEX_INITIALIZER;
+static __vanessa_logger_desc_module_t *__vanessa_logger_desc_list = NULL;
+
+/**********************************************************************
+ * Per-thread state
+ *
+ * Messages are formatted into scratch space that belongs to the
+ * calling thread rather than to the logger, so that any number of
+ * threads may log through the same logger concurrently.
+ *
+ * Lines too long for the fixed buffer go into a second buffer that
+ * grows by doubling and is kept for later lines, unless it has grown
+ * beyond __VANESSA_LOGGER_KEEP_SIZE, so a thread that logs long lines
+ * does not allocate memory for each of them.
+ **********************************************************************/
+
+#define __VANESSA_LOGGER_TIMESTAMP_LEN 48
+
+typedef struct {
+	time_t sec;
+	unsigned int flag;
+	size_t len;
+	char str[32];
+	size_t zone_len;
+	char zone[8];
+} __vanessa_logger_ts_cache_t;
+
+typedef struct {
+	char buffer[__VANESSA_LOGGER_BUF_SIZE];
+	char *overflow;
+	size_t overflow_size;
+	char body[__VANESSA_LOGGER_BUF_SIZE];
+	char *body_overflow;
+	const char *fields;
+	size_t fields_len;
+	char strherror[34];
+	__vanessa_logger_ts_cache_t ts;
+	unsigned int shard;
+	unsigned long long stats_mark;
+	const char *prefix;      /* function of the call site being */
+	size_t prefix_len;       /* logged from, and its length */
+	__vanessa_logger_ring_t *ring; /* flight recorder ring last used */
+	unsigned long long ring_id;    /* and the id of its recorder */
+} __vanessa_logger_tls_t;
+
+static pthread_key_t __vanessa_logger_tls_key;
+static pthread_once_t __vanessa_logger_tls_once = PTHREAD_ONCE_INIT;
+static int __vanessa_logger_tls_status = -1;
+static unsigned int __vanessa_logger_tls_shard = 0;
+
+/**********************************************************************
+ * Asynchronous logging
+ *
+ * Loggers opened with VANESSA_LOGGER_F_ASYNC format each message
+ * directly into a slot of a bounded ring and a writer thread drains
+ * the ring to the filehandle in batches.
+ *
+ * The ring is a multi-producer queue after Dmitry Vyukov's bounded
+ * queue: each slot carries a sequence number that tells producers
+ * when it is free and the writer when it has been filled, so no lock
+ * is taken on the logging path. The mutex and condition variables are
+ * only used to put the writer to sleep when the ring is empty and to
+ * wait for the ring to drain.
+ *
+ * A message too long for a slot is formatted into memory allocated for
+ * it, which the slot points to and the writer frees.
+ **********************************************************************/
+
+#define __VANESSA_LOGGER_ASYNC_SLOTS (size_t)1024 /* Must be a power of 2 */
+#define __VANESSA_LOGGER_ASYNC_BATCH 64
+#define __VANESSA_LOGGER_ASYNC_IDLE_MS 100
+
+typedef struct {
+	size_t seq;
+	size_t len;
+	char *ext;     /* The message if it did not fit in data */
+	char data[__VANESSA_LOGGER_BUF_SIZE];
+} __vanessa_logger_slot_t;
+
+struct __vanessa_logger_async_struct {
+	__vanessa_logger_t *vl;
+	__vanessa_logger_slot_t *slot;
+	size_t mask;
+	size_t head;
+	size_t tail;
+	int sleeping;
+	int stop;
+	int running;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_mutex_t io_lock;
+	pthread_cond_t wake;
+	pthread_cond_t drained;
+};
 
 /**********************************************************************
  * Prototype of internal functions
@@ -171,6 +542,122 @@ __vanessa_logger_log(__vanessa_logger_t * vl, int priority,
 static int 
 __vanessa_logger_reopen(__vanessa_logger_t * vl);
 
+static __vanessa_logger_tls_t *
+__vanessa_logger_tls_get(void);
+
+static void
+__vanessa_logger_recorder_destroy(__vanessa_logger_recorder_t *r);
+
+static void
+__vanessa_logger_recorder_release(__vanessa_logger_tls_t *tls);
+
+static void
+__vanessa_logger_record(__vanessa_logger_t * vl, int priority,
+		const char *prefix, const char *fmt, va_list ap);
+
+static void
+__vanessa_logger_recorder_check(__vanessa_logger_t * vl, int priority);
+
+static int
+__vanessa_logger_recorder_dump(__vanessa_logger_t * vl, int wait);
+
+static size_t
+__vanessa_logger_syslog_fmt(__vanessa_logger_t * vl,
+		__vanessa_logger_tls_t *tls, int priority, const char *prefix,
+		const char *fmt, va_list ap, char *buffer, size_t buffer_len);
+
+static __vanessa_logger_async_t *
+__vanessa_logger_async_create(__vanessa_logger_t * vl);
+
+static void
+__vanessa_logger_async_destroy(__vanessa_logger_async_t * async);
+
+static void
+__vanessa_logger_async_drain(__vanessa_logger_async_t * async);
+
+static void
+__vanessa_logger_async_init(__vanessa_logger_async_t * async);
+
+static void
+__vanessa_logger_register(__vanessa_logger_t * vl);
+
+static __vanessa_logger_filename_data_t *
+__vanessa_logger_filename_create(__vanessa_logger_t * vl,
+		const __vanessa_logger_filename_opt_t *opt);
+
+static void
+__vanessa_logger_filename_destroy(__vanessa_logger_filename_data_t *d);
+
+static int
+__vanessa_logger_filename_reopen(__vanessa_logger_filename_data_t *d);
+
+static int
+__vanessa_logger_filename_flush(__vanessa_logger_filename_data_t *d);
+
+static int
+__vanessa_logger_filename_flush_locked(__vanessa_logger_filename_data_t *d,
+		const char *line, size_t len);
+
+static void
+__vanessa_logger_rotate_account(__vanessa_logger_filename_data_t *d,
+		size_t len);
+
+static void
+__vanessa_logger_rotate_child(__vanessa_logger_rotate_t *r);
+
+static int
+__vanessa_logger_rotate_now(__vanessa_logger_filename_data_t *d);
+
+static void
+__vanessa_logger_rotate_destroy(__vanessa_logger_filename_data_t *d);
+
+static void
+__vanessa_logger_unregister(__vanessa_logger_t * vl);
+
+static void
+__vanessa_logger_category_destroy(__vanessa_logger_t * vl);
+
+static void
+__vanessa_logger_category_resolve_all(__vanessa_logger_t * vl);
+
+static void
+__vanessa_logger_site_report(__vanessa_logger_t * vl);
+
+static void
+__vanessa_logger_site_child(void);
+
+static __vanessa_logger_mmap_data_t *
+__vanessa_logger_mmap_create(const __vanessa_logger_mmap_opt_t *opt);
+
+static void
+__vanessa_logger_mmap_destroy(__vanessa_logger_mmap_data_t *d);
+
+static int
+__vanessa_logger_mmap_roll(__vanessa_logger_mmap_data_t *d,
+		__vanessa_logger_segment_t *old);
+
+static __vanessa_logger_syslog_data_t *
+__vanessa_logger_syslog_create(__vanessa_logger_t * vl,
+		const __vanessa_logger_syslog_opt_t *opt);
+
+static void
+__vanessa_logger_syslog_destroy(__vanessa_logger_syslog_data_t *d);
+
+static int
+__vanessa_logger_syslog_reopen(__vanessa_logger_syslog_data_t *d);
+
+static __vanessa_logger_fanout_data_t *
+__vanessa_logger_fanout_create(const __vanessa_logger_fanout_opt_t *opt);
+
+static void
+__vanessa_logger_fanout_destroy(__vanessa_logger_fanout_data_t *d);
+
+static __vanessa_logger_binary_t *
+__vanessa_logger_binary_create(__vanessa_logger_t * vl);
+
+static void
+__vanessa_logger_binary_destroy(__vanessa_logger_binary_t *b);
+
 
 /**********************************************************************
  * __vanessa_logger_create
@@ -197,9 +684,19 @@ __vanessa_logger_create(void)
 	vl->data.d_any = NULL;
 	vl->ready = __vanessa_logger_false;
 	vl->ident = NULL;
-	vl->buffer = NULL;
-	vl->buffer_len = 0;
+	vl->header = NULL;
+	vl->header_len = 0;
 	vl->max_priority = 0;
+	vl->flag = VANESSA_LOGGER_F_NONE;
+	vl->max_len = VANESSA_LOGGER_MAX_LEN;
+	vl->async = NULL;
+	vl->binary = NULL;
+	vl->stats = NULL;
+	vl->recorder = NULL;
+	vl->category = NULL;
+	vl->rules = NULL;
+	vl->prev = NULL;
+	vl->next = NULL;
 
 	return (vl);
 }
@@ -239,39 +736,50 @@ __vanessa_logger_destroy (__vanessa_logger_t * vl)
 
 static void __vanessa_logger_reset(__vanessa_logger_t * vl)
 {
-	__vanessa_logger_bool_t ready;
-
 	if (!vl) {
 		return;
 	}
 
+	/* Counts kept by call sites for this logger are logged to it */
+	__vanessa_logger_site_report(vl);
+
 	/* 
 	 * Logger is no longer ready
 	 */
-	ready = vl->ready;	/* Remember state logger _was_ in */
 	vl->ready = __vanessa_logger_false;
 
+	__vanessa_logger_unregister(vl);
+
+	/*
+	 * Write out anything still queued and stop the writer thread
+	 * before the filehandle goes away
+	 */
+	__vanessa_logger_async_destroy(vl->async);
+	vl->async = NULL;
+	__vanessa_logger_binary_destroy(vl->binary);
+	vl->binary = NULL;
+	free(vl->stats);
+	vl->stats = NULL;
+	__vanessa_logger_recorder_destroy(vl->recorder);
+	vl->recorder = NULL;
+	__vanessa_logger_category_destroy(vl);
+
 	/*
 	 * Close filehandles or log facilities as necessary
 	 * Free any memory used in storing data
 	 */
 	switch (vl->type) {
 	case __vanessa_logger_filename:
-		if (ready == __vanessa_logger_true) {
-			if (fclose(vl->data.d_filename->filehandle)) {
-				perror("__vanessa_logger_reset: fclose");
-			}
-		}
-		if (vl->data.d_filename != NULL) {
-			free(vl->data.d_filename-> filename);
-		}
-		free(vl->data.d_filename);
+		__vanessa_logger_filename_destroy(vl->data.d_filename);
+		break;
+	case __vanessa_logger_mmap:
+		__vanessa_logger_mmap_destroy(vl->data.d_mmap);
 		break;
 	case __vanessa_logger_syslog:
-		free(vl->data.d_syslog);
-		if (vl->ready == __vanessa_logger_true) {
-			closelog();
-		}
+		__vanessa_logger_syslog_destroy(vl->data.d_syslog);
+		break;
+	case __vanessa_logger_fanout:
+		__vanessa_logger_fanout_destroy(vl->data.d_fanout);
 		break;
 	default:
 		break;
@@ -284,20 +792,281 @@ static void __vanessa_logger_reset(__vanessa_logger_t * vl)
 	vl->data.d_any = NULL;
 
 	/*
-	 * Reset ident
+	 * Reset ident and header
 	 */
 	free(vl->ident);
+	vl->ident = NULL;
+	free(vl->header);
+	vl->header = NULL;
+	vl->header_len = 0;
+
+	/*
+	 * Reset max_priority
+	 */
+	vl->max_priority = 0;
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_render_header
+ * Internal function to render the "ident[pid] " header of a logger.
+ * The pid is converted by hand so that this is safe to call from
+ * a pthread_atfork(3) child handler.
+ * pre: vl: logger with ident set and header allocated to at least
+ *          strlen(ident) + __VANESSA_LOGGER_HEADER_PID_LEN bytes
+ * post: vl->header and vl->header_len are set
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_render_header(__vanessa_logger_t * vl)
+{
+	char digits[16];
+	unsigned long pid;
+	size_t len;
+	int i;
+
+	len = strlen(vl->ident);
+	memcpy(vl->header, vl->ident, len);
+	vl->header[len++] = '[';
+
+	vl->pid = getpid();
+	pid = (unsigned long) vl->pid;
+	i = sizeof(digits);
+	do {
+		digits[--i] = '0' + pid % 10;
+		pid /= 10;
+	} while (pid);
+	memcpy(vl->header + len, digits + i, sizeof(digits) - i);
+	len += sizeof(digits) - i;
+
+	vl->header[len++] = ']';
+	vl->header[len++] = ' ';
+	vl->header_len = len;
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_atfork_prepare
+ * __vanessa_logger_atfork_parent
+ * __vanessa_logger_atfork_child
+ * Internal pthread_atfork(3) handlers. The list of loggers is locked
+ * across fork(2) so that it is consistent in the child, where the
+ * ident[pid] header of each logger is re-rendered with the child's pid
+ * and the rings of asynchronous loggers are reset so that a new writer
+ * thread is started the first time the child logs.
+ * pre: none
+ * post: per-process state of loggers is correct for the caller
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_atfork_prepare(void)
+{
+	__vanessa_logger_t *vl;
+
+	/* vanessa_logger_desc_foreach() may log while holding this */
+	pthread_mutex_lock(&__vanessa_logger_desc_lock);
+	pthread_mutex_lock(&__vanessa_logger_list_lock);
+	pthread_mutex_lock(&__vanessa_logger_category_lock);
+	pthread_mutex_lock(&__vanessa_logger_site_lock);
 
 	/*
-	 * Reset buffer, buffer_len
+	 * A dump logs to the logger, and through it to any children,
+	 * so recorders are locked before any logger's own locks
 	 */
-	free(vl->buffer);
-	vl->buffer_len = 0;
+	for (vl = __vanessa_logger_list; vl; vl = vl->next) {
+		if (vl->recorder) {
+			pthread_mutex_lock(&vl->recorder->dump_lock);
+			pthread_mutex_lock(&vl->recorder->lock);
+		}
+	}
 
 	/*
-	 * Reset max_priority
+	 * Write out buffered lines so that they are not written
+	 * a second time by the child
 	 */
-	vl->max_priority = 0;
+	for (vl = __vanessa_logger_list; vl; vl = vl->next) {
+		/* Held while writing formats, so taken before the file */
+		if (vl->binary) {
+			pthread_mutex_lock(&vl->binary->lock);
+		}
+		if (vl->type == __vanessa_logger_filename) {
+			pthread_mutex_lock(&vl->data.d_filename->lock);
+			__vanessa_logger_filename_flush_locked(
+					vl->data.d_filename, NULL, 0);
+			if (vl->data.d_filename->rotate) {
+				pthread_mutex_lock(
+					&vl->data.d_filename->rotate->lock);
+			}
+			pthread_mutex_lock(&vl->data.d_filename->sync_lock);
+		}
+		/* Don't fork half way through moving to a new segment */
+		if (vl->type == __vanessa_logger_mmap) {
+			pthread_mutex_lock(&vl->data.d_mmap->lock);
+		}
+		/* Nor half way through reconnecting to syslog */
+		if (vl->type == __vanessa_logger_syslog) {
+			pthread_mutex_lock(&vl->data.d_syslog->lock);
+		}
+	}
+}
+
+static void
+__vanessa_logger_atfork_parent(void)
+{
+	__vanessa_logger_t *vl;
+
+	for (vl = __vanessa_logger_list; vl; vl = vl->next) {
+		if (vl->type == __vanessa_logger_filename) {
+			pthread_mutex_unlock(&vl->data.d_filename->sync_lock);
+			if (vl->data.d_filename->rotate) {
+				pthread_mutex_unlock(
+					&vl->data.d_filename->rotate->lock);
+			}
+			pthread_mutex_unlock(&vl->data.d_filename->lock);
+		}
+		if (vl->type == __vanessa_logger_mmap) {
+			pthread_mutex_unlock(&vl->data.d_mmap->lock);
+		}
+		if (vl->type == __vanessa_logger_syslog) {
+			pthread_mutex_unlock(&vl->data.d_syslog->lock);
+		}
+		if (vl->binary) {
+			pthread_mutex_unlock(&vl->binary->lock);
+		}
+	}
+
+	for (vl = __vanessa_logger_list; vl; vl = vl->next) {
+		if (vl->recorder) {
+			pthread_mutex_unlock(&vl->recorder->lock);
+			pthread_mutex_unlock(&vl->recorder->dump_lock);
+		}
+	}
+
+	pthread_mutex_unlock(&__vanessa_logger_site_lock);
+	pthread_mutex_unlock(&__vanessa_logger_category_lock);
+	pthread_mutex_unlock(&__vanessa_logger_list_lock);
+	pthread_mutex_unlock(&__vanessa_logger_desc_lock);
+}
+
+static void
+__vanessa_logger_atfork_child(void)
+{
+	__vanessa_logger_t *vl;
+	pthread_condattr_t attr;
+
+	for (vl = __vanessa_logger_list; vl; vl = vl->next) {
+		__vanessa_logger_render_header(vl);
+		if (vl->async) {
+			__vanessa_logger_async_init(vl->async);
+		}
+		if (vl->binary) {
+			pthread_mutex_init(&vl->binary->lock, NULL);
+		}
+		if (vl->recorder) {
+			pthread_mutex_init(&vl->recorder->lock, NULL);
+			pthread_mutex_init(&vl->recorder->dump_lock, NULL);
+		}
+		if (vl->type == __vanessa_logger_filename) {
+			pthread_mutex_init(&vl->data.d_filename->lock, NULL);
+			pthread_condattr_init(&attr);
+			pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+			pthread_cond_init(&vl->data.d_filename->cond, &attr);
+			pthread_condattr_destroy(&attr);
+			vl->data.d_filename->flusher_running = 0;
+			/* A sync under way belongs to the parent */
+			pthread_mutex_init(&vl->data.d_filename->sync_lock, 
+					NULL);
+			pthread_cond_init(&vl->data.d_filename->sync_cond, 
+					NULL);
+			vl->data.d_filename->syncing = 0;
+			vl->data.d_filename->synced = 
+				vl->data.d_filename->requested;
+			/* Rotation is left to the parent */
+			if (vl->data.d_filename->rotate) {
+				__vanessa_logger_rotate_child(
+					vl->data.d_filename->rotate);
+			}
+		}
+		/* Writers in the parent's other threads are not ours */
+		if (vl->type == __vanessa_logger_mmap) {
+			pthread_mutex_init(&vl->data.d_mmap->lock, NULL);
+			vl->data.d_mmap->seg[0].writers = 0;
+			vl->data.d_mmap->seg[1].writers = 0;
+		}
+		if (vl->type == __vanessa_logger_syslog) {
+			pthread_mutex_init(&vl->data.d_syslog->lock, NULL);
+		}
+	}
+
+	__vanessa_logger_site_child();
+	pthread_mutex_init(&__vanessa_logger_category_lock, NULL);
+	pthread_mutex_init(&__vanessa_logger_list_lock, NULL);
+	pthread_mutex_init(&__vanessa_logger_desc_lock, NULL);
+}
+
+static void
+__vanessa_logger_fork_init(void)
+{
+	if (pthread_atfork(__vanessa_logger_atfork_prepare, 
+				__vanessa_logger_atfork_parent,
+				__vanessa_logger_atfork_child)) {
+		perror("__vanessa_logger_fork_init: pthread_atfork");
+	}
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_register
+ * Internal function to add a logger to the list of loggers
+ * pre: vl: logger to add, must not already be on the list
+ * post: vl is on the list
+ *       the pthread_atfork(3) handlers are installed if they were not
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_register(__vanessa_logger_t * vl)
+{
+	pthread_once(&__vanessa_logger_fork_once, __vanessa_logger_fork_init);
+
+	pthread_mutex_lock(&__vanessa_logger_list_lock);
+	vl->prev = NULL;
+	vl->next = __vanessa_logger_list;
+	if (vl->next) {
+		vl->next->prev = vl;
+	}
+	__vanessa_logger_list = vl;
+	pthread_mutex_unlock(&__vanessa_logger_list_lock);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_unregister
+ * Internal function to remove a logger from the list of loggers
+ * pre: vl: logger to remove
+ * post: vl is not on the list
+ *       Nothing if vl was not on the list
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_unregister(__vanessa_logger_t * vl)
+{
+	pthread_mutex_lock(&__vanessa_logger_list_lock);
+	if (vl->prev) {
+		vl->prev->next = vl->next;
+	}
+	else if (__vanessa_logger_list == vl) {
+		__vanessa_logger_list = vl->next;
+	}
+	if (vl->next) {
+		vl->next->prev = vl->prev;
+	}
+	vl->prev = NULL;
+	vl->next = NULL;
+	pthread_mutex_unlock(&__vanessa_logger_list_lock);
 }
 
 
@@ -343,15 +1112,27 @@ __vanessa_logger_set(__vanessa_logger_t * vl, const char *ident,
 	}
 
 	/*
-	 * Set buffer
+	 * Render the ident[pid] header once, it is refreshed
+	 * by __vanessa_logger_atfork_child() in forked children
 	 */
-	vl->buffer = (char *) malloc(__VANESSA_LOGGER_BUF_SIZE);
-	if (!vl->buffer) {
+	vl->header = (char *) malloc(strlen(ident) + 
+			__VANESSA_LOGGER_HEADER_PID_LEN);
+	if (!vl->header) {
 		perror("__vanessa_logger_set: malloc 1");
 		__vanessa_logger_destroy(vl);
 		return (NULL);
 	}
-	vl->buffer_len = __VANESSA_LOGGER_BUF_SIZE;
+	__vanessa_logger_render_header(vl);
+
+	/*
+	 * Make sure per-thread formatting buffers are available
+	 */
+	if (!__vanessa_logger_tls_get()) {
+		fprintf(stderr, "__vanessa_logger_set: "
+			"__vanessa_logger_tls_get\n");
+		__vanessa_logger_destroy(vl);
+		return (NULL);
+	}
 
 	/*
 	 * Set type and option
@@ -369,38 +1150,59 @@ __vanessa_logger_set(__vanessa_logger_t * vl, const char *ident,
 		break;
 	case __vanessa_logger_filename:
 		vl->flag = option;
-		if ((vl->data.d_filename =
-		     (__vanessa_logger_filename_data_t *)
-		     malloc(sizeof(__vanessa_logger_filename_data_t)
-		     )) == NULL) {
-			perror("__vanessa_logger_set: malloc 2");
+		vl->data.d_filename = __vanessa_logger_filename_create(vl,
+				(__vanessa_logger_filename_opt_t *) data);
+		if (vl->data.d_filename == NULL) {
+			fprintf(stderr, "__vanessa_logger_set: "
+				"__vanessa_logger_filename_create\n");
+			vl->type = __vanessa_logger_none;
 			__vanessa_logger_destroy(vl);
 			return (NULL);
 		}
-		if ((vl->data.d_filename->filename =
-		     strdup((char *) data)) == NULL) {
-			perror("__vanessa_logger_set: malloc strdup 2");
+		break;
+	case __vanessa_logger_mmap:
+		vl->flag = option;
+		vl->data.d_mmap = __vanessa_logger_mmap_create(
+				(__vanessa_logger_mmap_opt_t *) data);
+		if (vl->data.d_mmap == NULL) {
+			fprintf(stderr, "__vanessa_logger_set: "
+				"__vanessa_logger_mmap_create\n");
+			vl->type = __vanessa_logger_none;
 			__vanessa_logger_destroy(vl);
 			return (NULL);
 		}
-		vl->data.d_filename->filehandle =
-		    fopen(vl->data.d_filename->filename, "a");
-		if (vl->data.d_filename->filehandle == NULL) {
-			perror("__vanessa_logger_set: fopen");
+		break;
+	case __vanessa_logger_syslog:
+		/* option holds the options of openlog(3) */
+		vl->flag = ((__vanessa_logger_syslog_opt_t *) data)->flag;
+		if (option & LOG_CONS) {
+			vl->flag |= VANESSA_LOGGER_F_CONS;
+		}
+#ifdef LOG_PERROR
+		if (option & LOG_PERROR) {
+			vl->flag |= VANESSA_LOGGER_F_PERROR;
+		}
+#endif
+		vl->data.d_syslog = __vanessa_logger_syslog_create(vl,
+				(__vanessa_logger_syslog_opt_t *) data);
+		if (vl->data.d_syslog == NULL) {
+			fprintf(stderr, "__vanessa_logger_set: "
+				"__vanessa_logger_syslog_create\n");
+			vl->type = __vanessa_logger_none;
 			__vanessa_logger_destroy(vl);
 			return (NULL);
 		}
 		break;
-	case __vanessa_logger_syslog:
-		vl->flag = VANESSA_LOGGER_F_NO_IDENT_PID;
-		if ((vl->data.d_syslog =
-		     (int *) malloc(sizeof(int))) == NULL) {
-			perror("__vanessa_logger_set: malloc 3");
+	case __vanessa_logger_fanout:
+		vl->data.d_fanout = __vanessa_logger_fanout_create(
+				(__vanessa_logger_fanout_opt_t *) data);
+		if (vl->data.d_fanout == NULL) {
+			fprintf(stderr, "__vanessa_logger_set: "
+				"__vanessa_logger_fanout_create\n");
+			vl->type = __vanessa_logger_none;
 			__vanessa_logger_destroy(vl);
 			return (NULL);
 		}
-		*(vl->data.d_syslog) = *((int *) data);
-		openlog(vl->ident, LOG_PID | option, *(vl->data.d_syslog));
 		break;
 	case __vanessa_logger_function:
 		vl->data.d_function = (vanessa_logger_log_function_va_t) data;
@@ -415,25 +1217,60 @@ __vanessa_logger_set(__vanessa_logger_t * vl, const char *ident,
 	vl->max_priority = max_priority;
 
 	/*
-	 * Set ready
+	 * Start the writer thread for asynchronous loggers
 	 */
-	vl->ready = __vanessa_logger_true;
+	if ((vl->type == __vanessa_logger_filehandle || 
+			vl->type == __vanessa_logger_filename ||
+			vl->type == __vanessa_logger_syslog) &&
+			vl->flag & VANESSA_LOGGER_F_ASYNC) {
+		vl->async = __vanessa_logger_async_create(vl);
+		if (!vl->async) {
+			fprintf(stderr, "__vanessa_logger_set: "
+				"__vanessa_logger_async_create\n");
+			__vanessa_logger_destroy(vl);
+			return (NULL);
+		}
+	}
 
-	return (vl);
-}
+	/*
+	 * Set up filename loggers that write records rather than text
+	 */
+	if (vl->type == __vanessa_logger_filename &&
+			vl->flag & VANESSA_LOGGER_F_BINARY) {
+		vl->binary = __vanessa_logger_binary_create(vl);
+		if (!vl->binary) {
+			fprintf(stderr, "__vanessa_logger_set: "
+				"__vanessa_logger_binary_create\n");
+			__vanessa_logger_destroy(vl);
+			return (NULL);
+		}
+	}
+
+	/*
+	 * Set ready
+	 */
+	vl->ready = __vanessa_logger_true;
+
+	__vanessa_logger_register(vl);
+
+	return (vl);
+}
 
 
 /**********************************************************************
  * __vanessa_logger_reopen
  * Internal function to reopen a logger
  * pre: vl: pointer to logger to reopen
- * post: In the case of a filename logger the logger is closed
- *       if it was open and then opened regardless of weather it
- *       was originally open or not.
- *       In the case of a none, syslog or filehandle logger or if vl is NULL
- *       nothing is done.
- *       If an error occurs -1 is returned and vl->ready is set to
- *       __vanessa_logger_false
+ * post: In the case of a filename logger the file is opened again
+ *       and then the old file is closed.
+ *       In the case of a syslog logger, its socket is connected
+ *       again, which picks up a restarted syslog daemon.
+ *       In the case of a fan-out logger each of its children is
+ *       reopened.
+ *       In the case of a none, function or filehandle logger or if
+ *       vl is NULL nothing is done.
+ *       If an error occurs -1 is returned and a filename logger
+ *       carries on logging to the old file
  * return: 0 on success
  *         -1 on error
  **********************************************************************/
@@ -447,27 +1284,52 @@ __vanessa_logger_reopen(__vanessa_logger_t * vl)
 
 	switch (vl->type) {
 	case __vanessa_logger_filename:
-		if (vl->ready == __vanessa_logger_true) {
-			vl->ready = __vanessa_logger_false;
-			if (fclose(vl->data.d_filename->filehandle)) {
-				perror("__vanessa_logger_reopen: fclose");
+		if (vl->async) {
+			int status;
+
+			/*
+			 * Messages logged while the file is being
+			 * reopened stay queued rather than being dropped
+			 */
+			__vanessa_logger_async_drain(vl->async);
+			pthread_mutex_lock(&vl->async->io_lock);
+			status = __vanessa_logger_filename_reopen(
+					vl->data.d_filename);
+			pthread_mutex_unlock(&vl->async->io_lock);
+			if (status < 0) {
 				return (-1);
 			}
+			break;
 		}
-		vl->data.d_filename->filehandle =
-		    fopen(vl->data.d_filename->filename, "a");
-		if (vl->data.d_filename->filehandle == NULL) {
-			perror("__vanessa_logger_reopen: fopen");
+		if (__vanessa_logger_filename_reopen(vl->data.d_filename) 
+				< 0) {
+			return (-1);
+		}
+		break;
+	case __vanessa_logger_mmap:
+		if (__vanessa_logger_mmap_roll(vl->data.d_mmap, NULL) < 0) {
 			return (-1);
 		}
-		vl->ready = __vanessa_logger_true;
 		break;
 	case __vanessa_logger_syslog:
-		if (vl->ready == __vanessa_logger_true) {
-			closelog();
+		if (__vanessa_logger_syslog_reopen(vl->data.d_syslog) < 0) {
+			return (-1);
 		}
-		openlog(vl->ident, LOG_PID | vl->option, *(vl->data.d_syslog));
 		break;
+	case __vanessa_logger_fanout:
+		{
+			int status = 0;
+			int i;
+
+			for (i = 0; i < vl->data.d_fanout->n; i++) {
+				if (__vanessa_logger_reopen(
+						vl->data.d_fanout->child[i]) 
+						< 0) {
+					status = -1;
+				}
+			}
+			return (status);
+		}
 	default:
 		break;
 	}
@@ -477,839 +1339,9743 @@ __vanessa_logger_reopen(__vanessa_logger_t * vl)
 
 
 /**********************************************************************
- * __vanessa_logger_va_func_wrapper
- * Internal wrapper function be able to use a 
- * vanessa_logger_log_function_t, which uses va_list, with a ...
- * pre: func: function to call
- *      priority: priority pass to func
- *      fmt: to pass to func
- *      ...: args to convert to an ap and pass to func
- * post: func is called 
+ * __vanessa_logger_reopen_check
+ * Internal function to reopen a logger if vanessa_logger_reopen_signal()
+ * has been called for it since it was last reopened
+ * pre: vl: logger about to log a message
+ * post: logger is reopened, if need be
  * return: none
  **********************************************************************/
 
-static void 
-__vanessa_logger_va_func_wrapper(vanessa_logger_log_function_va_t func,
-		int priority, const char *fmt, ...)
+static void
+__vanessa_logger_reopen_check(__vanessa_logger_t * vl)
 {
-	va_list ap;
+	if (!__atomic_load_n(&vl->reopen, __ATOMIC_RELAXED) ||
+			!__atomic_exchange_n(&vl->reopen, 0, __ATOMIC_ACQUIRE)) {
+		return;
+	}
 
-	va_start(ap, fmt);
-	func(priority, fmt, ap);
-	va_end(ap);
+	if (__vanessa_logger_reopen(vl) < 0) {
+		fprintf(stderr, "__vanessa_logger_reopen_check: "
+				"__vanessa_logger_reopen\n");
+	}
 }
 
 
+/**********************************************************************
+ * __vanessa_logger_tls_free
+ * Internal function to free the per-thread state of a thread.
+ * Called by pthreads when the thread exits.
+ * pre: data: per-thread state typecast to (void *)
+ * post: per-thread state and any memory it refers to is freed
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_tls_free(void *data)
+{
+	__vanessa_logger_tls_t *tls = (__vanessa_logger_tls_t *) data;
+
+	__vanessa_logger_recorder_release(tls);
+	free(tls->overflow);
+	free(tls->body_overflow);
+	free(tls);
+}
+
 
 /**********************************************************************
- * __vanessa_logger_log
- * Internal function to log a message
- * pre: vl: logger to use
- *      priority: priority to log with
- *                Only used if log type is __vanessa_logger_syslog
- *                Ignored otherwise
- *      fmt: format for log message
- *      ap: varargs for format
- * post: message is logged to appropriate logger
- *       vl->ident[pid]: will be prepended to each log
- *       '\n' will be appended to each log that doesn't already end with
- *       a '\n'
- *       Nothing on error
+ * __vanessa_logger_tls_init
+ * Internal function to create the key used to find the per-thread
+ * state of the calling thread. Run once via pthread_once(3).
+ * pre: none
+ * post: __vanessa_logger_tls_key is created
+ *       __vanessa_logger_tls_status is set to 0 on success
  * return: none
  **********************************************************************/
 
-int __vanessa_logger_do_fmt(__vanessa_logger_t *vl, 
-		const char *prefix, const char *fmt)
+static void
+__vanessa_logger_tls_init(void)
 {
-	int len;
-	size_t offset = 0;
-	int add_colon = 0;
+	if (pthread_key_create(&__vanessa_logger_tls_key, 
+				__vanessa_logger_tls_free)) {
+		perror("__vanessa_logger_tls_init: pthread_key_create");
+		return;
+	}
+	__vanessa_logger_tls_status = 0;
+}
 
-	memset(vl->buffer, 0, vl->buffer_len);
 
-	if(vl->flag & VANESSA_LOGGER_F_TIMESTAMP) {
-		struct tm *tm;
-		time_t now;
+/**********************************************************************
+ * __vanessa_logger_tls_get
+ * Internal function to find the per-thread state of the calling
+ * thread, allocating it the first time the thread logs.
+ * The state is freed when the thread exits.
+ * pre: none
+ * post: per-thread state is allocated if it did not already exist
+ * return: per-thread state for the calling thread
+ *         NULL on error
+ **********************************************************************/
 
-		now = time(NULL);
-		if (now == (time_t)-1) {
-			return -1;
-		}
-		tm = localtime(&now);
-		if (!tm) {
-			return -1;
-		}
-		len = strftime(vl->buffer + offset, 
-				vl->buffer_len - offset - 1, "%b %e %H:%M:%S ",
-				tm);
-		if (len < 0) {
-			return -1;
-		}
-		offset += len;
-		add_colon++;
+static __vanessa_logger_tls_t *
+__vanessa_logger_tls_get(void)
+{
+	__vanessa_logger_tls_t *tls;
+
+	if (pthread_once(&__vanessa_logger_tls_once, 
+				__vanessa_logger_tls_init) || 
+			__vanessa_logger_tls_status < 0) {
+		return (NULL);
 	}
 
-	if(vl->ident && !(vl->flag & VANESSA_LOGGER_F_NO_IDENT_PID)) {
-		len = snprintf(vl->buffer + offset , 
-				vl->buffer_len - offset - 1, "%s[%d] ",
-				vl->ident, getpid());
-		if (len < 0) {
-			return -1;
-		}
-		offset += len;
-		add_colon++;
+	tls = (__vanessa_logger_tls_t *) 
+		pthread_getspecific(__vanessa_logger_tls_key);
+	if (tls) {
+		return (tls);
 	}
 
-	if (add_colon) {
-		len = snprintf(vl->buffer + offset - 1, 
-				 vl->buffer_len - offset, ": ");
-		if (len < 0) {
-			return -1;
-		}
-		offset++;
+	tls = (__vanessa_logger_tls_t *) 
+		calloc(1, sizeof(__vanessa_logger_tls_t));
+	if (!tls) {
+		perror("__vanessa_logger_tls_get: calloc");
+		return (NULL);
 	}
+	tls->ts.sec = (time_t) -1;
+	tls->shard = __atomic_fetch_add(&__vanessa_logger_tls_shard, 1,
+			__ATOMIC_RELAXED) & (__VANESSA_LOGGER_STATS_SHARDS - 1);
 
-	if(prefix) {
-		len = strlen(prefix) + 2;
-		if (offset + len + 1 > vl->buffer_len) {
-			return -1;
-		}
-		memcpy(vl->buffer + offset, prefix, len - 2);
-		memcpy(vl->buffer + offset + len - 2, ": ", 2);
-		offset += len;
+	if (pthread_setspecific(__vanessa_logger_tls_key, tls)) {
+		perror("__vanessa_logger_tls_get: pthread_setspecific");
+		free(tls);
+		return (NULL);
 	}
 
-	len = strlen(fmt);
-	if (offset + len + 1 > vl->buffer_len) {
-		return -1;
+	return (tls);
+}
+
+
+/**********************************************************************
+ * Statistics
+ *
+ * Each thread is given one of __VANESSA_LOGGER_STATS_SHARDS shards of
+ * the counters of a logger when its per-thread state is created, so
+ * unless there are more threads than shards a thread has its counters
+ * to itself and bumping them costs an uncontended atomic add.
+ * Reading the statistics adds the shards together.
+ **********************************************************************/
+
+/*
+ * Return the shard of the statistics of a logger for the calling
+ * thread, NULL if statistics are off
+ */
+
+static __vanessa_logger_shard_t *
+__vanessa_logger_stats_shard(__vanessa_logger_t * vl, 
+		__vanessa_logger_tls_t *tls)
+{
+	__vanessa_logger_stats_t *stats;
+
+	stats = __atomic_load_n(&vl->stats, __ATOMIC_ACQUIRE);
+	if (!stats || !__atomic_load_n(&stats->enabled, __ATOMIC_RELAXED)) {
+		return (NULL);
 	}
-	memcpy(vl->buffer + offset, fmt, len);
-	offset += len;
 
-	if (*(vl->buffer+offset-1) != '\n') {
-		if(offset + 2 > vl->buffer_len) {
-			return -1;
-		}
-		*(vl->buffer+offset)='\n';
-		*(vl->buffer+offset+1)='\0';
+	return (stats->shard + (tls ? tls->shard : 0));
+}
+
+static unsigned long long
+__vanessa_logger_stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/*
+ * Return the time to pass to __vanessa_logger_stats_format() and
+ * __vanessa_logger_stats_write(), 0 if statistics are off
+ */
+
+static unsigned long long
+__vanessa_logger_stats_start(__vanessa_logger_t * vl)
+{
+	if (!__vanessa_logger_stats_shard(vl, NULL)) {
+		return (0);
 	}
 
-	return(0);
+	return (__vanessa_logger_stats_now());
 }
 
-void __vanessa_logger_do_fh(__vanessa_logger_t * vl, const char *prefix, 
-		const char *fmt, FILE *fh, va_list ap) 
+static unsigned long long
+__vanessa_logger_stats_time(vanessa_logger_histogram_t *h,
+		unsigned long long start)
 {
-	if (__vanessa_logger_do_fmt(vl, prefix, fmt) < 0) {
-		fprintf(fh, "__vanessa_logger_do_fh: output truncated\n");
-		return;
+	unsigned long long now;
+	unsigned long long nsec;
+	int i;
+
+	now = __vanessa_logger_stats_now();
+	nsec = now - start;
+	/* The smallest i for which nsec <= 2^i */
+	i = nsec > 1 ? 64 - __builtin_clzll(nsec - 1) : 0;
+	if (i >= VANESSA_LOGGER_STATS_BUCKETS) {
+		i = VANESSA_LOGGER_STATS_BUCKETS - 1;
 	}
 
-	if (((vfprintf(fh, vl->buffer, ap) < 0  || fflush(fh) == EOF) && 
-			vl->flag & VANESSA_LOGGER_F_CONS) ||
-			vl->flag & VANESSA_LOGGER_F_PERROR){
-		vfprintf(stderr, vl->buffer, ap);
-		fflush(stderr);
+	__atomic_fetch_add(&h->bucket[i], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum_nsec, nsec, __ATOMIC_RELAXED);
+
+	return (now);
+}
+
+/*
+ * Record the time taken to format a message since start.
+ * Return the time now, which is where writing the message starts,
+ * or 0 if statistics are off.
+ */
+
+static unsigned long long
+__vanessa_logger_stats_format(__vanessa_logger_t * vl, 
+		__vanessa_logger_tls_t *tls, unsigned long long start)
+{
+	__vanessa_logger_shard_t *shard;
+
+	if (!start) {
+		return (0);
 	}
+	shard = __vanessa_logger_stats_shard(vl, tls);
+	if (!shard) {
+		return (0);
+	}
+
+	return (__vanessa_logger_stats_time(&shard->format, start));
 }
 
-void __vanessa_logger_do_func(__vanessa_logger_t * vl, int priority, 
-		const char *prefix, const char *fmt, va_list ap, 
-		vanessa_logger_log_function_va_t func)
+/*
+ * Return where writing a message rendered by __vanessa_logger_render()
+ * starts, saving a second read of the clock
+ */
+
+static unsigned long long
+__vanessa_logger_stats_mark(__vanessa_logger_t * vl,
+		__vanessa_logger_tls_t *tls)
 {
-	if (__vanessa_logger_do_fmt(vl, prefix, fmt) < 0) {
-		__vanessa_logger_va_func_wrapper(func, priority, 
-				"__vanessa_logger_do_fh: output truncated\n");
-		return;
+	unsigned long long start;
+
+	if (tls && tls->stats_mark) {
+		start = tls->stats_mark;
+		tls->stats_mark = 0;
+		return (start);
 	}
 
-	(func)(priority, vl->buffer, ap);
+	return (__vanessa_logger_stats_start(vl));
 }
 
+/* Record the time taken to write messages since start and their fate */
 
-static void 
-__vanessa_logger_log(__vanessa_logger_t * vl, int priority, 
-		const char *prefix, const char *fmt, va_list ap)
+static void
+__vanessa_logger_stats_write(__vanessa_logger_t * vl,
+		__vanessa_logger_tls_t *tls, unsigned long long start,
+		unsigned long messages, size_t bytes, int status)
 {
-	if (vl == NULL || vl->ready == __vanessa_logger_false
-	    || priority > vl->max_priority) {
+	__vanessa_logger_shard_t *shard;
+
+	if (!start) {
+		return;
+	}
+	shard = __vanessa_logger_stats_shard(vl, tls);
+	if (!shard) {
 		return;
 	}
 
-	switch (vl->type) {
-		case __vanessa_logger_filehandle:
-			__vanessa_logger_do_fh(vl, prefix, fmt, 
-					vl->data.d_filehandle, ap);
-			break;
-		case __vanessa_logger_filename:
-			__vanessa_logger_do_fh(vl, prefix, fmt,
-			       	vl->data.d_filename->filehandle, ap);
-			break;
-		case __vanessa_logger_syslog:
-			__vanessa_logger_do_func(vl, priority, prefix, fmt, ap, 
-					vsyslog);
-			break;
-		case __vanessa_logger_function:
-			__vanessa_logger_do_func(vl, priority, prefix, fmt, ap,
-					vl->data.d_function);
-			break;
-		case __vanessa_logger_none:
-			break;
+	__vanessa_logger_stats_time(&shard->write, start);
+	if (status < 0) {
+		__atomic_fetch_add(shard->count +
+				__VANESSA_LOGGER_STAT_WRITE_ERRORS, 1,
+				__ATOMIC_RELAXED);
+		return;
 	}
+	__atomic_fetch_add(shard->count + __VANESSA_LOGGER_STAT_WRITTEN,
+			messages, __ATOMIC_RELAXED);
+	__atomic_fetch_add(shard->count + __VANESSA_LOGGER_STAT_BYTES,
+			bytes, __ATOMIC_RELAXED);
+}
+
+/* Bump a counter, such as __VANESSA_LOGGER_STAT_TRUNCATED */
+
+static void
+__vanessa_logger_stats_count(__vanessa_logger_t * vl,
+		__vanessa_logger_tls_t *tls, int counter)
+{
+	__vanessa_logger_shard_t *shard;
+
+	shard = __vanessa_logger_stats_shard(vl, tls);
+	if (!shard) {
+		return;
+	}
+
+	__atomic_fetch_add(shard->count + counter, 1, __ATOMIC_RELAXED);
 }
 
 
 /**********************************************************************
- * __vanessa_logger_get_facility_byname
- * Given the name of a syslog facility as an ASCII string,
- * return the facility as an integer.
- * Relies on facilitynames[] being defined in syslog.h
- * pre: facility_name: syslog facility as an ASCII string
- * post: none
- * return: logger as an int
- *         -1 if facility_name cannot be found in facilitynames[],
- *            if facility_name is NULL
- *            or other error
+ * Timestamps
+ *
+ * Rendering the date and time with localtime_r(3) and strftime(3) is
+ * expensive, so the part of a timestamp up to and including the seconds
+ * is cached per thread and only rebuilt when the second changes. The
+ * fraction of a second, if any, is filled in on every call from a table
+ * of digit pairs.
  **********************************************************************/
 
-static int 
-__vanessa_logger_get_facility_byname(const char *facility_name)
-{
-	int i;
+static const char __vanessa_logger_digits[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static const char *__vanessa_logger_month[12] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
 
-	extern CODE facilitynames[];
+#define __VANESSA_LOGGER_F_TIMESTAMP_LAYOUT \
+	(VANESSA_LOGGER_F_TIMESTAMP_USEC | VANESSA_LOGGER_F_TIMESTAMP_NSEC | \
+	 VANESSA_LOGGER_F_TIMESTAMP_RFC3339 | VANESSA_LOGGER_F_TIMESTAMP_UTC)
 
-	if (facility_name == NULL) {
-		fprintf(stderr,
-			"__vanessa_logger_get_facility_byname: "
-			"facility_name is NULL\n");
-		return (-1);
-	}
+/*
+ * Write the n least significant decimal digits of value to str,
+ * zero padded. n must be even.
+ */
 
-	for (i = 0; facilitynames[i].c_name != NULL; i++) {
-		if (!strcmp(facility_name, facilitynames[i].c_name)) {
-			return (facilitynames[i].c_val);
-		}
+static void
+__vanessa_logger_put_digits(char *str, unsigned long value, int n)
+{
+	const char *pair;
+
+	while (n > 0) {
+		pair = __vanessa_logger_digits + (value % 100) * 2;
+		str[n - 2] = pair[0];
+		str[n - 1] = pair[1];
+		value /= 100;
+		n -= 2;
 	}
-
-	fprintf(stderr,
-		"__vanessa_logger_get_facility_byname: facility \"%s\" "
-		"not found\n", facility_name);
-	return (-1);
 }
 
+
 /**********************************************************************
- * vanessa_logger_openlog_syslog
- * Exported function to open a logger that will log to syslog
- * pre: facility: facility to log to syslog with
- *      ident: Identity to prepend to each log
- *      max_priority: Maximum priority no to log
- *                    Priorities are integers, the levels listed
- *                    in syslog(3) should be used for a syslog logger
- *      option: options to pass to the openlog command
- *              Will be logically ored with LOG_PID
- * post: Logger is opened
- * return: pointer to logger
- *         NULL on error
+ * __vanessa_logger_gmtoff
+ * Internal function to find the offset of local time from UTC
+ * pre: now: time the offset is wanted for
+ *      tm: now converted by localtime_r(3)
+ * post: none
+ * return: offset of local time from UTC in seconds
  **********************************************************************/
 
-vanessa_logger_t *
-vanessa_logger_openlog_syslog(int facility, const char *ident,
-		const int max_priority, const int option)
+static long
+__vanessa_logger_gmtoff(time_t now, const struct tm *tm)
 {
-	__vanessa_logger_t *vl;
-
-	if ((vl = __vanessa_logger_create()) == NULL) {
-		fprintf(stderr, "vanessa_logger_openlog_syslog: "
-			"__vanessa_logger_create\n");
-		return (NULL);
+#ifdef HAVE_STRUCT_TM_TM_GMTOFF
+	(void) now;
+	return (tm->tm_gmtoff);
+#else
+	struct tm utc;
+	long off;
+
+	if (!gmtime_r(&now, &utc)) {
+		return (0);
 	}
-
-	if (__vanessa_logger_set(vl, ident, max_priority,
-			 __vanessa_logger_syslog, (void *) &facility, 
-			option) == NULL) {
-		fprintf(stderr, "vanessa_logger_openlog_syslog: "
-			"__vanessa_logger_set\n");
-		return (NULL);
+	off = (tm->tm_hour - utc.tm_hour) * 3600L +
+		(tm->tm_min - utc.tm_min) * 60L + (tm->tm_sec - utc.tm_sec);
+	if (tm->tm_year != utc.tm_year) {
+		off += tm->tm_year > utc.tm_year ? 86400L : -86400L;
 	}
-
-	return ((vanessa_logger_t *) vl);
+	else if (tm->tm_yday != utc.tm_yday) {
+		off += tm->tm_yday > utc.tm_yday ? 86400L : -86400L;
+	}
+	return (off);
+#endif
 }
 
 
 /**********************************************************************
- * vanessa_logger_openlog_syslog_byname
- * Exported function to open a logger that will log to syslog
- * pre: facility_name: Name of facility to log to syslog with
- *      ident: Identity to prepend to each log
- *      max_priority: Maximum priority no to log
- *                    Priorities are integers, the levels listed
- *                    in syslog(3) should be used for a syslog logger
- *      option: options to pass to the openlog command
- *              Will be logically ored with LOG_PID
- * post: Logger is opened
- * return: pointer to logger
- *         NULL on error
+ * __vanessa_logger_timestamp_cache
+ * Internal function to render the part of a timestamp that only
+ * changes once a second into a cache
+ * pre: cache: cache to fill in
+ *      now: time to render
+ *      flag: flags of logger, selects the layout
+ * post: cache is filled in for now and flag
+ * return: 0 on success
+ *         -1 on error
  **********************************************************************/
 
-vanessa_logger_t *
-vanessa_logger_openlog_syslog_byname(const char *facility_name,
-		const char *ident, const int max_priority, const int option)
+static int
+__vanessa_logger_timestamp_cache(__vanessa_logger_ts_cache_t *cache,
+		time_t now, unsigned int flag)
+{
+	struct tm tm;
+	char *str = cache->str;
+	long off;
+
+	if (flag & VANESSA_LOGGER_F_TIMESTAMP_UTC) {
+		if (!gmtime_r(&now, &tm)) {
+			return (-1);
+		}
+		off = 0;
+	}
+	else {
+		if (!localtime_r(&now, &tm)) {
+			return (-1);
+		}
+		off = __vanessa_logger_gmtoff(now, &tm);
+	}
+
+	if (flag & VANESSA_LOGGER_F_TIMESTAMP_RFC3339) {
+		/* YYYY-MM-DDTHH:MM:SS */
+		__vanessa_logger_put_digits(str, tm.tm_year + 1900, 4);
+		str[4] = '-';
+		__vanessa_logger_put_digits(str + 5, tm.tm_mon + 1, 2);
+		str[7] = '-';
+		__vanessa_logger_put_digits(str + 8, tm.tm_mday, 2);
+		str[10] = 'T';
+		str += 11;
+	}
+	else {
+		/* Mmm dd HH:MM:SS, as per "%b %e %H:%M:%S" */
+		memcpy(str, __vanessa_logger_month[tm.tm_mon], 3);
+		str[3] = ' ';
+		__vanessa_logger_put_digits(str + 4, tm.tm_mday, 2);
+		if (str[4] == '0') {
+			str[4] = ' ';
+		}
+		str[6] = ' ';
+		str += 7;
+	}
+	__vanessa_logger_put_digits(str, tm.tm_hour, 2);
+	str[2] = ':';
+	__vanessa_logger_put_digits(str + 3, tm.tm_min, 2);
+	str[5] = ':';
+	__vanessa_logger_put_digits(str + 6, tm.tm_sec, 2);
+	str += 8;
+	cache->len = str - cache->str;
+
+	/* +HH:MM or Z */
+	cache->zone_len = 0;
+	if (flag & VANESSA_LOGGER_F_TIMESTAMP_RFC3339) {
+		if (flag & VANESSA_LOGGER_F_TIMESTAMP_UTC) {
+			cache->zone[0] = 'Z';
+			cache->zone_len = 1;
+		}
+		else {
+			cache->zone[0] = off < 0 ? '-' : '+';
+			if (off < 0) {
+				off = -off;
+			}
+			__vanessa_logger_put_digits(cache->zone + 1,
+					off / 3600, 2);
+			cache->zone[3] = ':';
+			__vanessa_logger_put_digits(cache->zone + 4,
+					(off / 60) % 60, 2);
+			cache->zone_len = 6;
+		}
+	}
+
+	cache->sec = now;
+	cache->flag = flag & __VANESSA_LOGGER_F_TIMESTAMP_LAYOUT;
+
+	return (0);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_clock
+ * Internal function to read the time for a timestamp
+ * pre: flag: flags of logger, selects the clock
+ *      ts: time is written here
+ * post: ts is set
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_clock(unsigned int flag, struct timespec *ts)
+{
+	clockid_t clock = CLOCK_REALTIME;
+
+#ifdef CLOCK_REALTIME_COARSE
+	if (flag & VANESSA_LOGGER_F_TIMESTAMP_COARSE) {
+		clock = CLOCK_REALTIME_COARSE;
+	}
+#endif
+	return (clock_gettime(clock, ts) < 0 ? -1 : 0);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_timestamp_render
+ * Internal function to render a given time as a timestamp, followed
+ * by a space
+ * pre: flag: flags of logger, selects the layout
+ *      cache: per-thread cache of the last timestamp rendered.
+ *             May be NULL.
+ *      ts: time to render
+ *      str: buffer to render to, must be at least
+ *           __VANESSA_LOGGER_TIMESTAMP_LEN bytes long
+ * post: timestamp is written to str, it is not NUL terminated
+ * return: length of timestamp
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_timestamp_render(unsigned int flag,
+		__vanessa_logger_ts_cache_t *cache, const struct timespec *ts,
+		char *str)
+{
+	__vanessa_logger_ts_cache_t local;
+	size_t len;
+
+	if (!cache) {
+		cache = &local;
+		cache->sec = (time_t) -1;
+	}
+	if (cache->sec != ts->tv_sec ||
+			cache->flag != (flag & __VANESSA_LOGGER_F_TIMESTAMP_LAYOUT)) {
+		if (__vanessa_logger_timestamp_cache(cache, ts->tv_sec,
+					flag) < 0) {
+			return (-1);
+		}
+	}
+
+	memcpy(str, cache->str, cache->len);
+	len = cache->len;
+
+	if (flag & VANESSA_LOGGER_F_TIMESTAMP_NSEC) {
+		str[len] = '.';
+		str[len + 1] = '0' + ts->tv_nsec / 100000000;
+		__vanessa_logger_put_digits(str + len + 2,
+				ts->tv_nsec % 100000000, 8);
+		len += 10;
+	}
+	else if (flag & VANESSA_LOGGER_F_TIMESTAMP_USEC) {
+		str[len] = '.';
+		__vanessa_logger_put_digits(str + len + 1,
+				ts->tv_nsec / 1000, 6);
+		len += 7;
+	}
+
+	memcpy(str + len, cache->zone, cache->zone_len);
+	len += cache->zone_len;
+	str[len++] = ' ';
+
+	return (len);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_timestamp
+ * Internal function to render a timestamp of the current time,
+ * followed by a space
+ * pre: flag: flags of logger, selects the layout and clock
+ *      cache: per-thread cache of the last timestamp rendered.
+ *             May be NULL.
+ *      str: buffer to render to, must be at least
+ *           __VANESSA_LOGGER_TIMESTAMP_LEN bytes long
+ * post: timestamp is written to str, it is not NUL terminated
+ * return: length of timestamp
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_timestamp(unsigned int flag,
+		__vanessa_logger_ts_cache_t *cache, char *str)
+{
+	struct timespec ts;
+
+	if (__vanessa_logger_clock(flag, &ts) < 0) {
+		return (-1);
+	}
+
+	return (__vanessa_logger_timestamp_render(flag, cache, &ts, str));
+}
+
+
+/**********************************************************************
+ * Filename loggers
+ *
+ * A filename logger owns a file descriptor opened with O_APPEND.
+ * Depending on the flush policy chosen when it is opened each line is
+ * either written with its own write(2), or collected in a buffer that
+ * belongs to the logger and written out with writev(2) once enough
+ * bytes, messages or time have accumulated. Only whole lines are ever
+ * buffered, so each line still reaches the file in one piece.
+ **********************************************************************/
+
+/**********************************************************************
+ * __vanessa_logger_fd_write
+ * Internal function to write an I/O vector to a file descriptor,
+ * retrying on short writes and EINTR
+ * pre: fd: file descriptor to write to
+ *      iov: data to write, the elements may be modified
+ *      n: number of elements in iov
+ * post: data is written
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_fd_write(int fd, struct iovec *iov, int n)
+{
+	ssize_t bytes;
+
+	while (n > 0) {
+		bytes = writev(fd, iov, n);
+		if (bytes < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (-1);
+		}
+		while (n > 0 && (size_t)bytes >= iov->iov_len) {
+			bytes -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + bytes;
+			iov->iov_len -= bytes;
+		}
+	}
+
+	return (0);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_filename_flush_locked
+ * Internal function to write out the buffer of a filename logger,
+ * followed by a line that did not go into the buffer, in one writev(2).
+ * If this fails and VANESSA_LOGGER_F_CONS is set the data is written
+ * to stderr instead.
+ * pre: d: filename logger data, d->lock must be held unless d->flush
+ *         is VANESSA_LOGGER_FLUSH_LINE, as then nothing is buffered
+ *      line: line to write after the buffer, may be NULL
+ *      len: length of line
+ * post: buffer is empty
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_filename_flush_locked(__vanessa_logger_filename_data_t *d,
+		const char *line, size_t len)
+{
+	struct iovec iov[2];
+	int n = 0;
+	int status;
+
+	if (d->used) {
+		iov[n].iov_base = d->buffer;
+		iov[n].iov_len = d->used;
+		n++;
+	}
+	if (line && len) {
+		iov[n].iov_base = (char *) line;
+		iov[n].iov_len = len;
+		n++;
+	}
+	if (!n) {
+		return (0);
+	}
+
+	status = __vanessa_logger_fd_write(d->fd, iov, n);
+	if (status < 0 && d->vl->flag & VANESSA_LOGGER_F_CONS) {
+		flockfile(stderr);
+		fwrite(d->buffer, d->used, 1, stderr);
+		if (line) {
+			fwrite(line, len, 1, stderr);
+		}
+		fflush(stderr);
+		funlockfile(stderr);
+	}
+	else if (status == 0) {
+		__vanessa_logger_rotate_account(d, d->used + 
+				(line ? len : 0));
+	}
+
+	if (d->used) {
+		d->used = 0;
+		d->count = 0;
+	}
+
+	return (status);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_filename_flusher
+ * Internal function run by the flusher thread of a filename logger
+ * using VANESSA_LOGGER_FLUSH_MSEC. Writes out the buffer once the
+ * oldest line in it is flush_value milliseconds old, so that lines
+ * are not held indefinitely when nothing else is logged.
+ * pre: data: filename logger data typecast to (void *)
+ * post: buffer is flushed as needed until d->stop is set
+ * return: NULL
+ **********************************************************************/
+
+static void *
+__vanessa_logger_filename_flusher(void *data)
+{
+	__vanessa_logger_filename_data_t *d =
+		(__vanessa_logger_filename_data_t *) data;
+	struct timespec deadline;
+	struct timespec now;
+
+	pthread_mutex_lock(&d->lock);
+	while (!d->stop) {
+		if (!d->used) {
+			pthread_cond_wait(&d->cond, &d->lock);
+			continue;
+		}
+
+		deadline = d->first;
+		deadline.tv_sec += d->flush_value / 1000;
+		deadline.tv_nsec += (d->flush_value % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > deadline.tv_sec ||
+				(now.tv_sec == deadline.tv_sec &&
+				 now.tv_nsec >= deadline.tv_nsec)) {
+			__vanessa_logger_filename_flush_locked(d, NULL, 0);
+			continue;
+		}
+
+		pthread_cond_timedwait(&d->cond, &d->lock, &deadline);
+	}
+	pthread_mutex_unlock(&d->lock);
+
+	return (NULL);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_filename_write
+ * Internal function to write a line to a filename logger according
+ * to its flush policy
+ * pre: d: filename logger data
+ *      line: line to write
+ *      len: length of line
+ *      sync: if non-zero the line and anything buffered before it
+ *            is written straight away, ready to be synced
+ * post: line is written or buffered
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_filename_write(__vanessa_logger_filename_data_t *d,
+		const char *line, size_t len, int sync)
+{
+	struct timespec now;
+	int status = 0;
+	int flush = 0;
+
+	if (d->flush == VANESSA_LOGGER_FLUSH_LINE) {
+		return (__vanessa_logger_filename_flush_locked(d, line, len));
+	}
+
+	pthread_mutex_lock(&d->lock);
+
+	if (sync || d->used + len > d->buffer_size) {
+		status = __vanessa_logger_filename_flush_locked(d, line, len);
+		pthread_mutex_unlock(&d->lock);
+		return (status);
+	}
+
+	memcpy(d->buffer + d->used, line, len);
+	d->used += len;
+	d->count++;
+
+	switch (d->flush) {
+	case VANESSA_LOGGER_FLUSH_BYTES:
+		flush = d->used >= d->flush_value;
+		break;
+	case VANESSA_LOGGER_FLUSH_MESSAGES:
+		flush = d->count >= d->flush_value;
+		break;
+	case VANESSA_LOGGER_FLUSH_MSEC:
+		if (d->used == len) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			d->first = now;
+			/* The flusher thread is started lazily after fork */
+			if (!d->flusher_running) {
+				if (pthread_create(&d->flusher, NULL,
+					__vanessa_logger_filename_flusher, d)) {
+					flush = 1;
+				}
+				else {
+					d->flusher_running = 1;
+				}
+			}
+			pthread_cond_signal(&d->cond);
+		}
+		break;
+	}
+
+	if (flush) {
+		status = __vanessa_logger_filename_flush_locked(d, NULL, 0);
+	}
+
+	pthread_mutex_unlock(&d->lock);
+
+	return (status);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_filename_flush
+ * Internal function to write out anything buffered by a filename logger
+ * pre: d: filename logger data
+ * post: buffer is empty
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_filename_flush(__vanessa_logger_filename_data_t *d)
+{
+	int status;
+
+	if (d->flush == VANESSA_LOGGER_FLUSH_LINE) {
+		return (0);
+	}
+
+	pthread_mutex_lock(&d->lock);
+	status = __vanessa_logger_filename_flush_locked(d, NULL, 0);
+	pthread_mutex_unlock(&d->lock);
+
+	return (status);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_filename_commit
+ * Internal function to wait until everything written to the file of
+ * a filename logger so far is on disk. Concurrent callers share one
+ * fdatasync(2): whoever finds none under way waits out the commit
+ * window and then syncs on behalf of everyone who has arrived by then.
+ * pre: d: filename logger data, the caller's line has been written
+ * post: the caller's line has been synced to disk, or an attempt to
+ *       do so failed and is counted in d->stats.sync_errors
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_filename_commit(__vanessa_logger_filename_data_t *d)
+{
+	struct timespec start;
+	struct timespec now;
+	struct timespec window;
+	unsigned long ticket;
+	unsigned long target;
+	unsigned long usec;
+	int status;
+	int fd;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pthread_mutex_lock(&d->sync_lock);
+	ticket = ++d->requested;
+	while ((long)(d->synced - ticket) < 0) {
+		if (d->syncing) {
+			pthread_cond_wait(&d->sync_cond, &d->sync_lock);
+			continue;
+		}
+
+		d->syncing = 1;
+		if (d->sync_window) {
+			window.tv_sec = d->sync_window / 1000000;
+			window.tv_nsec = (d->sync_window % 1000000) * 1000L;
+			pthread_mutex_unlock(&d->sync_lock);
+			while (nanosleep(&window, &window) < 0 &&
+					errno == EINTR)
+				;
+			pthread_mutex_lock(&d->sync_lock);
+		}
+		target = d->requested;
+		/* d->fd is never changed, only the file behind it */
+		fd = d->fd;
+		pthread_mutex_unlock(&d->sync_lock);
+
+		status = fdatasync(fd);
+
+		pthread_mutex_lock(&d->sync_lock);
+		d->stats.syncs++;
+		if (status < 0) {
+			d->stats.sync_errors++;
+		}
+		d->synced = target;
+		d->syncing = 0;
+		pthread_cond_broadcast(&d->sync_cond);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	usec = (now.tv_sec - start.tv_sec) * 1000000UL +
+		now.tv_nsec / 1000 - start.tv_nsec / 1000;
+	d->stats.commits++;
+	d->stats.commit_usec_total += usec;
+	if (usec > d->stats.commit_usec_max) {
+		d->stats.commit_usec_max = usec;
+	}
+	pthread_mutex_unlock(&d->sync_lock);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_filename_open
+ * Internal function to open the file of a filename logger
+ * pre: filename: name of file to open
+ * post: file is opened for appending, and created if need be
+ * return: file descriptor
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_filename_open(const char *filename)
+{
+	int fd;
+
+	do {
+		fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0666);
+	} while (fd < 0 && errno == EINTR);
+
+	return (fd);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_filename_reopen
+ * Internal function to reopen the file of a filename logger.
+ * The new file is opened before the old one is closed, so if it can't
+ * be opened the logger carries on logging to the old one.
+ * Anything buffered is written to the old file, and the preamble, if
+ * any, starts the new one. A logger that rotates its file itself
+ * rotates it now instead. If group commit is in
+ * use the reopen takes the place of an fdatasync(2) of the old file,
+ * so that no caller is told that its line is on disk before it is.
+ *
+ * The new file is put in place with dup2(2) onto d->fd, so the
+ * descriptor that writers use never changes and is never closed under
+ * them. A write that is under way when the switch is made goes whole
+ * to the old file, which the kernel keeps open until the write is
+ * done. So writers that don't buffer, which take no lock, need not be
+ * waited for and their lines are neither lost nor written to a closed
+ * or reused descriptor.
+ * pre: d: filename logger data
+ * post: d->fd refers to the file now named d->filename
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_filename_reopen(__vanessa_logger_filename_data_t *d)
+{
+	struct iovec iov;
+	int fd;
+	int old_fd = -1;
+	int sync;
+	int status = 0;
+
+	/* A logger that rotates itself starts a new file instead */
+	if (d->rotate && (__atomic_load_n(&d->rotate->size, __ATOMIC_RELAXED)
+				|| d->rotate->interval)) {
+		return (__vanessa_logger_rotate_now(d));
+	}
+
+	fd = __vanessa_logger_filename_open(d->filename);
+	if (fd < 0) {
+		perror("__vanessa_logger_filename_reopen: open");
+		return (-1);
+	}
+
+	/* Nothing may be written to the new file ahead of the preamble */
+	if (d->preamble) {
+		iov.iov_base = d->preamble;
+		iov.iov_len = d->preamble_len;
+		if (__vanessa_logger_fd_write(fd, &iov, 1) < 0) {
+			perror("__vanessa_logger_filename_reopen: write");
+			close(fd);
+			return (-1);
+		}
+	}
+
+	pthread_mutex_lock(&d->sync_lock);
+	while (d->syncing) {
+		pthread_cond_wait(&d->sync_cond, &d->sync_lock);
+	}
+	d->syncing = 1;
+	sync = d->sync_priority != VANESSA_LOGGER_SYNC_NONE;
+	pthread_mutex_unlock(&d->sync_lock);
+
+	pthread_mutex_lock(&d->lock);
+	__vanessa_logger_filename_flush_locked(d, NULL, 0);
+	/* Keep hold of the old file to sync it */
+	if (sync) {
+		old_fd = dup(d->fd);
+	}
+	if (dup2(fd, d->fd) < 0) {
+		perror("__vanessa_logger_filename_reopen: dup2");
+		status = -1;
+	}
+	else {
+		__atomic_add_fetch(&d->generation, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&d->lock);
+
+	/*
+	 * Callers waiting now may have written to either file,
+	 * so both are synced
+	 */
+	pthread_mutex_lock(&d->sync_lock);
+	if (sync) {
+		if ((old_fd >= 0 && fdatasync(old_fd) < 0) || 
+				fdatasync(d->fd) < 0) {
+			d->stats.sync_errors++;
+		}
+		d->stats.syncs++;
+	}
+	d->synced = d->requested;
+	d->syncing = 0;
+	pthread_cond_broadcast(&d->sync_cond);
+	pthread_mutex_unlock(&d->sync_lock);
+
+	if (old_fd >= 0 && close(old_fd) < 0) {
+		perror("__vanessa_logger_filename_reopen: close");
+	}
+	if (close(fd) < 0) {
+		perror("__vanessa_logger_filename_reopen: close");
+	}
+
+	return (status);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_filename_create
+ * Internal function to set up the data of a filename logger and
+ * open its file
+ * pre: vl: logger the data belongs to
+ *      opt: filename and flush policy
+ * post: data is allocated and file is open
+ * return: filename logger data
+ *         NULL on error
+ **********************************************************************/
+
+static __vanessa_logger_filename_data_t *
+__vanessa_logger_filename_create(__vanessa_logger_t * vl,
+		const __vanessa_logger_filename_opt_t *opt)
+{
+	__vanessa_logger_filename_data_t *d;
+	pthread_condattr_t attr;
+
+	d = (__vanessa_logger_filename_data_t *)
+		calloc(1, sizeof(__vanessa_logger_filename_data_t));
+	if (!d) {
+		perror("__vanessa_logger_filename_create: calloc");
+		return (NULL);
+	}
+	d->fd = -1;
+	d->vl = vl;
+	d->flush = opt->flush;
+	d->flush_value = opt->flush_value;
+	d->sync_priority = VANESSA_LOGGER_SYNC_NONE;
+
+	switch (d->flush) {
+	case VANESSA_LOGGER_FLUSH_LINE:
+		break;
+	case VANESSA_LOGGER_FLUSH_BYTES:
+		d->buffer_size = d->flush_value;
+		break;
+	case VANESSA_LOGGER_FLUSH_MESSAGES:
+	case VANESSA_LOGGER_FLUSH_MSEC:
+		d->buffer_size = __VANESSA_LOGGER_FLUSH_BUF_SIZE;
+		break;
+	default:
+		fprintf(stderr, "__vanessa_logger_filename_create: "
+				"unknown flush policy %d\n", d->flush);
+		free(d);
+		return (NULL);
+	}
+
+	if (d->buffer_size) {
+		d->buffer = (char *) malloc(d->buffer_size);
+		if (!d->buffer) {
+			perror("__vanessa_logger_filename_create: malloc");
+			free(d);
+			return (NULL);
+		}
+	}
+
+	d->filename = strdup(opt->filename);
+	if (!d->filename) {
+		perror("__vanessa_logger_filename_create: strdup");
+		free(d->buffer);
+		free(d);
+		return (NULL);
+	}
+
+	d->fd = __vanessa_logger_filename_open(d->filename);
+	if (d->fd < 0) {
+		perror("__vanessa_logger_filename_create: open");
+		free(d->filename);
+		free(d->buffer);
+		free(d);
+		return (NULL);
+	}
+
+	pthread_mutex_init(&d->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&d->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&d->sync_lock, NULL);
+	pthread_cond_init(&d->sync_cond, NULL);
+
+	return (d);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_filename_destroy
+ * Internal function to flush and close the file of a filename logger
+ * and free its data
+ * pre: d: filename logger data
+ * post: buffer is written, flusher thread is stopped, file is closed
+ *       and memory is freed
+ *       Nothing if d is NULL
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_filename_destroy(__vanessa_logger_filename_data_t *d)
+{
+	if (!d) {
+		return;
+	}
+
+	pthread_mutex_lock(&d->lock);
+	__vanessa_logger_filename_flush_locked(d, NULL, 0);
+	d->stop = 1;
+	pthread_cond_signal(&d->cond);
+	pthread_mutex_unlock(&d->lock);
+	if (d->flusher_running) {
+		pthread_join(d->flusher, NULL);
+	}
+
+	__vanessa_logger_rotate_destroy(d);
+
+	if (close(d->fd) < 0) {
+		perror("__vanessa_logger_filename_destroy: close");
+	}
+
+	pthread_mutex_destroy(&d->lock);
+	pthread_cond_destroy(&d->cond);
+	pthread_mutex_destroy(&d->sync_lock);
+	pthread_cond_destroy(&d->sync_cond);
+	free(d->preamble);
+	free(d->filename);
+	free(d->buffer);
+	free(d);
+}
+
+
+/**********************************************************************
+ * Rotation of filename loggers
+ *
+ * A filename logger may rotate its own file once it has grown to a
+ * given size, at wall-clock boundaries, or both. The file being logged
+ * to is always called filename. Rotated files are called filename.1,
+ * filename.2 and so on, newest first, or filename.YYYYMMDD-HHMMSS after
+ * the local time at which they were rotated.
+ *
+ * A rotator thread opens the next file, as filename.next, ahead of
+ * time and writes the preamble, if any, to it. At the boundary the new
+ * file is swapped in with dup2(2) onto the descriptor of the logger, so
+ * the descriptor never changes and a write that races with the switch
+ * goes whole to one file or the other. After the switch the rotator
+ * thread syncs and closes the old file, renames the files, deletes any
+ * that are not to be kept and opens the next file. Nothing is logged
+ * to filename.next other than between a switch and the rename that
+ * follows it.
+ *
+ * Size is counted as lines are written, so a file may end up a few
+ * lines over the limit when several threads log at once.
+ **********************************************************************/
+
+/**********************************************************************
+ * __vanessa_logger_rotate_switch
+ * Internal function to switch a filename logger to the file opened
+ * ahead of time by the rotator thread
+ * pre: d: filename logger data, d->rotate->lock must be held
+ * post: lines written from now on go to the next file and the rotator
+ *       thread is woken to deal with the old one.
+ *       If the next file is not ready yet the switch is left to the
+ *       rotator thread, which makes it as soon as it is.
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_rotate_switch(__vanessa_logger_filename_data_t *d)
+{
+	__vanessa_logger_rotate_t *r = d->rotate;
+	int status = 0;
+
+	if (r->next < 0 || r->old >= 0) {
+		r->pending = 1;
+		pthread_cond_signal(&r->cond);
+		return (0);
+	}
+
+	if (dup2(r->next, d->fd) < 0) {
+		perror("__vanessa_logger_rotate_switch: dup2");
+		status = -1;
+	}
+	else {
+		r->old = r->fd;
+		r->fd = r->next;
+		r->next = -1;
+		__atomic_add_fetch(&d->generation, 1, __ATOMIC_RELEASE);
+	}
+
+	/* After an error try again once the file has grown some more */
+	r->pending = 0;
+	__atomic_store_n(&r->bytes, status ? 0 : d->preamble_len, 
+			__ATOMIC_RELAXED);
+	__atomic_store_n(&r->full, 0, __ATOMIC_RELEASE);
+	pthread_cond_signal(&r->cond);
+
+	return (status);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_rotate_account
+ * Internal function to count bytes written to the file of a filename
+ * logger and switch to the next file when the file is full
+ * pre: d: filename logger data. If d->lock is held it must have been
+ *         taken before d->rotate->lock.
+ *      len: number of bytes written
+ * post: bytes are counted and the file is switched if need be
+ *       Nothing if the logger does not rotate by size
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_rotate_account(__vanessa_logger_filename_data_t *d,
+		size_t len)
+{
+	__vanessa_logger_rotate_t *r;
+	unsigned long long size;
+
+	r = __atomic_load_n(&d->rotate, __ATOMIC_ACQUIRE);
+	if (!r) {
+		return;
+	}
+	size = __atomic_load_n(&r->size, __ATOMIC_RELAXED);
+	if (!size || __atomic_add_fetch(&r->bytes, len, 
+				__ATOMIC_RELAXED) < size) {
+		return;
+	}
+
+	/* Only the writer that fills the file switches it */
+	if (__atomic_exchange_n(&r->full, 1, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	pthread_mutex_lock(&r->lock);
+	__vanessa_logger_rotate_switch(d);
+	pthread_mutex_unlock(&r->lock);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_rotate_now
+ * Internal function to rotate the file of a filename logger now
+ * pre: d: filename logger data, d->rotate is set
+ * post: anything buffered is written to the old file and the logger
+ *       is switched to the next file, or will be as soon as it is ready
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_rotate_now(__vanessa_logger_filename_data_t *d)
+{
+	__vanessa_logger_rotate_t *r = d->rotate;
+	unsigned int generation;
+	int status = 0;
+
+	generation = __atomic_load_n(&d->generation, __ATOMIC_ACQUIRE);
+
+	if (d->flush != VANESSA_LOGGER_FLUSH_LINE) {
+		pthread_mutex_lock(&d->lock);
+		__vanessa_logger_filename_flush_locked(d, NULL, 0);
+	}
+
+	/* Unless writing out the buffer filled the file and switched it */
+	pthread_mutex_lock(&r->lock);
+	if (__atomic_load_n(&d->generation, __ATOMIC_ACQUIRE) == 
+			generation) {
+		status = __vanessa_logger_rotate_switch(d);
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	if (d->flush != VANESSA_LOGGER_FLUSH_LINE) {
+		pthread_mutex_unlock(&d->lock);
+	}
+
+	return (status);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_rotate_prepare
+ * Internal function to open the next file of a filename logger
+ * pre: d: filename logger data, d->rotate is set
+ * post: filename.next is opened and starts with the preamble, if any
+ * return: file descriptor
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_rotate_prepare(__vanessa_logger_filename_data_t *d)
+{
+	struct iovec iov;
+	int fd;
+
+	fd = __vanessa_logger_filename_open(d->rotate->tmp);
+	if (fd < 0) {
+		return (-1);
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	if (d->preamble) {
+		iov.iov_base = d->preamble;
+		iov.iov_len = d->preamble_len;
+		if (__vanessa_logger_fd_write(fd, &iov, 1) < 0) {
+			close(fd);
+			return (-1);
+		}
+	}
+
+	return (fd);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_rotate_is_stamp
+ * Internal function to recognise the suffix of a file rotated using
+ * VANESSA_LOGGER_ROTATE_DATE
+ * pre: s: suffix, after filename.
+ * post: none
+ * return: 1 if s is YYYYMMDD-HHMMSS, optionally followed by -N
+ *         0 otherwise
+ **********************************************************************/
+
+static int
+__vanessa_logger_rotate_is_stamp(const char *s)
+{
+	int i;
+
+	for (i = 0; i < 15; i++) {
+		if (i == 8 ? s[i] != '-' : !isdigit((unsigned char) s[i])) {
+			return (0);
+		}
+	}
+	if (!s[15]) {
+		return (1);
+	}
+	if (s[15] != '-' || !s[16]) {
+		return (0);
+	}
+	for (i = 16; s[i]; i++) {
+		if (i > 24 || !isdigit((unsigned char) s[i])) {
+			return (0);
+		}
+	}
+
+	return (1);
+}
+
+/*
+ * Order the suffixes of rotated files oldest first: by time and then by
+ * the number given to files rotated within the same second, with no
+ * number first and -2 before -10
+ */
+
+static int
+__vanessa_logger_rotate_cmp(const void *a, const void *b)
+{
+	const char *x = *(char * const *) a;
+	const char *y = *(char * const *) b;
+	unsigned long nx;
+	unsigned long ny;
+	int status;
+
+	status = strncmp(x, y, 15);
+	if (status) {
+		return (status);
+	}
+	nx = x[15] ? strtoul(x + 16, NULL, 10) : 0;
+	ny = y[15] ? strtoul(y + 16, NULL, 10) : 0;
+
+	return (nx < ny ? -1 : nx > ny);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_rotate_prune
+ * Internal function to delete the oldest files rotated by a filename
+ * logger using VANESSA_LOGGER_ROTATE_DATE
+ * pre: d: filename logger data, d->rotate is set
+ * post: no more than d->rotate->keep rotated files are left
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_rotate_prune(__vanessa_logger_filename_data_t *d)
+{
+	__vanessa_logger_rotate_t *r = d->rotate;
+	const char *base;
+	char *dir;
+	char **stamp = NULL;
+	char **tmp;
+	size_t n = 0;
+	size_t max = 0;
+	size_t base_len;
+	size_t i;
+	DIR *dh;
+	struct dirent *de;
+
+	base = strrchr(d->filename, '/');
+	if (!base) {
+		dir = strdup(".");
+		base = d->filename;
+	}
+	else {
+		dir = strndup(d->filename, base == d->filename ? 1 :
+				(size_t) (base - d->filename));
+		base++;
+	}
+	if (!dir) {
+		perror("__vanessa_logger_rotate_prune: strdup");
+		return;
+	}
+	base_len = strlen(base);
+
+	dh = opendir(dir);
+	if (!dh) {
+		perror("__vanessa_logger_rotate_prune: opendir");
+		free(dir);
+		return;
+	}
+	while ((de = readdir(dh))) {
+		if (strncmp(de->d_name, base, base_len) || 
+				de->d_name[base_len] != '.' ||
+				!__vanessa_logger_rotate_is_stamp(
+					de->d_name + base_len + 1)) {
+			continue;
+		}
+		if (n == max) {
+			max = max ? max * 2 : 16;
+			tmp = (char **) realloc(stamp, max * sizeof(*stamp));
+			if (!tmp) {
+				perror("__vanessa_logger_rotate_prune: "
+						"realloc");
+				break;
+			}
+			stamp = tmp;
+		}
+		stamp[n] = strdup(de->d_name + base_len + 1);
+		if (!stamp[n]) {
+			perror("__vanessa_logger_rotate_prune: strdup");
+			break;
+		}
+		n++;
+	}
+	closedir(dh);
+	free(dir);
+
+	qsort(stamp, n, sizeof(*stamp), __vanessa_logger_rotate_cmp);
+	for (i = 0; i < n; i++) {
+		if (i + r->keep < n) {
+			sprintf(r->name, "%s.%s", d->filename, stamp[i]);
+			if (unlink(r->name) < 0 && errno != ENOENT) {
+				perror("__vanessa_logger_rotate_prune: "
+						"unlink");
+			}
+		}
+		free(stamp[i]);
+	}
+	free(stamp);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_rotate_archive
+ * Internal function to rename the files of a filename logger after
+ * it has switched to the next file
+ * pre: d: filename logger data, d->rotate is set
+ * post: the old file is given its rotated name, filename.next is
+ *       renamed filename and files that are not to be kept are deleted
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_rotate_archive(__vanessa_logger_filename_data_t *d)
+{
+	__vanessa_logger_rotate_t *r = d->rotate;
+	char *from = r->name;
+	char *to = r->name + strlen(d->filename) + 32;
+	char stamp[32];
+	struct tm tm;
+	time_t now;
+	unsigned int i;
+
+	if (r->naming == VANESSA_LOGGER_ROTATE_NUMBER) {
+		/* Make room for filename.1 */
+		if (r->keep) {
+			i = r->keep;
+			sprintf(to, "%s.%u", d->filename, i);
+			unlink(to);
+		}
+		else {
+			for (i = 1; ; i++) {
+				sprintf(to, "%s.%u", d->filename, i);
+				if (access(to, F_OK) < 0) {
+					break;
+				}
+			}
+		}
+		for (; i > 1; i--) {
+			sprintf(from, "%s.%u", d->filename, i - 1);
+			sprintf(to, "%s.%u", d->filename, i);
+			if (rename(from, to) < 0 && errno != ENOENT) {
+				perror("__vanessa_logger_rotate_archive: "
+						"rename");
+			}
+		}
+		sprintf(to, "%s.1", d->filename);
+	}
+	else {
+		now = time(NULL);
+		localtime_r(&now, &tm);
+		strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+		sprintf(to, "%s.%s", d->filename, stamp);
+	}
+
+	/*
+	 * Linking rather than renaming means that there is always a file
+	 * called filename. Files rotated within the same second are told
+	 * apart by a suffix.
+	 */
+	for (i = 1; link(d->filename, to) < 0; i++) {
+		if (errno != EEXIST || r->naming == 
+				VANESSA_LOGGER_ROTATE_NUMBER || i > 1000) {
+			if (rename(d->filename, to) < 0) {
+				perror("__vanessa_logger_rotate_archive: "
+						"rename");
+			}
+			break;
+		}
+		sprintf(to, "%s.%s-%u", d->filename, stamp, i);
+	}
+
+	if (rename(r->tmp, d->filename) < 0) {
+		perror("__vanessa_logger_rotate_archive: rename");
+	}
+
+	if (r->naming == VANESSA_LOGGER_ROTATE_DATE && r->keep) {
+		__vanessa_logger_rotate_prune(d);
+	}
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_rotate_retire
+ * Internal function used by the rotator thread to finish with the
+ * file that a filename logger has switched away from
+ * pre: d: filename logger data, d->rotate is set
+ *      old: descriptor of the old file
+ * post: if group commit is in use both files are synced, so that no
+ *       caller is told that its line is on disk before it is. The old
+ *       file is closed and the files are renamed.
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_rotate_retire(__vanessa_logger_filename_data_t *d, int old)
+{
+	unsigned long target;
+	int status;
+
+	pthread_mutex_lock(&d->sync_lock);
+	while (d->syncing) {
+		pthread_cond_wait(&d->sync_cond, &d->sync_lock);
+	}
+	if (d->sync_priority != VANESSA_LOGGER_SYNC_NONE) {
+		d->syncing = 1;
+		target = d->requested;
+		pthread_mutex_unlock(&d->sync_lock);
+
+		status = fdatasync(old) < 0 || fdatasync(d->fd) < 0;
+
+		pthread_mutex_lock(&d->sync_lock);
+		d->stats.syncs++;
+		if (status) {
+			d->stats.sync_errors++;
+		}
+		d->synced = target;
+		d->syncing = 0;
+		pthread_cond_broadcast(&d->sync_cond);
+	}
+	pthread_mutex_unlock(&d->sync_lock);
+
+	if (close(old) < 0) {
+		perror("__vanessa_logger_rotate_retire: close");
+	}
+
+	__vanessa_logger_rotate_archive(d);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_rotate_deadline
+ * Internal function to find the next wall-clock boundary
+ * pre: now: current time
+ *      interval: seconds between boundaries, counted from midnight
+ *                local time
+ * post: none
+ * return: time of next boundary
+ **********************************************************************/
+
+static time_t
+__vanessa_logger_rotate_deadline(time_t now, unsigned long interval)
+{
+	struct tm tm;
+	long offset;
+
+	localtime_r(&now, &tm);
+	offset = __vanessa_logger_gmtoff(now, &tm);
+
+	return (((now + offset) / (time_t) interval + 1) * 
+			(time_t) interval - offset);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_rotator
+ * Internal function run by the rotator thread of a filename logger.
+ * Keeps the next file open ahead of time, rotates at wall-clock
+ * boundaries and finishes with old files after a switch.
+ * pre: data: filename logger data typecast to (void *)
+ * post: files are rotated as needed until d->rotate->stop is set
+ * return: NULL
+ **********************************************************************/
+
+static void *
+__vanessa_logger_rotator(void *data)
+{
+	__vanessa_logger_filename_data_t *d =
+		(__vanessa_logger_filename_data_t *) data;
+	__vanessa_logger_rotate_t *r = d->rotate;
+	struct timespec wake;
+	time_t now;
+	int active;
+	int old;
+	int fd;
+
+	pthread_mutex_lock(&r->lock);
+	while (!r->stop) {
+		if (r->old >= 0) {
+			/* r->old stays set so that there is no switch */
+			old = r->old;
+			pthread_mutex_unlock(&r->lock);
+			__vanessa_logger_rotate_retire(d, old);
+			pthread_mutex_lock(&r->lock);
+			r->old = -1;
+			continue;
+		}
+
+		now = time(NULL);
+		active = r->size || r->interval;
+		if (active && r->next < 0 && now >= r->retry) {
+			pthread_mutex_unlock(&r->lock);
+			fd = __vanessa_logger_rotate_prepare(d);
+			if (fd < 0) {
+				perror("__vanessa_logger_rotator: "
+						"__vanessa_logger_rotate_prepare");
+			}
+			pthread_mutex_lock(&r->lock);
+			if (fd < 0) {
+				r->retry = now + 1;
+			}
+			r->next = fd;
+			continue;
+		}
+
+		if ((r->pending && r->next >= 0) || 
+				(r->interval && now >= r->deadline)) {
+			if (r->interval && now >= r->deadline) {
+				r->deadline = __vanessa_logger_rotate_deadline(
+						now, r->interval);
+			}
+			pthread_mutex_unlock(&r->lock);
+			__vanessa_logger_rotate_now(d);
+			pthread_mutex_lock(&r->lock);
+			continue;
+		}
+
+		wake.tv_sec = 0;
+		wake.tv_nsec = 0;
+		if (active && r->next < 0) {
+			wake.tv_sec = r->retry;
+		}
+		if (r->interval && (!wake.tv_sec || 
+					r->deadline < wake.tv_sec)) {
+			wake.tv_sec = r->deadline;
+		}
+		if (wake.tv_sec) {
+			pthread_cond_timedwait(&r->cond, &r->lock, &wake);
+		}
+		else {
+			pthread_cond_wait(&r->cond, &r->lock);
+		}
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	return (NULL);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_rotate_discard
+ * Internal function to close the next file of a filename logger,
+ * which has not been switched to, and remove it unless it held lines
+ * from before the logger was opened.
+ * pre: d: filename logger data, d->rotate is set
+ * post: the next file is closed
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_rotate_discard(__vanessa_logger_filename_data_t *d)
+{
+	__vanessa_logger_rotate_t *r = d->rotate;
+	struct stat st;
+
+	if (r->next < 0) {
+		return;
+	}
+
+	if (!fstat(r->next, &st) && (size_t) st.st_size <= d->preamble_len) {
+		unlink(r->tmp);
+	}
+	close(r->next);
+	r->next = -1;
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_rotate_child
+ * Internal function to turn off rotation in a child after fork(2),
+ * leaving the parent to rotate the files
+ * pre: r: rotation data
+ * post: rotation is off and the rotator thread can be started again
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_rotate_child(__vanessa_logger_rotate_t *r)
+{
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	r->running = 0;
+	r->size = 0;
+	r->interval = 0;
+	r->pending = 0;
+	r->full = 0;
+	if (r->fd >= 0) {
+		close(r->fd);
+		r->fd = -1;
+	}
+	if (r->next >= 0) {
+		close(r->next);
+		r->next = -1;
+	}
+	if (r->old >= 0) {
+		close(r->old);
+		r->old = -1;
+	}
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_rotate_create
+ * Internal function to allocate the rotation data of a filename logger
+ * pre: d: filename logger data
+ * post: rotation data is allocated, rotation is off
+ * return: rotation data
+ *         NULL on error
+ **********************************************************************/
+
+static __vanessa_logger_rotate_t *
+__vanessa_logger_rotate_create(__vanessa_logger_filename_data_t *d)
+{
+	__vanessa_logger_rotate_t *r;
+	size_t len;
+
+	r = (__vanessa_logger_rotate_t *)
+		calloc(1, sizeof(__vanessa_logger_rotate_t));
+	if (!r) {
+		perror("__vanessa_logger_rotate_create: calloc");
+		return (NULL);
+	}
+	r->fd = -1;
+	r->next = -1;
+	r->old = -1;
+
+	len = strlen(d->filename);
+	r->tmp = (char *) malloc(len + sizeof(".next"));
+	r->name = (char *) malloc(2 * (len + 32));
+	if (!r->tmp || !r->name) {
+		perror("__vanessa_logger_rotate_create: malloc");
+		free(r->tmp);
+		free(r->name);
+		free(r);
+		return (NULL);
+	}
+	sprintf(r->tmp, "%s.next", d->filename);
+
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+
+	return (r);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_rotate_destroy
+ * Internal function to stop the rotator thread of a filename logger
+ * and free its rotation data
+ * pre: d: filename logger data
+ * post: a switch that has been made is seen through, the next file
+ *       is discarded and memory is freed
+ *       Nothing if the logger has no rotation data
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_rotate_destroy(__vanessa_logger_filename_data_t *d)
+{
+	__vanessa_logger_rotate_t *r = d->rotate;
+
+	if (!r) {
+		return;
+	}
+
+	pthread_mutex_lock(&r->lock);
+	r->stop = 1;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+	if (r->running) {
+		pthread_join(r->thread, NULL);
+	}
+
+	if (r->old >= 0) {
+		__vanessa_logger_rotate_retire(d, r->old);
+	}
+	__vanessa_logger_rotate_discard(d);
+	if (r->fd >= 0) {
+		close(r->fd);
+	}
+
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->cond);
+	free(r->tmp);
+	free(r->name);
+	free(r);
+	d->rotate = NULL;
+}
+
+
+/**********************************************************************
+ * Memory mapped segment loggers
+ *
+ * A memory mapped logger writes to a series of fixed size segment
+ * files, named filename.00000000, filename.00000001 and so on. Each
+ * segment is preallocated with posix_fallocate(3) and mapped shared,
+ * so logging a line is a memcpy(3) into the page cache with no system
+ * call.
+ *
+ * A segment starts with a small header that holds the offset of the
+ * next free byte, which writers advance atomically to reserve space.
+ * It is kept in the mapping rather than in the logger so that it is
+ * shared with forked children. Each record is the length of the line,
+ * a CRC-32C of the length and the line, and the line itself, padded to
+ * a multiple of 8 bytes. The checksum is stored last, so a record that
+ * was torn by a crash does not verify. When a segment is opened again
+ * it is scanned, everything after the last valid record is zeroed and
+ * logging carries on from there.
+ *
+ * Each process that has a segment open holds a shared flock(2) on it,
+ * which forked children inherit along with the file descriptor. A
+ * segment is only set up or recovered by an opener that can take the
+ * lock exclusively, that is when no live writer owns it. Otherwise,
+ * say when a parent and child that were forked both move on to the same
+ * segment, the second opener appends to the records of the first.
+ *
+ * When a segment fills up the writer that notices takes
+ * d->lock, maps the next segment and publishes it. It then waits for
+ * writers still copying into the old segment before unmapping it. Two
+ * segment structures are used in turn so that a writer that picked up
+ * the old one just before the switch still refers to valid memory.
+ **********************************************************************/
+
+static const char __vanessa_logger_segment_magic[8] = "VLSEG001";
+
+static uint32_t __vanessa_logger_crc32c_table[256];
+static pthread_once_t __vanessa_logger_crc32c_once = PTHREAD_ONCE_INIT;
+
+static void
+__vanessa_logger_crc32c_init(void)
+{
+	uint32_t crc;
+	int i;
+	int j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++) {
+			crc = (crc >> 1) ^ (crc & 1 ? 0x82f63b78 : 0);
+		}
+		__vanessa_logger_crc32c_table[i] = crc;
+	}
+}
+
+static uint32_t
+__vanessa_logger_crc32c(uint32_t crc, const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *) data;
+
+	crc = ~crc;
+	while (len--) {
+		crc = __vanessa_logger_crc32c_table[(crc ^ *p++) & 0xff] ^
+			(crc >> 8);
+	}
+	return (~crc);
+}
+
+#define __VANESSA_LOGGER_RECORD_LEN(len) \
+	((sizeof(__vanessa_logger_record_t) + (len) + 7) & ~(size_t)7)
+
+
+/**********************************************************************
+ * __vanessa_logger_segment_scan
+ * Internal function to find the valid records in a segment.
+ * Records that do not verify are skipped as long as their length
+ * is plausible. A length of zero or one that runs past the end of the
+ * segment is space that was reserved but never written, perhaps by a
+ * writer that died, and the scan steps over it 8 bytes at a time.
+ * pre: map: mapping of segment
+ *      size: size of segment
+ *      fh: if not NULL the lines of valid records are written here
+ *      records: if not NULL the number of valid records is written here
+ * post: none
+ * return: offset of the end of the last valid record
+ **********************************************************************/
+
+static size_t
+__vanessa_logger_segment_scan(const char *map, size_t size, FILE *fh,
+		unsigned long *records)
+{
+	const __vanessa_logger_record_t *rec;
+	size_t offset = sizeof(__vanessa_logger_segment_hdr_t);
+	size_t end = offset;
+	unsigned long count = 0;
+	uint32_t len;
+
+	while (offset + sizeof(*rec) <= size) {
+		rec = (const __vanessa_logger_record_t *) (map + offset);
+		len = rec->len;
+		if (!len || len > size - offset - sizeof(*rec)) {
+			offset += 8;
+			continue;
+		}
+		if (__vanessa_logger_crc32c(__vanessa_logger_crc32c(0, 
+				&len, sizeof(len)), rec + 1, len) == 
+				rec->crc) {
+			if (fh) {
+				fwrite(rec + 1, len, 1, fh);
+			}
+			count++;
+			end = offset + __VANESSA_LOGGER_RECORD_LEN(len);
+		}
+		offset += __VANESSA_LOGGER_RECORD_LEN(len);
+	}
+
+	if (records) {
+		*records = count;
+	}
+	return (end);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_segment_open
+ * Internal function to open and map a segment of a memory mapped
+ * logger, creating and preallocating it if need be. An existing
+ * segment that no live writer owns is recovered: anything after its
+ * last valid record is zeroed and new records are appended after it.
+ * pre: d: memory mapped logger data
+ *      s: segment structure to fill in, must not be in use
+ *      index: number of the segment
+ * post: segment is mapped and a shared lock is held on it
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_segment_open(__vanessa_logger_mmap_data_t *d,
+		__vanessa_logger_segment_t *s, unsigned long index)
+{
+	__vanessa_logger_segment_hdr_t *hdr;
+	struct stat st;
+	char *name;
+	size_t end;
+	size_t offset;
+	int status;
+	int owner = 1;
+
+	name = (char *) malloc(strlen(d->filename) + 16);
+	if (!name) {
+		perror("__vanessa_logger_segment_open: malloc");
+		return (-1);
+	}
+	sprintf(name, "%s.%08lu", d->filename, index);
+
+	s->fd = open(name, O_RDWR | O_CREAT, 0666);
+	if (s->fd < 0) {
+		perror("__vanessa_logger_segment_open: open");
+		free(name);
+		return (-1);
+	}
+	free(name);
+
+	/*
+	 * If someone else has the segment open they own it, wait for
+	 * them to finish setting it up and leave it as it is
+	 */
+	while ((status = flock(s->fd, LOCK_EX | LOCK_NB)) < 0 && 
+			errno == EINTR)
+		;
+	if (status < 0 && errno == EWOULDBLOCK) {
+		owner = 0;
+		while ((status = flock(s->fd, LOCK_SH)) < 0 && 
+				errno == EINTR)
+			;
+	}
+	if (status < 0) {
+		perror("__vanessa_logger_segment_open: flock");
+		goto err;
+	}
+
+	if (fstat(s->fd, &st) < 0) {
+		perror("__vanessa_logger_segment_open: fstat");
+		goto err;
+	}
+	s->size = d->size;
+	if ((size_t) st.st_size > s->size || !owner) {
+		s->size = st.st_size;
+	}
+	else if ((size_t) st.st_size < s->size) {
+		status = posix_fallocate(s->fd, 0, s->size);
+		if (status == EINVAL || status == EOPNOTSUPP) {
+			/* Not supported by the filesystem, grow it sparse */
+			status = ftruncate(s->fd, s->size) < 0 ? errno : 0;
+		}
+		if (status) {
+			errno = status;
+			perror("__vanessa_logger_segment_open: "
+					"posix_fallocate");
+			goto err;
+		}
+	}
+
+	s->map = (char *) mmap(NULL, s->size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, s->fd, 0);
+	if (s->map == MAP_FAILED) {
+		perror("__vanessa_logger_segment_open: mmap");
+		goto err;
+	}
+
+	hdr = (__vanessa_logger_segment_hdr_t *) s->map;
+	if (!st.st_size) {
+		memcpy(hdr->magic, __vanessa_logger_segment_magic,
+				sizeof(hdr->magic));
+		hdr->offset = sizeof(*hdr);
+	}
+	else if (memcmp(hdr->magic, __vanessa_logger_segment_magic,
+				sizeof(hdr->magic))) {
+		fprintf(stderr, "__vanessa_logger_segment_open: "
+				"%s.%08lu is not a segment\n", d->filename, 
+				index);
+		munmap(s->map, s->size);
+		goto err;
+	}
+	else if (owner) {
+		/* Zero any torn records after the last valid one */
+		end = __vanessa_logger_segment_scan(s->map, s->size, NULL,
+				NULL);
+		offset = hdr->offset < s->size ? hdr->offset : s->size;
+		if (offset > end) {
+			memset(s->map + end, 0, offset - end);
+		}
+		hdr->offset = end;
+	}
+
+	/* Downgrading does not block, so no other opener can slip in */
+	if (owner && flock(s->fd, LOCK_SH) < 0) {
+		perror("__vanessa_logger_segment_open: flock");
+		munmap(s->map, s->size);
+		goto err;
+	}
+
+	s->index = index;
+	return (0);
+
+err:
+	close(s->fd);
+	s->fd = -1;
+	return (-1);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_segment_close
+ * Internal function to unmap and close a segment of a memory mapped
+ * logger. The segment keeps its preallocated size.
+ * pre: s: segment, no writers may be using it
+ * post: segment is unmapped and closed
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_segment_close(__vanessa_logger_segment_t *s)
+{
+	if (s->fd < 0) {
+		return;
+	}
+	if (munmap(s->map, s->size) < 0) {
+		perror("__vanessa_logger_segment_close: munmap");
+	}
+	if (close(s->fd) < 0) {
+		perror("__vanessa_logger_segment_close: close");
+	}
+	s->map = NULL;
+	s->fd = -1;
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_segment_last
+ * Internal function to find the highest numbered segment of a memory
+ * mapped logger that already exists
+ * pre: filename: filename of logger, segments are filename.NNNNNNNN
+ * post: none
+ * return: number of the highest numbered segment, 0 if there are none
+ **********************************************************************/
+
+static unsigned long
+__vanessa_logger_segment_last(const char *filename)
+{
+	DIR *dir;
+	struct dirent *ent;
+	const char *base;
+	char *dirname;
+	char *end;
+	size_t len;
+	unsigned long index;
+	unsigned long last = 0;
+
+	base = strrchr(filename, '/');
+	if (base) {
+		dirname = strndup(filename, base - filename + 1);
+		base++;
+	}
+	else {
+		dirname = strdup(".");
+		base = filename;
+	}
+	if (!dirname) {
+		return (0);
+	}
+	len = strlen(base);
+
+	dir = opendir(dirname);
+	free(dirname);
+	if (!dir) {
+		return (0);
+	}
+	while ((ent = readdir(dir))) {
+		if (strncmp(ent->d_name, base, len) || 
+				ent->d_name[len] != '.' ||
+				!isdigit((unsigned char) ent->d_name[len + 1])) {
+			continue;
+		}
+		index = strtoul(ent->d_name + len + 1, &end, 10);
+		if (!*end && index > last) {
+			last = index;
+		}
+	}
+	closedir(dir);
+
+	return (last);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_mmap_roll
+ * Internal function to move a memory mapped logger on to its next
+ * segment
+ * pre: d: memory mapped logger data
+ *      old: segment the caller found to be full, if it is no longer
+ *           the current segment someone else has already moved on.
+ *           If NULL the logger moves on regardless.
+ * post: d->current is a segment with space in it
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_mmap_roll(__vanessa_logger_mmap_data_t *d,
+		__vanessa_logger_segment_t *old)
+{
+	__vanessa_logger_segment_t *next;
+
+	pthread_mutex_lock(&d->lock);
+
+	if (old && old != d->current) {
+		pthread_mutex_unlock(&d->lock);
+		return (0);
+	}
+	old = d->current;
+	next = old == d->seg ? d->seg + 1 : d->seg;
+
+	if (__vanessa_logger_segment_open(d, next, old->index + 1) < 0) {
+		pthread_mutex_unlock(&d->lock);
+		return (-1);
+	}
+	__atomic_store_n(&d->current, next, __ATOMIC_SEQ_CST);
+
+	while (__atomic_load_n(&old->writers, __ATOMIC_SEQ_CST)) {
+		sched_yield();
+	}
+	__vanessa_logger_segment_close(old);
+
+	pthread_mutex_unlock(&d->lock);
+	return (0);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_mmap_write
+ * Internal function to append a line to a memory mapped logger
+ * pre: d: memory mapped logger data
+ *      line: line to write
+ *      len: length of line
+ * post: line is copied into the current segment as a record.
+ *       A line too long to fit in an empty segment is truncated.
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_mmap_write(__vanessa_logger_mmap_data_t *d,
+		const char *line, size_t len)
+{
+	__vanessa_logger_segment_t *s;
+	__vanessa_logger_segment_hdr_t *hdr;
+	__vanessa_logger_record_t *rec;
+	uint64_t offset;
+	size_t need;
+	uint32_t len32;
+	char *data;
+
+	if (len > d->size - sizeof(*hdr) - sizeof(*rec) - 8) {
+		len = d->size - sizeof(*hdr) - sizeof(*rec) - 8;
+	}
+	need = __VANESSA_LOGGER_RECORD_LEN(len);
+
+	while (1) {
+		s = __atomic_load_n(&d->current, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&s->writers, 1, __ATOMIC_SEQ_CST);
+		if (s != __atomic_load_n(&d->current, __ATOMIC_SEQ_CST)) {
+			__atomic_sub_fetch(&s->writers, 1, __ATOMIC_SEQ_CST);
+			continue;
+		}
+
+		hdr = (__vanessa_logger_segment_hdr_t *) s->map;
+		offset = __atomic_fetch_add(&hdr->offset, need, 
+				__ATOMIC_RELAXED);
+		if (offset + need <= s->size) {
+			break;
+		}
+
+		__atomic_sub_fetch(&s->writers, 1, __ATOMIC_SEQ_CST);
+		if (__vanessa_logger_mmap_roll(d, s) < 0) {
+			return (-1);
+		}
+	}
+
+	rec = (__vanessa_logger_record_t *) (s->map + offset);
+	data = (char *) (rec + 1);
+	len32 = len;
+	rec->len = len32;
+	memcpy(data, line, len);
+	if (len && data[len - 1] != '\n') {
+		data[len - 1] = '\n';
+	}
+	__atomic_store_n(&rec->crc, __vanessa_logger_crc32c(
+				__vanessa_logger_crc32c(0, &len32, 
+					sizeof(len32)), data, len), 
+			__ATOMIC_RELEASE);
+
+	__atomic_sub_fetch(&s->writers, 1, __ATOMIC_RELEASE);
+	return (0);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_mmap_create
+ * Internal function to set up the data of a memory mapped logger
+ * and map its newest segment
+ * pre: opt: filename and segment size
+ * post: data is allocated and current segment is mapped
+ * return: memory mapped logger data
+ *         NULL on error
+ **********************************************************************/
+
+static __vanessa_logger_mmap_data_t *
+__vanessa_logger_mmap_create(const __vanessa_logger_mmap_opt_t *opt)
+{
+	__vanessa_logger_mmap_data_t *d;
+	long page;
+
+	pthread_once(&__vanessa_logger_crc32c_once, 
+			__vanessa_logger_crc32c_init);
+
+	d = (__vanessa_logger_mmap_data_t *)
+		calloc(1, sizeof(__vanessa_logger_mmap_data_t));
+	if (!d) {
+		perror("__vanessa_logger_mmap_create: calloc");
+		return (NULL);
+	}
+	d->seg[0].fd = -1;
+	d->seg[1].fd = -1;
+
+	/* Segments are a whole number of pages */
+	page = sysconf(_SC_PAGESIZE);
+	if (page <= 0) {
+		page = 4096;
+	}
+	d->size = opt->segment_size ? opt->segment_size :
+		VANESSA_LOGGER_MMAP_SEGMENT_SIZE;
+	d->size = (d->size + page - 1) & ~((size_t) page - 1);
+
+	d->filename = strdup(opt->filename);
+	if (!d->filename) {
+		perror("__vanessa_logger_mmap_create: strdup");
+		free(d);
+		return (NULL);
+	}
+
+	if (__vanessa_logger_segment_open(d, d->seg,
+			__vanessa_logger_segment_last(d->filename)) < 0) {
+		fprintf(stderr, "__vanessa_logger_mmap_create: "
+				"__vanessa_logger_segment_open\n");
+		free(d->filename);
+		free(d);
+		return (NULL);
+	}
+	d->current = d->seg;
+
+	pthread_mutex_init(&d->lock, NULL);
+
+	return (d);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_mmap_destroy
+ * Internal function to unmap the current segment of a memory mapped
+ * logger and free its data
+ * pre: d: memory mapped logger data
+ * post: segment is unmapped and memory is freed
+ *       Nothing if d is NULL
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_mmap_destroy(__vanessa_logger_mmap_data_t *d)
+{
+	if (!d) {
+		return;
+	}
+
+	__vanessa_logger_segment_close(d->seg);
+	__vanessa_logger_segment_close(d->seg + 1);
+	pthread_mutex_destroy(&d->lock);
+	free(d->filename);
+	free(d);
+}
+
+
+/**********************************************************************
+ * Syslog loggers
+ *
+ * A syslog logger has its own AF_UNIX socket connected to the syslog
+ * daemon and frames each message itself, as per RFC 3164 or RFC 5424,
+ * rather than going through openlog(3) and syslog(3), whose state and
+ * lock are shared by the whole process.
+ *
+ * The file descriptor of the socket never changes, so it is used
+ * without a lock. If sending fails the socket is connected again, under
+ * d->lock: a datagram socket is simply connected again, a stream socket,
+ * used if the daemon only accepts streams, is replaced with dup2(2).
+ * Messages sent over a stream are terminated by a NUL, as syslog(3) does.
+ *
+ * The writer thread of an asynchronous logger sends each batch it takes
+ * from the ring with a single sendmmsg(2) where it is available.
+ **********************************************************************/
+
+#ifndef _PATH_LOG
+#define _PATH_LOG "/dev/log"
+#endif
+
+#define __VANESSA_LOGGER_SYSLOG_APP_NAME_LEN 48
+
+
+/**********************************************************************
+ * __vanessa_logger_syslog_connect
+ * Internal function to connect the socket of a syslog logger to the
+ * syslog daemon
+ * pre: d: syslog logger data, d->lock must be held
+ * post: d->fd is connected, as a stream socket if the daemon does not
+ *       accept datagrams
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_syslog_connect(__vanessa_logger_syslog_data_t *d)
+{
+	int stream = d->stream;
+	int fd;
+	int i;
+
+	for (i = 0; i < 2; i++, stream = !stream) {
+		/* A datagram socket can simply be connected again */
+		if (!stream && !d->stream) {
+			if (!connect(d->fd, (struct sockaddr *) &d->addr,
+						d->addr_len)) {
+				return (0);
+			}
+			if (errno != EPROTOTYPE) {
+				return (-1);
+			}
+			continue;
+		}
+
+		fd = socket(AF_UNIX, stream ? SOCK_STREAM : SOCK_DGRAM, 0);
+		if (fd < 0) {
+			return (-1);
+		}
+		if (!connect(fd, (struct sockaddr *) &d->addr, d->addr_len)) {
+			if (dup2(fd, d->fd) < 0) {
+				close(fd);
+				return (-1);
+			}
+			close(fd);
+			fcntl(d->fd, F_SETFD, FD_CLOEXEC);
+			__atomic_store_n(&d->stream, stream, __ATOMIC_RELEASE);
+			return (0);
+		}
+		close(fd);
+		if (errno != EPROTOTYPE) {
+			return (-1);
+		}
+	}
+
+	return (-1);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_syslog_xmit
+ * Internal function to make one attempt at sending messages to the
+ * syslog daemon
+ * pre: d: syslog logger data
+ *      iov: messages to send, one element each, each followed by a NUL
+ *      n: number of messages, no more than __VANESSA_LOGGER_ASYNC_BATCH
+ * post: some or all of the messages are sent
+ * return: number of messages sent
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_syslog_xmit(__vanessa_logger_syslog_data_t *d,
+		struct iovec *iov, int n)
+{
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msg[__VANESSA_LOGGER_ASYNC_BATCH];
+#endif
+	struct iovec tmp[__VANESSA_LOGGER_ASYNC_BATCH];
+	struct msghdr hdr;
+	ssize_t bytes;
+	int i;
+
+	if (__atomic_load_n(&d->stream, __ATOMIC_ACQUIRE)) {
+		for (i = 0; i < n; i++) {
+			tmp[i].iov_base = iov[i].iov_base;
+			tmp[i].iov_len = iov[i].iov_len + 1;
+		}
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_iov = tmp;
+		hdr.msg_iovlen = n;
+		while (hdr.msg_iovlen > 0) {
+			bytes = sendmsg(d->fd, &hdr, MSG_NOSIGNAL);
+			if (bytes < 0) {
+				return (-1);
+			}
+			while (hdr.msg_iovlen > 0 &&
+					(size_t)bytes >= hdr.msg_iov->iov_len) {
+				bytes -= hdr.msg_iov->iov_len;
+				hdr.msg_iov++;
+				hdr.msg_iovlen--;
+			}
+			if (hdr.msg_iovlen > 0) {
+				hdr.msg_iov->iov_base =
+					(char *)hdr.msg_iov->iov_base + bytes;
+				hdr.msg_iov->iov_len -= bytes;
+			}
+		}
+		return (n);
+	}
+
+#ifdef HAVE_SENDMMSG
+	if (n > 1) {
+		memset(msg, 0, n * sizeof(*msg));
+		for (i = 0; i < n; i++) {
+			msg[i].msg_hdr.msg_iov = iov + i;
+			msg[i].msg_hdr.msg_iovlen = 1;
+		}
+		return (sendmmsg(d->fd, msg, n, MSG_NOSIGNAL));
+	}
+#endif
+
+	if (send(d->fd, iov->iov_base, iov->iov_len, MSG_NOSIGNAL) < 0) {
+		return (-1);
+	}
+	return (1);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_syslog_send
+ * Internal function to send messages to the syslog daemon. If sending
+ * fails the socket is connected again and the rest are sent once more.
+ * pre: d: syslog logger data
+ *      iov: messages to send, one element each, each followed by a NUL
+ *      n: number of messages, no more than __VANESSA_LOGGER_ASYNC_BATCH
+ * post: messages are sent
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_syslog_send(__vanessa_logger_syslog_data_t *d,
+		struct iovec *iov, int n)
+{
+	int retried = 0;
+	int status;
+	int sent;
+
+	while (n > 0) {
+		sent = __vanessa_logger_syslog_xmit(d, iov, n);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (retried++) {
+				return (-1);
+			}
+			pthread_mutex_lock(&d->lock);
+			status = __vanessa_logger_syslog_connect(d);
+			pthread_mutex_unlock(&d->lock);
+			if (status < 0) {
+				return (-1);
+			}
+			continue;
+		}
+		iov += sent;
+		n -= sent;
+	}
+
+	return (0);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_syslog_stderr
+ * Internal function to write syslog messages to stderr, for
+ * VANESSA_LOGGER_F_CONS and VANESSA_LOGGER_F_PERROR. The "<PRI>" that
+ * starts each one is left out and a '\n' is added.
+ * pre: iov: messages to write, one element each
+ *      n: number of messages
+ * post: messages are written to stderr
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_syslog_stderr(const struct iovec *iov, int n)
+{
+	const char *line;
+	const char *end;
+	int i;
+
+	flockfile(stderr);
+	for (i = 0; i < n; i++) {
+		line = (const char *) iov[i].iov_base;
+		end = memchr(line, '>', iov[i].iov_len);
+		end = end ? end + 1 : line;
+		fwrite(end, iov[i].iov_len - (end - line), 1, stderr);
+		fputc('\n', stderr);
+	}
+	fflush(stderr);
+	funlockfile(stderr);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_syslog_reopen
+ * Internal function to connect the socket of a syslog logger to the
+ * syslog daemon again, for instance after the daemon has restarted
+ * pre: d: syslog logger data
+ * post: socket is connected again
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_syslog_reopen(__vanessa_logger_syslog_data_t *d)
+{
+	int status;
+
+	pthread_mutex_lock(&d->lock);
+	status = __vanessa_logger_syslog_connect(d);
+	pthread_mutex_unlock(&d->lock);
+
+	return (status);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_syslog_create
+ * Internal function to set up the data of a syslog logger and
+ * connect it to the syslog daemon
+ * pre: vl: logger the data belongs to, with ident and flag set
+ *      opt: path of socket, facility and flags
+ * post: data is allocated and socket is created. It is connected
+ *       if the syslog daemon is listening.
+ * return: syslog logger data
+ *         NULL on error
+ **********************************************************************/
+
+static __vanessa_logger_syslog_data_t *
+__vanessa_logger_syslog_create(__vanessa_logger_t * vl,
+		const __vanessa_logger_syslog_opt_t *opt)
+{
+	__vanessa_logger_syslog_data_t *d;
+	char host[256];
+	const char *path;
+	const char *app;
+	size_t len;
+	size_t i;
+
+	path = opt->path ? opt->path : _PATH_LOG;
+	if (strlen(path) >= sizeof(d->addr.sun_path)) {
+		fprintf(stderr, "__vanessa_logger_syslog_create: "
+				"%s: path too long\n", path);
+		return (NULL);
+	}
+
+	d = (__vanessa_logger_syslog_data_t *)
+		calloc(1, sizeof(__vanessa_logger_syslog_data_t));
+	if (!d) {
+		perror("__vanessa_logger_syslog_create: calloc");
+		return (NULL);
+	}
+	d->facility = opt->facility & LOG_FACMASK;
+	d->addr.sun_family = AF_UNIX;
+	strcpy(d->addr.sun_path, path);
+	d->addr_len = offsetof(struct sockaddr_un, sun_path) +
+		strlen(path) + 1;
+	d->ident_len = strlen(vl->ident);
+
+	/* RFC 3164 has local time to the second, RFC 5424 RFC 3339 */
+	d->ts_flag = vl->flag & (VANESSA_LOGGER_F_TIMESTAMP_UTC |
+			VANESSA_LOGGER_F_TIMESTAMP_COARSE);
+	if (vl->flag & VANESSA_LOGGER_F_RFC5424) {
+		d->ts_flag |= VANESSA_LOGGER_F_TIMESTAMP_RFC3339 |
+			VANESSA_LOGGER_F_TIMESTAMP_USEC;
+
+		/* "HOSTNAME APP-NAME ", APP-NAME is printable ASCII */
+		if (gethostname(host, sizeof(host)) < 0 || !*host) {
+			strcpy(host, "-");
+		}
+		host[sizeof(host) - 1] = '\0';
+		app = d->ident_len ? vl->ident : "-";
+		len = strlen(app);
+		if (len > __VANESSA_LOGGER_SYSLOG_APP_NAME_LEN) {
+			len = __VANESSA_LOGGER_SYSLOG_APP_NAME_LEN;
+		}
+		d->tag = (char *) malloc(strlen(host) + len + 3);
+		if (!d->tag) {
+			perror("__vanessa_logger_syslog_create: malloc");
+			free(d);
+			return (NULL);
+		}
+		d->tag_len = sprintf(d->tag, "%s %.*s ", host, (int) len, app);
+		for (i = strlen(host) + 1; i < d->tag_len - 1; i++) {
+			if (d->tag[i] <= ' ' || d->tag[i] > '~') {
+				d->tag[i] = '_';
+			}
+		}
+	}
+
+	d->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (d->fd < 0) {
+		perror("__vanessa_logger_syslog_create: socket");
+		free(d->tag);
+		free(d);
+		return (NULL);
+	}
+	fcntl(d->fd, F_SETFD, FD_CLOEXEC);
+	pthread_mutex_init(&d->lock, NULL);
+
+	/* Like syslog(3), carry on if there is no daemon yet */
+	__vanessa_logger_syslog_connect(d);
+
+	return (d);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_syslog_destroy
+ * Internal function to close the socket of a syslog logger and free
+ * its data
+ * pre: d: syslog logger data
+ * post: socket is closed and memory is freed
+ *       Nothing if d is NULL
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_syslog_destroy(__vanessa_logger_syslog_data_t *d)
+{
+	if (!d) {
+		return;
+	}
+
+	if (close(d->fd) < 0) {
+		perror("__vanessa_logger_syslog_destroy: close");
+	}
+	pthread_mutex_destroy(&d->lock);
+	free(d->tag);
+	free(d);
+}
+
+
+/**********************************************************************
+ * Fan-out loggers
+ *
+ * A fan-out logger hands each message to a number of child loggers,
+ * for instance a file, syslog and stderr. The message is expanded from
+ * its format once, then passed to each child that is to log it as a
+ * string, and the child adds its own header and framing. Each child
+ * keeps its own max_priority, flags and, if it was opened with
+ * VANESSA_LOGGER_F_ASYNC, its own queue and writer thread, so a slow
+ * child does not hold up the others.
+ **********************************************************************/
+
+/**********************************************************************
+ * __vanessa_logger_fanout_create
+ * Internal function to set up the data of a fan-out logger
+ * pre: opt: children of logger
+ * post: data is allocated. The fan-out logger owns the children.
+ * return: fan-out logger data
+ *         NULL on error, in which case the children are untouched
+ **********************************************************************/
+
+static __vanessa_logger_fanout_data_t *
+__vanessa_logger_fanout_create(const __vanessa_logger_fanout_opt_t *opt)
+{
+	__vanessa_logger_fanout_data_t *d;
+	__vanessa_logger_t *child;
+	int i;
+
+	if (opt->n < 1) {
+		fprintf(stderr, "__vanessa_logger_fanout_create: "
+				"no children\n");
+		return (NULL);
+	}
+	for (i = 0; i < opt->n; i++) {
+		child = (__vanessa_logger_t *) opt->child[i];
+		/* Children of children would share the message buffer */
+		if (!child || child->type == __vanessa_logger_fanout) {
+			fprintf(stderr, "__vanessa_logger_fanout_create: "
+					"invalid child %d\n", i);
+			return (NULL);
+		}
+	}
+
+	d = (__vanessa_logger_fanout_data_t *)
+		malloc(sizeof(__vanessa_logger_fanout_data_t));
+	if (!d) {
+		perror("__vanessa_logger_fanout_create: malloc");
+		return (NULL);
+	}
+	d->child = (__vanessa_logger_t **) 
+		malloc(opt->n * sizeof(*d->child));
+	if (!d->child) {
+		perror("__vanessa_logger_fanout_create: malloc");
+		free(d);
+		return (NULL);
+	}
+	memcpy(d->child, opt->child, opt->n * sizeof(*d->child));
+	d->n = opt->n;
+
+	return (d);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_fanout_destroy
+ * Internal function to close the children of a fan-out logger and
+ * free its data
+ * pre: d: fan-out logger data
+ * post: children are closed and memory is freed
+ *       Nothing if d is NULL
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_fanout_destroy(__vanessa_logger_fanout_data_t *d)
+{
+	int i;
+
+	if (!d) {
+		return;
+	}
+
+	for (i = 0; i < d->n; i++) {
+		vanessa_logger_closelog((vanessa_logger_t *) d->child[i]);
+	}
+	free(d->child);
+	free(d);
+}
+
+
+/**********************************************************************
+ * Categories
+ *
+ * A category is a named part of a program, such as "net.tls", that
+ * logs through a logger. Names are hierarchical, with components
+ * separated by '.'. The level rules given to
+ * vanessa_logger_set_levels() are compiled into a trie with a node for
+ * each component. Each node holds the level for the category itself
+ * and the level for those below it. Whenever the rules or the
+ * max_priority of the logger change, the threshold of each registered
+ * category is worked out again from the trie and stored in the
+ * category. The check made when logging is then a single comparison.
+ **********************************************************************/
+
+#define __VANESSA_LOGGER_LEVEL_UNSET INT_MIN
+
+static const struct {
+	const char *name;
+	int level;
+} __vanessa_logger_level_names[] = {
+	{ "emerg",   LOG_EMERG },
+	{ "alert",   LOG_ALERT },
+	{ "crit",    LOG_CRIT },
+	{ "err",     LOG_ERR },
+	{ "error",   LOG_ERR },
+	{ "warning", LOG_WARNING },
+	{ "warn",    LOG_WARNING },
+	{ "notice",  LOG_NOTICE },
+	{ "info",    LOG_INFO },
+	{ "debug",   LOG_DEBUG },
+	{ "none",    -1 },
+	{ NULL,      0 }
+};
+
+
+/**********************************************************************
+ * __vanessa_logger_trie_destroy
+ * Internal function to free a trie of level rules
+ * pre: t: root of trie, may be NULL
+ * post: memory is freed
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_trie_destroy(__vanessa_logger_trie_t *t)
+{
+	__vanessa_logger_trie_t *next;
+
+	while (t) {
+		next = t->sibling;
+		__vanessa_logger_trie_destroy(t->child);
+		free(t->name);
+		free(t);
+		t = next;
+	}
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_trie_node
+ * Internal function to allocate a node of a trie of level rules
+ * pre: name: component, NULL for the root
+ *      len: length of name
+ * post: node is allocated with no levels set
+ * return: node
+ *         NULL on error
+ **********************************************************************/
+
+static __vanessa_logger_trie_t *
+__vanessa_logger_trie_node(const char *name, size_t len)
+{
+	__vanessa_logger_trie_t *t;
+
+	t = (__vanessa_logger_trie_t *) calloc(1, sizeof(*t));
+	if (!t) {
+		perror("__vanessa_logger_trie_node: calloc");
+		return (NULL);
+	}
+	t->level = __VANESSA_LOGGER_LEVEL_UNSET;
+	t->below = __VANESSA_LOGGER_LEVEL_UNSET;
+	if (name) {
+		t->name = strndup(name, len);
+		if (!t->name) {
+			perror("__vanessa_logger_trie_node: strndup");
+			free(t);
+			return (NULL);
+		}
+	}
+
+	return (t);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_trie_add
+ * Internal function to add a rule to a trie of level rules
+ * pre: root: root of trie
+ *      pattern: "*", "name" or "name.*"
+ *      level: level for pattern
+ * post: "*" sets the level of every category without a more specific
+ *       rule. "name" sets the level of name and of the categories below
+ *       it, "name.*" only that of the categories below it. A later
+ *       rule for the same pattern replaces an earlier one.
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_trie_add(__vanessa_logger_trie_t *root, const char *pattern,
+		int level)
+{
+	__vanessa_logger_trie_t *t = root;
+	__vanessa_logger_trie_t *c;
+	const char *end;
+	size_t len;
+	int below_only = 0;
+
+	if (!strcmp(pattern, "*")) {
+		root->below = level;
+		return (0);
+	}
+
+	len = strlen(pattern);
+	if (len > 2 && !strcmp(pattern + len - 2, ".*")) {
+		below_only = 1;
+		len -= 2;
+	}
+
+	end = pattern + len;
+	while (pattern < end) {
+		len = strcspn(pattern, ".");
+		if (pattern + len > end) {
+			len = end - pattern;
+		}
+		if (!len || memchr(pattern, '*', len)) {
+			return (-1);
+		}
+		for (c = t->child; c; c = c->sibling) {
+			if (strlen(c->name) == len && 
+					!strncmp(c->name, pattern, len)) {
+				break;
+			}
+		}
+		if (!c) {
+			c = __vanessa_logger_trie_node(pattern, len);
+			if (!c) {
+				return (-1);
+			}
+			c->sibling = t->child;
+			t->child = c;
+		}
+		t = c;
+		pattern += len;
+		if (pattern < end && ++pattern == end) {
+			/* Trailing '.' */
+			return (-1);
+		}
+	}
+
+	if (t == root) {
+		return (-1);
+	}
+	if (!below_only) {
+		t->level = level;
+	}
+	t->below = level;
+
+	return (0);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_trie_resolve
+ * Internal function to find the level of a category
+ * pre: root: root of trie, may be NULL
+ *      name: name of category
+ *      level: level if no rule applies
+ * post: none
+ * return: level from the most specific rule that applies to name
+ **********************************************************************/
+
+static int
+__vanessa_logger_trie_resolve(const __vanessa_logger_trie_t *root,
+		const char *name, int level)
+{
+	const __vanessa_logger_trie_t *t = root;
+	const __vanessa_logger_trie_t *c;
+	size_t len;
+
+	if (!t) {
+		return (level);
+	}
+	if (t->below != __VANESSA_LOGGER_LEVEL_UNSET) {
+		level = t->below;
+	}
+
+	while (*name) {
+		len = strcspn(name, ".");
+		for (c = t->child; c; c = c->sibling) {
+			if (strlen(c->name) == len && 
+					!strncmp(c->name, name, len)) {
+				break;
+			}
+		}
+		if (!c) {
+			break;
+		}
+		t = c;
+		name += len;
+		if (*name) {
+			name++;
+			if (t->below != __VANESSA_LOGGER_LEVEL_UNSET) {
+				level = t->below;
+			}
+		}
+		else if (t->level != __VANESSA_LOGGER_LEVEL_UNSET) {
+			level = t->level;
+		}
+	}
+
+	return (level);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_level_parse
+ * Internal function to parse a level
+ * pre: str: name of level, such as "debug", or a number
+ *      level: level is written here
+ * post: level is set on success
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_level_parse(const char *str, int *level)
+{
+	char *end;
+	long l;
+	int i;
+
+	for (i = 0; __vanessa_logger_level_names[i].name; i++) {
+		if (!strcasecmp(str, __vanessa_logger_level_names[i].name)) {
+			*level = __vanessa_logger_level_names[i].level;
+			return (0);
+		}
+	}
+
+	errno = 0;
+	l = strtol(str, &end, 10);
+	if (!*str || *end || errno || l < -1 || l > INT_MAX) {
+		return (-1);
+	}
+	*level = l;
+
+	return (0);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_category_resolve_all
+ * Internal function to work out the threshold of each category of
+ * a logger again
+ * pre: vl: logger, __vanessa_logger_category_lock must be held
+ * post: max_priority of each category of vl is set
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_category_resolve_all(__vanessa_logger_t * vl)
+{
+	vanessa_logger_category_t *cat;
+
+	for (cat = vl->category; cat; cat = cat->next) {
+		__atomic_store_n(&cat->max_priority,
+				__vanessa_logger_trie_resolve(vl->rules,
+					cat->name, vl->max_priority),
+				__ATOMIC_RELAXED);
+	}
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_category_destroy
+ * Internal function to free the categories and level rules of a logger
+ * pre: vl: logger
+ * post: memory is freed, categories of vl may no longer be used
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_category_destroy(__vanessa_logger_t * vl)
+{
+	vanessa_logger_category_t *cat;
+
+	pthread_mutex_lock(&__vanessa_logger_category_lock);
+	while ((cat = vl->category)) {
+		vl->category = cat->next;
+		free(cat->name);
+		free(cat);
+	}
+	__vanessa_logger_trie_destroy(vl->rules);
+	vl->rules = NULL;
+	pthread_mutex_unlock(&__vanessa_logger_category_lock);
+}
+
+
+/**********************************************************************
+ * Rate limiting of call sites
+ *
+ * Each site limits itself with the generic cell rate algorithm, which
+ * behaves like a token bucket holding rate tokens but needs only a
+ * single word of state: the time at which the bucket would be full
+ * again, the theoretical arrival time. A message is let through if
+ * adding its share of the interval to that time leaves it no more than
+ * one interval ahead of now. The time is advanced by compare and swap.
+ *
+ * Sites with messages dropped or repeated are put on a list, under
+ * __vanessa_logger_site_lock, the first time that happens after their
+ * counts were last logged. A reporter thread logs the counts of each
+ * site on the list when they fall due and exits once the list is
+ * empty. It is started again when needed.
+ **********************************************************************/
+
+#define __VANESSA_LOGGER_SITE_REPORT_MSEC 30000
+
+static vanessa_logger_site_t *__vanessa_logger_site_list = NULL;
+static int __vanessa_logger_site_running = 0;
+static pthread_cond_t __vanessa_logger_site_cond;
+static pthread_once_t __vanessa_logger_site_once = PTHREAD_ONCE_INIT;
+
+
+static void
+__vanessa_logger_site_init(void)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&__vanessa_logger_site_cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_site_now
+ * Internal function to read the monotonic clock cheaply
+ * pre: none
+ * post: none
+ * return: nanoseconds on the monotonic clock, which may lag
+ *         CLOCK_MONOTONIC by up to a clock tick
+ **********************************************************************/
+
+static unsigned long long
+__vanessa_logger_site_now(void)
+{
+	struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+	if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) < 0)
+#endif
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_site_admit
+ * Internal function to check the limit of a call site
+ * pre: site: site to check, site->rate must not be 0
+ *      now: result of __vanessa_logger_site_now()
+ * post: the theoretical arrival time of site is advanced if the
+ *       message is let through
+ * return: 1 if the message is let through
+ *         0 if it is to be dropped
+ **********************************************************************/
+
+static int
+__vanessa_logger_site_admit(vanessa_logger_site_t * site,
+		unsigned long long now)
+{
+	unsigned long long interval = site->interval * 1000000ULL;
+	unsigned long long emission = interval / site->rate;
+	unsigned long long tat;
+	unsigned long long next;
+
+	tat = __atomic_load_n(&site->tat, __ATOMIC_RELAXED);
+	do {
+		next = (tat > now ? tat : now) + emission;
+		if (next - now > interval) {
+			return (0);
+		}
+	} while (!__atomic_compare_exchange_n(&site->tat, &tat, next, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return (1);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_site_hash
+ * Internal function to hash a message using 64 bit FNV-1a
+ * pre: str: message
+ * post: none
+ * return: hash of str
+ **********************************************************************/
+
+static unsigned long long
+__vanessa_logger_site_hash(const char *str)
+{
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+
+	while (*str) {
+		hash ^= (unsigned char) *str++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return (hash);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_site_log_counts
+ * Internal function to log the counts of a call site
+ * pre: site: site on the list, which has been unlinked from it
+ *      __vanessa_logger_site_lock must be held
+ * post: the dropped and repeated counts of site are logged to the
+ *       logger that site was listed for and reset
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_site_log_counts(vanessa_logger_site_t * site)
+{
+	unsigned int dropped;
+	unsigned int repeated;
+
+	/* Counted from here on means listed again */
+	__atomic_store_n(&site->listed, 0, __ATOMIC_RELAXED);
+	repeated = __atomic_exchange_n(&site->repeated, 0, __ATOMIC_RELAXED);
+	dropped = __atomic_exchange_n(&site->dropped, 0, __ATOMIC_RELAXED);
+
+	if (repeated) {
+		vanessa_logger_log(site->vl, site->priority, 
+				"%s:%d: last message repeated %u times",
+				site->file, site->line, repeated);
+	}
+	if (dropped) {
+		vanessa_logger_log(site->vl, site->priority,
+				"%s:%d: %u messages suppressed",
+				site->file, site->line, dropped);
+	}
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_site_reporter
+ * Internal function run by the thread that logs the counts of call
+ * sites when they fall due
+ * pre: data: unused
+ * post: the list of sites is empty
+ * return: NULL
+ **********************************************************************/
+
+static void *
+__vanessa_logger_site_reporter(void *data)
+{
+	vanessa_logger_site_t **p;
+	vanessa_logger_site_t *site;
+	unsigned long long next;
+	unsigned long long now;
+	struct timespec ts;
+
+	(void) data;
+
+	pthread_mutex_lock(&__vanessa_logger_site_lock);
+	while (__vanessa_logger_site_list) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		next = ULLONG_MAX;
+
+		p = &__vanessa_logger_site_list;
+		while ((site = *p)) {
+			if (site->report_at <= now) {
+				*p = site->next;
+				__vanessa_logger_site_log_counts(site);
+				continue;
+			}
+			if (site->report_at < next) {
+				next = site->report_at;
+			}
+			p = &site->next;
+		}
+
+		if (!__vanessa_logger_site_list) {
+			break;
+		}
+		ts.tv_sec = next / 1000000000ULL;
+		ts.tv_nsec = next % 1000000000ULL;
+		pthread_cond_timedwait(&__vanessa_logger_site_cond,
+				&__vanessa_logger_site_lock, &ts);
+	}
+	__vanessa_logger_site_running = 0;
+	pthread_mutex_unlock(&__vanessa_logger_site_lock);
+
+	return (NULL);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_site_add
+ * Internal function to put a call site on the list of those with
+ * counts to log
+ * pre: site: site that has just dropped or repeated a message
+ *      vl: logger the message was for
+ *      priority: priority of the message
+ *      now: result of __vanessa_logger_site_now()
+ * post: site is on the list, and the reporter thread is running
+ *       Nothing if site was already on the list
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_site_add(vanessa_logger_site_t * site, 
+		__vanessa_logger_t * vl, int priority, unsigned long long now)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	pthread_once(&__vanessa_logger_site_once, __vanessa_logger_site_init);
+
+	pthread_mutex_lock(&__vanessa_logger_site_lock);
+
+	if (site->listed) {
+		goto out;
+	}
+	site->vl = (vanessa_logger_t *) vl;
+	site->priority = priority;
+	site->report_at = now + (site->interval ? site->interval :
+			__VANESSA_LOGGER_SITE_REPORT_MSEC) * 1000000ULL;
+	site->next = __vanessa_logger_site_list;
+	__vanessa_logger_site_list = site;
+	__atomic_store_n(&site->listed, 1, __ATOMIC_RELAXED);
+
+	if (__vanessa_logger_site_running) {
+		pthread_cond_signal(&__vanessa_logger_site_cond);
+		goto out;
+	}
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, __vanessa_logger_site_reporter,
+				NULL)) {
+		/* Counts are still logged by vanessa_logger_flush() */
+		fprintf(stderr, "__vanessa_logger_site_add: "
+				"pthread_create\n");
+	}
+	else {
+		__vanessa_logger_site_running = 1;
+	}
+	pthread_attr_destroy(&attr);
+
+out:
+	pthread_mutex_unlock(&__vanessa_logger_site_lock);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_site_report
+ * Internal function to log the counts of the call sites listed for
+ * a logger without waiting for them to fall due
+ * pre: vl: logger
+ * post: counts of sites listed for vl are logged and the sites are
+ *       taken off the list
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_site_report(__vanessa_logger_t * vl)
+{
+	vanessa_logger_site_t **p;
+	vanessa_logger_site_t *site;
+
+	pthread_mutex_lock(&__vanessa_logger_site_lock);
+	p = &__vanessa_logger_site_list;
+	while ((site = *p)) {
+		if (site->vl == (vanessa_logger_t *) vl) {
+			*p = site->next;
+			__vanessa_logger_site_log_counts(site);
+			continue;
+		}
+		p = &site->next;
+	}
+	pthread_mutex_unlock(&__vanessa_logger_site_lock);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_site_child
+ * Internal function to reset the call site list in a forked child
+ * pre: called from the pthread_atfork(3) child handler
+ * post: the list is empty and no reporter thread is running. Counts
+ *       are kept and logged once the sites are listed again.
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_site_child(void)
+{
+	vanessa_logger_site_t *site;
+
+	while ((site = __vanessa_logger_site_list)) {
+		__vanessa_logger_site_list = site->next;
+		site->listed = 0;
+	}
+	__vanessa_logger_site_running = 0;
+	pthread_mutex_init(&__vanessa_logger_site_lock, NULL);
+	__vanessa_logger_site_init();
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_async_wake
+ * Internal function to wake the writer thread of an asynchronous logger
+ * pre: async: asynchronous state of logger
+ * post: writer thread is signalled
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_async_wake(__vanessa_logger_async_t * async)
+{
+	pthread_mutex_lock(&async->lock);
+	pthread_cond_signal(&async->wake);
+	pthread_mutex_unlock(&async->lock);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_async_claim
+ * Internal function to claim the next free slot in the ring of an
+ * asynchronous logger. If the ring is full then the caller yields
+ * until the writer thread has made room, messages are never dropped.
+ * pre: async: asynchronous state of logger
+ *      pos: position of the claimed slot is written here
+ * post: slot is reserved for the caller
+ * return: slot claimed
+ **********************************************************************/
+
+static __vanessa_logger_slot_t *
+__vanessa_logger_async_claim(__vanessa_logger_async_t * async, size_t *pos)
+{
+	__vanessa_logger_slot_t *slot;
+	size_t p;
+	size_t seq;
+
+	p = __atomic_load_n(&async->head, __ATOMIC_RELAXED);
+	while (1) {
+		slot = async->slot + (p & async->mask);
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == p) {
+			if (__atomic_compare_exchange_n(&async->head, &p, 
+					p + 1, 1, __ATOMIC_RELAXED, 
+					__ATOMIC_RELAXED)) {
+				break;
+			}
+		}
+		else if ((ssize_t)(seq - p) < 0) {
+			__vanessa_logger_async_wake(async);
+			sched_yield();
+			p = __atomic_load_n(&async->head, __ATOMIC_RELAXED);
+		}
+		else {
+			p = __atomic_load_n(&async->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	*pos = p;
+	return (slot);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_async_publish
+ * Internal function to hand a filled slot to the writer thread
+ * pre: async: asynchronous state of logger
+ *      slot: slot returned by __vanessa_logger_async_claim
+ *      pos: position returned by __vanessa_logger_async_claim
+ * post: slot is visible to the writer thread, which is woken
+ *       if it is asleep
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_async_publish(__vanessa_logger_async_t * async,
+		__vanessa_logger_slot_t * slot, size_t pos)
+{
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&async->sleeping, __ATOMIC_SEQ_CST)) {
+		__vanessa_logger_async_wake(async);
+	}
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_async_write
+ * Internal function used by the writer thread to write a batch of
+ * messages to the filehandle of a logger with a single writev(2),
+ * or to send them to syslog with a single sendmmsg(2), where possible.
+ * pre: vl: logger to write to
+ *      iov: messages to write
+ *      n: number of elements in iov
+ * post: messages are written. If there is an error and
+ *       VANESSA_LOGGER_F_CONS is set they are written to stderr instead
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_async_write(__vanessa_logger_t * vl, struct iovec *iov, 
+		int n)
+{
+	struct iovec tmp[__VANESSA_LOGGER_ASYNC_BATCH];
+	FILE *fh;
+	size_t len;
+	int fd;
+	int i;
+	int status = 0;
+
+	/* __vanessa_logger_fd_write() modifies the vector it is given */
+	memcpy(tmp, iov, n * sizeof(*iov));
+
+	if (vl->type == __vanessa_logger_filename) {
+		status = __vanessa_logger_fd_write(vl->data.d_filename->fd,
+				tmp, n);
+		if (status == 0) {
+			for (i = 0, len = 0; i < n; i++) {
+				len += iov[i].iov_len;
+			}
+			__vanessa_logger_rotate_account(vl->data.d_filename,
+					len);
+		}
+		goto out;
+	}
+
+	if (vl->type == __vanessa_logger_syslog) {
+		status = __vanessa_logger_syslog_send(vl->data.d_syslog, tmp,
+				n);
+		if (status < 0 && vl->flag & VANESSA_LOGGER_F_CONS) {
+			__vanessa_logger_syslog_stderr(iov, n);
+		}
+		return (status);
+	}
+
+	fh = vl->data.d_filehandle;
+	flockfile(fh);
+	fd = fileno(fh);
+	if (fflush(fh) == EOF) {
+		status = -1;
+	}
+	else if (fd < 0) {
+		for (i = 0; i < n; i++) {
+			if (fwrite(iov[i].iov_base, iov[i].iov_len, 1, 
+						fh) != 1) {
+				status = -1;
+				break;
+			}
+		}
+		if (fflush(fh) == EOF) {
+			status = -1;
+		}
+	}
+	else {
+		status = __vanessa_logger_fd_write(fd, tmp, n);
+	}
+	funlockfile(fh);
+
+out:
+	if (status < 0 && vl->flag & VANESSA_LOGGER_F_CONS) {
+		flockfile(stderr);
+		for (i = 0; i < n; i++) {
+			fwrite(iov[i].iov_base, iov[i].iov_len, 1, stderr);
+		}
+		fflush(stderr);
+		funlockfile(stderr);
+	}
+
+	return (status);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_async_thread
+ * Internal function run by the writer thread of an asynchronous logger.
+ * Collects runs of filled slots, writes them out and returns the slots
+ * to producers. Sleeps when the ring is empty.
+ * pre: data: asynchronous state of logger typecast to (void *)
+ * post: ring is drained until async->stop is set and the ring is empty
+ * return: NULL
+ **********************************************************************/
+
+static void *
+__vanessa_logger_async_thread(void *data)
+{
+	__vanessa_logger_async_t *async = (__vanessa_logger_async_t *) data;
+	__vanessa_logger_slot_t *slot;
+	__vanessa_logger_tls_t *tls;
+	struct iovec iov[__VANESSA_LOGGER_ASYNC_BATCH];
+	struct timespec ts;
+	unsigned long long start;
+	size_t pos;
+	size_t len;
+	int status;
+	int n;
+	int i;
+
+	tls = NULL;
+	while (1) {
+		pos = async->tail;
+		for (n = 0; n < __VANESSA_LOGGER_ASYNC_BATCH; n++) {
+			slot = async->slot + ((pos + n) & async->mask);
+			if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) !=
+					pos + n + 1) {
+				break;
+			}
+			iov[n].iov_base = slot->ext ? slot->ext : slot->data;
+			iov[n].iov_len = slot->len;
+		}
+
+		if (n) {
+			start = __vanessa_logger_stats_start(async->vl);
+			pthread_mutex_lock(&async->io_lock);
+			status = __vanessa_logger_async_write(async->vl, iov, 
+					n);
+			pthread_mutex_unlock(&async->io_lock);
+			if (start) {
+				if (!tls) {
+					tls = __vanessa_logger_tls_get();
+				}
+				for (i = 0, len = 0; i < n; i++) {
+					len += iov[i].iov_len;
+				}
+				__vanessa_logger_stats_write(async->vl, tls,
+						start, n, len, status);
+			}
+
+			for (i = 0; i < n; i++) {
+				slot = async->slot + ((pos + i) & async->mask);
+				free(slot->ext);
+				slot->ext = NULL;
+				__atomic_store_n(&slot->seq, 
+						pos + i + async->mask + 1, 
+						__ATOMIC_RELEASE);
+			}
+
+			pthread_mutex_lock(&async->lock);
+			__atomic_store_n(&async->tail, pos + n, 
+					__ATOMIC_RELEASE);
+			pthread_cond_broadcast(&async->drained);
+			pthread_mutex_unlock(&async->lock);
+			continue;
+		}
+
+		pthread_mutex_lock(&async->lock);
+		if (async->stop) {
+			pthread_mutex_unlock(&async->lock);
+			break;
+		}
+		__atomic_store_n(&async->sleeping, 1, __ATOMIC_SEQ_CST);
+		slot = async->slot + (pos & async->mask);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) != pos + 1) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += __VANESSA_LOGGER_ASYNC_IDLE_MS * 1000000L;
+			if (ts.tv_nsec >= 1000000000L) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&async->wake, &async->lock, &ts);
+		}
+		__atomic_store_n(&async->sleeping, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&async->lock);
+	}
+
+	return (NULL);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_async_init
+ * Internal function to put the ring of an asynchronous logger into its
+ * empty state and initialise its locks. Used both when the ring is
+ * created and in a forked child, where the writer thread of the parent
+ * does not exist and anything queued is the parent's to write.
+ * pre: async: asynchronous state of logger with slot and mask set
+ * post: ring is empty and no writer thread is running
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_async_init(__vanessa_logger_async_t * async)
+{
+	size_t i;
+
+	for (i = 0; i <= async->mask; i++) {
+		async->slot[i].seq = i;
+		free(async->slot[i].ext);
+		async->slot[i].ext = NULL;
+	}
+	async->head = 0;
+	async->tail = 0;
+	async->sleeping = 0;
+	async->stop = 0;
+	async->running = 0;
+	pthread_mutex_init(&async->lock, NULL);
+	pthread_mutex_init(&async->io_lock, NULL);
+	pthread_cond_init(&async->wake, NULL);
+	pthread_cond_init(&async->drained, NULL);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_async_start
+ * Internal function to start the writer thread of an asynchronous
+ * logger if it is not already running
+ * pre: async: asynchronous state of logger
+ * post: writer thread is running
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_async_start(__vanessa_logger_async_t * async)
+{
+	int status = 0;
+
+	pthread_mutex_lock(&async->lock);
+	if (!async->running) {
+		if (pthread_create(&async->thread, NULL, 
+				__vanessa_logger_async_thread, async)) {
+			perror("__vanessa_logger_async_start: "
+					"pthread_create");
+			status = -1;
+		}
+		else {
+			__atomic_store_n(&async->running, 1, 
+					__ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&async->lock);
+
+	return (status);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_async_create
+ * Internal function to allocate the ring of an asynchronous logger
+ * and start its writer thread
+ * pre: vl: logger that will use the ring
+ * post: ring is allocated and writer thread is running
+ * return: asynchronous state of logger
+ *         NULL on error
+ **********************************************************************/
+
+static __vanessa_logger_async_t *
+__vanessa_logger_async_create(__vanessa_logger_t * vl)
+{
+	__vanessa_logger_async_t *async;
+
+	async = (__vanessa_logger_async_t *) 
+		calloc(1, sizeof(__vanessa_logger_async_t));
+	if (!async) {
+		perror("__vanessa_logger_async_create: calloc 1");
+		return (NULL);
+	}
+
+	async->slot = (__vanessa_logger_slot_t *) calloc(
+			__VANESSA_LOGGER_ASYNC_SLOTS, 
+			sizeof(__vanessa_logger_slot_t));
+	if (!async->slot) {
+		perror("__vanessa_logger_async_create: calloc 2");
+		free(async);
+		return (NULL);
+	}
+
+	async->vl = vl;
+	async->mask = __VANESSA_LOGGER_ASYNC_SLOTS - 1;
+	__vanessa_logger_async_init(async);
+
+	if (__vanessa_logger_async_start(async) < 0) {
+		fprintf(stderr, "__vanessa_logger_async_create: "
+				"__vanessa_logger_async_start\n");
+		pthread_mutex_destroy(&async->lock);
+		pthread_mutex_destroy(&async->io_lock);
+		pthread_cond_destroy(&async->wake);
+		pthread_cond_destroy(&async->drained);
+		free(async->slot);
+		free(async);
+		return (NULL);
+	}
+
+	return (async);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_async_drain
+ * Internal function to wait until every message that had been queued
+ * on an asynchronous logger when it was called has been written
+ * pre: async: asynchronous state of logger
+ * post: messages queued before the call have been written
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_async_drain(__vanessa_logger_async_t * async)
+{
+	size_t target;
+
+	if (!__atomic_load_n(&async->running, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	target = __atomic_load_n(&async->head, __ATOMIC_ACQUIRE);
+
+	pthread_mutex_lock(&async->lock);
+	while ((ssize_t)(target - __atomic_load_n(&async->tail, 
+					__ATOMIC_ACQUIRE)) > 0) {
+		pthread_cond_signal(&async->wake);
+		pthread_cond_wait(&async->drained, &async->lock);
+	}
+	pthread_mutex_unlock(&async->lock);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_async_destroy
+ * Internal function to drain the ring of an asynchronous logger,
+ * stop its writer thread and free it
+ * pre: async: asynchronous state of logger
+ * post: all queued messages are written and memory is freed
+ *       Nothing if async is NULL
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_async_destroy(__vanessa_logger_async_t * async)
+{
+	if (!async) {
+		return;
+	}
+
+	__vanessa_logger_async_drain(async);
+
+	pthread_mutex_lock(&async->lock);
+	async->stop = 1;
+	pthread_cond_signal(&async->wake);
+	pthread_mutex_unlock(&async->lock);
+	if (async->running) {
+		pthread_join(async->thread, NULL);
+	}
+
+	pthread_mutex_destroy(&async->lock);
+	pthread_mutex_destroy(&async->io_lock);
+	pthread_cond_destroy(&async->wake);
+	pthread_cond_destroy(&async->drained);
+	free(async->slot);
+	free(async);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_va_func_wrapper
+ * Internal wrapper function be able to use a 
+ * vanessa_logger_log_function_t, which uses va_list, with a ...
+ * pre: func: function to call
+ *      priority: priority pass to func
+ *      fmt: to pass to func
+ *      ...: args to convert to an ap and pass to func
+ * post: func is called 
+ * return: none
+ **********************************************************************/
+
+static void 
+__vanessa_logger_va_func_wrapper(vanessa_logger_log_function_va_t func,
+		int priority, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	func(priority, fmt, ap);
+	va_end(ap);
+}
+
+
+
+/**********************************************************************
+ * __vanessa_logger_log
+ * Internal function to log a message
+ * pre: vl: logger to use
+ *      priority: priority to log with
+ *                Only used if log type is __vanessa_logger_syslog
+ *                Ignored otherwise
+ *      fmt: format for log message
+ *      ap: varargs for format
+ * post: message is logged to appropriate logger
+ *       vl->ident[pid]: will be prepended to each log
+ *       '\n' will be appended to each log that doesn't already end with
+ *       a '\n'
+ *       Nothing on error
+ * return: none
+ **********************************************************************/
+
+/*
+ * Copy as much of src as fits into buffer at offset and return the
+ * offset that the next byte belongs at, regardless of whether it fits.
+ */
+
+static size_t
+__vanessa_logger_append(char *buffer, size_t buffer_len, size_t offset,
+		const char *src, size_t len)
+{
+	if (offset < buffer_len) {
+		memcpy(buffer + offset, src,
+				len < buffer_len - offset ?
+				len : buffer_len - offset);
+	}
+	return (offset + len);
+}
+
+/*
+ * Length of prefix, which is known without measuring it when it is
+ * the function of the call site that the thread is logging from.
+ */
+
+static size_t
+__vanessa_logger_prefix_len(const __vanessa_logger_tls_t *tls,
+		const char *prefix)
+{
+	if (tls && tls->prefix == prefix) {
+		return (tls->prefix_len);
+	}
+
+	return (strlen(prefix));
+}
+
+/*
+ * Expand a message into buf, or into memory allocated for it and
+ * stored in *overflow if it does not fit. err is the errno to
+ * expand %m with. Returns the message or NULL on error.
+ */
+
+static const char *
+__vanessa_logger_expand(char *buf, size_t size, char **overflow, int err,
+		const char *fmt, va_list ap)
+{
+	va_list aq;
+	int len;
+
+	va_copy(aq, ap);
+	errno = err;
+	len = vsnprintf(buf, size, fmt, ap);
+	if (len < 0) {
+		buf = NULL;
+	}
+	else if ((size_t) len >= size) {
+		*overflow = (char *) malloc(len + 1);
+		errno = err;
+		if (*overflow && vsnprintf(*overflow, len + 1, fmt, aq) >= 0) {
+			buf = *overflow;
+		}
+	}
+	va_end(aq);
+
+	return (buf);
+}
+
+/*
+ * Return the length of the run at the start of src that may be copied
+ * into a JSON string as it is, that is without '"', '\\' or control
+ * characters. Where SSE2 is available 16 bytes are checked at a time.
+ */
+
+static size_t
+__vanessa_logger_json_clean(const char *src, size_t len)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1f);
+	__m128i v;
+	int mask;
+
+	for (; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *) (src + i));
+		mask = _mm_movemask_epi8(_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+					_mm_cmpeq_epi8(v, backslash)),
+				/* v <= 0x1f, unsigned */
+				_mm_cmpeq_epi8(_mm_min_epu8(v, control), v)));
+		if (mask) {
+			return (i + __builtin_ctz(mask));
+		}
+	}
+#endif
+
+	for (; i < len; i++) {
+		if ((unsigned char) src[i] < 0x20 || src[i] == '"' ||
+				src[i] == '\\') {
+			break;
+		}
+	}
+
+	return (i);
+}
+
+/*
+ * As __vanessa_logger_append() but escape src for use inside a JSON
+ * string. Runs that need no escaping are copied in one go.
+ */
+
+static size_t
+__vanessa_logger_append_json(char *buffer, size_t buffer_len, size_t offset,
+		const char *src, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	char esc[6];
+	size_t run;
+	size_t esc_len;
+
+	while (len) {
+		run = __vanessa_logger_json_clean(src, len);
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				src, run);
+		src += run;
+		len -= run;
+		if (!len) {
+			break;
+		}
+
+		esc[0] = '\\';
+		esc_len = 2;
+		switch (*src) {
+		case '"':
+		case '\\':
+			esc[1] = *src;
+			break;
+		case '\n':
+			esc[1] = 'n';
+			break;
+		case '\r':
+			esc[1] = 'r';
+			break;
+		case '\t':
+			esc[1] = 't';
+			break;
+		default:
+			memcpy(esc + 1, "u00", 3);
+			esc[4] = hex[((unsigned char) *src) >> 4];
+			esc[5] = hex[*src & 0xf];
+			esc_len = 6;
+			break;
+		}
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				esc, esc_len);
+		src++;
+		len--;
+	}
+
+	return (offset);
+}
+
+/*
+ * Render a message as a line of JSON for a VANESSA_LOGGER_F_JSON logger,
+ * {"time":...,"ident":...,"pid":...,"level":...,"func":...,"msg":...}
+ * followed by the fields of vanessa_logger_logkv(), if any. The message
+ * loses a trailing '\n'. Returns as for __vanessa_logger_do_fmt().
+ */
+
+static int
+__vanessa_logger_do_json(__vanessa_logger_t *vl, char *buffer,
+		size_t buffer_len, int priority, const char *prefix,
+		const char *fmt, va_list ap)
+{
+	__vanessa_logger_tls_t *tls;
+	char str[__VANESSA_LOGGER_TIMESTAMP_LEN];
+	char msg[__VANESSA_LOGGER_BUF_SIZE];
+	char *overflow = NULL;
+	const char *body;
+	const char *level = NULL;
+	size_t offset;
+	size_t len;
+	int err = errno;
+	int i;
+
+	tls = __vanessa_logger_tls_get();
+	offset = __vanessa_logger_append(buffer, buffer_len, 0, "{", 1);
+
+	if (vl->flag & VANESSA_LOGGER_F_TIMESTAMP) {
+		i = __vanessa_logger_timestamp(vl->flag, 
+				tls ? &tls->ts : NULL, str);
+		if (i < 0) {
+			return (-1);
+		}
+		/* Less the trailing space */
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				"\"time\":\"", 8);
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				str, i - 1);
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				"\",", 2);
+	}
+
+	if (vl->header && !(vl->flag & VANESSA_LOGGER_F_NO_IDENT_PID)) {
+		len = strlen(vl->ident);
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				"\"ident\":\"", 9);
+		offset = __vanessa_logger_append_json(buffer, buffer_len, 
+				offset, vl->ident, len);
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				"\",\"pid\":", 8);
+		/* The digits of the pid, from the ident[pid] header */
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				vl->header + len + 1, vl->header_len - len - 3);
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				",", 1);
+	}
+
+	for (i = 0; __vanessa_logger_level_names[i].name; i++) {
+		if (__vanessa_logger_level_names[i].level == priority) {
+			level = __vanessa_logger_level_names[i].name;
+			break;
+		}
+	}
+	if (level) {
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				"\"level\":\"", 9);
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				level, strlen(level));
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				"\"", 1);
+	}
+	else {
+		i = snprintf(str, sizeof(str), "\"level\":%d", priority);
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				str, i);
+	}
+
+	if (prefix) {
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				",\"func\":\"", 9);
+		offset = __vanessa_logger_append_json(buffer, buffer_len, 
+				offset, prefix,
+				__vanessa_logger_prefix_len(tls, prefix));
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				"\"", 1);
+	}
+
+	body = __vanessa_logger_expand(msg, sizeof(msg), &overflow, err,
+			fmt, ap);
+	if (!body) {
+		return (-1);
+	}
+	len = strlen(body);
+	if (len && body[len - 1] == '\n') {
+		len--;
+	}
+	offset = __vanessa_logger_append(buffer, buffer_len, offset,
+			",\"msg\":\"", 8);
+	offset = __vanessa_logger_append_json(buffer, buffer_len, offset,
+			body, len);
+	offset = __vanessa_logger_append(buffer, buffer_len, offset, "\"", 1);
+	free(overflow);
+
+	if (tls && tls->fields) {
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				tls->fields, tls->fields_len);
+	}
+
+	offset = __vanessa_logger_append(buffer, buffer_len, offset, 
+			"}\n", 3);
+
+	return (offset - 1);
+}
+
+/*
+ * Render the key/value pairs of vanessa_logger_logkv(), up to a NULL
+ * key, as JSON members each preceded by a ',' if json is non-zero, or
+ * else in logfmt as key=value each preceded by a ' '. Strings are only
+ * quoted in logfmt if they need to be. The result is NUL terminated if
+ * it fits. Returns its length, regardless of whether it fits, or -1 if
+ * a type is not known.
+ */
+
+static int
+__vanessa_logger_kv_fmt(char *buffer, size_t buffer_len, int json,
+		va_list ap)
+{
+	char num[32];
+	const char *key;
+	const char *str;
+	size_t offset = 0;
+	size_t len;
+	size_t i;
+	double d;
+	int quote;
+	int n;
+
+	while ((key = va_arg(ap, const char *))) {
+		if (json) {
+			offset = __vanessa_logger_append(buffer, buffer_len,
+					offset, ",\"", 2);
+			offset = __vanessa_logger_append_json(buffer, 
+					buffer_len, offset, key, strlen(key));
+			offset = __vanessa_logger_append(buffer, buffer_len,
+					offset, "\":", 2);
+		}
+		else {
+			offset = __vanessa_logger_append(buffer, buffer_len,
+					offset, " ", 1);
+			offset = __vanessa_logger_append(buffer, buffer_len,
+					offset, key, strlen(key));
+			offset = __vanessa_logger_append(buffer, buffer_len,
+					offset, "=", 1);
+		}
+
+		n = -1;
+		switch (va_arg(ap, int)) {
+		case VANESSA_LOGGER_KV_STR:
+			str = va_arg(ap, const char *);
+			if (!str) {
+				n = snprintf(num, sizeof(num), "null");
+				break;
+			}
+			len = strlen(str);
+			quote = json || !len;
+			for (i = 0; i < len && !quote; i++) {
+				quote = (unsigned char) str[i] <= ' ' ||
+					str[i] == '=' || str[i] == '"' ||
+					str[i] == '\\';
+			}
+			if (!quote) {
+				offset = __vanessa_logger_append(buffer, 
+						buffer_len, offset, str, len);
+				continue;
+			}
+			offset = __vanessa_logger_append(buffer, buffer_len,
+					offset, "\"", 1);
+			offset = __vanessa_logger_append_json(buffer, 
+					buffer_len, offset, str, len);
+			offset = __vanessa_logger_append(buffer, buffer_len,
+					offset, "\"", 1);
+			continue;
+		case VANESSA_LOGGER_KV_INT:
+			n = snprintf(num, sizeof(num), "%d", va_arg(ap, int));
+			break;
+		case VANESSA_LOGGER_KV_LLONG:
+			n = snprintf(num, sizeof(num), "%lld", 
+					va_arg(ap, long long));
+			break;
+		case VANESSA_LOGGER_KV_ULLONG:
+			n = snprintf(num, sizeof(num), "%llu", 
+					va_arg(ap, unsigned long long));
+			break;
+		case VANESSA_LOGGER_KV_DOUBLE:
+			d = va_arg(ap, double);
+			/* JSON has no NaN or infinity */
+			if (json && !isfinite(d)) {
+				n = snprintf(num, sizeof(num), "null");
+			}
+			else {
+				n = snprintf(num, sizeof(num), "%.15g", d);
+			}
+			break;
+		case VANESSA_LOGGER_KV_BOOL:
+			n = snprintf(num, sizeof(num), "%s", 
+					va_arg(ap, int) ? "true" : "false");
+			break;
+		}
+		if (n < 0) {
+			return (-1);
+		}
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				num, n);
+	}
+
+	if (offset < buffer_len) {
+		buffer[offset] = '\0';
+	}
+
+	return (offset);
+}
+
+/*
+ * The header (timestamp, ident[pid] and prefix) is copied into the
+ * buffer literally, it is never interpreted as a format, so a '%' in an
+ * ident or prefix is harmless. Returns the length of the header, which
+ * may be more than buffer_len, or -1 on error.
+ */
+
+int __vanessa_logger_do_header(__vanessa_logger_t *vl,
+		__vanessa_logger_tls_t *tls, char *buffer, size_t buffer_len,
+		const char *prefix)
+{
+	char str[__VANESSA_LOGGER_TIMESTAMP_LEN];
+	int len;
+	size_t offset = 0;
+	int add_colon = 0;
+
+	if(vl->flag & VANESSA_LOGGER_F_TIMESTAMP) {
+		len = __vanessa_logger_timestamp(vl->flag, 
+				tls ? &tls->ts : NULL, str);
+		if (len < 0) {
+			return -1;
+		}
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				str, len);
+		add_colon++;
+	}
+
+	if(vl->header && !(vl->flag & VANESSA_LOGGER_F_NO_IDENT_PID)) {
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				vl->header, vl->header_len);
+		add_colon++;
+	}
+
+	if (add_colon) {
+		/* Replace the trailing space with ": " */
+		offset = __vanessa_logger_append(buffer, buffer_len,
+				offset - 1, ": ", 2);
+	}
+
+	if(prefix) {
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				prefix, __vanessa_logger_prefix_len(tls, prefix));
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				": ", 2);
+	}
+
+	return(offset);
+}
+
+/*
+ * Render a complete line: the header followed by fmt expanded with ap
+ * and a '\n' if the message does not already end with one. The result
+ * is NUL terminated if it fits. Like vsnprintf(3) the return value is
+ * the length of the whole line, so the line was truncated if it is
+ * buffer_len or more. Returns -1 on error.
+ */
+
+int __vanessa_logger_do_fmt(__vanessa_logger_t *vl,
+		__vanessa_logger_tls_t *tls, char *buffer, size_t buffer_len,
+		int priority, const char *prefix, const char *fmt, va_list ap)
+{
+	int len;
+	size_t offset;
+	size_t room;
+
+	if (vl->flag & VANESSA_LOGGER_F_JSON) {
+		return (__vanessa_logger_do_json(vl, buffer, buffer_len,
+					priority, prefix, fmt, ap));
+	}
+
+	len = __vanessa_logger_do_header(vl, tls, buffer, buffer_len, prefix);
+	if (len < 0) {
+		return -1;
+	}
+	offset = len;
+
+	room = offset < buffer_len ? buffer_len - offset : 0;
+	len = vsnprintf(room ? buffer + offset : NULL, room, fmt, ap);
+	if (len < 0) {
+		return -1;
+	}
+	offset += len;
+
+	if (offset >= buffer_len) {
+		/* Truncated, assume a '\n' is needed */
+		return(offset + 1);
+	}
+
+	if (!len || *(buffer+offset-1) != '\n') {
+		if(offset + 1 < buffer_len) {
+			*(buffer+offset)='\n';
+			*(buffer+offset+1)='\0';
+		}
+		offset++;
+	}
+
+	return(offset);
+}
+
+/*
+ * Render a line as the logger writes it, that is framed for syslog or
+ * as __vanessa_logger_do_fmt() does for other loggers. Like vsnprintf(3)
+ * the return value is the length of the whole line, so it was cut
+ * short if it is buffer_len or more. Returns -1 on error.
+ */
+
+static int
+__vanessa_logger_line(__vanessa_logger_t * vl, __vanessa_logger_tls_t *tls,
+		char *buffer, size_t buffer_len, int priority,
+		const char *prefix, const char *fmt, va_list ap)
+{
+	if (vl->type == __vanessa_logger_syslog) {
+		return (__vanessa_logger_syslog_fmt(vl, tls, priority, prefix,
+					fmt, ap, buffer, buffer_len));
+	}
+
+	return (__vanessa_logger_do_fmt(vl, tls, buffer, buffer_len,
+				priority, prefix, fmt, ap));
+}
+
+/*
+ * Return how much of a line of JSON, cut short, to keep so that it ends
+ * inside a string value, such as the message, and not part way through
+ * an escape. At most len bytes are kept. Returns 0 if there is nowhere
+ * to cut.
+ */
+
+static size_t
+__vanessa_logger_json_cut(const char *buffer, size_t len)
+{
+	size_t cut = 0;
+	size_t esc;
+	size_t i;
+	int in_string = 0;
+	int value = 0;
+	char last = '\0';
+
+	for (i = 0; i < len; i++) {
+		if (!in_string) {
+			if (buffer[i] == '"') {
+				in_string = 1;
+				value = last == ':';
+				if (value) {
+					cut = i + 1;
+				}
+			}
+			else if (buffer[i] != ' ') {
+				last = buffer[i];
+			}
+			continue;
+		}
+		if (buffer[i] == '"') {
+			in_string = 0;
+			last = '"';
+			continue;
+		}
+		esc = 1;
+		if (buffer[i] == '\\') {
+			esc = i + 1 < len && buffer[i + 1] == 'u' ? 6 : 2;
+			if (i + esc > len) {
+				break;
+			}
+		}
+		i += esc - 1;
+		if (value) {
+			cut = i + 1;
+		}
+	}
+
+	return (cut);
+}
+
+/*
+ * End a line that was cut short at buffer_len bytes with
+ * __VANESSA_LOGGER_TRUNCATED, and a '\n' unless it is for syslog.
+ * A line of JSON is cut inside a string and closed with '"}' so that
+ * it is still valid. Returns the length of the line.
+ */
+
+static size_t
+__vanessa_logger_truncate(__vanessa_logger_t * vl,
+		__vanessa_logger_tls_t *tls, char *buffer, size_t buffer_len)
+{
+	static const char marker[] = __VANESSA_LOGGER_TRUNCATED "\n";
+	static const char json_marker[] = __VANESSA_LOGGER_TRUNCATED "\"}\n";
+	size_t len;
+	size_t cut;
+
+	__vanessa_logger_stats_count(vl, tls, __VANESSA_LOGGER_STAT_TRUNCATED);
+
+	if (vl->type != __vanessa_logger_syslog &&
+			vl->flag & VANESSA_LOGGER_F_JSON) {
+		len = sizeof(json_marker) - 1;
+		cut = __vanessa_logger_json_cut(buffer, buffer_len - len - 1);
+		if (cut) {
+			memcpy(buffer + cut, json_marker, len + 1);
+			return (cut + len);
+		}
+	}
+
+	len = sizeof(marker) - 1;
+	if (vl->type == __vanessa_logger_syslog) {
+		len--;
+	}
+	memcpy(buffer + buffer_len - len - 1, marker, len);
+	buffer[buffer_len - 1] = '\0';
+
+	return (buffer_len - 1);
+}
+
+/*
+ * Return the calling thread's buffer for long lines, grown to at least
+ * size bytes. NULL on error.
+ */
+
+static char *
+__vanessa_logger_tls_grow(__vanessa_logger_tls_t *tls, size_t size)
+{
+	size_t n;
+
+	if (size <= tls->overflow_size) {
+		return (tls->overflow);
+	}
+
+	n = tls->overflow_size ? tls->overflow_size * 2 :
+		__VANESSA_LOGGER_BUF_SIZE * 4;
+	while (n < size) {
+		n *= 2;
+	}
+
+	free(tls->overflow);
+	tls->overflow_size = 0;
+	tls->overflow = (char *) malloc(n);
+	if (!tls->overflow) {
+		return (NULL);
+	}
+	tls->overflow_size = n;
+
+	return (tls->overflow);
+}
+
+/*
+ * Render a line into the calling thread's buffer for long lines if it
+ * has one, otherwise into its fixed buffer. If it does not fit it is
+ * rendered again into the buffer for long lines, grown to fit, cut
+ * short at the max_len of the logger. So a thread that logs long lines
+ * usually renders each of them once.
+ */
+
+static char *
+__vanessa_logger_render(__vanessa_logger_t * vl, __vanessa_logger_tls_t *tls,
+		int priority, const char *prefix, const char *fmt, va_list ap,
+		size_t *line_len)
+{
+	unsigned long long start;
+	char *buffer;
+	size_t size;
+	int len;
+	va_list aq;
+
+	start = __vanessa_logger_stats_start(vl);
+
+	if (tls->overflow_size > __VANESSA_LOGGER_KEEP_SIZE) {
+		free(tls->overflow);
+		tls->overflow = NULL;
+		tls->overflow_size = 0;
+	}
+
+	if (tls->overflow_size) {
+		buffer = tls->overflow;
+		size = tls->overflow_size < vl->max_len ? 
+			tls->overflow_size : vl->max_len;
+	}
+	else {
+		buffer = tls->buffer;
+		size = sizeof(tls->buffer);
+	}
+
+	va_copy(aq, ap);
+	len = __vanessa_logger_line(vl, tls, buffer, size, priority, prefix,
+			fmt, ap);
+	if (len >= 0 && (size_t)len >= size && size < vl->max_len) {
+		size = (size_t)len < vl->max_len ? 
+			(size_t)len + 1 : vl->max_len;
+		buffer = __vanessa_logger_tls_grow(tls, size);
+		if (!buffer) {
+			/* Make do with tls->buffer */
+			buffer = tls->buffer;
+			size = sizeof(tls->buffer);
+		}
+		len = __vanessa_logger_line(vl, tls, buffer, size, priority,
+				prefix, fmt, aq);
+	}
+	va_end(aq);
+	if (len < 0) {
+		return (NULL);
+	}
+	if ((size_t)len >= size) {
+		len = __vanessa_logger_truncate(vl, tls, buffer, size);
+	}
+	tls->stats_mark = __vanessa_logger_stats_format(vl, tls, start);
+	*line_len = len;
+
+	return (buffer);
+}
+
+/*
+ * Format a message into a slot of an asynchronous logger, or into
+ * memory allocated for it if it does not fit
+ */
+
+static void
+__vanessa_logger_async_fill(__vanessa_logger_t * vl, 
+		__vanessa_logger_tls_t *tls, __vanessa_logger_slot_t *slot,
+		int priority, const char *prefix, const char *fmt, va_list ap)
+{
+	unsigned long long start;
+	size_t size;
+	int len;
+	va_list aq;
+
+	start = __vanessa_logger_stats_start(vl);
+	va_copy(aq, ap);
+	len = __vanessa_logger_line(vl, tls, slot->data, sizeof(slot->data),
+			priority, prefix, fmt, ap);
+	if (len < 0) {
+		len = snprintf(slot->data, sizeof(slot->data),
+				"__vanessa_logger_async_fill: "
+				"output truncated\n");
+		__vanessa_logger_stats_count(vl, tls,
+				__VANESSA_LOGGER_STAT_TRUNCATED);
+	}
+	else if ((size_t)len >= sizeof(slot->data)) {
+		size = (size_t)len < vl->max_len ? 
+			(size_t)len + 1 : vl->max_len;
+		if (size > sizeof(slot->data)) {
+			slot->ext = (char *) malloc(size);
+		}
+		if (slot->ext) {
+			len = __vanessa_logger_line(vl, tls, slot->ext, size,
+					priority, prefix, fmt, aq);
+		}
+		else {
+			size = sizeof(slot->data);
+		}
+		if (len < 0) {
+			/* Keep what is in slot->data */
+			free(slot->ext);
+			slot->ext = NULL;
+			size = sizeof(slot->data);
+			len = size;
+		}
+		if ((size_t)len >= size) {
+			len = __vanessa_logger_truncate(vl, tls, 
+					slot->ext ? slot->ext : slot->data, 
+					size);
+		}
+	}
+	va_end(aq);
+	slot->len = len;
+	__vanessa_logger_stats_format(vl, tls, start);
+}
+
+/*
+ * Asynchronous loggers format straight into a ring slot, the writer
+ * thread does the rest.
+ */
+
+void __vanessa_logger_do_async(__vanessa_logger_t * vl, int priority,
+		const char *prefix, const char *fmt, va_list ap)
+{
+	__vanessa_logger_slot_t *slot;
+	__vanessa_logger_tls_t *tls;
+	size_t pos;
+
+	/* The writer thread is started lazily in forked children */
+	if (!__atomic_load_n(&vl->async->running, __ATOMIC_ACQUIRE) &&
+			__vanessa_logger_async_start(vl->async) < 0) {
+		return;
+	}
+
+	slot = __vanessa_logger_async_claim(vl->async, &pos);
+	tls = __vanessa_logger_tls_get();
+	__vanessa_logger_async_fill(vl, tls, slot, priority, prefix, fmt, ap);
+
+	if (vl->flag & VANESSA_LOGGER_F_PERROR) {
+		flockfile(stderr);
+		fwrite(slot->ext ? slot->ext : slot->data, slot->len, 1, 
+				stderr);
+		fflush(stderr);
+		funlockfile(stderr);
+	}
+
+	__vanessa_logger_async_publish(vl->async, slot, pos);
+}
+
+/*
+ * The line is rendered once and handed to the filehandle with a single
+ * fwrite(3) and fflush(3) made while the stream is locked, so lines from
+ * concurrent threads are never interleaved. If the line is also to go to
+ * stderr the same rendered bytes are written there.
+ */
+
+void __vanessa_logger_do_fh(__vanessa_logger_t * vl, int priority,
+		const char *prefix, const char *fmt, FILE *fh, va_list ap)
+{
+	__vanessa_logger_tls_t *tls;
+	unsigned long long start;
+	char *line = NULL;
+	size_t len;
+	int status;
+
+	tls = __vanessa_logger_tls_get();
+	if (tls) {
+		line = __vanessa_logger_render(vl, tls, priority, prefix, 
+				fmt, ap, &len);
+	}
+	if (!line) {
+		fprintf(fh, "__vanessa_logger_do_fh: output truncated\n");
+		__vanessa_logger_stats_count(vl, tls,
+				__VANESSA_LOGGER_STAT_TRUNCATED);
+		return;
+	}
+
+	start = __vanessa_logger_stats_mark(vl, tls);
+	flockfile(fh);
+	status = (fwrite(line, len, 1, fh) != 1 || fflush(fh) == EOF);
+	funlockfile(fh);
+	__vanessa_logger_stats_write(vl, tls, start, 1, len, -status);
+
+	if ((status && vl->flag & VANESSA_LOGGER_F_CONS) ||
+			vl->flag & VANESSA_LOGGER_F_PERROR){
+		flockfile(stderr);
+		fwrite(line, len, 1, stderr);
+		fflush(stderr);
+		funlockfile(stderr);
+	}
+}
+
+/*
+ * Callers of a filename logger that uses group commit wait for their
+ * line to reach the disk if it is important enough.
+ */
+
+void __vanessa_logger_do_filename(__vanessa_logger_t * vl, int priority,
+		const char *prefix, const char *fmt, va_list ap)
+{
+	__vanessa_logger_tls_t *tls;
+	unsigned long long start;
+	char *line = NULL;
+	size_t len;
+	int sync;
+	int status;
+	static const char truncated[] = 
+		"__vanessa_logger_do_filename: output truncated\n";
+
+	tls = __vanessa_logger_tls_get();
+	if (tls) {
+		line = __vanessa_logger_render(vl, tls, priority, prefix, 
+				fmt, ap, &len);
+	}
+	if (!line) {
+		line = (char *) truncated;
+		len = sizeof(truncated) - 1;
+		__vanessa_logger_stats_count(vl, tls,
+				__VANESSA_LOGGER_STAT_TRUNCATED);
+	}
+
+	start = __vanessa_logger_stats_mark(vl, tls);
+	sync = priority <= __atomic_load_n(&vl->data.d_filename->sync_priority,
+			__ATOMIC_RELAXED);
+	status = __vanessa_logger_filename_write(vl->data.d_filename, line,
+			len, sync);
+	if (sync) {
+		__vanessa_logger_filename_commit(vl->data.d_filename);
+	}
+	__vanessa_logger_stats_write(vl, tls, start, 1, len, status);
+
+	if (vl->flag & VANESSA_LOGGER_F_PERROR){
+		flockfile(stderr);
+		fwrite(line, len, 1, stderr);
+		fflush(stderr);
+		funlockfile(stderr);
+	}
+}
+
+void __vanessa_logger_do_mmap(__vanessa_logger_t * vl, int priority,
+		const char *prefix, const char *fmt, va_list ap)
+{
+	__vanessa_logger_tls_t *tls;
+	unsigned long long start;
+	char *line = NULL;
+	size_t len;
+	int status;
+	static const char truncated[] = 
+		"__vanessa_logger_do_mmap: output truncated\n";
+
+	tls = __vanessa_logger_tls_get();
+	if (tls) {
+		line = __vanessa_logger_render(vl, tls, priority, prefix, 
+				fmt, ap, &len);
+	}
+	if (!line) {
+		line = (char *) truncated;
+		len = sizeof(truncated) - 1;
+		__vanessa_logger_stats_count(vl, tls,
+				__VANESSA_LOGGER_STAT_TRUNCATED);
+	}
+
+	start = __vanessa_logger_stats_mark(vl, tls);
+	status = __vanessa_logger_mmap_write(vl->data.d_mmap, line, len);
+	__vanessa_logger_stats_write(vl, tls, start, 1, len, status);
+
+	if ((status < 0 && vl->flag & VANESSA_LOGGER_F_CONS) ||
+			vl->flag & VANESSA_LOGGER_F_PERROR) {
+		flockfile(stderr);
+		fwrite(line, len, 1, stderr);
+		fflush(stderr);
+		funlockfile(stderr);
+	}
+}
+
+/**********************************************************************
+ * __vanessa_logger_syslog_fmt
+ * Internal function to frame a message for the syslog daemon
+ * pre: vl: syslog logger
+ *      tls: per-thread state of caller, may be NULL
+ *      priority: priority of message, may include a facility
+ *      prefix: prefix of message, may be NULL
+ *      fmt: format of message
+ *      ap: arguments of message
+ *      buffer: buffer to frame message in
+ *      buffer_len: length of buffer
+ * post: message is written to buffer, truncated if need be, without
+ *       a trailing '\n' and followed by a NUL
+ * return: length of message, not counting the NUL.
+ *         Like vsnprintf(3) the message was truncated if this is
+ *         buffer_len or more.
+ **********************************************************************/
+
+static size_t
+__vanessa_logger_syslog_fmt(__vanessa_logger_t * vl,
+		__vanessa_logger_tls_t *tls, int priority, const char *prefix,
+		const char *fmt, va_list ap, char *buffer, size_t buffer_len)
+{
+	__vanessa_logger_syslog_data_t *d = vl->data.d_syslog;
+	char str[__VANESSA_LOGGER_TIMESTAMP_LEN];
+	char digits[8];
+	size_t offset;
+	size_t room;
+	int err = errno;
+	int len;
+	int i;
+
+	/* As per syslog(3), the facility of the logger is the default */
+	priority &= LOG_PRIMASK | LOG_FACMASK;
+	if (!(priority & LOG_FACMASK)) {
+		priority |= d->facility;
+	}
+	i = sizeof(digits);
+	digits[--i] = '>';
+	do {
+		digits[--i] = '0' + priority % 10;
+		priority /= 10;
+	} while (priority);
+	digits[--i] = '<';
+	offset = __vanessa_logger_append(buffer, buffer_len, 0, digits + i,
+			sizeof(digits) - i);
+	if (vl->flag & VANESSA_LOGGER_F_RFC5424) {
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				"1 ", 2);
+	}
+
+	len = __vanessa_logger_timestamp(d->ts_flag, tls ? &tls->ts : NULL,
+			str);
+	if (len > 0) {
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				str, len);
+	}
+
+	if (vl->flag & VANESSA_LOGGER_F_RFC5424) {
+		/* HOSTNAME APP-NAME PROCID MSGID STRUCTURED-DATA */
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				d->tag, d->tag_len);
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				vl->header + d->ident_len + 1,
+				vl->header_len - d->ident_len - 3);
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				" - - ", 5);
+	}
+	else {
+		/* ident[pid]: */
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				vl->header, vl->header_len - 1);
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				": ", 2);
+	}
+
+	if (prefix) {
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				prefix, __vanessa_logger_prefix_len(tls, prefix));
+		offset = __vanessa_logger_append(buffer, buffer_len, offset,
+				": ", 2);
+	}
+
+	room = offset < buffer_len ? buffer_len - offset : 0;
+	errno = err;
+	len = vsnprintf(room ? buffer + offset : NULL, room, fmt, ap);
+	if (len > 0) {
+		offset += len;
+	}
+
+	if (offset >= buffer_len) {
+		/* Truncated, like vsnprintf(3) return the length needed */
+		buffer[buffer_len - 1] = '\0';
+		return (offset);
+	}
+	if (len > 0 && buffer[offset - 1] == '\n') {
+		offset--;
+	}
+	buffer[offset] = '\0';
+
+	return (offset);
+}
+
+
+/*
+ * Syslog loggers frame the message straight into the calling thread's
+ * buffer, or into a ring slot for asynchronous loggers, and send it as
+ * one datagram.
+ */
+
+void __vanessa_logger_do_syslog(__vanessa_logger_t * vl, int priority,
+		const char *prefix, const char *fmt, va_list ap)
+{
+	__vanessa_logger_tls_t *tls;
+	__vanessa_logger_slot_t *slot;
+	unsigned long long start;
+	struct iovec iov;
+	size_t pos;
+	int status;
+
+	tls = __vanessa_logger_tls_get();
+
+	if (vl->async) {
+		/* The writer thread is started lazily in forked children */
+		if (!__atomic_load_n(&vl->async->running, __ATOMIC_ACQUIRE) &&
+				__vanessa_logger_async_start(vl->async) < 0) {
+			return;
+		}
+		slot = __vanessa_logger_async_claim(vl->async, &pos);
+		__vanessa_logger_async_fill(vl, tls, slot, priority, prefix,
+				fmt, ap);
+		if (vl->flag & VANESSA_LOGGER_F_PERROR) {
+			iov.iov_base = slot->ext ? slot->ext : slot->data;
+			iov.iov_len = slot->len;
+			__vanessa_logger_syslog_stderr(&iov, 1);
+		}
+		__vanessa_logger_async_publish(vl->async, slot, pos);
+		return;
+	}
+
+	if (!tls) {
+		return;
+	}
+
+	iov.iov_base = __vanessa_logger_render(vl, tls, priority, prefix, 
+			fmt, ap, &iov.iov_len);
+	if (!iov.iov_base) {
+		__vanessa_logger_stats_count(vl, tls,
+				__VANESSA_LOGGER_STAT_TRUNCATED);
+		return;
+	}
+	start = __vanessa_logger_stats_mark(vl, tls);
+
+	status = __vanessa_logger_syslog_send(vl->data.d_syslog, &iov, 1);
+	__vanessa_logger_stats_write(vl, tls, start, 1, iov.iov_len, status);
+
+	if ((status < 0 && vl->flag & VANESSA_LOGGER_F_CONS) ||
+			vl->flag & VANESSA_LOGGER_F_PERROR) {
+		__vanessa_logger_syslog_stderr(&iov, 1);
+	}
+}
+
+/*
+ * Fan-out loggers expand the message into a buffer of their own, as
+ * the children render their lines into the usual one, and hand it to
+ * each child as a string.
+ */
+
+static void
+__vanessa_logger_fanout_child(__vanessa_logger_t * vl, int priority,
+		const char *prefix, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	__vanessa_logger_log(vl, priority, prefix, fmt, ap);
+	va_end(ap);
+}
+
+void __vanessa_logger_do_fanout(__vanessa_logger_t * vl, int priority,
+		const char *prefix, const char *fmt, va_list ap)
+{
+	__vanessa_logger_fanout_data_t *d = vl->data.d_fanout;
+	__vanessa_logger_tls_t *tls;
+	unsigned long long start;
+	const char *body;
+	int err = errno;
+	int i;
+
+	/* Don't expand a message that no child wants */
+	for (i = 0; i < d->n; i++) {
+		if (priority <= d->child[i]->max_priority) {
+			break;
+		}
+	}
+	if (i == d->n) {
+		return;
+	}
+
+	tls = __vanessa_logger_tls_get();
+	if (!tls) {
+		return;
+	}
+	free(tls->body_overflow);
+	tls->body_overflow = NULL;
+
+	start = __vanessa_logger_stats_start(vl);
+	body = __vanessa_logger_expand(tls->body, sizeof(tls->body),
+			&tls->body_overflow, err, fmt, ap);
+	if (!body) {
+		body = "__vanessa_logger_do_fanout: output truncated\n";
+		__vanessa_logger_stats_count(vl, tls,
+				__VANESSA_LOGGER_STAT_TRUNCATED);
+	}
+	start = __vanessa_logger_stats_format(vl, tls, start);
+
+	for (i = 0; i < d->n; i++) {
+		__vanessa_logger_fanout_child(d->child[i], priority, prefix,
+				"%s", body);
+	}
+	__vanessa_logger_stats_write(vl, tls, start, 1, strlen(body), 0);
+}
+
+void __vanessa_logger_do_func(__vanessa_logger_t * vl, int priority,
+		const char *prefix, const char *fmt, va_list ap,
+		vanessa_logger_log_function_va_t func)
+{
+	__vanessa_logger_tls_t *tls;
+	unsigned long long start;
+	char *line = NULL;
+	size_t len;
+
+	tls = __vanessa_logger_tls_get();
+	if (tls) {
+		line = __vanessa_logger_render(vl, tls, priority, prefix, 
+				fmt, ap, &len);
+	}
+	if (!line) {
+		__vanessa_logger_va_func_wrapper(func, priority,
+				"__vanessa_logger_do_func: output truncated\n");
+		__vanessa_logger_stats_count(vl, tls,
+				__VANESSA_LOGGER_STAT_TRUNCATED);
+		return;
+	}
+
+	start = __vanessa_logger_stats_mark(vl, tls);
+	__vanessa_logger_va_func_wrapper(func, priority, "%s", line);
+	__vanessa_logger_stats_write(vl, tls, start, 1, len, 0);
+}
+
+
+/**********************************************************************
+ * Binary loggers
+ *
+ * A filename logger opened with VANESSA_LOGGER_F_BINARY does not
+ * format messages. Each message is written as a record holding an
+ * identifier for its format string, the time, the pid and the values
+ * of its arguments, with the contents of %s arguments copied.
+ * vanessa_logger_binary_decode() turns the records back into the lines
+ * that a text logger would have written.
+ *
+ * Format strings are looked up by their address and checked against a
+ * copy of their contents, so a buffer that is reused for a different
+ * format gets a format of its own. A format string is written to the
+ * file once, in a format record that precedes the first message that
+ * uses it. The ident is written in a header
+ * record at the start of each file the logger opens. Formats that
+ * can't be recorded, such as those using %n, positional arguments or
+ * wide strings, are formatted when logged and recorded as text.
+ *
+ * Each record starts with:
+ *   uint32_t len       length of the record, including this header
+ *   uint8_t  type      __VANESSA_LOGGER_REC_*
+ *   uint8_t  priority  priority of a message
+ *   uint16_t reserved  0
+ *   uint32_t flag      flags of the logger when a message was logged
+ * which is followed by:
+ *   HEADER:  "VLBIN002", sizeof(long), sizeof(void *),
+ *            sizeof(long double), 0, ident
+ *   FORMAT:  uint32_t id, format string
+ *   MESSAGE: uint32_t id, uint32_t pid, uint64_t sec, uint32_t nsec,
+ *            prefix (MESSAGE_PREFIX only), arguments
+ * Strings are a uint16_t length followed by that many bytes. Values are
+ * in host byte order, which the header record lets the decoder check.
+ * A message with id 0 has a single string argument, its text.
+ **********************************************************************/
+
+#define __VANESSA_LOGGER_REC_HEADER         1
+#define __VANESSA_LOGGER_REC_FORMAT         2
+#define __VANESSA_LOGGER_REC_MESSAGE        3
+#define __VANESSA_LOGGER_REC_MESSAGE_PREFIX 4
+
+#define __VANESSA_LOGGER_ARG_NONE    0
+#define __VANESSA_LOGGER_ARG_INT     1
+#define __VANESSA_LOGGER_ARG_LONG    2
+#define __VANESSA_LOGGER_ARG_LLONG   3
+#define __VANESSA_LOGGER_ARG_INTMAX  4
+#define __VANESSA_LOGGER_ARG_SIZE    5
+#define __VANESSA_LOGGER_ARG_PTRDIFF 6
+#define __VANESSA_LOGGER_ARG_DOUBLE  7
+#define __VANESSA_LOGGER_ARG_LDOUBLE 8
+#define __VANESSA_LOGGER_ARG_PTR     9
+#define __VANESSA_LOGGER_ARG_STR     10
+#define __VANESSA_LOGGER_ARG_ERRNO   11 /* %m, recorded as a string */
+#define __VANESSA_LOGGER_ARG_WINT    12
+
+static const char __vanessa_logger_binary_magic[8] = "VLBIN002";
+
+typedef struct {
+	uint32_t len;
+	uint8_t type;
+	uint8_t priority;
+	uint16_t reserved;
+	uint32_t flag;
+} __vanessa_logger_rec_t;
+
+typedef struct {
+	uint32_t id;
+	uint32_t pid;
+	uint64_t sec;
+	uint32_t nsec;
+} __attribute__ ((packed)) __vanessa_logger_rec_message_t;
+
+
+/*
+ * Parse the conversion specification that starts at *p, just after a
+ * '%'. Sets *stars to the number of '*' widths and precisions it takes,
+ * which come before its argument, and *type to the type of its argument.
+ * *p is left just after the specification. Returns -1 if it can't be
+ * recorded in binary form.
+ */
+
+static int
+__vanessa_logger_binary_spec(const char **p, int *stars, int *type)
+{
+	const char *s = *p;
+	int mod = 0;
+
+	*stars = 0;
+	*type = __VANESSA_LOGGER_ARG_NONE;
+
+	if (*s == '%') {
+		*p = s + 1;
+		return (0);
+	}
+
+	while (*s && strchr("-+ #0'I", *s)) {
+		s++;
+	}
+	if (*s == '*') {
+		(*stars)++;
+		s++;
+	}
+	while (isdigit((unsigned char) *s)) {
+		s++;
+	}
+	if (*s == '.') {
+		s++;
+		if (*s == '*') {
+			(*stars)++;
+			s++;
+		}
+		while (isdigit((unsigned char) *s)) {
+			s++;
+		}
+	}
+	if (*s == '$') {
+		return (-1);
+	}
+
+	switch (*s) {
+	case 'h':
+		s += s[1] == 'h' ? 2 : 1;
+		break;
+	case 'l':
+		if (s[1] == 'l') {
+			mod = 'q';
+			s += 2;
+		}
+		else {
+			mod = 'l';
+			s++;
+		}
+		break;
+	case 'q':
+	case 'L':
+	case 'j':
+	case 'z':
+	case 'Z':
+	case 't':
+		mod = *s++;
+		break;
+	}
+
+	switch (*s) {
+	case 'd':
+	case 'i':
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+		switch (mod) {
+		case 'l':
+			*type = __VANESSA_LOGGER_ARG_LONG;
+			break;
+		case 'q':
+		case 'L':
+			*type = __VANESSA_LOGGER_ARG_LLONG;
+			break;
+		case 'j':
+			*type = __VANESSA_LOGGER_ARG_INTMAX;
+			break;
+		case 'z':
+		case 'Z':
+			*type = __VANESSA_LOGGER_ARG_SIZE;
+			break;
+		case 't':
+			*type = __VANESSA_LOGGER_ARG_PTRDIFF;
+			break;
+		default:
+			*type = __VANESSA_LOGGER_ARG_INT;
+			break;
+		}
+		break;
+	case 'c':
+		*type = mod == 'l' ? __VANESSA_LOGGER_ARG_WINT :
+			__VANESSA_LOGGER_ARG_INT;
+		break;
+	case 'C':
+		*type = __VANESSA_LOGGER_ARG_WINT;
+		break;
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		*type = mod == 'L' ? __VANESSA_LOGGER_ARG_LDOUBLE :
+			__VANESSA_LOGGER_ARG_DOUBLE;
+		break;
+	case 's':
+		if (mod == 'l') {
+			return (-1);
+		}
+		*type = __VANESSA_LOGGER_ARG_STR;
+		break;
+	case 'p':
+		*type = __VANESSA_LOGGER_ARG_PTR;
+		break;
+	case 'm':
+		*type = __VANESSA_LOGGER_ARG_ERRNO;
+		break;
+	default:
+		/* %n, %S and anything unknown */
+		return (-1);
+	}
+
+	*p = s + 1;
+	return (0);
+}
+
+
+/*
+ * Work out the arguments a format string takes, in order, '*' widths
+ * and precisions included. Returns the number of arguments or -1 if
+ * the format can't be recorded in binary form.
+ */
+
+static int
+__vanessa_logger_binary_parse(const char *fmt, unsigned char *arg)
+{
+	const char *p = fmt;
+	int stars;
+	int type;
+	int n = 0;
+
+	if (strlen(fmt) > __VANESSA_LOGGER_BINARY_FORMAT_LEN) {
+		return (-1);
+	}
+
+	while ((p = strchr(p, '%'))) {
+		p++;
+		if (__vanessa_logger_binary_spec(&p, &stars, &type) < 0) {
+			return (-1);
+		}
+		if (type == __VANESSA_LOGGER_ARG_NONE) {
+			continue;
+		}
+		if (n + stars + 1 > __VANESSA_LOGGER_BINARY_ARGS) {
+			return (-1);
+		}
+		while (stars--) {
+			arg[n++] = __VANESSA_LOGGER_ARG_INT;
+		}
+		arg[n++] = type;
+	}
+
+	return (n);
+}
+
+
+static size_t
+__vanessa_logger_binary_put_str(char *buffer, size_t buffer_len,
+		size_t offset, const char *str, size_t len)
+{
+	uint16_t len16;
+
+	if (len > 0xffff) {
+		len = 0xffff;
+	}
+	len16 = len;
+	offset = __vanessa_logger_append(buffer, buffer_len, offset,
+			(const char *) &len16, sizeof(len16));
+	return (__vanessa_logger_append(buffer, buffer_len, offset, str, 
+				len));
+}
+
+#define __VANESSA_LOGGER_BINARY_PUT(buffer, buffer_len, offset, type, ap) \
+	do { \
+		type __v = va_arg(ap, type); \
+		offset = __vanessa_logger_append(buffer, buffer_len, offset, \
+				(const char *) &__v, sizeof(__v)); \
+	} while (0)
+
+
+/**********************************************************************
+ * __vanessa_logger_binary_encode
+ * Internal function to encode a message record
+ * pre: vl: logger
+ *      f: format of message, NULL to record fmt expanded with ap as text
+ *      priority: priority of message
+ *      prefix: prefix of message, may be NULL
+ *      fmt: format of message
+ *      err: value of errno when the message was logged, for %m
+ *      ts: time the message was logged
+ *      ap: arguments of message
+ *      buffer: buffer to encode to
+ *      buffer_len: length of buffer
+ *      truncate: if non-zero a message recorded as text is truncated
+ *                so that the record fits in buffer
+ * post: record is written to buffer if it fits
+ * return: length of record, like vsnprintf(3) the record did not fit
+ *         if this is more than buffer_len
+ **********************************************************************/
+
+static size_t
+__vanessa_logger_binary_encode(__vanessa_logger_t * vl,
+		const __vanessa_logger_fmt_t *f, int priority,
+		const char *prefix, const char *fmt, int err,
+		const struct timespec *ts, va_list ap, char *buffer,
+		size_t buffer_len, int truncate)
+{
+	__vanessa_logger_rec_t rec;
+	__vanessa_logger_rec_message_t msg;
+	char errbuf[128];
+	const char *str;
+	uint16_t len16;
+	size_t offset;
+	size_t room;
+	int len;
+	int i;
+
+	rec.type = prefix ? __VANESSA_LOGGER_REC_MESSAGE_PREFIX :
+		__VANESSA_LOGGER_REC_MESSAGE;
+	rec.priority = priority;
+	rec.reserved = 0;
+	rec.flag = vl->flag;
+	msg.id = f ? f->id : 0;
+	msg.pid = vl->pid;
+	msg.sec = ts->tv_sec;
+	msg.nsec = ts->tv_nsec;
+
+	offset = sizeof(rec);
+	offset = __vanessa_logger_append(buffer, buffer_len, offset,
+			(const char *) &msg, sizeof(msg));
+	if (prefix) {
+		offset = __vanessa_logger_binary_put_str(buffer, buffer_len,
+				offset, prefix, strlen(prefix));
+	}
+
+	if (!f) {
+		/* Text, expanded in place after room for its length */
+		room = offset + sizeof(len16) < buffer_len ?
+			buffer_len - offset - sizeof(len16) : 0;
+		if (room > 0xffff) {
+			room = 0xffff;
+		}
+		errno = err;
+		len = vsnprintf(room ? buffer + offset + sizeof(len16) : NULL,
+				room, fmt, ap);
+		if (len < 0) {
+			len = 0;
+		}
+		if (truncate && (size_t) len >= room) {
+			len = room ? room - 1 : 0;
+		}
+		if (len > 0xffff) {
+			len = 0xffff;
+		}
+		len16 = len;
+		__vanessa_logger_append(buffer, buffer_len, offset,
+				(const char *) &len16, sizeof(len16));
+		offset += sizeof(len16) + len;
+		/* Make room for vsnprintf(3)'s NUL on a retry */
+		if (offset > buffer_len) {
+			offset++;
+		}
+	}
+
+	for (i = 0; f && i < f->nargs; i++) {
+		switch (f->arg[i]) {
+		case __VANESSA_LOGGER_ARG_INT:
+		case __VANESSA_LOGGER_ARG_WINT:
+			__VANESSA_LOGGER_BINARY_PUT(buffer, buffer_len, offset,
+					int, ap);
+			break;
+		case __VANESSA_LOGGER_ARG_LONG:
+			__VANESSA_LOGGER_BINARY_PUT(buffer, buffer_len, offset,
+					long, ap);
+			break;
+		case __VANESSA_LOGGER_ARG_LLONG:
+			__VANESSA_LOGGER_BINARY_PUT(buffer, buffer_len, offset,
+					long long, ap);
+			break;
+		case __VANESSA_LOGGER_ARG_INTMAX:
+			__VANESSA_LOGGER_BINARY_PUT(buffer, buffer_len, offset,
+					intmax_t, ap);
+			break;
+		case __VANESSA_LOGGER_ARG_SIZE:
+			__VANESSA_LOGGER_BINARY_PUT(buffer, buffer_len, offset,
+					size_t, ap);
+			break;
+		case __VANESSA_LOGGER_ARG_PTRDIFF:
+			__VANESSA_LOGGER_BINARY_PUT(buffer, buffer_len, offset,
+					ptrdiff_t, ap);
+			break;
+		case __VANESSA_LOGGER_ARG_DOUBLE:
+			__VANESSA_LOGGER_BINARY_PUT(buffer, buffer_len, offset,
+					double, ap);
+			break;
+		case __VANESSA_LOGGER_ARG_LDOUBLE:
+			__VANESSA_LOGGER_BINARY_PUT(buffer, buffer_len, offset,
+					long double, ap);
+			break;
+		case __VANESSA_LOGGER_ARG_PTR:
+			__VANESSA_LOGGER_BINARY_PUT(buffer, buffer_len, offset,
+					void *, ap);
+			break;
+		case __VANESSA_LOGGER_ARG_STR:
+			str = va_arg(ap, const char *);
+			if (!str) {
+				str = "(null)";
+			}
+			offset = __vanessa_logger_binary_put_str(buffer,
+					buffer_len, offset, str, strlen(str));
+			break;
+		case __VANESSA_LOGGER_ARG_ERRNO:
+#ifdef STRERROR_R_CHAR_P
+			str = strerror_r(err, errbuf, sizeof(errbuf));
+#else
+			if (strerror_r(err, errbuf, sizeof(errbuf))) {
+				snprintf(errbuf, sizeof(errbuf),
+						"Unknown error %d", err);
+			}
+			str = errbuf;
+#endif
+			offset = __vanessa_logger_binary_put_str(buffer,
+					buffer_len, offset, str, strlen(str));
+			break;
+		}
+	}
+
+	rec.len = offset;
+	__vanessa_logger_append(buffer, buffer_len, 0, (const char *) &rec,
+			sizeof(rec));
+
+	return (offset);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_binary_write
+ * Internal function to write a record to a binary logger, through the
+ * ring of an asynchronous logger if it has one
+ * pre: vl: binary logger
+ *      rec: record to write, no longer than __VANESSA_LOGGER_BUF_SIZE
+ *           for an asynchronous logger
+ *      len: length of record
+ * post: record is written or queued
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_binary_write(__vanessa_logger_t * vl, const char *rec,
+		size_t len)
+{
+	__vanessa_logger_slot_t *slot;
+	size_t pos;
+
+	if (vl->async) {
+		slot = __vanessa_logger_async_claim(vl->async, &pos);
+		memcpy(slot->data, rec, len);
+		slot->len = len;
+		__vanessa_logger_async_publish(vl->async, slot, pos);
+		return;
+	}
+
+	__vanessa_logger_filename_write(vl->data.d_filename, rec, len, 0);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_binary_lookup
+ * Internal function to find the format record of a format string,
+ * adding it and writing it to the current file if need be
+ * pre: vl: binary logger
+ *      fmt: format string
+ * post: the format record is in the current file, or queued to be
+ *       written to it ahead of anything logged after this call
+ * return: format, NULL if fmt can't be recorded in binary form
+ **********************************************************************/
+
+static const __vanessa_logger_fmt_t *
+__vanessa_logger_binary_lookup(__vanessa_logger_t * vl, const char *fmt)
+{
+	__vanessa_logger_binary_t *b = vl->binary;
+	__vanessa_logger_fmt_t *f;
+	__vanessa_logger_rec_t rec;
+	char buffer[sizeof(rec) + sizeof(uint32_t) + sizeof(uint16_t) +
+		__VANESSA_LOGGER_BINARY_FORMAT_LEN];
+	unsigned int generation;
+	const char *key;
+	size_t i;
+	size_t offset;
+	int nargs;
+
+	generation = __atomic_load_n(&vl->data.d_filename->generation,
+			__ATOMIC_ACQUIRE);
+
+	i = ((uintptr_t) fmt >> 3) & (__VANESSA_LOGGER_BINARY_FORMATS - 1);
+	while (1) {
+		f = b->fmt + i;
+		key = __atomic_load_n(&f->fmt, __ATOMIC_ACQUIRE);
+		if (key == fmt && !strcmp(f->copy, fmt)) {
+			if (f->nargs < 0) {
+				return (NULL);
+			}
+			if (__atomic_load_n(&f->generation, 
+					__ATOMIC_ACQUIRE) == generation) {
+				return (f);
+			}
+			break;
+		}
+		if (!key) {
+			break;
+		}
+		i = (i + 1) & (__VANESSA_LOGGER_BINARY_FORMATS - 1);
+	}
+
+	/* Slow path, add the format and/or write it to this file */
+	pthread_mutex_lock(&b->lock);
+
+	if (!f->fmt) {
+		if (b->used >= __VANESSA_LOGGER_BINARY_FORMATS / 2) {
+			pthread_mutex_unlock(&b->lock);
+			return (NULL);
+		}
+		f->copy = strdup(fmt);
+		if (!f->copy) {
+			pthread_mutex_unlock(&b->lock);
+			return (NULL);
+		}
+		nargs = __vanessa_logger_binary_parse(fmt, f->arg);
+		f->nargs = nargs;
+		f->id = ++b->used;
+		/* Not yet written to any file */
+		f->generation = generation - 1;
+		__atomic_store_n(&f->fmt, fmt, __ATOMIC_RELEASE);
+	}
+	else if (f->fmt != fmt || strcmp(f->copy, fmt)) {
+		/* Another format took the slot first, start again */
+		pthread_mutex_unlock(&b->lock);
+		return (__vanessa_logger_binary_lookup(vl, fmt));
+	}
+
+	if (f->nargs < 0) {
+		pthread_mutex_unlock(&b->lock);
+		return (NULL);
+	}
+
+	if (f->generation != generation) {
+		rec.type = __VANESSA_LOGGER_REC_FORMAT;
+		rec.priority = 0;
+		rec.reserved = 0;
+		rec.flag = 0;
+		offset = sizeof(rec);
+		offset = __vanessa_logger_append(buffer, sizeof(buffer), 
+				offset, (const char *) &f->id, sizeof(f->id));
+		offset = __vanessa_logger_binary_put_str(buffer, 
+				sizeof(buffer), offset, fmt, strlen(fmt));
+		rec.len = offset;
+		memcpy(buffer, &rec, sizeof(rec));
+		__vanessa_logger_binary_write(vl, buffer, offset);
+		__atomic_store_n(&f->generation, generation, 
+				__ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&b->lock);
+
+	return (f);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_binary_create
+ * Internal function to set up a filename logger to write records
+ * rather than text
+ * pre: vl: filename logger, with ident set
+ * post: binary state is allocated, the header record is written and
+ *       will be written to each file the logger opens
+ * return: binary state of logger
+ *         NULL on error
+ **********************************************************************/
+
+static __vanessa_logger_binary_t *
+__vanessa_logger_binary_create(__vanessa_logger_t * vl)
+{
+	__vanessa_logger_filename_data_t *d = vl->data.d_filename;
+	__vanessa_logger_binary_t *b;
+	__vanessa_logger_rec_t rec;
+	char *header;
+	size_t len;
+
+	b = (__vanessa_logger_binary_t *) 
+		calloc(1, sizeof(__vanessa_logger_binary_t));
+	if (!b) {
+		perror("__vanessa_logger_binary_create: calloc");
+		return (NULL);
+	}
+
+	len = strlen(vl->ident);
+	if (len > 0xffff) {
+		len = 0xffff;
+	}
+	rec.len = sizeof(rec) + sizeof(__vanessa_logger_binary_magic) + 4 +
+		sizeof(uint16_t) + len;
+	rec.type = __VANESSA_LOGGER_REC_HEADER;
+	rec.priority = 0;
+	rec.reserved = 0;
+	rec.flag = 0;
+
+	header = (char *) malloc(rec.len);
+	if (!header) {
+		perror("__vanessa_logger_binary_create: malloc");
+		free(b);
+		return (NULL);
+	}
+	memcpy(header, &rec, sizeof(rec));
+	memcpy(header + sizeof(rec), __vanessa_logger_binary_magic,
+			sizeof(__vanessa_logger_binary_magic));
+	len = sizeof(rec) + sizeof(__vanessa_logger_binary_magic);
+	header[len++] = sizeof(long);
+	header[len++] = sizeof(void *);
+	header[len++] = sizeof(long double);
+	header[len++] = 0;
+	__vanessa_logger_binary_put_str(header, rec.len, len, vl->ident,
+			strlen(vl->ident));
+
+	pthread_mutex_init(&b->lock, NULL);
+
+	pthread_mutex_lock(&d->lock);
+	d->preamble = header;
+	d->preamble_len = rec.len;
+	__vanessa_logger_filename_flush_locked(d, header, rec.len);
+	pthread_mutex_unlock(&d->lock);
+
+	return (b);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_binary_destroy
+ * Internal function to free the binary state of a logger
+ * pre: b: binary state of logger
+ * post: memory is freed
+ *       Nothing if b is NULL
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_binary_destroy(__vanessa_logger_binary_t *b)
+{
+	size_t i;
+
+	if (!b) {
+		return;
+	}
+
+	for (i = 0; i < __VANESSA_LOGGER_BINARY_FORMATS; i++) {
+		free(b->fmt[i].copy);
+	}
+	pthread_mutex_destroy(&b->lock);
+	free(b);
+}
+
+
+/*
+ * Binary loggers record the message rather than formatting it. The
+ * record is built in the calling thread's buffer, or in memory
+ * allocated for the purpose if it does not fit, or directly in a ring
+ * slot for asynchronous loggers, in which case it is recorded as
+ * truncated text if it is too long.
+ */
+
+void __vanessa_logger_do_binary(__vanessa_logger_t * vl, int priority,
+		const char *prefix, const char *fmt, va_list ap)
+{
+	const __vanessa_logger_fmt_t *f;
+	__vanessa_logger_tls_t *tls;
+	__vanessa_logger_slot_t *slot;
+	struct timespec ts;
+	unsigned long long start;
+	va_list aq;
+	size_t len;
+	size_t pos;
+	char *rec;
+	int err = errno;
+	int sync;
+	int status;
+
+	/* The writer thread is started lazily in forked children */
+	if (vl->async && !__atomic_load_n(&vl->async->running, 
+				__ATOMIC_ACQUIRE) &&
+			__vanessa_logger_async_start(vl->async) < 0) {
+		return;
+	}
+
+	/* Echo the text of the message to stderr */
+	if (vl->flag & VANESSA_LOGGER_F_PERROR) {
+		tls = __vanessa_logger_tls_get();
+		va_copy(aq, ap);
+		rec = tls ? __vanessa_logger_render(vl, tls, priority, prefix,
+				fmt, aq, &len) : NULL;
+		va_end(aq);
+		if (rec) {
+			flockfile(stderr);
+			fwrite(rec, len, 1, stderr);
+			fflush(stderr);
+			funlockfile(stderr);
+		}
+		errno = err;
+	}
+
+	f = __vanessa_logger_binary_lookup(vl, fmt);
+	if (__vanessa_logger_clock(vl->flag, &ts) < 0) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+	}
+
+	va_copy(aq, ap);
+
+	if (vl->async) {
+		slot = __vanessa_logger_async_claim(vl->async, &pos);
+		len = __vanessa_logger_binary_encode(vl, f, priority, prefix,
+				fmt, err, &ts, ap, slot->data, 
+				sizeof(slot->data), 0);
+		if (len > sizeof(slot->data)) {
+			len = __vanessa_logger_binary_encode(vl, NULL, 
+					priority, prefix, fmt, err, &ts, aq, 
+					slot->data, sizeof(slot->data), 1);
+		}
+		slot->len = len;
+		__vanessa_logger_async_publish(vl->async, slot, pos);
+		va_end(aq);
+		if (priority <= __atomic_load_n(
+					&vl->data.d_filename->sync_priority,
+					__ATOMIC_RELAXED)) {
+			__vanessa_logger_async_drain(vl->async);
+			__vanessa_logger_filename_commit(vl->data.d_filename);
+		}
+		return;
+	}
+
+	tls = __vanessa_logger_tls_get();
+	if (!tls) {
+		va_end(aq);
+		return;
+	}
+	start = __vanessa_logger_stats_start(vl);
+	rec = tls->buffer;
+	len = __vanessa_logger_binary_encode(vl, f, priority, prefix, fmt,
+			err, &ts, ap, rec, sizeof(tls->buffer), 0);
+	if (len > sizeof(tls->buffer)) {
+		rec = __vanessa_logger_tls_grow(tls, len);
+		if (rec) {
+			len = __vanessa_logger_binary_encode(vl, f, priority, 
+					prefix, fmt, err, &ts, aq, rec, len, 
+					1);
+		}
+	}
+	va_end(aq);
+	if (!rec) {
+		return;
+	}
+	start = __vanessa_logger_stats_format(vl, tls, start);
+
+	sync = priority <= __atomic_load_n(&vl->data.d_filename->sync_priority,
+			__ATOMIC_RELAXED);
+	status = __vanessa_logger_filename_write(vl->data.d_filename, rec,
+			len, sync);
+	if (sync) {
+		__vanessa_logger_filename_commit(vl->data.d_filename);
+	}
+	__vanessa_logger_stats_write(vl, tls, start, 1, len, status);
+}
+
+
+
+/**********************************************************************
+ * Decoding binary loggers
+ *
+ * The decoder keeps the ident and the format strings it has seen so
+ * that files written by one logger can be decoded one after the other,
+ * for instance a file and the files it was rotated to.
+ **********************************************************************/
+
+typedef struct {
+	char *fmt;
+	int nargs;
+} __vanessa_logger_decode_fmt_t;
+
+typedef struct {
+	char *s;
+	size_t len;
+	size_t size;
+} __vanessa_logger_sb_t;
+
+typedef struct {
+	char *ident;
+	__vanessa_logger_decode_fmt_t *fmt;
+	size_t nfmt;
+	__vanessa_logger_ts_cache_t ts;
+	__vanessa_logger_sb_t line;
+	__vanessa_logger_sb_t str;
+	char *rec;
+	size_t rec_size;
+} __vanessa_logger_decoder_t;
+
+#define __VANESSA_LOGGER_REC_MAX (size_t)(16 << 20)
+
+static int
+__vanessa_logger_sb_reserve(__vanessa_logger_sb_t *sb, size_t len)
+{
+	size_t size;
+	char *s;
+
+	if (sb->len + len < sb->size) {
+		return (0);
+	}
+	size = sb->size ? sb->size : 256;
+	while (size <= sb->len + len) {
+		size *= 2;
+	}
+	s = (char *) realloc(sb->s, size);
+	if (!s) {
+		return (-1);
+	}
+	sb->s = s;
+	sb->size = size;
+	return (0);
+}
+
+static int
+__vanessa_logger_sb_append(__vanessa_logger_sb_t *sb, const char *str,
+		size_t len)
+{
+	if (__vanessa_logger_sb_reserve(sb, len) < 0) {
+		return (-1);
+	}
+	memcpy(sb->s + sb->len, str, len);
+	sb->len += len;
+	sb->s[sb->len] = '\0';
+	return (0);
+}
+
+static int
+__vanessa_logger_sb_printf(__vanessa_logger_sb_t *sb, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (len < 0 || __vanessa_logger_sb_reserve(sb, len) < 0) {
+		return (-1);
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(sb->s + sb->len, len + 1, fmt, ap);
+	va_end(ap);
+	sb->len += len;
+	return (0);
+}
+
+/*
+ * Take len bytes from the record at *p, or a string if v is NULL,
+ * which is left NUL terminated in dec->str
+ */
+
+static int
+__vanessa_logger_decode_get(__vanessa_logger_decoder_t *dec,
+		const char **p, const char *end, void *v, size_t len)
+{
+	uint16_t len16;
+
+	if (!v) {
+		if (__vanessa_logger_decode_get(dec, p, end, &len16,
+					sizeof(len16)) < 0) {
+			return (-1);
+		}
+		dec->str.len = 0;
+		if ((size_t) (end - *p) < len16 ||
+				__vanessa_logger_sb_append(&dec->str, *p, 
+					len16) < 0) {
+			return (-1);
+		}
+		*p += len16;
+		return (0);
+	}
+
+	if ((size_t) (end - *p) < len) {
+		return (-1);
+	}
+	memcpy(v, *p, len);
+	*p += len;
+	return (0);
+}
+
+#define __VANESSA_LOGGER_DECODE_PRINTF(dec, sb, p, end, spec, nstar, star, \
+		type) \
+	do { \
+		type __v; \
+		if (__vanessa_logger_decode_get(dec, p, end, &__v, \
+					sizeof(__v)) < 0) { \
+			return (-1); \
+		} \
+		if (nstar == 2) { \
+			__vanessa_logger_sb_printf(sb, spec, star[0], \
+					star[1], __v); \
+		} \
+		else if (nstar == 1) { \
+			__vanessa_logger_sb_printf(sb, spec, star[0], __v); \
+		} \
+		else { \
+			__vanessa_logger_sb_printf(sb, spec, __v); \
+		} \
+	} while (0)
+
+
+/**********************************************************************
+ * __vanessa_logger_decode_args
+ * Internal function to expand a format string with the arguments
+ * recorded in a message record
+ * pre: dec: decoder
+ *      fmt: format string
+ *      p: arguments, advanced past those used
+ *      end: end of record
+ * post: expanded message is appended to dec->line
+ * return: 0 on success
+ *         -1 if the record is too short
+ **********************************************************************/
+
+static int
+__vanessa_logger_decode_args(__vanessa_logger_decoder_t *dec, 
+		const char *fmt, const char **p, const char *end)
+{
+	__vanessa_logger_sb_t *sb = &dec->line;
+	const char *s = fmt;
+	const char *q;
+	char spec[64];
+	int star[2];
+	int nstar;
+	int type;
+	int i;
+
+	while ((q = strchr(s, '%'))) {
+		__vanessa_logger_sb_append(sb, s, q - s);
+		s = q++;
+		if (__vanessa_logger_binary_spec(&q, &nstar, &type) < 0 ||
+				(size_t) (q - s) >= sizeof(spec)) {
+			return (-1);
+		}
+		if (type == __VANESSA_LOGGER_ARG_NONE) {
+			__vanessa_logger_sb_append(sb, "%", 1);
+			s = q;
+			continue;
+		}
+		memcpy(spec, s, q - s);
+		spec[q - s] = '\0';
+		s = q;
+
+		for (i = 0; i < nstar; i++) {
+			if (__vanessa_logger_decode_get(dec, p, end, star + i,
+						sizeof(*star)) < 0) {
+				return (-1);
+			}
+		}
+
+		switch (type) {
+		case __VANESSA_LOGGER_ARG_INT:
+			__VANESSA_LOGGER_DECODE_PRINTF(dec, sb, p, end, spec,
+					nstar, star, int);
+			break;
+		case __VANESSA_LOGGER_ARG_WINT:
+			__VANESSA_LOGGER_DECODE_PRINTF(dec, sb, p, end, spec,
+					nstar, star, wint_t);
+			break;
+		case __VANESSA_LOGGER_ARG_LONG:
+			__VANESSA_LOGGER_DECODE_PRINTF(dec, sb, p, end, spec,
+					nstar, star, long);
+			break;
+		case __VANESSA_LOGGER_ARG_LLONG:
+			__VANESSA_LOGGER_DECODE_PRINTF(dec, sb, p, end, spec,
+					nstar, star, long long);
+			break;
+		case __VANESSA_LOGGER_ARG_INTMAX:
+			__VANESSA_LOGGER_DECODE_PRINTF(dec, sb, p, end, spec,
+					nstar, star, intmax_t);
+			break;
+		case __VANESSA_LOGGER_ARG_SIZE:
+			__VANESSA_LOGGER_DECODE_PRINTF(dec, sb, p, end, spec,
+					nstar, star, size_t);
+			break;
+		case __VANESSA_LOGGER_ARG_PTRDIFF:
+			__VANESSA_LOGGER_DECODE_PRINTF(dec, sb, p, end, spec,
+					nstar, star, ptrdiff_t);
+			break;
+		case __VANESSA_LOGGER_ARG_DOUBLE:
+			__VANESSA_LOGGER_DECODE_PRINTF(dec, sb, p, end, spec,
+					nstar, star, double);
+			break;
+		case __VANESSA_LOGGER_ARG_LDOUBLE:
+			__VANESSA_LOGGER_DECODE_PRINTF(dec, sb, p, end, spec,
+					nstar, star, long double);
+			break;
+		case __VANESSA_LOGGER_ARG_PTR:
+			__VANESSA_LOGGER_DECODE_PRINTF(dec, sb, p, end, spec,
+					nstar, star, void *);
+			break;
+		case __VANESSA_LOGGER_ARG_ERRNO:
+			/* Recorded as the string %m expanded to */
+			spec[strlen(spec) - 1] = 's';
+			/* Fall through */
+		case __VANESSA_LOGGER_ARG_STR:
+			if (__vanessa_logger_decode_get(dec, p, end, NULL, 
+						0) < 0) {
+				return (-1);
+			}
+			if (nstar == 2) {
+				__vanessa_logger_sb_printf(sb, spec, star[0],
+						star[1], dec->str.s);
+			}
+			else if (nstar == 1) {
+				__vanessa_logger_sb_printf(sb, spec, star[0],
+						dec->str.s);
+			}
+			else {
+				__vanessa_logger_sb_printf(sb, spec, 
+						dec->str.s);
+			}
+			break;
+		}
+	}
+	__vanessa_logger_sb_append(sb, s, strlen(s));
+
+	return (0);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_decode_line
+ * Internal function to turn a message record back into a line
+ * pre: dec: decoder
+ *      rec: header of record
+ *      body: rest of record
+ *      end: end of record
+ * post: line, ending in a '\n', is left in dec->line. If the record is
+ *       damaged it holds as much of the line as could be decoded.
+ * return: none
+ **********************************************************************/
+
+static void
+__vanessa_logger_decode_line(__vanessa_logger_decoder_t *dec,
+		const __vanessa_logger_rec_t *rec, const char *body, 
+		const char *end)
+{
+	__vanessa_logger_rec_message_t msg;
+	__vanessa_logger_sb_t *sb = &dec->line;
+	char str[__VANESSA_LOGGER_TIMESTAMP_LEN];
+	struct timespec ts;
+	int add_colon = 0;
+	int status = -1;
+	int len;
+
+	sb->len = 0;
+	__vanessa_logger_sb_reserve(sb, 0);
+
+	if (__vanessa_logger_decode_get(dec, &body, end, &msg, 
+				sizeof(msg)) < 0) {
+		goto out;
+	}
+
+	if (rec->flag & VANESSA_LOGGER_F_TIMESTAMP) {
+		ts.tv_sec = msg.sec;
+		ts.tv_nsec = msg.nsec;
+		len = __vanessa_logger_timestamp_render(rec->flag, &dec->ts,
+				&ts, str);
+		if (len > 0) {
+			__vanessa_logger_sb_append(sb, str, len);
+			add_colon++;
+		}
+	}
+	if (dec->ident && !(rec->flag & VANESSA_LOGGER_F_NO_IDENT_PID)) {
+		__vanessa_logger_sb_printf(sb, "%s[%lu] ", dec->ident,
+				(unsigned long) msg.pid);
+		add_colon++;
+	}
+	if (add_colon) {
+		sb->len--;
+		__vanessa_logger_sb_append(sb, ": ", 2);
+	}
+
+	if (rec->type == __VANESSA_LOGGER_REC_MESSAGE_PREFIX) {
+		if (__vanessa_logger_decode_get(dec, &body, end, NULL, 0) < 0) {
+			goto out;
+		}
+		__vanessa_logger_sb_append(sb, dec->str.s, dec->str.len);
+		__vanessa_logger_sb_append(sb, ": ", 2);
+	}
+
+	if (!msg.id) {
+		if (__vanessa_logger_decode_get(dec, &body, end, NULL, 0) < 0) {
+			goto out;
+		}
+		__vanessa_logger_sb_append(sb, dec->str.s, dec->str.len);
+	}
+	else if (msg.id >= dec->nfmt || !dec->fmt[msg.id].fmt) {
+		__vanessa_logger_sb_printf(sb, "<unknown format %lu>",
+				(unsigned long) msg.id);
+	}
+	else if (__vanessa_logger_decode_args(dec, dec->fmt[msg.id].fmt, 
+				&body, end) < 0) {
+		goto out;
+	}
+	status = 0;
+
+out:
+	if (status < 0) {
+		__vanessa_logger_sb_append(sb, "<truncated record>", 18);
+	}
+	if (!sb->len || sb->s[sb->len - 1] != '\n') {
+		__vanessa_logger_sb_append(sb, "\n", 1);
+	}
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_decode_message
+ * Internal function to turn a message record back into a line
+ * pre: dec: decoder
+ *      rec: header of record
+ *      body: rest of record
+ *      end: end of record
+ *      fh: filehandle to write line to
+ * post: line is written to fh, if the record is damaged as much of
+ *       the line as could be decoded is written
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_decode_message(__vanessa_logger_decoder_t *dec,
+		const __vanessa_logger_rec_t *rec, const char *body, 
+		const char *end, FILE *fh)
+{
+	__vanessa_logger_sb_t *sb = &dec->line;
+
+	__vanessa_logger_decode_line(dec, rec, body, end);
+	if (sb->s && fwrite(sb->s, sb->len, 1, fh) != 1) {
+		return (-1);
+	}
+
+	return (0);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_decode_format
+ * Internal function to remember the format string in a format record
+ * pre: dec: decoder
+ *      body: record after its header
+ *      end: end of record
+ * post: format string is stored by its id
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+static int
+__vanessa_logger_decode_format(__vanessa_logger_decoder_t *dec,
+		const char *body, const char *end)
+{
+	__vanessa_logger_decode_fmt_t *fmt;
+	unsigned char arg[__VANESSA_LOGGER_BINARY_ARGS];
+	uint32_t id;
+	size_t n;
+
+	if (__vanessa_logger_decode_get(dec, &body, end, &id, 
+				sizeof(id)) < 0 ||
+			__vanessa_logger_decode_get(dec, &body, end, NULL, 
+				0) < 0 || !id) {
+		fprintf(stderr, "__vanessa_logger_decode_format: "
+				"damaged format record\n");
+		return (0);
+	}
+
+	if (id >= dec->nfmt) {
+		n = dec->nfmt ? dec->nfmt : 64;
+		while (n <= id) {
+			n *= 2;
+		}
+		fmt = (__vanessa_logger_decode_fmt_t *) realloc(dec->fmt,
+				n * sizeof(*fmt));
+		if (!fmt) {
+			perror("__vanessa_logger_decode_format: realloc");
+			return (-1);
+		}
+		memset(fmt + dec->nfmt, 0, (n - dec->nfmt) * sizeof(*fmt));
+		dec->fmt = fmt;
+		dec->nfmt = n;
+	}
+
+	free(dec->fmt[id].fmt);
+	dec->fmt[id].fmt = strdup(dec->str.s);
+	if (!dec->fmt[id].fmt) {
+		perror("__vanessa_logger_decode_format: strdup");
+		return (-1);
+	}
+	dec->fmt[id].nargs = __vanessa_logger_binary_parse(dec->str.s, arg);
+
+	return (0);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_decode_header
+ * Internal function to check the header record at the start of a file
+ * and take the ident from it
+ * pre: dec: decoder
+ *      body: record after its header
+ *      end: end of record
+ * post: dec->ident is set
+ * return: 0 on success
+ *         -1 if the file was written on an incompatible host
+ **********************************************************************/
+
+static int
+__vanessa_logger_decode_header(__vanessa_logger_decoder_t *dec,
+		const char *body, const char *end)
+{
+	char magic[sizeof(__vanessa_logger_binary_magic) + 4];
+
+	if (__vanessa_logger_decode_get(dec, &body, end, magic,
+				sizeof(magic)) < 0 ||
+			memcmp(magic, __vanessa_logger_binary_magic, 
+				sizeof(__vanessa_logger_binary_magic))) {
+		fprintf(stderr, "__vanessa_logger_decode_header: "
+				"not a binary log\n");
+		return (-1);
+	}
+	if (magic[8] != sizeof(long) || magic[9] != sizeof(void *) ||
+			magic[10] != sizeof(long double)) {
+		fprintf(stderr, "__vanessa_logger_decode_header: "
+				"written on an incompatible host\n");
+		return (-1);
+	}
+
+	if (__vanessa_logger_decode_get(dec, &body, end, NULL, 0) < 0) {
+		return (-1);
+	}
+	free(dec->ident);
+	dec->ident = strdup(dec->str.s);
+	if (!dec->ident) {
+		perror("__vanessa_logger_decode_header: strdup");
+		return (-1);
+	}
+
+	return (0);
+}
+
+
+/*
+ * Log a message that has already passed the priority check, which is
+ * made against the logger or against a category
+ */
+
+static void 
+__vanessa_logger_emit(__vanessa_logger_t * vl, int priority, 
+		const char *prefix, const char *fmt, va_list ap)
+{
+	if (vl->ready == __vanessa_logger_false) {
+		__vanessa_logger_stats_count(vl, NULL, 
+				__VANESSA_LOGGER_STAT_DROPPED);
+		return;
+	}
+
+	__vanessa_logger_reopen_check(vl);
+
+	if (vl->recorder) {
+		__vanessa_logger_recorder_check(vl, priority);
+	}
+
+	if (vl->binary) {
+		__vanessa_logger_do_binary(vl, priority, prefix, fmt, ap);
+		return;
+	}
+
+	/* Syslog loggers frame messages for their ring themselves */
+	if (vl->async && vl->type != __vanessa_logger_syslog) {
+		__vanessa_logger_do_async(vl, priority, prefix, fmt, ap);
+		if (vl->type == __vanessa_logger_filename && priority <= 
+				__atomic_load_n(
+					&vl->data.d_filename->sync_priority,
+					__ATOMIC_RELAXED)) {
+			__vanessa_logger_async_drain(vl->async);
+			__vanessa_logger_filename_commit(vl->data.d_filename);
+		}
+		return;
+	}
+
+	switch (vl->type) {
+		case __vanessa_logger_filehandle:
+			__vanessa_logger_do_fh(vl, priority, prefix, fmt, 
+					vl->data.d_filehandle, ap);
+			break;
+		case __vanessa_logger_filename:
+			__vanessa_logger_do_filename(vl, priority, prefix, fmt, 
+					ap);
+			break;
+		case __vanessa_logger_mmap:
+			__vanessa_logger_do_mmap(vl, priority, prefix, fmt, 
+					ap);
+			break;
+		case __vanessa_logger_syslog:
+			__vanessa_logger_do_syslog(vl, priority, prefix, fmt, 
+					ap);
+			break;
+		case __vanessa_logger_fanout:
+			__vanessa_logger_do_fanout(vl, priority, prefix, fmt, 
+					ap);
+			break;
+		case __vanessa_logger_function:
+			__vanessa_logger_do_func(vl, priority, prefix, fmt, ap,
+					vl->data.d_function);
+			break;
+		case __vanessa_logger_none:
+			break;
+	}
+}
+
+static void 
+__vanessa_logger_log(__vanessa_logger_t * vl, int priority, 
+		const char *prefix, const char *fmt, va_list ap)
+{
+	if (vl == NULL) {
+		return;
+	}
+
+	if (priority > vl->max_priority) {
+		if (vl->recorder) {
+			__vanessa_logger_record(vl, priority, prefix, fmt, ap);
+		}
+		return;
+	}
+
+	__vanessa_logger_emit(vl, priority, prefix, fmt, ap);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_get_facility_byname
+ * Given the name of a syslog facility as an ASCII string,
+ * return the facility as an integer.
+ * Relies on facilitynames[] being defined in syslog.h
+ * pre: facility_name: syslog facility as an ASCII string
+ * post: none
+ * return: logger as an int
+ *         -1 if facility_name cannot be found in facilitynames[],
+ *            if facility_name is NULL
+ *            or other error
+ **********************************************************************/
+
+static int 
+__vanessa_logger_get_facility_byname(const char *facility_name)
+{
+	int i;
+
+	extern CODE facilitynames[];
+
+	if (facility_name == NULL) {
+		fprintf(stderr,
+			"__vanessa_logger_get_facility_byname: "
+			"facility_name is NULL\n");
+		return (-1);
+	}
+
+	for (i = 0; facilitynames[i].c_name != NULL; i++) {
+		if (!strcmp(facility_name, facilitynames[i].c_name)) {
+			return (facilitynames[i].c_val);
+		}
+	}
+
+	fprintf(stderr,
+		"__vanessa_logger_get_facility_byname: facility \"%s\" "
+		"not found\n", facility_name);
+	return (-1);
+}
+
+/**********************************************************************
+ * vanessa_logger_openlog_syslog
+ * Exported function to open a logger that will log to syslog
+ * pre: facility: facility to log to syslog with
+ *      ident: Identity to prepend to each log
+ *      max_priority: Maximum priority no to log
+ *                    Priorities are integers, the levels listed
+ *                    in syslog(3) should be used for a syslog logger
+ *      option: options as per openlog(3)
+ *              See "Syslog loggers" in vanessa_logger.h for
+ *              those that are honoured
+ * post: Logger is opened
+ * return: pointer to logger
+ *         NULL on error
+ **********************************************************************/
+
+vanessa_logger_t *
+vanessa_logger_openlog_syslog(int facility, const char *ident,
+		const int max_priority, const int option)
+{
+	vanessa_logger_t *vl;
+
+	vl = vanessa_logger_openlog_syslog_path(NULL, facility, ident,
+			max_priority, option, VANESSA_LOGGER_F_NONE);
+	if (!vl) {
+		fprintf(stderr, "vanessa_logger_openlog_syslog: "
+			"vanessa_logger_openlog_syslog_path\n");
+		return (NULL);
+	}
+
+	return (vl);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_openlog_syslog_path
+ * Exported function to open a logger that will log to a syslog daemon
+ * listening on a given socket
+ * pre: path: path of socket of syslog daemon, NULL for /dev/log
+ *      facility: facility to log to syslog with
+ *      ident: Identity to prepend to each log
+ *      max_priority: Maximum priority no to log
+ *                    Priorities are integers, the levels listed
+ *                    in syslog(3) should be used for a syslog logger
+ *      option: options as per openlog(3)
+ *              See "Syslog loggers" in vanessa_logger.h for
+ *              those that are honoured
+ *      flag: flags for logger, of which VANESSA_LOGGER_F_ASYNC,
+ *            VANESSA_LOGGER_F_RFC5424, VANESSA_LOGGER_F_TIMESTAMP_UTC
+ *            and VANESSA_LOGGER_F_TIMESTAMP_COARSE are honoured
+ * post: Logger is opened. It is not an error if there is no syslog
+ *       daemon yet.
+ * return: pointer to logger
+ *         NULL on error
+ **********************************************************************/
+
+vanessa_logger_t *
+vanessa_logger_openlog_syslog_path(const char *path, const int facility,
+		const char *ident, const int max_priority, const int option,
+		const int flag)
+{
+	__vanessa_logger_t *vl;
+	__vanessa_logger_syslog_opt_t opt;
+
+	if ((vl = __vanessa_logger_create()) == NULL) {
+		fprintf(stderr, "vanessa_logger_openlog_syslog_path: "
+			"__vanessa_logger_create\n");
+		return (NULL);
+	}
+
+	opt.path = path;
+	opt.facility = facility;
+	opt.flag = flag & (VANESSA_LOGGER_F_ASYNC | 
+			VANESSA_LOGGER_F_RFC5424 |
+			VANESSA_LOGGER_F_TIMESTAMP_UTC |
+			VANESSA_LOGGER_F_TIMESTAMP_COARSE);
+
+	if (__vanessa_logger_set(vl, ident, max_priority,
+			 __vanessa_logger_syslog, (void *) &opt, 
+			option) == NULL) {
+		fprintf(stderr, "vanessa_logger_openlog_syslog_path: "
+			"__vanessa_logger_set\n");
+		return (NULL);
+	}
+
+	return ((vanessa_logger_t *) vl);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_openlog_syslog_byname
+ * Exported function to open a logger that will log to syslog
+ * pre: facility_name: Name of facility to log to syslog with
+ *      ident: Identity to prepend to each log
+ *      max_priority: Maximum priority no to log
+ *                    Priorities are integers, the levels listed
+ *                    in syslog(3) should be used for a syslog logger
+ *      option: options as per openlog(3)
+ *              See "Syslog loggers" in vanessa_logger.h for
+ *              those that are honoured
+ * post: Logger is opened
+ * return: pointer to logger
+ *         NULL on error
+ **********************************************************************/
+
+vanessa_logger_t *
+vanessa_logger_openlog_syslog_byname(const char *facility_name,
+		const char *ident, const int max_priority, const int option)
+{
+	__vanessa_logger_t *vl;
+	int facility;
+
+	facility = __vanessa_logger_get_facility_byname(facility_name);
+	if (facility < 0) {
+		fprintf(stderr, "vanessa_logger_open_syslog_byname: "
+			"__vanessa_logger_get_facility_byname\n");
+		return (NULL);
+	}
+
+	vl = vanessa_logger_openlog_syslog(facility, ident, max_priority,
+					   option);
+	if (!vl) {
+		fprintf(stderr,
+			"vanessa_logger_openlog_syslog: "
+			"vanessa_logger_openlog_syslog\n");
+		return (NULL);
+	}
+
+	return ((vanessa_logger_t *) vl);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_openlog_filehandle
+ * Exported function to open a logger that will log to a filehandle
+ * pre: filehandle: open filehandle to log to
+ *      ident: Identity to prepend to each log
+ *      max_priority: Maximum priority number to log
+ *                    Priorities are integers, the levels listed
+ *                    in syslog(3) should be used for a syslog logger
+ *      flag: flags for logger
+ *            See "Flags for filehandle or filename loggers"
+ *           in vanessa_logger.h for valid flags
+ * post: Logger is opened
+ * return: pointer to logger
+ *         NULL on error
+ **********************************************************************/
+
+vanessa_logger_t *
+vanessa_logger_openlog_filehandle(FILE * filehandle, const char *ident,
+		const int max_priority, const int flag)
+{
+	__vanessa_logger_t *vl;
+
+	if ((vl = __vanessa_logger_create()) == NULL) {
+		fprintf(stderr,
+			"vanessa_logger_openlog_filehandle: "
+			"__vanessa_logger_create\n");
+		return (NULL);
+	}
+
+	if (__vanessa_logger_set(vl, ident, max_priority, 
+			__vanessa_logger_filehandle, (void *) filehandle, 
+			flag) == NULL) {
+		fprintf(stderr, "vanessa_logger_openlog_filehandle: "
+				"__vanessa_logger_set\n");
+		return (NULL);
+	}
+
+	return ((vanessa_logger_t *) vl);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_openlog_filename
+ * Exported function to open a logger that will log to a filename
+ *          that will be opened
+ * pre: filename: filename to log to
+ *      ident: Identity to prepend to each log
+ *      max_priority: Maximum priority number to log
+ *                    Priorities are integers, the levels listed
+ *                    in syslog(3) should be used for a syslog logger
+ *      flag: flags for logger
+ *            See "Flags for filehandle or filename loggers"
+ *           in vanessa_logger.h for valid flags
+ * post: Logger is opened
+ * return: pointer to logger
+ *         NULL on error
+ **********************************************************************/
+
+vanessa_logger_t *
+vanessa_logger_openlog_filename(const char *filename, const char *ident,
+		const int max_priority, const int flag)
+{
+	vanessa_logger_t *vl;
+
+	vl = vanessa_logger_openlog_filename_flush(filename, ident,
+			max_priority, flag, VANESSA_LOGGER_FLUSH_LINE, 0);
+	if (!vl) {
+		fprintf(stderr, "vanessa_logger_openlog_filename: "
+			"vanessa_logger_openlog_filename_flush\n");
+		return (NULL);
+	}
+
+	return (vl);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_openlog_filename_flush
+ * Exported function to open a logger that will log to a filename
+ *          that will be opened, buffering lines according to a
+ *          flush policy
+ * pre: filename: filename to log to
+ *      ident: Identity to prepend to each log
+ *      max_priority: Maximum priority number to log
+ *                    Priorities are integers, the levels listed
+ *                    in syslog(3) should be used for a syslog logger
+ *      flag: flags for logger
+ *            See "Flags for filehandle or filename loggers"
+ *           in vanessa_logger.h for valid flags
+ *      flush: flush policy
+ *             See "Flush policies for filename loggers"
+ *             in vanessa_logger.h for valid policies
+ *      flush_value: bytes, messages or milliseconds for flush
+ * post: Logger is opened
+ * return: pointer to logger
+ *         NULL on error
+ **********************************************************************/
+
+vanessa_logger_t *
+vanessa_logger_openlog_filename_flush(const char *filename, 
+		const char *ident, const int max_priority, const int flag,
+		const int flush, const unsigned long flush_value)
+{
+	__vanessa_logger_t *vl;
+	__vanessa_logger_filename_opt_t opt;
+
+	if (!filename) {
+		return (NULL);
+	}
+
+	vl = __vanessa_logger_create();
+	if (!vl) {
+		fprintf(stderr, "vanessa_logger_openlog_filename_flush: "
+			"__vanessa_logger_create\n");
+		return (NULL);
+	}
+
+	opt.filename = filename;
+	opt.flush = flush;
+	opt.flush_value = flush_value;
+
+	if (__vanessa_logger_set(vl, ident, max_priority,
+			 __vanessa_logger_filename, (void *) &opt, 
+			flag) == NULL) {
+		fprintf(stderr, "vanessa_logger_openlog_filename_flush: "
+			"__vanessa_logger_set\n");
+		return (NULL);
+	}
+
+	return ((vanessa_logger_t *) vl);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_openlog_mmap
+ * Exported function to open a logger that will log to memory mapped
+ *          segment files
+ * pre: filename: base name of segment files to log to
+ *      ident: Identity to prepend to each log
+ *      max_priority: Maximum priority number to log
+ *                    Priorities are integers, the levels listed
+ *                    in syslog(3) should be used for a syslog logger
+ *      flag: flags for logger
+ *            See "Flags for filehandle or filename loggers"
+ *            in vanessa_logger.h for valid flags
+ *      segment_size: size of each segment in bytes, rounded up to
+ *                    a whole number of pages.
+ *                    0 for VANESSA_LOGGER_MMAP_SEGMENT_SIZE
+ * post: Logger is opened
+ * return: pointer to logger
+ *         NULL on error
+ **********************************************************************/
+
+vanessa_logger_t *
+vanessa_logger_openlog_mmap(const char *filename, const char *ident,
+		const int max_priority, const int flag, 
+		const size_t segment_size)
+{
+	__vanessa_logger_t *vl;
+	__vanessa_logger_mmap_opt_t opt;
+
+	if (!filename) {
+		return (NULL);
+	}
+
+	vl = __vanessa_logger_create();
+	if (!vl) {
+		fprintf(stderr, "vanessa_logger_openlog_mmap: "
+			"__vanessa_logger_create\n");
+		return (NULL);
+	}
+
+	opt.filename = filename;
+	opt.segment_size = segment_size;
+
+	if (__vanessa_logger_set(vl, ident, max_priority,
+			 __vanessa_logger_mmap, (void *) &opt, 
+			flag & ~VANESSA_LOGGER_F_ASYNC) == NULL) {
+		fprintf(stderr, "vanessa_logger_openlog_mmap: "
+			"__vanessa_logger_set\n");
+		return (NULL);
+	}
+
+	return ((vanessa_logger_t *) vl);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_mmap_dump
+ * Exported function to write out the lines held in a segment written
+ * by a memory mapped logger. Torn records are skipped.
+ * pre: segment: name of segment file
+ *      fh: filehandle to write lines to
+ * post: lines of valid records are written to fh
+ * return: number of valid records
+ *         -1 on error
+ **********************************************************************/
+
+long
+vanessa_logger_mmap_dump(const char *segment, FILE *fh)
+{
+	struct stat st;
+	unsigned long records = 0;
+	char *map;
+	int fd;
+
+	if (!segment || !fh) {
+		return (-1);
+	}
+
+	pthread_once(&__vanessa_logger_crc32c_once, 
+			__vanessa_logger_crc32c_init);
+
+	fd = open(segment, O_RDONLY);
+	if (fd < 0) {
+		perror("vanessa_logger_mmap_dump: open");
+		return (-1);
+	}
+	if (fstat(fd, &st) < 0) {
+		perror("vanessa_logger_mmap_dump: fstat");
+		close(fd);
+		return (-1);
+	}
+	if ((size_t) st.st_size < sizeof(__vanessa_logger_segment_hdr_t)) {
+		close(fd);
+		return (0);
+	}
+
+	map = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("vanessa_logger_mmap_dump: mmap");
+		return (-1);
+	}
+
+	if (memcmp(map, __vanessa_logger_segment_magic, 
+				sizeof(__vanessa_logger_segment_magic))) {
+		fprintf(stderr, "vanessa_logger_mmap_dump: "
+				"%s is not a segment\n", segment);
+		munmap(map, st.st_size);
+		return (-1);
+	}
+
+	__vanessa_logger_segment_scan(map, st.st_size, fh, &records);
+	munmap(map, st.st_size);
+
+	return ((long) records);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_decoder_create
+ * Exported function to create a decoder for the files written by
+ * VANESSA_LOGGER_F_BINARY loggers
+ * pre: none
+ * post: decoder is allocated
+ * return: decoder
+ *         NULL on error
+ **********************************************************************/
+
+vanessa_logger_decoder_t *
+vanessa_logger_decoder_create(void)
+{
+	__vanessa_logger_decoder_t *dec;
+
+	dec = (__vanessa_logger_decoder_t *) 
+		calloc(1, sizeof(__vanessa_logger_decoder_t));
+	if (!dec) {
+		perror("vanessa_logger_decoder_create: calloc");
+		return (NULL);
+	}
+	dec->ts.sec = (time_t) -1;
+
+	return ((vanessa_logger_decoder_t *) dec);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_decoder_destroy
+ * Exported function to free a decoder
+ * pre: decoder: decoder to free
+ * post: memory is freed
+ *       Nothing if decoder is NULL
+ * return: none
+ **********************************************************************/
+
+void
+vanessa_logger_decoder_destroy(vanessa_logger_decoder_t *decoder)
+{
+	__vanessa_logger_decoder_t *dec = 
+		(__vanessa_logger_decoder_t *) decoder;
+	size_t i;
+
+	if (!dec) {
+		return;
+	}
+
+	for (i = 0; i < dec->nfmt; i++) {
+		free(dec->fmt[i].fmt);
+	}
+	free(dec->fmt);
+	free(dec->ident);
+	free(dec->line.s);
+	free(dec->str.s);
+	free(dec->rec);
+	free(dec);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_decode
+ * Exported function to turn the records written by a
+ * VANESSA_LOGGER_F_BINARY logger back into lines of text
+ * pre: decoder: decoder, which remembers the format strings it has
+ *               seen so that a series of files can be decoded in turn
+ *      in: filehandle to read records from
+ *      out: filehandle to write lines to
+ * post: in is read to its end and lines are written to out.
+ *       Timestamps are rendered in the local time of the caller.
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+int
+vanessa_logger_decode(vanessa_logger_decoder_t *decoder, FILE *in, 
+		FILE *out)
+{
+	__vanessa_logger_decoder_t *dec = 
+		(__vanessa_logger_decoder_t *) decoder;
+	__vanessa_logger_rec_t rec;
+	size_t len;
+	char *body;
+	char *end;
+
+	if (!dec || !in || !out) {
+		return (-1);
+	}
+
+	while (1) {
+		len = fread(&rec, 1, sizeof(rec), in);
+		if (!len && feof(in)) {
+			break;
+		}
+		if (len != sizeof(rec)) {
+			fprintf(stderr, "vanessa_logger_decode: "
+					"truncated record at end of file\n");
+			break;
+		}
+		if (rec.len < sizeof(rec) || rec.len > __VANESSA_LOGGER_REC_MAX) {
+			fprintf(stderr, "vanessa_logger_decode: "
+					"damaged record\n");
+			return (-1);
+		}
+
+		len = rec.len - sizeof(rec);
+		if (len > dec->rec_size) {
+			body = (char *) realloc(dec->rec, len);
+			if (!body) {
+				perror("vanessa_logger_decode: realloc");
+				return (-1);
+			}
+			dec->rec = body;
+			dec->rec_size = len;
+		}
+		body = dec->rec;
+		end = body + len;
+		if (len && fread(body, len, 1, in) != 1) {
+			fprintf(stderr, "vanessa_logger_decode: "
+					"truncated record at end of file\n");
+			break;
+		}
+
+		switch (rec.type) {
+		case __VANESSA_LOGGER_REC_HEADER:
+			if (__vanessa_logger_decode_header(dec, body, end) < 0) {
+				return (-1);
+			}
+			break;
+		case __VANESSA_LOGGER_REC_FORMAT:
+			if (__vanessa_logger_decode_format(dec, body, end) < 0) {
+				return (-1);
+			}
+			break;
+		case __VANESSA_LOGGER_REC_MESSAGE:
+		case __VANESSA_LOGGER_REC_MESSAGE_PREFIX:
+			if (__vanessa_logger_decode_message(dec, &rec, body, 
+						end, out) < 0) {
+				perror("vanessa_logger_decode: fwrite");
+				return (-1);
+			}
+			break;
+		default:
+			/* Skip records this decoder does not know about */
+			break;
+		}
+	}
+
+	if (ferror(in)) {
+		perror("vanessa_logger_decode: fread");
+		return (-1);
+	}
+
+	return (0);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_openlog_function
+ * Exported function to open a logger that will log to a given function
+ * pre: function: function to use for logging
+ *      ident: Identity to prepend to each log
+ *      max_priority: Maximum priority number to log
+ *                    Priorities are integers, the levels listed
+ *                    in syslog(3) should be used for a syslog logger
+ *      option: ignored
+ * post: Logger is opened
+ * return: pointer to logger
+ *         NULL on error
+ **********************************************************************/
+
+vanessa_logger_t *
+vanessa_logger_openlog_function(vanessa_logger_log_function_va_t log_function, 
+		const char *ident, const int max_priority, const int option)
 {
 	__vanessa_logger_t *vl;
-	int facility;
 
-	facility = __vanessa_logger_get_facility_byname(facility_name);
-	if (facility < 0) {
-		fprintf(stderr, "vanessa_logger_open_syslog_byname: "
-			"__vanessa_logger_get_facility_byname\n");
+	if ((vl = __vanessa_logger_create()) == NULL) {
+		fprintf(stderr, "vanessa_logger_openlog_function: "
+			"__vanessa_logger_create\n");
+		return (NULL);
+	}
+
+	if (__vanessa_logger_set(vl, ident, max_priority,
+			 __vanessa_logger_function, (void *) log_function, 
+			option) == NULL) {
+		fprintf(stderr, "vanessa_logger_openlog_function: "
+			"__vanessa_logger_set\n");
+		return (NULL);
+	}
+
+	return ((vanessa_logger_t *) vl);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_openlog_fanout
+ * Exported function to open a logger that will log to other loggers
+ * pre: child: loggers to log to, which must not be fan-out loggers
+ *      n: number of elements in child
+ *      max_priority: Maximum priority number to log
+ *                    Priorities are integers, the levels listed
+ *                    in syslog(3) should be used for a syslog logger
+ * post: Logger is opened and owns the loggers in child, which are
+ *       closed when it is closed
+ * return: pointer to logger
+ *         NULL on error, in which case the loggers in child still
+ *         belong to the caller
+ **********************************************************************/
+
+vanessa_logger_t *
+vanessa_logger_openlog_fanout(vanessa_logger_t **child, const int n,
+		const int max_priority)
+{
+	__vanessa_logger_t *vl;
+	__vanessa_logger_fanout_opt_t opt;
+
+	if ((vl = __vanessa_logger_create()) == NULL) {
+		fprintf(stderr, "vanessa_logger_openlog_fanout: "
+			"__vanessa_logger_create\n");
+		return (NULL);
+	}
+
+	opt.child = child;
+	opt.n = n;
+	if (__vanessa_logger_set(vl, "", max_priority,
+			 __vanessa_logger_fanout, (void *) &opt, 0) == NULL) {
+		fprintf(stderr, "vanessa_logger_openlog_fanout: "
+			"__vanessa_logger_set\n");
+		return (NULL);
+	}
+
+	return ((vanessa_logger_t *) vl);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_change_max_priority
+ * Exported function to change the maximum priority that the logger
+ * will log.
+ * pre: vl: logger to change the maximum priority of
+ *      max_priority: Maximum priority number to log
+ *                    Priorities are integers, the levels listed
+ *                    in syslog(3) should be used for a syslog logger
+ * post: maximum priority of logger is changed
+ *       nothing if vl is NULL
+ * return: none
+ **********************************************************************/
+
+void 
+vanessa_logger_change_max_priority(vanessa_logger_t * vl, 
+		const int max_priority)
+{
+	if (vl == NULL) {
+		return;
+	}
+
+	((__vanessa_logger_t *) vl)->max_priority = max_priority;
+
+	/* Categories without a rule of their own follow the logger */
+	pthread_mutex_lock(&__vanessa_logger_category_lock);
+	__vanessa_logger_category_resolve_all((__vanessa_logger_t *) vl);
+	pthread_mutex_unlock(&__vanessa_logger_category_lock);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_category
+ * Exported function to register a category of a logger
+ * pre: vl: logger that the category logs through
+ *      name: name of category, such as "net.tls"
+ * post: category is registered with vl if it was not already
+ * return: handle for the category
+ *         NULL on error
+ **********************************************************************/
+
+vanessa_logger_category_t *
+vanessa_logger_category(vanessa_logger_t * vl, const char *name)
+{
+	__vanessa_logger_t *l = (__vanessa_logger_t *) vl;
+	vanessa_logger_category_t *cat;
+
+	if (vl == NULL || name == NULL) {
+		fprintf(stderr, "vanessa_logger_category: NULL argument\n");
+		return (NULL);
+	}
+
+	pthread_mutex_lock(&__vanessa_logger_category_lock);
+
+	for (cat = l->category; cat; cat = cat->next) {
+		if (!strcmp(cat->name, name)) {
+			goto out;
+		}
+	}
+
+	cat = (vanessa_logger_category_t *) malloc(sizeof(*cat));
+	if (!cat) {
+		perror("vanessa_logger_category: malloc");
+		goto out;
+	}
+	cat->name = strdup(name);
+	if (!cat->name) {
+		perror("vanessa_logger_category: strdup");
+		free(cat);
+		cat = NULL;
+		goto out;
+	}
+	cat->vl = vl;
+	cat->max_priority = __vanessa_logger_trie_resolve(l->rules, name,
+			l->max_priority);
+	cat->next = l->category;
+	l->category = cat;
+
+out:
+	pthread_mutex_unlock(&__vanessa_logger_category_lock);
+	return (cat);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_set_levels
+ * Exported function to set the levels of the categories of a logger
+ * pre: vl: logger to set levels of
+ *      rules: rules separated by ',' or white space, each of the form
+ *             pattern=level, for instance "*=warning,net.*=debug"
+ * post: rules of vl are replaced and the threshold of each of its
+ *       categories is worked out again
+ * return: 0 on success
+ *         -1 on error, in which case the rules are not changed
+ **********************************************************************/
+
+int
+vanessa_logger_set_levels(vanessa_logger_t * vl, const char *rules)
+{
+	__vanessa_logger_t *l = (__vanessa_logger_t *) vl;
+	__vanessa_logger_trie_t *root = NULL;
+	__vanessa_logger_trie_t *old;
+	char *buf = NULL;
+	char *rule;
+	char *save;
+	char *eq;
+	int level;
+
+	if (vl == NULL) {
+		fprintf(stderr, "vanessa_logger_set_levels: NULL logger\n");
+		return (-1);
+	}
+
+	if (rules && *rules) {
+		root = __vanessa_logger_trie_node(NULL, 0);
+		buf = strdup(rules);
+		if (!root || !buf) {
+			fprintf(stderr, "vanessa_logger_set_levels: "
+					"out of memory\n");
+			goto err;
+		}
+		for (rule = strtok_r(buf, ", \t\n", &save); rule; 
+				rule = strtok_r(NULL, ", \t\n", &save)) {
+			eq = strchr(rule, '=');
+			if (!eq) {
+				goto invalid;
+			}
+			*eq = '\0';
+			if (__vanessa_logger_level_parse(eq + 1, &level) < 0 ||
+					__vanessa_logger_trie_add(root, rule,
+						level) < 0) {
+				*eq = '=';
+				goto invalid;
+			}
+		}
+		free(buf);
+	}
+
+	pthread_mutex_lock(&__vanessa_logger_category_lock);
+	old = l->rules;
+	l->rules = root;
+	__vanessa_logger_category_resolve_all(l);
+	pthread_mutex_unlock(&__vanessa_logger_category_lock);
+
+	__vanessa_logger_trie_destroy(old);
+	return (0);
+
+invalid:
+	fprintf(stderr, "vanessa_logger_set_levels: invalid rule \"%s\"\n",
+			rule);
+err:
+	free(buf);
+	__vanessa_logger_trie_destroy(root);
+	return (-1);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_log_category
+ * Exported function to log a message in a category
+ * pre: cat: category to log in
+ *      priority: priority to log with
+ *      fmt: format of message to log
+ *      ...: data for fmt
+ * post: Message is logged if priority is no more than the threshold
+ *       of cat
+ * return: none
+ **********************************************************************/
+
+void
+vanessa_logger_log_category(vanessa_logger_category_t * cat, int priority,
+		const char *fmt, ...)
+{
+	va_list ap;
+
+	if (cat == NULL || priority > cat->max_priority) {
+		return;
+	}
+
+	va_start(ap, fmt);
+	__vanessa_logger_emit((__vanessa_logger_t *) cat->vl, priority, NULL,
+			fmt, ap);
+	va_end(ap);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_logv_category
+ * Exported function to log a message in a category
+ * Same as vanessa_logger_log_category but a va_list is given instead
+ * of a variable number of arguments.
+ **********************************************************************/
+
+void
+vanessa_logger_logv_category(vanessa_logger_category_t * cat, int priority,
+		const char *fmt, va_list ap)
+{
+	if (cat == NULL || priority > cat->max_priority) {
+		return;
+	}
+
+	__vanessa_logger_emit((__vanessa_logger_t *) cat->vl, priority, NULL,
+			fmt, ap);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_log_limit
+ * Exported function to log a message from a rate limited call site
+ * pre: site: site the message is logged from
+ *      vl: pointer to logger to log to
+ *      priority: priority to log with
+ *      fmt: format of message to log
+ *      ...: data for fmt
+ * post: Message is logged unless it is filtered out by priority,
+ *       dropped by the limit of site or is a repeat of the previous
+ *       message from site
+ * return: none
+ **********************************************************************/
+
+void
+vanessa_logger_log_limit(vanessa_logger_site_t * site, 
+		vanessa_logger_t * vl, int priority, const char *fmt, ...)
+{
+	__vanessa_logger_t *l = (__vanessa_logger_t *) vl;
+	char buf[__VANESSA_LOGGER_BUF_SIZE];
+	char *overflow = NULL;
+	const char *body;
+	unsigned long long now = 0;
+	unsigned long long hash;
+	unsigned int repeated;
+	int err = errno;
+	va_list ap;
+
+	if (l == NULL || site == NULL || priority > l->max_priority) {
+		return;
+	}
+
+	/* Drop messages over the limit before they are expanded */
+	if (site->rate) {
+		now = __vanessa_logger_site_now();
+		if (!__vanessa_logger_site_admit(site, now)) {
+			__atomic_add_fetch(&site->dropped, 1, 
+					__ATOMIC_RELAXED);
+			goto list;
+		}
+	}
+
+	va_start(ap, fmt);
+	body = __vanessa_logger_expand(buf, sizeof(buf), &overflow, err, 
+			fmt, ap);
+	va_end(ap);
+	if (!body) {
+		body = "vanessa_logger_log_limit: output truncated\n";
+	}
+
+	hash = __vanessa_logger_site_hash(body);
+	if (__atomic_exchange_n(&site->hash, hash, __ATOMIC_RELAXED) == hash) {
+		free(overflow);
+		__atomic_add_fetch(&site->repeated, 1, __ATOMIC_RELAXED);
+		if (!now) {
+			now = __vanessa_logger_site_now();
+		}
+		goto list;
+	}
+
+	repeated = __atomic_exchange_n(&site->repeated, 0, __ATOMIC_RELAXED);
+	if (repeated) {
+		vanessa_logger_log(vl, priority, 
+				"%s:%d: last message repeated %u times",
+				site->file, site->line, repeated);
+	}
+	vanessa_logger_log(vl, priority, "%s", body);
+	free(overflow);
+	return;
+
+list:
+	if (!__atomic_load_n(&site->listed, __ATOMIC_RELAXED)) {
+		__vanessa_logger_site_add(site, l, priority, now);
+	}
+}
+
+
+/**********************************************************************
+ * vanessa_logger_logkv
+ * Exported function to log a message with key/value pairs
+ * pre: vl: pointer to logger to log to
+ *      priority: priority to log with
+ *      msg: message, which is not used as a format
+ *      ...: key, type, value triples ended by a NULL key
+ * post: Message is logged as a line of JSON by VANESSA_LOGGER_F_JSON
+ *       loggers and as text followed by key=value pairs by others
+ * return: none
+ **********************************************************************/
+
+void
+vanessa_logger_logkv(vanessa_logger_t * vl, int priority, const char *msg,
+		...)
+{
+	va_list ap;
+
+	va_start(ap, msg);
+	vanessa_logger_logkvv(vl, priority, msg, ap);
+	va_end(ap);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_logkvv
+ * Exported function to log a message with key/value pairs
+ * Same as vanessa_logger_logkv but a va_list is given instead
+ * of a variable number of arguments.
+ **********************************************************************/
+
+void
+vanessa_logger_logkvv(vanessa_logger_t * vl, int priority, const char *msg,
+		va_list ap)
+{
+	__vanessa_logger_t *l = (__vanessa_logger_t *) vl;
+	__vanessa_logger_tls_t *tls;
+	char buf[__VANESSA_LOGGER_BUF_SIZE];
+	char *overflow = NULL;
+	const char *fields = buf;
+	va_list aq;
+	int json;
+	int len;
+	int i;
+
+	if (l == NULL || priority > l->max_priority || 
+			l->ready == __vanessa_logger_false) {
+		return;
+	}
+
+	/* Children may want JSON or text */
+	if (l->type == __vanessa_logger_fanout) {
+		__vanessa_logger_reopen_check(l);
+		for (i = 0; i < l->data.d_fanout->n; i++) {
+			va_copy(aq, ap);
+			vanessa_logger_logkvv(l->data.d_fanout->child[i],
+					priority, msg, aq);
+			va_end(aq);
+		}
+		return;
+	}
+
+	json = (l->flag & VANESSA_LOGGER_F_JSON) && !l->binary;
+
+	va_copy(aq, ap);
+	len = __vanessa_logger_kv_fmt(buf, sizeof(buf), json, ap);
+	if (len < 0) {
+		fprintf(stderr, "vanessa_logger_logkvv: unknown type\n");
+		*buf = '\0';
+		len = 0;
+	}
+	else if ((size_t) len >= sizeof(buf)) {
+		overflow = (char *) malloc(len + 1);
+		if (overflow) {
+			__vanessa_logger_kv_fmt(overflow, len + 1, json, aq);
+			fields = overflow;
+		}
+		else {
+			perror("vanessa_logger_logkvv: malloc");
+			*buf = '\0';
+			len = 0;
+		}
+	}
+	va_end(aq);
+
+	if (!json) {
+		vanessa_logger_log(vl, priority, "%s%s", msg, fields);
+		free(overflow);
+		return;
+	}
+
+	/* Picked up by __vanessa_logger_do_json() */
+	tls = __vanessa_logger_tls_get();
+	if (tls) {
+		tls->fields = fields;
+		tls->fields_len = len;
+	}
+	vanessa_logger_log(vl, priority, "%s", msg);
+	if (tls) {
+		tls->fields = NULL;
+	}
+	free(overflow);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_closelog
+ * Exported function to close a logger
+ * pre: vl: pointer to logger to close
+ * post: logger is closed and memory is freed
+ *       If global logger set by vanessa_logger_set() is being closed
+ *       then it is unset using vanessa_logger_unset()
+ * return: none
+ **********************************************************************/
+
+void 
+vanessa_logger_closelog(vanessa_logger_t * vl)
+{
+	if(vanessa_logger_get() == vl) {
+		vanessa_logger_unset();
+	}
+	__vanessa_logger_destroy((__vanessa_logger_t *) vl);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_log
+ * Exported function to log a message
+ * pre: vl: pointer to logger to log to
+ *      priority: Priority to log with.
+ *                If priority is more than max_priority as provided to
+ *                vanessa_logger_openlog_*.
+ *                Levels described in syslog(3) should be used for
+ *                syslog loggers as the priority will be used when
+ *                logging to syslog. These priorities may also be
+ *                used for filehandle and filename loggers.
+ *                Strangely with syslog higher priorities have
+ *                _lower_ priority numbers. For this
+ *                reason vanessa_logger regards messages with
+ *                lower priority numbers as being higher priority
+ *                than messages with lower priority. I suggest
+ *                just using the syslog priorities to avoid confusion.
+ *      fmt: format of message to log as per sprintf(3) for
+ *           filename and filehandle loggers and as
+ *           per syslog(3) for syslog loggers
+ *      ...: data for fmt
+ * post: Message is logged
+ * return: none
+ **********************************************************************/
+
+void 
+vanessa_logger_log(vanessa_logger_t * vl, int priority, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	__vanessa_logger_log((__vanessa_logger_t *) vl, priority, NULL, 
+			fmt, ap);
+	va_end(ap);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_logv
+ * Exported function to log a message
+ * Same as vanessa_logger_log but a va_list is given instead
+ * of a variable number of arguments.
+ **********************************************************************/
+
+void 
+vanessa_logger_logv(vanessa_logger_t * vl, int priority, const char *fmt, 
+		va_list ap)
+{
+	__vanessa_logger_log((__vanessa_logger_t *) vl, priority, NULL,
+			fmt, ap);
+}
+
+
+/**********************************************************************
+ * _vanessa_logger_log_prefix
+ * Exported function used by convenience macros to prefix a message
+ * with the function name that the message was generated in
+ **********************************************************************/
+
+void 
+_vanessa_logger_log_prefix(vanessa_logger_t * vl, int priority, 
+		const char *prefix, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	__vanessa_logger_log((__vanessa_logger_t *) vl, priority, prefix,
+			fmt, ap);
+	va_end(ap);
+}
+
+
+/**********************************************************************
+ * _vanessa_logger_log_desc
+ * Exported function used by convenience macros to log a message
+ * from a call site with a descriptor. The message is logged with the
+ * priority of the site, regardless of the max_priority of the logger
+ * if the site is VANESSA_LOGGER_DESC_ON.
+ **********************************************************************/
+
+void
+_vanessa_logger_log_desc(vanessa_logger_t * vl, vanessa_logger_desc_t *desc,
+		const char *prefix, const char *fmt, ...)
+{
+	__vanessa_logger_t *l = (__vanessa_logger_t *) vl;
+	__vanessa_logger_tls_t *tls = NULL;
+	va_list ap;
+
+	if (l == NULL) {
+		return;
+	}
+
+	if (desc->priority > l->max_priority &&
+			__atomic_load_n(&desc->enabled, __ATOMIC_RELAXED) != 
+			VANESSA_LOGGER_DESC_ON) {
+		if (l->recorder) {
+			va_start(ap, fmt);
+			__vanessa_logger_record(l, desc->priority, prefix,
+					fmt, ap);
+			va_end(ap);
+		}
+		return;
+	}
+
+	if (prefix == desc->func) {
+		tls = __vanessa_logger_tls_get();
+		if (tls) {
+			tls->prefix = desc->func;
+			tls->prefix_len = desc->func_len;
+		}
+	}
+
+	va_start(ap, fmt);
+	__vanessa_logger_emit(l, desc->priority, prefix, fmt, ap);
+	va_end(ap);
+
+	if (tls) {
+		tls->prefix = NULL;
+	}
+}
+
+
+/**********************************************************************
+ * _vanessa_logger_desc_register
+ * Exported function used to register the call sites of a programme
+ * or shared object. Called by each of its files that includes
+ * vanessa_logger.h, repeats are ignored.
+ **********************************************************************/
+
+void
+_vanessa_logger_desc_register(vanessa_logger_desc_t **start,
+		vanessa_logger_desc_t **stop)
+{
+	__vanessa_logger_desc_module_t *m;
+	vanessa_logger_desc_t **d;
+
+	if (!start || start >= stop) {
+		return;
+	}
+
+	pthread_mutex_lock(&__vanessa_logger_desc_lock);
+
+	for (m = __vanessa_logger_desc_list; m; m = m->next) {
+		if (m->start == start) {
+			goto out;
+		}
+	}
+
+	m = (__vanessa_logger_desc_module_t *) malloc(sizeof(*m));
+	if (!m) {
+		perror("_vanessa_logger_desc_register: malloc");
+		goto out;
+	}
+
+	for (d = start; d < stop; d++) {
+		if (*d) {
+			(*d)->id = __vanessa_logger_site_hash((*d)->fmt);
+		}
+	}
+
+	m->start = start;
+	m->stop = stop;
+	m->next = __vanessa_logger_desc_list;
+	__vanessa_logger_desc_list = m;
+
+out:
+	pthread_mutex_unlock(&__vanessa_logger_desc_lock);
+}
+
+
+/**********************************************************************
+ * _vanessa_logger_desc_unregister
+ * Exported function used to unregister the call sites of a programme
+ * or shared object as it is unloaded
+ **********************************************************************/
+
+void
+_vanessa_logger_desc_unregister(vanessa_logger_desc_t **start)
+{
+	__vanessa_logger_desc_module_t **m;
+	__vanessa_logger_desc_module_t *found;
+
+	if (!start) {
+		return;
+	}
+
+	pthread_mutex_lock(&__vanessa_logger_desc_lock);
+
+	for (m = &__vanessa_logger_desc_list; *m; m = &(*m)->next) {
+		if ((*m)->start == start) {
+			found = *m;
+			*m = found->next;
+			free(found);
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&__vanessa_logger_desc_lock);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_desc_foreach
+ * Exported function to list the registered call sites
+ * pre: func: called for each site with its descriptor and data.
+ *            Returning non-zero stops the walk.
+ *      data: passed to func
+ * post: func has been called for the sites
+ * return: 0 if every site was visited
+ *         value returned by func if it stopped the walk
+ **********************************************************************/
+
+int
+vanessa_logger_desc_foreach(vanessa_logger_desc_function_t func,
+		void *data)
+{
+	__vanessa_logger_desc_module_t *m;
+	vanessa_logger_desc_t **d;
+	int status = 0;
+
+	pthread_mutex_lock(&__vanessa_logger_desc_lock);
+
+	for (m = __vanessa_logger_desc_list; m && !status; m = m->next) {
+		for (d = m->start; d < m->stop && !status; d++) {
+			if (*d) {
+				status = func(*d, data);
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&__vanessa_logger_desc_lock);
+
+	return (status);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_desc_match
+ * Internal function to check whether a call site matches a pattern
+ * pre: desc: call site
+ *      pattern: as for vanessa_logger_desc_set()
+ * post: none
+ * return: 1 if desc matches pattern
+ *         0 otherwise
+ **********************************************************************/
+
+static int
+__vanessa_logger_desc_match(const vanessa_logger_desc_t *desc,
+		const char *pattern)
+{
+	char str[PATH_MAX + 16];
+	const char *base;
+	char *end;
+
+	if (*pattern == '#') {
+		errno = 0;
+		return (strtoull(pattern + 1, &end, 16) == desc->id &&
+				!errno && end != pattern + 1 && !*end);
+	}
+
+	base = strrchr(desc->file, '/');
+	base = base ? base + 1 : desc->file;
+
+	if (!fnmatch(pattern, desc->func, 0) ||
+			!fnmatch(pattern, desc->file, 0) ||
+			!fnmatch(pattern, base, 0)) {
+		return (1);
+	}
+
+	snprintf(str, sizeof(str), "%s:%u", desc->file, desc->line);
+	if (!fnmatch(pattern, str, 0)) {
+		return (1);
+	}
+
+	if (base != desc->file) {
+		snprintf(str, sizeof(str), "%s:%u", base, desc->line);
+		if (!fnmatch(pattern, str, 0)) {
+			return (1);
+		}
+	}
+
+	return (0);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_desc_set
+ * Exported function to switch call sites on or off
+ * pre: pattern: sites to switch, see vanessa_logger.h
+ *      enabled: VANESSA_LOGGER_DESC_OFF, VANESSA_LOGGER_DESC_DEFAULT
+ *               or VANESSA_LOGGER_DESC_ON
+ * post: matching sites are switched
+ * return: number of sites matched
+ *         -1 on error
+ **********************************************************************/
+
+int
+vanessa_logger_desc_set(const char *pattern, int enabled)
+{
+	__vanessa_logger_desc_module_t *m;
+	vanessa_logger_desc_t **d;
+	int count = 0;
+
+	if (!pattern || enabled < VANESSA_LOGGER_DESC_OFF ||
+			enabled > VANESSA_LOGGER_DESC_ON) {
+		fprintf(stderr, "vanessa_logger_desc_set: invalid argument\n");
+		return (-1);
+	}
+
+	pthread_mutex_lock(&__vanessa_logger_desc_lock);
+
+	for (m = __vanessa_logger_desc_list; m; m = m->next) {
+		for (d = m->start; d < m->stop; d++) {
+			if (!*d || !__vanessa_logger_desc_match(*d, pattern)) {
+				continue;
+			}
+			__atomic_store_n(&(*d)->enabled, enabled,
+					__ATOMIC_RELAXED);
+			count++;
+		}
+	}
+
+	pthread_mutex_unlock(&__vanessa_logger_desc_lock);
+
+	return (count);
+}
+
+
+/* Write out one call site for vanessa_logger_desc_dump() */
+
+static int
+__vanessa_logger_desc_dump_one(vanessa_logger_desc_t *desc, void *data)
+{
+	static const char *state[] = { "off", "default", "on" };
+	FILE *fh = (FILE *) data;
+	unsigned char enabled;
+	const char *c;
+
+	enabled = __atomic_load_n(&desc->enabled, __ATOMIC_RELAXED);
+	fprintf(fh, "%s:%u %s %d %016llx %s \"", desc->file, desc->line,
+			desc->func, desc->priority, desc->id,
+			enabled <= VANESSA_LOGGER_DESC_ON ? 
+			state[enabled] : "?");
+	for (c = desc->fmt; *c; c++) {
+		if (*c == '"' || *c == '\\') {
+			fputc('\\', fh);
+			fputc(*c, fh);
+		}
+		else if (*c == '\n') {
+			fputs("\\n", fh);
+		}
+		else {
+			fputc(*c, fh);
+		}
+	}
+	fputs("\"\n", fh);
+
+	return (0);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_desc_dump
+ * Exported function to write out the registered call sites
+ * pre: fh: filehandle to write to
+ * post: a line of the form
+ *         file:line func priority id state "fmt"
+ *       is written to fh for each site
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+int
+vanessa_logger_desc_dump(FILE *fh)
+{
+	if (!fh) {
+		fprintf(stderr, "vanessa_logger_desc_dump: invalid argument\n");
+		return (-1);
+	}
+
+	vanessa_logger_desc_foreach(__vanessa_logger_desc_dump_one, fh);
+
+	if (fflush(fh) || ferror(fh)) {
+		perror("vanessa_logger_desc_dump: fflush");
+		return (-1);
+	}
+
+	return (0);
+}
+
+/**********************************************************************
+ * vanessa_logger_set_flag
+ * Set flags for logger
+ * Should only be used on filehandle or filename loggers,
+ * ignored otherwise.
+ * pre: vl: logger to set flags of
+ *      flag: value to set flags to
+ *            See "Flags for filehandle or filename loggers"
+ *            in vanessa_logger.h for valid flags
+ * post: flag is set
+ * return: none
+ **********************************************************************/
+
+void
+vanessa_logger_set_flag(vanessa_logger_t * vl, vanessa_logger_flag_t flag)
+{
+	switch (((__vanessa_logger_t *)vl)->type) {
+		case __vanessa_logger_filehandle:
+		case __vanessa_logger_filename:
+		case __vanessa_logger_mmap:
+			/* These can only be set on open */
+			flag &= ~(VANESSA_LOGGER_F_ASYNC | 
+					VANESSA_LOGGER_F_BINARY);
+			flag |= ((__vanessa_logger_t *)vl)->flag & 
+				(VANESSA_LOGGER_F_ASYNC | 
+				 VANESSA_LOGGER_F_BINARY);
+			((__vanessa_logger_t *)vl)->flag = flag;
+			break;
+		case __vanessa_logger_syslog:
+		case __vanessa_logger_fanout:
+		case __vanessa_logger_function:
+		case __vanessa_logger_none:
+			break;
+	}
+}
+
+
+/**********************************************************************
+ * vanessa_logger_get_flag
+ * Set flags for logger
+ * Should only be used on filehandle or filename loggers,
+ * will return 0 for other types of loggers.
+ * See "Flags for filehandle or filename loggers"
+ * in vanessa_logger.h for valid flags
+ * pre: vl: logger to get flags of
+ * post: none
+ * return: flags for logger
+ **********************************************************************/
+
+vanessa_logger_flag_t
+vanessa_logger_get_flag(vanessa_logger_t * vl)
+{
+	switch (((__vanessa_logger_t *)vl)->type) {
+		case __vanessa_logger_filehandle:
+		case __vanessa_logger_filename:
+		case __vanessa_logger_mmap:
+			return ((__vanessa_logger_t *)vl)->flag;
+		case __vanessa_logger_syslog:
+		case __vanessa_logger_fanout:
+		case __vanessa_logger_function:
+		case __vanessa_logger_none:
+			return 0;
+	}
+
+	/* Not reached */
+	return 0;
+}
+
+
+/**********************************************************************
+ * vanessa_logger_set_max_len
+ * Set the length of the longest line a logger writes
+ * pre: vl: logger to change
+ *      max_len: longest line in bytes, including the trailing '\n'
+ *               and a NUL, at least VANESSA_LOGGER_MIN_LEN
+ * post: max_len is set
+ * return: none
+ **********************************************************************/
+
+void
+vanessa_logger_set_max_len(vanessa_logger_t * vl, size_t max_len)
+{
+	if (!vl) {
+		return;
+	}
+	if (max_len < VANESSA_LOGGER_MIN_LEN) {
+		max_len = VANESSA_LOGGER_MIN_LEN;
+	}
+
+	((__vanessa_logger_t *)vl)->max_len = max_len;
+}
+
+
+/**********************************************************************
+ * vanessa_logger_strherror_r
+ * Returns a string describing the error code present in errnum
+ * according to the errors for h_errno which is set by gethostbyname(3)
+ * gethostbyaddr(3) and others. Analogous to strerror_r(3).
+ * pre: errnum: Error to show as a string
+ *      buf: buffer to write error string to
+ *      n: length of buf in bytes
+ * post: on success error string is written to buf
+ *       on invalid input errno is set to -EINVAL
+ *       if buf is too short then errno is set to -ERANGE
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+int
+vanessa_logger_strherror_r(int errnum, char *buf, size_t n)
+{
+	size_t len;
+	char *str;
+
+	switch(errnum) {
+		case HOST_NOT_FOUND:
+			str = "Unknown host";
+			break;
+		case NO_ADDRESS:
+		/* case NO_DATA: */
+			str = "Host has no address";
+			break;
+		case NO_RECOVERY:
+			str = "Non-recoverable name server error";
+			break;
+		case TRY_AGAIN:
+			str = "Transient lookup error";
+			break;
+		default:
+			errno = -EINVAL;
+			return(-1);
+	}
+
+	len = strlen(str) + 1;
+	if(len > n) {
+		errno = -ERANGE;
+		return(-1);
+	}
+
+	memcpy(buf, str, len);
+	return(0);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_strherror
+ * Returns a string describing the error code present in errnum
+ * according to the errors for h_errno which is set by gethostbyname(3)
+ * gethostbyaddr(3) and others. Analogous to strerror_r(3).
+ * pre: errnum: Error to show as a string
+ * post: none on success
+ *       on invalid input errno is set to -EINVAL
+ *       if buf is too short then errno is set to -ERANGE
+ * return: error string for errnum on success
+ *         error string for newly set errno on error
+ **********************************************************************/
+
+char *
+vanessa_logger_strherror(int errnum)
+{
+	__vanessa_logger_tls_t *tls;
+	int status;
+
+	tls = __vanessa_logger_tls_get();
+	if (!tls) {
+		return(strerror(errno));
+	}
+
+	status = vanessa_logger_strherror_r(errnum, tls->strherror,
+			sizeof(tls->strherror));
+	if(status < 0) {
+		return(strerror(errno));
+	}
+
+	return(tls->strherror);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_reopen
+ * Exported function to reopen a logger
+ * pre: vl: pointer to logger to reopen
+ * post: logger is reopened
+ * return: 0 on success
+ *         -1 on error
+ *
+ * Note: Takes locks and may wait for other threads, so it must not be
+ *       called from a signal handler. Use
+ *       vanessa_logger_reopen_signal() there instead.
+ **********************************************************************/
+
+int vanessa_logger_reopen(vanessa_logger_t * vl)
+{
+	if (__vanessa_logger_reopen((__vanessa_logger_t *) vl)) {
+		fprintf(stderr,
+			"vanessa_logger_reopen: __vanessa_logger_reopen\n");
+		return (-1);
+	}
+	return (0);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_reopen_signal
+ * Exported function to ask for a logger to be reopened.
+ * Safe to call from a signal handler.
+ * pre: vl: pointer to logger to reopen
+ * post: the logger is reopened the next time a message is logged to it
+ * return: none
+ **********************************************************************/
+
+void
+vanessa_logger_reopen_signal(vanessa_logger_t * vl)
+{
+	__vanessa_logger_t *l = (__vanessa_logger_t *) vl;
+
+	if (!l) {
+		return;
+	}
+
+	__atomic_store_n(&l->reopen, 1, __ATOMIC_RELEASE);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_flush
+ * Exported function to write out any messages a logger is holding
+ * pre: vl: pointer to logger to flush
+ * post: Counts kept by rate limited call sites are logged.
+ *       Messages buffered by a filename logger or queued by a
+ *       VANESSA_LOGGER_F_ASYNC logger are written and a filehandle
+ *       logger's filehandle is flushed.
+ *       Nothing for other loggers or if vl is NULL.
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+int vanessa_logger_flush(vanessa_logger_t * vl)
+{
+	__vanessa_logger_t *l = (__vanessa_logger_t *) vl;
+
+	if (!l || l->ready == __vanessa_logger_false) {
+		return (0);
+	}
+
+	__vanessa_logger_site_report(l);
+
+	if (l->async) {
+		__vanessa_logger_async_drain(l->async);
+	}
+
+	switch (l->type) {
+	case __vanessa_logger_filename:
+		return (__vanessa_logger_filename_flush(l->data.d_filename));
+	case __vanessa_logger_filehandle:
+		return (fflush(l->data.d_filehandle) == EOF ? -1 : 0);
+	case __vanessa_logger_fanout:
+		{
+			int status = 0;
+			int i;
+
+			for (i = 0; i < l->data.d_fanout->n; i++) {
+				if (vanessa_logger_flush(
+						l->data.d_fanout->child[i]) 
+						< 0) {
+					status = -1;
+				}
+			}
+			return (status);
+		}
+	default:
+		break;
+	}
+
+	return (0);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_set_sync
+ * Exported function to set which messages a filename logger makes
+ * durable before returning to the caller
+ * pre: vl: pointer to logger to change
+ *      sync_priority: messages of this priority or lower are made
+ *                     durable. VANESSA_LOGGER_SYNC_NONE turns group
+ *                     commit off.
+ *      window_usec: microseconds to wait for other callers before
+ *                   calling fdatasync(2), may be 0
+ * post: group commit settings of logger are changed
+ * return: 0 on success
+ *         -1 on error, including if vl is not a filename logger
+ **********************************************************************/
+
+int vanessa_logger_set_sync(vanessa_logger_t * vl, int sync_priority,
+		unsigned long window_usec)
+{
+	__vanessa_logger_t *l = (__vanessa_logger_t *) vl;
+	__vanessa_logger_filename_data_t *d;
+
+	if (!l || l->type != __vanessa_logger_filename) {
+		return (-1);
+	}
+	d = l->data.d_filename;
+
+	pthread_mutex_lock(&d->sync_lock);
+	d->sync_window = window_usec;
+	__atomic_store_n(&d->sync_priority, sync_priority, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&d->sync_lock);
+
+	return (0);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_get_sync_stats
+ * Exported function to read the group commit counters of a filename
+ * logger
+ * pre: vl: pointer to logger
+ *      stats: counters are written here
+ * post: stats is filled in
+ * return: 0 on success
+ *         -1 on error, including if vl is not a filename logger
+ **********************************************************************/
+
+int vanessa_logger_get_sync_stats(vanessa_logger_t * vl,
+		vanessa_logger_sync_stats_t *stats)
+{
+	__vanessa_logger_t *l = (__vanessa_logger_t *) vl;
+	__vanessa_logger_filename_data_t *d;
+
+	if (!l || l->type != __vanessa_logger_filename || !stats) {
+		return (-1);
+	}
+	d = l->data.d_filename;
+
+	pthread_mutex_lock(&d->sync_lock);
+	*stats = d->stats;
+	pthread_mutex_unlock(&d->sync_lock);
+
+	return (0);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_set_rotate
+ * Exported function to set when a filename logger rotates its file
+ * pre: vl: pointer to logger to change
+ *      size: rotate once the file is this many bytes long, 0 for never
+ *      interval: rotate every interval seconds, counted from midnight
+ *                local time, 0 for never
+ *      naming: VANESSA_LOGGER_ROTATE_NUMBER or
+ *              VANESSA_LOGGER_ROTATE_DATE
+ *      keep: number of rotated files to keep, 0 to keep them all
+ * post: rotation settings of logger are changed
+ * return: 0 on success
+ *         -1 on error, including if vl is not a filename logger
+ **********************************************************************/
+
+int vanessa_logger_set_rotate(vanessa_logger_t * vl, 
+		unsigned long long size, unsigned long interval, int naming,
+		unsigned int keep)
+{
+	__vanessa_logger_t *l = (__vanessa_logger_t *) vl;
+	__vanessa_logger_filename_data_t *d;
+	__vanessa_logger_rotate_t *r;
+	struct stat st;
+	int status = 0;
+
+	if (!l || l->type != __vanessa_logger_filename) {
+		return (-1);
+	}
+	if (naming != VANESSA_LOGGER_ROTATE_NUMBER &&
+			naming != VANESSA_LOGGER_ROTATE_DATE) {
+		return (-1);
+	}
+	d = l->data.d_filename;
+
+	pthread_mutex_lock(&d->lock);
+	r = d->rotate;
+	if (!r) {
+		r = __vanessa_logger_rotate_create(d);
+		__atomic_store_n(&d->rotate, r, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&d->lock);
+	if (!r) {
+		return (-1);
+	}
+
+	pthread_mutex_lock(&r->lock);
+
+	/* After fork(2) the child has to start again */
+	if (r->fd < 0) {
+		r->fd = fcntl(d->fd, F_DUPFD_CLOEXEC, 0);
+		if (r->fd < 0) {
+			perror("vanessa_logger_set_rotate: fcntl");
+			status = -1;
+			goto out;
+		}
+	}
+
+	if (!size && !interval) {
+		__vanessa_logger_rotate_discard(d);
+	}
+	r->interval = interval;
+	r->naming = naming;
+	r->keep = keep;
+	r->retry = 0;
+	if (interval) {
+		r->deadline = __vanessa_logger_rotate_deadline(time(NULL),
+				interval);
+	}
+	__atomic_store_n(&r->bytes, fstat(d->fd, &st) ? 0 : st.st_size,
+			__ATOMIC_RELAXED);
+	__atomic_store_n(&r->size, size, __ATOMIC_RELAXED);
+
+	if (!r->running && (size || interval)) {
+		if (pthread_create(&r->thread, NULL, 
+					__vanessa_logger_rotator, d)) {
+			fprintf(stderr, "vanessa_logger_set_rotate: "
+					"pthread_create\n");
+			__atomic_store_n(&r->size, 0, __ATOMIC_RELAXED);
+			r->interval = 0;
+			status = -1;
+			goto out;
+		}
+		r->running = 1;
+	}
+	pthread_cond_signal(&r->cond);
+
+out:
+	pthread_mutex_unlock(&r->lock);
+	return (status);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_str_dump
+ * Sanitise a buffer into ASCII
+ * pre: vl: Vanessa logger to log errors to. May be NULL.
+ *      buffer: buffer to sanitise
+ *      size: number of bytes in buffer to sanitise
+ *      flag: If VANESSA_LOGGER_STR_DUMP_HEX then a hexadecimal dump
+ *            will be done. Else an octal dump will be done.
+ * post: a new buffer is allocated. For each byte in buffer
+ *       that is a printable ASCII character it is added to
+ *       the new buffer. All other characters are represented
+ *       in the new buffer as octal, in the form \xxx.
+ * return: the new buffer, this should be freed by the caller
+ *         NULL on error
+ **********************************************************************/
+
+/*
+ * An octal dump copies printable ASCII other than '\\', '"' and '\''
+ * as it is and escapes everything else. The output for each byte value
+ * is looked up in a table, which is filled in the first time it is
+ * needed. Where SSE2 is available bytes are classified 16 at a time
+ * and blocks that need no escaping are copied in one go.
+ */
+
+static struct {
+	char str[4];
+	size_t len;
+} __vanessa_logger_str_dump_oct_table[256];
+static pthread_once_t __vanessa_logger_str_dump_oct_once = PTHREAD_ONCE_INIT;
+
+static void
+__vanessa_logger_str_dump_oct_init(void)
+{
+	static const char escape[] = "\a\b\t\n\v\f\r\\\"'";
+	static const char letter[] = "abtnvfr\\\"'";
+	char *str;
+	const char *e;
+	int c;
+
+	for (c = 0; c < 256; c++) {
+		str = __vanessa_logger_str_dump_oct_table[c].str;
+		e = c ? strchr(escape, c) : NULL;
+		if (e) {
+			str[0] = '\\';
+			str[1] = letter[e - escape];
+			__vanessa_logger_str_dump_oct_table[c].len = 2;
+		}
+		else if (c >= ' ' && c <= '~') {
+			str[0] = c;
+			__vanessa_logger_str_dump_oct_table[c].len = 1;
+		}
+		else {
+			str[0] = '\\';
+			str[1] = '0' + (c >> 6);
+			str[2] = '0' + ((c >> 3) & 0x7);
+			str[3] = '0' + (c & 0x7);
+			__vanessa_logger_str_dump_oct_table[c].len = 4;
+		}
+	}
+}
+
+/* out always has room for 4 bytes, as no byte needs more */
+#define __VANESSA_LOGGER_STR_DUMP_OCT_BYTE(c, out) \
+	do { \
+		memcpy((out), __vanessa_logger_str_dump_oct_table[ \
+				(unsigned char) (c)].str, 4); \
+		(out) += __vanessa_logger_str_dump_oct_table[ \
+			(unsigned char) (c)].len; \
+	} while (0)
+
+static char *
+__vanessa_logger_str_dump_oct(const char *buffer, size_t buffer_length,
+		char *out)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i space = _mm_set1_epi8(' ' - 1);
+	const __m128i del = _mm_set1_epi8(0x7f);
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i dquote = _mm_set1_epi8('"');
+	const __m128i squote = _mm_set1_epi8('\'');
+	__m128i v;
+	int mask;
+	int j;
+#endif
+
+	pthread_once(&__vanessa_logger_str_dump_oct_once,
+			__vanessa_logger_str_dump_oct_init);
+
+#ifdef __SSE2__
+	for (; i + 16 <= buffer_length; i += 16) {
+		v = _mm_loadu_si128((const __m128i *) (buffer + i));
+		/* Signed, so bytes of 0x80 and over are not > ' ' - 1 */
+		mask = _mm_movemask_epi8(_mm_andnot_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, backslash),
+					_mm_or_si128(_mm_cmpeq_epi8(v, dquote),
+						_mm_cmpeq_epi8(v, squote))),
+				_mm_and_si128(_mm_cmpgt_epi8(v, space),
+					_mm_cmplt_epi8(v, del))));
+		if (mask == 0xffff) {
+			_mm_storeu_si128((__m128i *) out, v);
+			out += 16;
+			continue;
+		}
+		for (j = 0; j < 16; j++) {
+			__VANESSA_LOGGER_STR_DUMP_OCT_BYTE(buffer[i + j], out);
+		}
+	}
+#endif
+
+	for (; i < buffer_length; i++) {
+		__VANESSA_LOGGER_STR_DUMP_OCT_BYTE(buffer[i], out);
+	}
+
+	*out = '\0';
+
+	return (out);
+}
+
+/*
+ * Bytes are written as pairs of hex digits with a space after each
+ * group of four, other than the last. Where SSE2 is available the
+ * digits of 16 bytes are worked out at a time.
+ */
+
+static char *
+__vanessa_logger_str_dump_hex(const char *buffer, size_t buffer_length,
+		char *out)
+{
+	static const char digit[] = "0123456789abcdef";
+	const unsigned char *in = (const unsigned char *) buffer;
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i zero = _mm_set1_epi8('0');
+	const __m128i alpha = _mm_set1_epi8('a' - '0' - 10);
+	__m128i v;
+	__m128i hex[2];
+	int j;
+
+	for (; i + 16 <= buffer_length; i += 16) {
+		v = _mm_loadu_si128((const __m128i *) (in + i));
+		hex[0] = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+		v = _mm_and_si128(v, nibble);
+		hex[1] = _mm_unpackhi_epi8(hex[0], v);
+		hex[0] = _mm_unpacklo_epi8(hex[0], v);
+		for (j = 0; j < 2; j++) {
+			hex[j] = _mm_add_epi8(hex[j], _mm_add_epi8(zero,
+					_mm_and_si128(_mm_cmpgt_epi8(hex[j], 
+							nine), alpha)));
+			_mm_storel_epi64((__m128i *) out, hex[j]);
+			out[8] = ' ';
+			_mm_storel_epi64((__m128i *) (out + 9), 
+					_mm_unpackhi_epi64(hex[j], hex[j]));
+			out[17] = ' ';
+			out += 18;
+		}
+	}
+#endif
+
+	for (; i < buffer_length; i++) {
+		*out++ = digit[in[i] >> 4];
+		*out++ = digit[in[i] & 0xf];
+		if ((i & 0x3) == 3) {
+			*out++ = ' ';
+		}
+	}
+
+	/* No space after the last group */
+	if (buffer_length && !(buffer_length & 0x3)) {
+		out--;
+	}
+	*out = '\0';
+
+	return (out);
+}
+
+
+char *
+vanessa_logger_str_dump(vanessa_logger_t * vl, const char *buffer, 
+		const size_t buffer_length, vanessa_logger_flag_t flag)
+{
+	size_t len;
+	char *out;
+
+	len = VANESSA_LOGGER_STR_DUMP_LEN(buffer_length, flag);
+	out = (char *) malloc(len);
+	if (!out) {
+		vanessa_logger_log(vl, LOG_DEBUG, 
+				"vanessa_logger_str_dump: malloc: %s",
+				strerror(errno));
+		return (NULL);
+	}
+
+	return (vanessa_logger_str_dump_r(vl, buffer, buffer_length, flag,
+				out, len));
+}
+
+
+/**********************************************************************
+ * vanessa_logger_str_dump_r
+ * Sanitise a buffer into ASCII in memory provided by the caller
+ * pre: vl: Vanessa logger to log errors to. May be NULL.
+ *      buffer: buffer to sanitise
+ *      buffer_length: number of bytes in buffer to sanitise
+ *      flag: as for vanessa_logger_str_dump()
+ *      out: memory to write the result to
+ *      out_len: size of out, which must be at least
+ *               VANESSA_LOGGER_STR_DUMP_LEN(buffer_length, flag)
+ * post: out holds the result of vanessa_logger_str_dump()
+ * return: out
+ *         NULL if out_len is too small
+ **********************************************************************/
+
+char *
+vanessa_logger_str_dump_r(vanessa_logger_t * vl, const char *buffer, 
+		const size_t buffer_length, vanessa_logger_flag_t flag,
+		char *out, const size_t out_len)
+{
+	if (out_len < VANESSA_LOGGER_STR_DUMP_LEN(buffer_length, flag)) {
+		vanessa_logger_log(vl, LOG_DEBUG, "vanessa_logger_str_dump_r: "
+				"output buffer too small");
 		return (NULL);
 	}
 
-	vl = vanessa_logger_openlog_syslog(facility, ident, max_priority,
-					   option);
-	if (!vl) {
-		fprintf(stderr,
-			"vanessa_logger_openlog_syslog: "
-			"vanessa_logger_openlog_syslog\n");
-		return (NULL);
+	if(flag == VANESSA_LOGGER_STR_DUMP_HEX) {
+		__vanessa_logger_str_dump_hex(buffer, buffer_length, out);
+	}
+	else {
+		__vanessa_logger_str_dump_oct(buffer, buffer_length, out);
+	}
+
+	return (out);
+}			 
+
+
+/**********************************************************************
+ * vanessa_logger_log_hexdump
+ * Exported function to log a buffer as a hex dump, like xxd(1)
+ * pre: vl: pointer to logger to log to
+ *      priority: priority to log with
+ *      buffer: buffer to dump
+ *      buffer_length: number of bytes in buffer
+ * post: Each 16 bytes of buffer are logged as a line of their
+ *       offset, hex and ASCII
+ *       Nothing if priority is filtered out
+ * return: none
+ **********************************************************************/
+
+#define __VANESSA_LOGGER_HEXDUMP_WIDTH 16
+
+void
+vanessa_logger_log_hexdump(vanessa_logger_t * vl, int priority,
+		const void *buffer, size_t buffer_length)
+{
+	static const char digit[] = "0123456789abcdef";
+	const unsigned char *in = (const unsigned char *) buffer;
+	/* Offset, hex, ASCII: 16 + 2 + 40 + 1 + 16 + 1 */
+	char line[80];
+	unsigned long long offset;
+	size_t n;
+	size_t i;
+	char *p;
+	int shift;
+
+	if (vl == NULL || 
+			priority > ((__vanessa_logger_t *) vl)->max_priority) {
+		return;
+	}
+
+	/* Each line is rendered in place, so no memory is allocated */
+	for (offset = 0; offset < buffer_length; 
+			offset += __VANESSA_LOGGER_HEXDUMP_WIDTH) {
+		p = line;
+
+		/* At least eight digits, more for large buffers */
+		shift = 60;
+		while (shift > 28 && !(offset >> shift)) {
+			shift -= 4;
+		}
+		for (; shift >= 0; shift -= 4) {
+			*p++ = digit[(offset >> shift) & 0xf];
+		}
+		*p++ = ':';
+		*p++ = ' ';
+
+		n = buffer_length - offset;
+		if (n > __VANESSA_LOGGER_HEXDUMP_WIDTH) {
+			n = __VANESSA_LOGGER_HEXDUMP_WIDTH;
+		}
+		for (i = 0; i < __VANESSA_LOGGER_HEXDUMP_WIDTH; i++) {
+			if (i < n) {
+				*p++ = digit[in[i] >> 4];
+				*p++ = digit[in[i] & 0xf];
+			}
+			else {
+				*p++ = ' ';
+				*p++ = ' ';
+			}
+			if (i & 0x1) {
+				*p++ = ' ';
+			}
+		}
+		*p++ = ' ';
+
+		for (i = 0; i < n; i++) {
+			*p++ = (in[i] >= ' ' && in[i] <= '~') ? in[i] : '.';
+		}
+		*p = '\0';
+
+		vanessa_logger_log(vl, priority, "%s", line);
+		in += n;
+	}
+}
+
+
+/**********************************************************************
+ * vanessa_logger_set_stats
+ * Exported function to turn the statistics of a logger on or off
+ * pre: vl: pointer to logger
+ *      enable: non-zero to turn statistics on, 0 to turn them off
+ * post: statistics are collected, or not. Counts are kept when
+ *       statistics are turned off and on again.
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+int
+vanessa_logger_set_stats(vanessa_logger_t * vl, int enable)
+{
+	__vanessa_logger_t *l = (__vanessa_logger_t *) vl;
+	__vanessa_logger_stats_t *stats;
+	__vanessa_logger_stats_t *expected = NULL;
+	void *mem;
+
+	if (!l) {
+		return (-1);
+	}
+
+	stats = __atomic_load_n(&l->stats, __ATOMIC_ACQUIRE);
+	if (!stats && enable) {
+		if (posix_memalign(&mem, 64, sizeof(*stats))) {
+			perror("vanessa_logger_set_stats: posix_memalign");
+			return (-1);
+		}
+		stats = (__vanessa_logger_stats_t *) mem;
+		memset(stats, 0, sizeof(*stats));
+		if (!__atomic_compare_exchange_n(&l->stats, &expected, stats,
+					0, __ATOMIC_ACQ_REL,
+					__ATOMIC_ACQUIRE)) {
+			/* Turned on by another thread */
+			free(stats);
+			stats = expected;
+		}
+	}
+	if (stats) {
+		__atomic_store_n(&stats->enabled, !!enable, __ATOMIC_RELAXED);
+	}
+
+	return (0);
+}
+
+
+/*
+ * Add a histogram of a shard to a total
+ */
+
+static void
+__vanessa_logger_histogram_add(vanessa_logger_histogram_t *to,
+		vanessa_logger_histogram_t *from)
+{
+	unsigned long long n;
+	int i;
+
+	for (i = 0; i < VANESSA_LOGGER_STATS_BUCKETS; i++) {
+		n = __atomic_load_n(from->bucket + i, __ATOMIC_RELAXED);
+		to->bucket[i] += n;
+		to->count += n;
+	}
+	to->sum_nsec += __atomic_load_n(&from->sum_nsec, __ATOMIC_RELAXED);
+}
+
+
+/**********************************************************************
+ * vanessa_logger_get_stats
+ * Exported function to read the statistics of a logger
+ * pre: vl: pointer to logger
+ *      stats: statistics are written here
+ * post: stats is filled in, with zeros if statistics have never
+ *       been turned on
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+int
+vanessa_logger_get_stats(vanessa_logger_t * vl, vanessa_logger_stats_t *stats)
+{
+	__vanessa_logger_t *l = (__vanessa_logger_t *) vl;
+	__vanessa_logger_stats_t *s;
+	__vanessa_logger_shard_t *shard;
+	unsigned long long count[__VANESSA_LOGGER_STATS];
+	int i;
+	int j;
+
+	if (!l || !stats) {
+		return (-1);
+	}
+
+	memset(stats, 0, sizeof(*stats));
+	s = __atomic_load_n(&l->stats, __ATOMIC_ACQUIRE);
+	if (!s) {
+		return (0);
+	}
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < __VANESSA_LOGGER_STATS_SHARDS; i++) {
+		shard = s->shard + i;
+		for (j = 0; j < __VANESSA_LOGGER_STATS; j++) {
+			count[j] += __atomic_load_n(shard->count + j,
+					__ATOMIC_RELAXED);
+		}
+		__vanessa_logger_histogram_add(&stats->format, &shard->format);
+		__vanessa_logger_histogram_add(&stats->write, &shard->write);
 	}
 
-	return ((vanessa_logger_t *) vl);
+	stats->written = count[__VANESSA_LOGGER_STAT_WRITTEN];
+	stats->bytes = count[__VANESSA_LOGGER_STAT_BYTES];
+	stats->dropped = count[__VANESSA_LOGGER_STAT_DROPPED];
+	stats->truncated = count[__VANESSA_LOGGER_STAT_TRUNCATED];
+	stats->write_errors = count[__VANESSA_LOGGER_STAT_WRITE_ERRORS];
+
+	return (0);
 }
 
 
 /**********************************************************************
- * vanessa_logger_openlog_filehandle
- * Exported function to open a logger that will log to a filehandle
- * pre: filehandle: open filehandle to log to
- *      ident: Identity to prepend to each log
- *      max_priority: Maximum priority number to log
- *                    Priorities are integers, the levels listed
- *                    in syslog(3) should be used for a syslog logger
- *      flag: flags for logger
- *            See "Flags for filehandle or filename loggers"
- *           in vanessa_logger.h for valid flags
- * post: Logger is opened
- * return: pointer to logger
+ * __vanessa_logger_stats_text
+ * Internal function to render the statistics of a logger in the
+ * Prometheus text exposition format
+ * pre: vl: pointer to logger
+ *      len: length of the text is written here
+ * post: text is allocated, the caller should free it
+ * return: text
  *         NULL on error
  **********************************************************************/
 
-vanessa_logger_t *
-vanessa_logger_openlog_filehandle(FILE * filehandle, const char *ident,
-		const int max_priority, const int flag)
+static const struct {
+	const char *name;
+	const char *help;
+	size_t offset;
+} __vanessa_logger_stats_counters[] = {
+	{ "messages_total", "Messages handed to the sink",
+		offsetof(vanessa_logger_stats_t, written) },
+	{ "bytes_total", "Bytes in messages handed to the sink",
+		offsetof(vanessa_logger_stats_t, bytes) },
+	{ "dropped_total", "Messages dropped as the logger was not ready",
+		offsetof(vanessa_logger_stats_t, dropped) },
+	{ "truncated_total", "Messages that could not be formatted in full",
+		offsetof(vanessa_logger_stats_t, truncated) },
+	{ "write_errors_total", "Failed writes",
+		offsetof(vanessa_logger_stats_t, write_errors) },
+	{ NULL, NULL, 0 }
+};
+
+static void
+__vanessa_logger_stats_histogram(FILE *fh, const char *name,
+		const char *help, const char *label,
+		vanessa_logger_histogram_t *h)
 {
-	__vanessa_logger_t *vl;
+	unsigned long long n = 0;
+	int i;
 
-	if ((vl = __vanessa_logger_create()) == NULL) {
-		fprintf(stderr,
-			"vanessa_logger_openlog_filehandle: "
-			"__vanessa_logger_create\n");
+	fprintf(fh, "# HELP vanessa_logger_%s %s\n"
+			"# TYPE vanessa_logger_%s histogram\n",
+			name, help, name);
+	for (i = 0; i < VANESSA_LOGGER_STATS_BUCKETS - 1; i++) {
+		n += h->bucket[i];
+		fprintf(fh, "vanessa_logger_%s_bucket{%s,le=\"%.10g\"} %llu\n",
+				name, label, ldexp(1e-9, i), n);
+	}
+	fprintf(fh, "vanessa_logger_%s_bucket{%s,le=\"+Inf\"} %llu\n"
+			"vanessa_logger_%s_sum{%s} %.9f\n"
+			"vanessa_logger_%s_count{%s} %llu\n",
+			name, label, h->count, name, label,
+			h->sum_nsec / 1e9, name, label, h->count);
+}
+
+static char *
+__vanessa_logger_stats_text(__vanessa_logger_t * vl, size_t *len)
+{
+	vanessa_logger_stats_t stats;
+	char *label;
+	char *text;
+	const char *ident;
+	FILE *fh;
+	size_t label_len;
+	int i;
+
+	if (vanessa_logger_get_stats((vanessa_logger_t *) vl, &stats) < 0) {
 		return (NULL);
 	}
 
-	if (__vanessa_logger_set(vl, ident, max_priority, 
-			__vanessa_logger_filehandle, (void *) filehandle, 
-			flag) == NULL) {
-		fprintf(stderr, "vanessa_logger_openlog_filehandle: "
-				"__vanessa_logger_set\n");
+	/* ident="...", with \, " and newline escaped */
+	ident = vl->ident ? vl->ident : "";
+	label = (char *) malloc(strlen(ident) * 2 + 9);
+	if (!label) {
+		perror("__vanessa_logger_stats_text: malloc");
+		return (NULL);
+	}
+	label_len = sprintf(label, "ident=\"");
+	for (; *ident; ident++) {
+		if (*ident == '\\' || *ident == '"' || *ident == '\n') {
+			label[label_len++] = '\\';
+		}
+		label[label_len++] = *ident == '\n' ? 'n' : *ident;
+	}
+	label[label_len++] = '"';
+	label[label_len] = '\0';
+
+	fh = open_memstream(&text, len);
+	if (!fh) {
+		perror("__vanessa_logger_stats_text: open_memstream");
+		free(label);
+		return (NULL);
+	}
+	for (i = 0; __vanessa_logger_stats_counters[i].name; i++) {
+		fprintf(fh, "# HELP vanessa_logger_%s %s\n"
+				"# TYPE vanessa_logger_%s counter\n"
+				"vanessa_logger_%s{%s} %llu\n",
+				__vanessa_logger_stats_counters[i].name,
+				__vanessa_logger_stats_counters[i].help,
+				__vanessa_logger_stats_counters[i].name,
+				__vanessa_logger_stats_counters[i].name, label,
+				*(unsigned long long *)((char *) &stats +
+				__vanessa_logger_stats_counters[i].offset));
+	}
+	__vanessa_logger_stats_histogram(fh, "format_seconds",
+			"Time taken to format messages", label, &stats.format);
+	__vanessa_logger_stats_histogram(fh, "write_seconds",
+			"Time taken to write messages", label, &stats.write);
+	free(label);
+
+	if (fclose(fh) == EOF) {
+		perror("__vanessa_logger_stats_text: fclose");
+		free(text);
 		return (NULL);
 	}
 
-	return ((vanessa_logger_t *) vl);
+	return (text);
 }
 
 
 /**********************************************************************
- * vanessa_logger_openlog_filename
- * Exported function to open a logger that will log to a filename
- *          that will be opened
- * pre: filename: filename to log to
- *      ident: Identity to prepend to each log
- *      max_priority: Maximum priority number to log
- *                    Priorities are integers, the levels listed
- *                    in syslog(3) should be used for a syslog logger
- *      flag: flags for logger
- *            See "Flags for filehandle or filename loggers"
- *           in vanessa_logger.h for valid flags
- * post: Logger is opened
- * return: pointer to logger
- *         NULL on error
+ * vanessa_logger_export_stats
+ * Exported function to write the statistics of a logger to a file in
+ * the Prometheus text exposition format
+ * pre: vl: pointer to logger
+ *      filename: file to write to. It is written as filename.tmp
+ *                and renamed, so readers never see part of it.
+ * post: filename is replaced
+ * return: 0 on success
+ *         -1 on error
  **********************************************************************/
 
-vanessa_logger_t *
-vanessa_logger_openlog_filename(const char *filename, const char *ident,
-		const int max_priority, const int flag)
+int
+vanessa_logger_export_stats(vanessa_logger_t * vl, const char *filename)
 {
-	__vanessa_logger_t *vl;
+	char *text;
+	char *tmp;
+	size_t len;
+	FILE *fh;
+	int status = -1;
 
-	vl = __vanessa_logger_create();
-	if (!vl) {
-		fprintf(stderr, "vanessa_logger_openlog_filename: "
-			"__vanessa_logger_create\n");
-		return (NULL);
+	if (!vl || !filename) {
+		return (-1);
 	}
 
-	if (__vanessa_logger_set(vl, ident, max_priority,
-			 __vanessa_logger_filename, (void *) filename, 
-			flag) == NULL) {
-		fprintf(stderr, "vanessa_logger_openlog_filename: "
-			"__vanessa_logger_set\n");
-		return (NULL);
+	text = __vanessa_logger_stats_text((__vanessa_logger_t *) vl, &len);
+	if (!text) {
+		return (-1);
+	}
+	tmp = (char *) malloc(strlen(filename) + 5);
+	if (!tmp) {
+		perror("vanessa_logger_export_stats: malloc");
+		free(text);
+		return (-1);
 	}
+	sprintf(tmp, "%s.tmp", filename);
 
-	return ((vanessa_logger_t *) vl);
+	fh = fopen(tmp, "w");
+	if (!fh) {
+		perror("vanessa_logger_export_stats: fopen");
+		goto out;
+	}
+	if (fwrite(text, len, 1, fh) != 1) {
+		perror("vanessa_logger_export_stats: fwrite");
+		fclose(fh);
+		unlink(tmp);
+		goto out;
+	}
+	if (fclose(fh) == EOF) {
+		perror("vanessa_logger_export_stats: fclose");
+		unlink(tmp);
+		goto out;
+	}
+	if (rename(tmp, filename) < 0) {
+		perror("vanessa_logger_export_stats: rename");
+		unlink(tmp);
+		goto out;
+	}
+	status = 0;
+
+out:
+	free(tmp);
+	free(text);
+	return (status);
 }
 
 
 /**********************************************************************
- * vanessa_logger_openlog_function
- * Exported function to open a logger that will log to a given function
- * pre: function: function to use for logging
- *      ident: Identity to prepend to each log
- *      max_priority: Maximum priority number to log
- *                    Priorities are integers, the levels listed
- *                    in syslog(3) should be used for a syslog logger
- *      option: ignored
- * post: Logger is opened
- * return: pointer to logger
+ * vanessa_logger_export_stats_function
+ * Exported function to hand the statistics of a logger, in the
+ * Prometheus text exposition format, to a function
+ * pre: vl: pointer to logger
+ *      func: called once with the text, its length and data
+ *      data: passed to func
+ * post: func has been called
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+int
+vanessa_logger_export_stats_function(vanessa_logger_t * vl,
+		vanessa_logger_stats_function_t func, void *data)
+{
+	char *text;
+	size_t len;
+
+	if (!vl || !func) {
+		return (-1);
+	}
+
+	text = __vanessa_logger_stats_text((__vanessa_logger_t *) vl, &len);
+	if (!text) {
+		return (-1);
+	}
+	func(text, len, data);
+	free(text);
+
+	return (0);
+}
+
+
+/**********************************************************************
+ * Flight recorder
+ *
+ * Messages filtered out by the max_priority of a logger are recorded
+ * as binary message records in a ring that belongs to the calling
+ * thread. The owner is the only thread that moves the head and the
+ * tail of a ring, so recording takes no lock. The owner moves the
+ * tail past the records that it is about to overwrite before it writes
+ * over them, so the records between the tail, read after a ring has
+ * been copied, and the head, read before it was, are intact in the copy.
+ *
+ * Rings are only freed along with the recorder, so a dump may walk the
+ * list of rings without a lock.
+ **********************************************************************/
+
+#define __VANESSA_LOGGER_RECORDER_MIN_SIZE (4 * __VANESSA_LOGGER_BUF_SIZE)
+
+static unsigned long long __vanessa_logger_recorder_id = 0;
+
+typedef struct {
+	unsigned long long nsec; /* time recorded */
+	size_t offset;           /* of the record in the dump buffer */
+} __vanessa_logger_dump_entry_t;
+
+
+/*
+ * Copy len bytes at position pos of a ring of size bytes to buf
+ */
+
+static void
+__vanessa_logger_ring_get(const char *data, size_t size,
+		unsigned long long pos, void *buf, size_t len)
+{
+	size_t offset = pos & (size - 1);
+	size_t n = size - offset;
+
+	if (n > len) {
+		n = len;
+	}
+	memcpy(buf, data + offset, n);
+	memcpy((char *) buf + n, data, len - n);
+}
+
+
+/*
+ * Add a record to a ring, dropping the oldest records to make room.
+ * Only called by the owner of the ring.
+ */
+
+static void
+__vanessa_logger_ring_put(__vanessa_logger_ring_t *ring, size_t size,
+		const char *rec, size_t len)
+{
+	unsigned long long head = ring->head;
+	unsigned long long tail = ring->tail;
+	size_t offset;
+	size_t n;
+	uint32_t old;
+
+	while (head + len - tail > size) {
+		__vanessa_logger_ring_get(ring->data, size, tail, &old,
+				sizeof(old));
+		if (old < sizeof(__vanessa_logger_rec_t)) {
+			tail = head;
+			break;
+		}
+		tail += old;
+	}
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	offset = head & (size - 1);
+	n = size - offset;
+	if (n > len) {
+		n = len;
+	}
+	memcpy(ring->data + offset, rec, n);
+	memcpy(ring->data, rec + n, len - n);
+
+	__atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+}
+
+
+/**********************************************************************
+ * __vanessa_logger_recorder_ring
+ * Internal function to find the ring of the calling thread
+ * pre: r: recorder
+ *      tls: per-thread state of the calling thread
+ * post: the thread owns a ring, one left by a thread that has exited
+ *       or a new one
+ * return: ring
  *         NULL on error
  **********************************************************************/
 
-vanessa_logger_t *
-vanessa_logger_openlog_function(vanessa_logger_log_function_va_t log_function, 
-		const char *ident, const int max_priority, const int option)
+static __vanessa_logger_ring_t *
+__vanessa_logger_recorder_ring(__vanessa_logger_recorder_t *r,
+		__vanessa_logger_tls_t *tls)
 {
-	__vanessa_logger_t *vl;
+	__vanessa_logger_ring_t *ring;
+	__vanessa_logger_ring_t *spare = NULL;
 
-	if ((vl = __vanessa_logger_create()) == NULL) {
-		fprintf(stderr, "vanessa_logger_openlog_function: "
-			"__vanessa_logger_create\n");
-		return (NULL);
+	if (tls->ring_id == r->id) {
+		return (tls->ring);
 	}
 
-	if (__vanessa_logger_set(vl, ident, max_priority,
-			 __vanessa_logger_function, (void *) log_function, 
-			option) == NULL) {
-		fprintf(stderr, "vanessa_logger_openlog_function: "
-			"__vanessa_logger_set\n");
-		return (NULL);
+	pthread_mutex_lock(&r->lock);
+
+	for (ring = r->ring; ring; ring = ring->next) {
+		if (ring->owner == tls) {
+			break;
+		}
+		if (!ring->owner && !spare) {
+			spare = ring;
+		}
+	}
+	if (!ring) {
+		ring = spare;
+	}
+	if (!ring) {
+		ring = (__vanessa_logger_ring_t *) calloc(1, sizeof(*ring));
+		if (ring) {
+			ring->data = (char *) malloc(r->size);
+		}
+		if (!ring || !ring->data) {
+			perror("__vanessa_logger_recorder_ring: malloc");
+			free(ring);
+			pthread_mutex_unlock(&r->lock);
+			return (NULL);
+		}
+		ring->next = r->ring;
+		__atomic_store_n(&r->ring, ring, __ATOMIC_RELEASE);
 	}
+	ring->owner = tls;
 
-	return ((vanessa_logger_t *) vl);
+	pthread_mutex_unlock(&r->lock);
+
+	tls->ring = ring;
+	tls->ring_id = r->id;
+
+	return (ring);
 }
 
 
 /**********************************************************************
- * vanessa_logger_change_max_priority
- * Exported function to change the maximum priority that the logger
- * will log.
- * pre: vl: logger to change the maximum priority of
- *      max_priority: Maximum priority number to log
- *                    Priorities are integers, the levels listed
- *                    in syslog(3) should be used for a syslog logger
- * post: maximum priority of logger is changed
- *       nothing if vl is NULL
+ * __vanessa_logger_recorder_release
+ * Internal function to hand back the rings of a thread that is
+ * exiting, so that other threads may take them over
+ * pre: tls: per-thread state of the thread
+ * post: the thread owns no rings
  * return: none
  **********************************************************************/
 
-void 
-vanessa_logger_change_max_priority(vanessa_logger_t * vl, 
-		const int max_priority)
+static void
+__vanessa_logger_recorder_release(__vanessa_logger_tls_t *tls)
 {
-	if (vl == NULL) {
+	__vanessa_logger_recorder_t *r;
+	__vanessa_logger_ring_t *ring;
+	__vanessa_logger_t *vl;
+
+	if (!tls->ring) {
 		return;
 	}
 
-	((__vanessa_logger_t *) vl)->max_priority = max_priority;
+	pthread_mutex_lock(&__vanessa_logger_list_lock);
+	for (vl = __vanessa_logger_list; vl; vl = vl->next) {
+		r = __atomic_load_n(&vl->recorder, __ATOMIC_ACQUIRE);
+		if (!r) {
+			continue;
+		}
+		pthread_mutex_lock(&r->lock);
+		for (ring = r->ring; ring; ring = ring->next) {
+			if (ring->owner == tls) {
+				ring->owner = NULL;
+			}
+		}
+		pthread_mutex_unlock(&r->lock);
+	}
+	pthread_mutex_unlock(&__vanessa_logger_list_lock);
 }
 
 
 /**********************************************************************
- * vanessa_logger_closelog
- * Exported function to close a logger
- * pre: vl: pointer to logger to close
- * post: logger is closed and memory is freed
- *       If global logger set by vanessa_logger_set() is being closed
- *       then it is unset using vanessa_logger_unset()
- * return: none
+ * __vanessa_logger_recorder_lookup
+ * Internal function to find the format of a format string, adding it
+ * to the formats of the recorder if need be. Like those of binary
+ * loggers, formats are looked up by address and checked against a copy
+ * of their contents.
+ * pre: r: recorder
+ *      fmt: format string
+ * post: a copy of fmt is kept for dumps
+ * return: format, NULL if fmt can't be recorded in binary form
  **********************************************************************/
 
-void 
-vanessa_logger_closelog(vanessa_logger_t * vl)
+static const __vanessa_logger_fmt_t *
+__vanessa_logger_recorder_lookup(__vanessa_logger_recorder_t *r,
+		const char *fmt)
 {
-	if(vanessa_logger_get() == vl) {
-		vanessa_logger_unset();
+	__vanessa_logger_fmt_t *f;
+	const char *key;
+	char *copy;
+	size_t i;
+
+	i = ((uintptr_t) fmt >> 3) & (__VANESSA_LOGGER_BINARY_FORMATS - 1);
+	while (1) {
+		f = r->fmt + i;
+		key = __atomic_load_n(&f->fmt, __ATOMIC_ACQUIRE);
+		if (key == fmt && r->copy[f->id] && 
+				!strcmp(r->copy[f->id], fmt)) {
+			return (f->nargs < 0 ? NULL : f);
+		}
+		if (!key) {
+			break;
+		}
+		i = (i + 1) & (__VANESSA_LOGGER_BINARY_FORMATS - 1);
 	}
-	__vanessa_logger_destroy((__vanessa_logger_t *) vl);
+
+	pthread_mutex_lock(&r->lock);
+
+	if (f->fmt && (f->fmt != fmt || !r->copy[f->id] ||
+				strcmp(r->copy[f->id], fmt))) {
+		/* Another format took the slot first, start again */
+		pthread_mutex_unlock(&r->lock);
+		return (__vanessa_logger_recorder_lookup(r, fmt));
+	}
+
+	if (!f->fmt) {
+		if (r->used >= __VANESSA_LOGGER_BINARY_FORMATS / 2) {
+			pthread_mutex_unlock(&r->lock);
+			return (NULL);
+		}
+		f->id = ++r->used;
+		f->nargs = __vanessa_logger_binary_parse(fmt, f->arg);
+		copy = strdup(fmt);
+		if (!copy) {
+			perror("__vanessa_logger_recorder_lookup: strdup");
+			f->nargs = -1;
+		}
+		r->copy[f->id] = copy;
+		__atomic_store_n(&f->fmt, fmt, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&r->lock);
+
+	return (f->nargs < 0 ? NULL : f);
 }
 
 
 /**********************************************************************
- * vanessa_logger_log
- * Exported function to log a message
- * pre: vl: pointer to logger to log to
- *      priority: Priority to log with.
- *                If priority is more than max_priority as provided to
- *                vanessa_logger_openlog_*.
- *                Levels described in syslog(3) should be used for
- *                syslog loggers as the priority will be used when
- *                logging to syslog. These priorities may also be
- *                used for filehandle and filename loggers.
- *                Strangely with syslog higher priorities have
- *                _lower_ priority numbers. For this
- *                reason vanessa_logger regards messages with
- *                lower priority numbers as being higher priority
- *                than messages with lower priority. I suggest
- *                just using the syslog priorities to avoid confusion.
- *      fmt: format of message to log as per sprintf(3) for
- *           filename and filehandle loggers and as
- *           per syslog(3) for syslog loggers
- *      ...: data for fmt
- * post: Message is logged
+ * __vanessa_logger_record
+ * Internal function to record a message that the max_priority of a
+ * logger filters out
+ * pre: vl: logger with a recorder
+ *      priority: priority of message
+ *      prefix: prefix of message, may be NULL
+ *      fmt: format of message
+ *      ap: arguments of message
+ * post: message is recorded in the ring of the calling thread if
+ *       the recorder is on and priority is no more than its priority
  * return: none
  **********************************************************************/
 
-void 
-vanessa_logger_log(vanessa_logger_t * vl, int priority, const char *fmt, ...)
+static void
+__vanessa_logger_record(__vanessa_logger_t * vl, int priority,
+		const char *prefix, const char *fmt, va_list ap)
 {
-	va_list ap;
+	__vanessa_logger_recorder_t *r;
+	const __vanessa_logger_fmt_t *f;
+	__vanessa_logger_ring_t *ring;
+	__vanessa_logger_tls_t *tls;
+	struct timespec ts;
+	va_list aq;
+	size_t len;
+	int err = errno;
+
+	r = __atomic_load_n(&vl->recorder, __ATOMIC_ACQUIRE);
+	if (priority > __atomic_load_n(&r->priority, __ATOMIC_RELAXED)) {
+		return;
+	}
+
+	tls = __vanessa_logger_tls_get();
+	if (!tls) {
+		return;
+	}
+	ring = __vanessa_logger_recorder_ring(r, tls);
+	if (!ring) {
+		return;
+	}
 
-	va_start(ap, fmt);
-	__vanessa_logger_log((__vanessa_logger_t *) vl, priority, NULL, 
-			fmt, ap);
-	va_end(ap);
-}
+	f = __vanessa_logger_recorder_lookup(r, fmt);
+	if (__vanessa_logger_clock(vl->flag, &ts) < 0) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+	}
 
+	va_copy(aq, ap);
+	len = __vanessa_logger_binary_encode(vl, f, priority, prefix, fmt,
+			err, &ts, ap, tls->buffer, sizeof(tls->buffer), 0);
+	if (len > sizeof(tls->buffer)) {
+		len = __vanessa_logger_binary_encode(vl, NULL, priority,
+				prefix, fmt, err, &ts, aq, tls->buffer,
+				sizeof(tls->buffer), 1);
+	}
+	va_end(aq);
 
-/**********************************************************************
- * vanessa_logger_logv
- * Exported function to log a message
- * Same as vanessa_logger_log but a va_list is given instead
- * of a variable number of arguments.
- **********************************************************************/
+	__vanessa_logger_ring_put(ring, r->size, tls->buffer, len);
+	errno = err;
 
-void 
-vanessa_logger_logv(vanessa_logger_t * vl, int priority, const char *fmt, 
-		va_list ap)
-{
-	__vanessa_logger_log((__vanessa_logger_t *) vl, priority, NULL,
-			fmt, ap);
+	if (__atomic_load_n(&r->pending, __ATOMIC_RELAXED)) {
+		__vanessa_logger_recorder_dump(vl, 0);
+	}
 }
 
 
-/**********************************************************************
- * _vanessa_logger_log_prefix
- * Exported function used by convenience macros to prefix a message
- * with the function name that the message was generated in
- **********************************************************************/
+/*
+ * Log a message regardless of max_priority, for dumps. A dump may be
+ * made part way through vanessa_logger_logkvv(), whose fields belong
+ * to its own message and not to those dumped.
+ */
 
-void 
-_vanessa_logger_log_prefix(vanessa_logger_t * vl, int priority, 
-		const char *prefix, const char *fmt, ...)
+static void
+__vanessa_logger_recorder_emit(__vanessa_logger_t * vl, int priority,
+		const char *fmt, ...)
 {
+	__vanessa_logger_tls_t *tls;
+	const char *fields = NULL;
 	va_list ap;
 
+	tls = __vanessa_logger_tls_get();
+	if (tls) {
+		fields = tls->fields;
+		tls->fields = NULL;
+	}
+
 	va_start(ap, fmt);
-	__vanessa_logger_log((__vanessa_logger_t *) vl, priority, prefix,
-			fmt, ap);
+	__vanessa_logger_emit(vl, priority, NULL, fmt, ap);
 	va_end(ap);
+
+	if (tls) {
+		tls->fields = fields;
+	}
 }
 
-/**********************************************************************
- * vanessa_logger_set_flag
- * Set flags for logger
- * Should only be used on filehandle or filename loggers,
- * ignored otherwise.
- * pre: vl: logger to set flags of
- *      flag: value to set flags to
- *            See "Flags for filehandle or filename loggers"
- *            in vanessa_logger.h for valid flags
- * post: flag is set
- * return: none
- **********************************************************************/
 
-void
-vanessa_logger_set_flag(vanessa_logger_t * vl, vanessa_logger_flag_t flag)
+/*
+ * Order dumped messages by the time they were recorded, and those
+ * recorded by a thread at the same time in the order it recorded them
+ */
+
+static int
+__vanessa_logger_dump_entry_cmp(const void *a, const void *b)
 {
-	switch (((__vanessa_logger_t *)vl)->type) {
-		case __vanessa_logger_filehandle:
-		case __vanessa_logger_filename:
-			((__vanessa_logger_t *)vl)->flag = flag;
-			break;
-		case __vanessa_logger_syslog:
-		case __vanessa_logger_function:
-		case __vanessa_logger_none:
-			break;
+	const __vanessa_logger_dump_entry_t *x = 
+		(const __vanessa_logger_dump_entry_t *) a;
+	const __vanessa_logger_dump_entry_t *y = 
+		(const __vanessa_logger_dump_entry_t *) b;
+
+	if (x->nsec != y->nsec) {
+		return (x->nsec < y->nsec ? -1 : 1);
 	}
+	return (x->offset < y->offset ? -1 : x->offset > y->offset);
 }
 
 
 /**********************************************************************
- * vanessa_logger_get_flag
- * Set flags for logger
- * Should only be used on filehandle or filename loggers,
- * will return 0 for other types of loggers.
- * See "Flags for filehandle or filename loggers"
- * in vanessa_logger.h for valid flags
- * pre: vl: logger to get flags of
- * post: none
- * return: flags for logger
+ * __vanessa_logger_recorder_dump
+ * Internal function to log the messages in the recorder of a logger
+ * pre: vl: logger with a recorder
+ *      wait: if zero and a dump is already under way nothing is done,
+ *            otherwise wait for it to finish
+ * post: messages recorded in the last seconds seconds of the recorder
+ *       that have not been dumped before are logged, oldest first
+ * return: number of messages logged
+ *         -1 on error
  **********************************************************************/
 
-vanessa_logger_flag_t
-vanessa_logger_get_flag(vanessa_logger_t * vl)
+static int
+__vanessa_logger_recorder_dump(__vanessa_logger_t * vl, int wait)
 {
-	switch (((__vanessa_logger_t *)vl)->type) {
-		case __vanessa_logger_filehandle:
-		case __vanessa_logger_filename:
-			return ((__vanessa_logger_t *)vl)->flag;
-		case __vanessa_logger_syslog:
-		case __vanessa_logger_function:
-		case __vanessa_logger_none:
-			return 0;
+	__vanessa_logger_recorder_t *r;
+	__vanessa_logger_ring_t *ring;
+	__vanessa_logger_dump_entry_t *entry = NULL;
+	__vanessa_logger_dump_entry_t *e;
+	__vanessa_logger_decoder_t dec;
+	__vanessa_logger_rec_message_t msg;
+	__vanessa_logger_rec_t rec;
+	__vanessa_logger_sb_t buf = { NULL, 0, 0 };
+	unsigned long long head;
+	unsigned long long tail;
+	unsigned long long pos;
+	unsigned long long oldest = 0;
+	unsigned int seconds;
+	struct timespec now;
+	size_t n = 0;
+	size_t size = 0;
+	size_t i;
+	char *scratch;
+	char *p;
+	int status = -1;
+
+	r = __atomic_load_n(&vl->recorder, __ATOMIC_ACQUIRE);
+	if (wait) {
+		pthread_mutex_lock(&r->dump_lock);
+	}
+	else if (pthread_mutex_trylock(&r->dump_lock)) {
+		return (0);
 	}
+	__atomic_store_n(&r->pending, 0, __ATOMIC_RELAXED);
 
-	/* Not reached */
-	return 0;
-}
+	memset(&dec, 0, sizeof(dec));
+	dec.ts.sec = (time_t) -1;
 
+	scratch = (char *) malloc(r->size);
+	if (!scratch) {
+		perror("__vanessa_logger_recorder_dump: malloc");
+		goto out;
+	}
 
-static char vanessa_logger_strherror_str[34];
+	seconds = __atomic_load_n(&r->seconds, __ATOMIC_RELAXED);
+	if (seconds && !__vanessa_logger_clock(vl->flag, &now) &&
+			(unsigned long long) now.tv_sec > seconds) {
+		oldest = (now.tv_sec - seconds) * 1000000000ULL + now.tv_nsec;
+	}
 
-/**********************************************************************
- * vanessa_logger_strherror_r
- * Returns a string describing the error code present in errnum
- * according to the errors for h_errno which is set by gethostbyname(3)
- * gethostbyaddr(3) and others. Analogous to strerror_r(3).
- * pre: errnum: Error to show as a string
- *      buf: buffer to write error string to
- *      n: length of buf in bytes
- * post: on success error string is written to buf
- *       on invalid input errno is set to -EINVAL
- *       if buf is too short then errno is set to -ERANGE
- * return: 0 on success
- *         -1 on error
- **********************************************************************/
+	for (ring = __atomic_load_n(&r->ring, __ATOMIC_ACQUIRE); ring;
+			ring = ring->next) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (head == ring->dumped) {
+			continue;
+		}
+		memcpy(scratch, ring->data, r->size);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+		pos = tail > ring->dumped ? tail : ring->dumped;
+		ring->dumped = head;
+
+		while (pos < head) {
+			__vanessa_logger_ring_get(scratch, r->size, pos, &rec,
+					sizeof(rec));
+			if (rec.len < sizeof(rec) + sizeof(msg) ||
+					rec.len > head - pos) {
+				break;
+			}
+			__vanessa_logger_ring_get(scratch, r->size,
+					pos + sizeof(rec), &msg, sizeof(msg));
+			pos += rec.len;
+			if (msg.sec * 1000000000ULL + msg.nsec < oldest) {
+				continue;
+			}
 
-int
-vanessa_logger_strherror_r(int errnum, char *buf, size_t n)
-{
-	size_t len;
-	char *str;
+			if (n == size) {
+				size = size ? size * 2 : 64;
+				e = (__vanessa_logger_dump_entry_t *) realloc(
+						entry, size * sizeof(*e));
+				if (!e) {
+					perror("__vanessa_logger_recorder_dump: "
+							"realloc");
+					goto out;
+				}
+				entry = e;
+			}
+			if (__vanessa_logger_sb_reserve(&buf, rec.len) < 0) {
+				perror("__vanessa_logger_recorder_dump: "
+						"realloc");
+				goto out;
+			}
+			entry[n].nsec = msg.sec * 1000000000ULL + msg.nsec;
+			entry[n].offset = buf.len;
+			n++;
+			__vanessa_logger_ring_get(scratch, r->size, 
+					pos - rec.len, buf.s + buf.len, 
+					rec.len);
+			buf.len += rec.len;
+		}
+	}
 
-	switch(errnum) {
-		case HOST_NOT_FOUND:
-			str = "Unknown host";
-			break;
-		case NO_ADDRESS:
-		/* case NO_DATA: */
-			str = "Host has no address";
-			break;
-		case NO_RECOVERY:
-			str = "Non-recoverable name server error";
-			break;
-		case TRY_AGAIN:
-			str = "Transient lookup error";
-			break;
-		default:
-			errno = -EINVAL;
-			return(-1);
+	if (!n) {
+		status = 0;
+		goto out;
 	}
 
-	len = strlen(str) + 1;
-	if(len > n) {
-		errno = -ERANGE;
-		return(-1);
+	/* Formats are only freed with the recorder */
+	pthread_mutex_lock(&r->lock);
+	dec.nfmt = r->used + 1;
+	dec.fmt = (__vanessa_logger_decode_fmt_t *) calloc(dec.nfmt,
+			sizeof(*dec.fmt));
+	for (i = 1; dec.fmt && i < dec.nfmt; i++) {
+		dec.fmt[i].fmt = r->copy[i];
+	}
+	pthread_mutex_unlock(&r->lock);
+	if (!dec.fmt) {
+		perror("__vanessa_logger_recorder_dump: calloc");
+		goto out;
 	}
 
-	memcpy(buf, str, len);
-	return(0);
+	qsort(entry, n, sizeof(*entry), __vanessa_logger_dump_entry_cmp);
+
+	__vanessa_logger_recorder_emit(vl, LOG_NOTICE,
+			"flight recorder: %lu messages", (unsigned long) n);
+	for (i = 0; i < n; i++) {
+		p = buf.s + entry[i].offset;
+		memcpy(&rec, p, sizeof(rec));
+		/* Show when each message was recorded */
+		rec.flag = (rec.flag & __VANESSA_LOGGER_F_TIMESTAMP_LAYOUT) |
+			VANESSA_LOGGER_F_TIMESTAMP;
+		if (!(rec.flag & (VANESSA_LOGGER_F_TIMESTAMP_USEC |
+						VANESSA_LOGGER_F_TIMESTAMP_NSEC))) {
+			rec.flag |= VANESSA_LOGGER_F_TIMESTAMP_USEC;
+		}
+		__vanessa_logger_decode_line(&dec, &rec, p + sizeof(rec),
+				p + rec.len);
+		if (dec.line.len) {
+			/* Drop the '\n', the logger adds its own */
+			dec.line.s[--dec.line.len] = '\0';
+		}
+		__vanessa_logger_recorder_emit(vl, rec.priority, "%s",
+				dec.line.s);
+	}
+	status = n;
+
+out:
+	pthread_mutex_unlock(&r->dump_lock);
+	free(dec.fmt);
+	free(dec.line.s);
+	free(dec.str.s);
+	free(buf.s);
+	free(entry);
+	free(scratch);
+
+	return (status);
 }
 
 
 /**********************************************************************
- * vanessa_logger_strherror
- * Returns a string describing the error code present in errnum
- * according to the errors for h_errno which is set by gethostbyname(3)
- * gethostbyaddr(3) and others. Analogous to strerror_r(3).
- * pre: errnum: Error to show as a string
- * post: none on success
- *       on invalid input errno is set to -EINVAL
- *       if buf is too short then errno is set to -ERANGE
- * return: error string for errnum on success
- *         error string for newly set errno on error
+ * __vanessa_logger_recorder_check
+ * Internal function to dump the recorder of a logger if a message
+ * about to be logged is a trigger or a dump has been asked for
+ * pre: vl: logger with a recorder
+ *      priority: priority of the message
+ * post: recorder is dumped, if need be
+ * return: none
  **********************************************************************/
 
-char *
-vanessa_logger_strherror(int errnum)
+static void
+__vanessa_logger_recorder_check(__vanessa_logger_t * vl, int priority)
 {
-	int status;
+	__vanessa_logger_recorder_t *r;
 
-	status = vanessa_logger_strherror_r(errnum, 
-			vanessa_logger_strherror_str,
-			sizeof(vanessa_logger_strherror_str));
-	if(status < 0) {
-		return(strerror(errno));
+	r = __atomic_load_n(&vl->recorder, __ATOMIC_ACQUIRE);
+	if (priority <= __atomic_load_n(&r->trigger, __ATOMIC_RELAXED) ||
+			__atomic_load_n(&r->pending, __ATOMIC_RELAXED)) {
+		__vanessa_logger_recorder_dump(vl, 0);
 	}
-
-	return(vanessa_logger_strherror_str);
 }
 
 
 /**********************************************************************
- * vanessa_logger_reopen
- * Exported function to reopen a logger
- * pre: vl: pointer to logger to reopen
- * post: logger is reopened
- * return: 0 on success
- *         -1 on error
- *
- * Note: May be used as part of a signal handler to reopen logger
- *       on for instance receiving a SIGHUP
+ * __vanessa_logger_recorder_destroy
+ * Internal function to free a recorder
+ * pre: r: recorder
+ * post: recorder, its rings and formats are freed
+ *       Nothing if r is NULL
+ * return: none
  **********************************************************************/
 
-int vanessa_logger_reopen(vanessa_logger_t * vl)
+static void
+__vanessa_logger_recorder_destroy(__vanessa_logger_recorder_t *r)
 {
-	if (__vanessa_logger_reopen((__vanessa_logger_t *) vl)) {
-		fprintf(stderr,
-			"vanessa_logger_reopen: __vanessa_logger_reopen\n");
-		return (-1);
+	__vanessa_logger_ring_t *ring;
+	__vanessa_logger_ring_t *next;
+	size_t i;
+
+	if (!r) {
+		return;
 	}
-	return (0);
+
+	for (ring = r->ring; ring; ring = next) {
+		next = ring->next;
+		free(ring->data);
+		free(ring);
+	}
+	for (i = 1; i <= r->used; i++) {
+		free(r->copy[i]);
+	}
+	pthread_mutex_destroy(&r->lock);
+	pthread_mutex_destroy(&r->dump_lock);
+	free(r);
 }
 
 
 /**********************************************************************
- * vanessa_logger_str_dump
- * Sanitise a buffer into ASCII
- * pre: vl: Vanessa logger to log errors to. May be NULL.
- *      buffer: buffer to sanitise
- *      size: number of bytes in buffer to sanitise
- *      flag: If VANESSA_LOGGER_STR_DUMP_HEX then a hexadecimal dump
- *            will be done. Else an octal dump will be done.
- * post: a new buffer is allocated. For each byte in buffer
- *       that is a printable ASCII character it is added to
- *       the new buffer. All other characters are represented
- *       in the new buffer as octal, in the form \xxx.
- * return: the new buffer, this should be freed by the caller
- *         NULL on error
+ * vanessa_logger_set_recorder
+ * Exported function to set up the flight recorder of a logger
+ * pre: vl: pointer to logger
+ *      priority: messages filtered out by the max_priority of vl
+ *                with this priority or lower are recorded.
+ *                -1 turns the recorder off.
+ *      size: size in bytes of the ring of each thread, rounded up
+ *            to a power of 2. 0 for VANESSA_LOGGER_RECORDER_SIZE.
+ *            Only used the first time the recorder is turned on.
+ *      seconds: age of the oldest message dumped, 0 for no limit
+ *      trigger: messages logged with this priority or lower dump
+ *               the recorder, for instance LOG_ERR. -1 for none.
+ * post: recorder is set up, messages already recorded are kept
+ * return: 0 on success
+ *         -1 on error
  **********************************************************************/
 
-static char *
-__vanessa_logger_str_dump_oct(vanessa_logger_t * vl, 
-		const char *buffer, const size_t buffer_length)
+int
+vanessa_logger_set_recorder(vanessa_logger_t * vl, int priority,
+		size_t size, unsigned int seconds, int trigger)
 {
-	const char *in_pos;
-	const char *in_top;
-	char *out_pos;
-	char *out;
+	__vanessa_logger_t *l = (__vanessa_logger_t *) vl;
+	__vanessa_logger_recorder_t *r;
+	__vanessa_logger_recorder_t *expected = NULL;
+	size_t ring_size = __VANESSA_LOGGER_RECORDER_MIN_SIZE;
 
-	out = (char *) malloc(buffer_length * 4 + 1);
-	if (!out) {
-		vanessa_logger_log(vl, LOG_DEBUG, 
-				"vanessa_logger_str_dump: malloc: %s",
-				strerror(errno));
-		return (NULL);
+	if (!l) {
+		return (-1);
 	}
 
-	out_pos = out;
-	in_top = buffer + buffer_length;
-	for (in_pos = buffer; in_pos < in_top; in_pos++) {
-		switch(*in_pos) {
-			case '\a':
-				*out_pos++ = '\\';
-				*out_pos++ = 'a';
-				continue;
-			case '\b':
-				*out_pos++ = '\\';
-				*out_pos++ = 'b';
-				continue;
-			case '\t':
-				*out_pos++ = '\\';
-				*out_pos++ = 't';
-				continue;
-			case '\n':
-				*out_pos++ = '\\';
-				*out_pos++ = 'n';
-				continue;
-			case '\v':
-				*out_pos++ = '\\';
-				*out_pos++ = 'v';
-				continue;
-			case '\f':
-				*out_pos++ = '\\';
-				*out_pos++ = 'f';
-				continue;
-			case '\r':
-				*out_pos++ = '\\';
-				*out_pos++ = 'r';
-				continue;
-			case '\\': 
-			case '"': 
-			case '\'':
-				*out_pos++ = '\\';
-				*out_pos++ = *in_pos;
-				continue;
+	r = __atomic_load_n(&l->recorder, __ATOMIC_ACQUIRE);
+	if (!r && priority >= 0) {
+		if (!size) {
+			size = VANESSA_LOGGER_RECORDER_SIZE;
+		}
+		while (ring_size < size) {
+			if (ring_size > (size_t) -1 / 2) {
+				fprintf(stderr, "vanessa_logger_set_recorder: "
+						"size is too large\n");
+				return (-1);
+			}
+			ring_size <<= 1;
+		}
+
+		r = (__vanessa_logger_recorder_t *) calloc(1, sizeof(*r));
+		if (!r) {
+			perror("vanessa_logger_set_recorder: calloc");
+			return (-1);
+		}
+		r->priority = -1;
+		r->trigger = -1;
+		r->size = ring_size;
+		r->id = __atomic_add_fetch(&__vanessa_logger_recorder_id, 1,
+				__ATOMIC_RELAXED);
+		pthread_mutex_init(&r->lock, NULL);
+		pthread_mutex_init(&r->dump_lock, NULL);
+		/* The fork handlers must all see the same recorder */
+		pthread_mutex_lock(&__vanessa_logger_list_lock);
+		if (!__atomic_compare_exchange_n(&l->recorder, &expected, r,
+					0, __ATOMIC_ACQ_REL,
+					__ATOMIC_ACQUIRE)) {
+			/* Set up by another thread */
+			pthread_mutex_unlock(&__vanessa_logger_list_lock);
+			__vanessa_logger_recorder_destroy(r);
+			r = expected;
 		}
-		if (isgraph(*in_pos) || *in_pos == ' ') {
-			*out_pos++ = *in_pos;
-		} 
 		else {
-			snprintf(out_pos, 5, "\\%03o", *in_pos & 0xff);
-			out_pos += 4;
+			pthread_mutex_unlock(&__vanessa_logger_list_lock);
 		}
 	}
+	if (r) {
+		__atomic_store_n(&r->seconds, seconds, __ATOMIC_RELAXED);
+		__atomic_store_n(&r->trigger, trigger, __ATOMIC_RELAXED);
+		__atomic_store_n(&r->priority, priority, __ATOMIC_RELAXED);
+	}
 
-	*out_pos++ = '\0';
-
-	return (out);
+	return (0);
 }
 
 
-static char *
-__vanessa_logger_str_dump_hex(vanessa_logger_t * vl, const char *buffer,
-			      const size_t buffer_length)
+/**********************************************************************
+ * vanessa_logger_dump_recorder
+ * Exported function to log the messages in the flight recorder of a
+ * logger
+ * pre: vl: pointer to logger
+ * post: recorded messages that have not been dumped before are logged
+ * return: number of messages logged
+ *         -1 on error
+ **********************************************************************/
+
+int
+vanessa_logger_dump_recorder(vanessa_logger_t * vl)
 {
-	const char *in_pos;
-	const char *in_top;
-	char *out_pos;
-	char *out;
-	int i;
+	__vanessa_logger_t *l = (__vanessa_logger_t *) vl;
 
-	out = (char *) malloc((buffer_length << 1) + (buffer_length >> 2) + 1);
-	if (!out) {
-		vanessa_logger_log(vl, LOG_DEBUG, 
-				"vanessa_logger_str_dump: malloc: %s",
-				strerror(errno));
-		return (NULL);
+	if (!l) {
+		return (-1);
 	}
-
-	i = 0;
-	out_pos = out;
-	in_top = buffer + buffer_length;
-	for (in_pos = buffer; in_pos < in_top; in_pos++) {
-		sprintf(out_pos, "%02x", *in_pos);
-		out_pos += 2;
-		if((i++ & 0x3) == 3 && in_pos + 1 != in_top) {
-			*out_pos++ = ' ';
-		}
+	if (!__atomic_load_n(&l->recorder, __ATOMIC_ACQUIRE)) {
+		return (0);
 	}
 
-	*out_pos++ = '\0';
-
-	return (out);
+	return (__vanessa_logger_recorder_dump(l, 1));
 }
 
 
-char *
-vanessa_logger_str_dump(vanessa_logger_t * vl, const char *buffer, 
-		const size_t buffer_length, vanessa_logger_flag_t flag)
+/**********************************************************************
+ * vanessa_logger_recorder_signal
+ * Exported function to ask for the flight recorder of a logger to
+ * be dumped. Safe to call from a signal handler.
+ * pre: vl: pointer to logger
+ * post: the recorder is dumped the next time a message is logged to,
+ *       or recorded by, vl
+ * return: none
+ **********************************************************************/
+
+void
+vanessa_logger_recorder_signal(vanessa_logger_t * vl)
 {
-	if(flag == VANESSA_LOGGER_STR_DUMP_HEX) {
-		return(__vanessa_logger_str_dump_hex(vl, buffer,
-						     buffer_length));
+	__vanessa_logger_t *l = (__vanessa_logger_t *) vl;
+	__vanessa_logger_recorder_t *r;
+
+	if (!l) {
+		return;
 	}
 
-	return(__vanessa_logger_str_dump_oct(vl, buffer, buffer_length));
-}			 
+	r = __atomic_load_n(&l->recorder, __ATOMIC_ACQUIRE);
+	if (r) {
+		__atomic_store_n(&r->pending, 1, __ATOMIC_RELAXED);
+	}
+}
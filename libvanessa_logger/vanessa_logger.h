@@ -32,6 +32,13 @@
 #ifndef VANESSA_LOGGER_FLIM
 #define VANESSA_LOGGER_FLIM
 
+/*
+ * Loggers may be used by several threads at once. Each thread formats
+ * messages into its own buffer and each message is written to the
+ * underlying filehandle, syslog or function in one go, so lines from
+ * different threads are not interleaved.
+ */
+
 typedef void vanessa_logger_t;
 
 typedef void (*vanessa_logger_log_function_va_t) 
@@ -60,6 +67,16 @@ typedef void (*vanessa_logger_log_function_va_t)
 
 typedef unsigned int vanessa_logger_flag_t;
 
+/*
+ * Allow gcc to check format strings against their arguments
+ */
+#ifdef __GNUC__
+#define VANESSA_LOGGER_FORMAT(fmt, first) \
+	__attribute__ ((format (printf, fmt, first)))
+#else
+#define VANESSA_LOGGER_FORMAT(fmt, first)
+#endif
+
 
 /**********************************************************************
  * Flags for filehandle or filename loggers
@@ -72,6 +89,60 @@ typedef unsigned int vanessa_logger_flag_t;
 					      is an error while writing 
 					      to the filehandle or filename */
 #define VANESSA_LOGGER_F_PERROR       0x8  /* Print to stderr as well */
+#define VANESSA_LOGGER_F_ASYNC       0x10  /* Queue messages and write them
+					      from a background thread.
+					      Only honoured when the logger
+					      is opened */
+#define VANESSA_LOGGER_F_BINARY     0x400  /* Write records for
+					      vanessa_logger_decode()
+					      rather than text. Only
+					      honoured when a filename
+					      logger is opened */
+#define VANESSA_LOGGER_F_JSON      0x1000  /* Write each message as a
+					      line of JSON. See
+					      "Structured logging" */
+
+/*
+ * The following modify the layout of VANESSA_LOGGER_F_TIMESTAMP,
+ * which must also be set for them to have any effect.
+ * The default layout is that of syslog, "Mmm dd HH:MM:SS".
+ */
+#define VANESSA_LOGGER_F_TIMESTAMP_USEC    0x20  /* Add microseconds */
+#define VANESSA_LOGGER_F_TIMESTAMP_NSEC    0x40  /* Add nanoseconds */
+#define VANESSA_LOGGER_F_TIMESTAMP_RFC3339 0x80  /* RFC 3339 layout:
+						    YYYY-MM-DDTHH:MM:SS+HH:MM */
+#define VANESSA_LOGGER_F_TIMESTAMP_UTC    0x100  /* UTC, not local time */
+#define VANESSA_LOGGER_F_TIMESTAMP_COARSE 0x200  /* Read the time from
+						    CLOCK_REALTIME_COARSE,
+						    cheaper but only
+						    accurate to a few ms */
+
+/**********************************************************************
+ * Syslog loggers
+ *
+ * Syslog loggers do not use openlog(3) and syslog(3). Each one has its
+ * own socket connected to the syslog daemon, so loggers with different
+ * facilities or idents do not interfere with each other and one logger
+ * being reopened does not affect the others.
+ *
+ * Messages are framed as per RFC 3164, "<PRI>Mmm dd HH:MM:SS ident[pid]: ",
+ * unless VANESSA_LOGGER_F_RFC5424 is set. If the daemon goes away the
+ * logger connects to it again the next time it logs.
+ * A VANESSA_LOGGER_F_ASYNC syslog logger sends the messages queued
+ * for its writer thread in batches, with one sendmmsg(2) where available.
+ *
+ * Of the options of openlog(3) LOG_CONS and LOG_PERROR are honoured,
+ * the pid is always logged. VANESSA_LOGGER_F_CONS writes to stderr,
+ * not the console.
+ **********************************************************************/
+
+#define VANESSA_LOGGER_F_RFC5424    0x800  /* Frame syslog messages as
+					      per RFC 5424:
+					      "<PRI>1 TIMESTAMP HOSTNAME
+					      ident pid - - ". Only honoured
+					      when a syslog logger is
+					      opened */
+
 
 /**********************************************************************
  * vanessa_logger_openlog_syslog
@@ -81,8 +152,9 @@ typedef unsigned int vanessa_logger_flag_t;
  *      max_priority: Maximum priority no to log
  *                    Priorities are integers, the levels listed
  *                    in syslog(3) should be used for a syslog logger
- *      option: options to pass to the openlog command
- *              Will be logically ored with LOG_PID
+ *      option: options as per openlog(3)
+ *              See "Syslog loggers" in vanessa_logger.h for
+ *              those that are honoured
  * post: Logger is opened
  * return: pointer to logger
  *         NULL on error
@@ -93,6 +165,34 @@ vanessa_logger_openlog_syslog(const int facility, const char *ident,
 		const int max_priority, const int option);
 
 
+/**********************************************************************
+ * vanessa_logger_openlog_syslog_path
+ * Exported function to open a logger that will log to a syslog daemon
+ * listening on a given socket
+ * pre: path: path of socket of syslog daemon, NULL for /dev/log
+ *      facility: facility to log to syslog with
+ *      ident: Identity to prepend to each log
+ *      max_priority: Maximum priority no to log
+ *                    Priorities are integers, the levels listed
+ *                    in syslog(3) should be used for a syslog logger
+ *      option: options as per openlog(3)
+ *              See "Syslog loggers" in vanessa_logger.h for
+ *              those that are honoured
+ *      flag: flags for logger, of which VANESSA_LOGGER_F_ASYNC,
+ *            VANESSA_LOGGER_F_RFC5424, VANESSA_LOGGER_F_TIMESTAMP_UTC
+ *            and VANESSA_LOGGER_F_TIMESTAMP_COARSE are honoured
+ * post: Logger is opened. It is not an error if there is no syslog
+ *       daemon yet.
+ * return: pointer to logger
+ *         NULL on error
+ **********************************************************************/
+
+vanessa_logger_t *
+vanessa_logger_openlog_syslog_path(const char *path, const int facility,
+		const char *ident, const int max_priority, const int option,
+		const int flag);
+
+
 /**********************************************************************
  * vanessa_logger_openlog_syslog_byname
  * Exported function to open a logger that will log to syslog
@@ -101,8 +201,9 @@ vanessa_logger_openlog_syslog(const int facility, const char *ident,
  *      max_priority: Maximum priority no to log
  *                    Priorities are integers, the levels listed
  *                    in syslog(3) should be used for a syslog logger
- *      option: options to pass to the openlog command
- *              Will be logically ored with LOG_PID
+ *      option: options as per openlog(3)
+ *              See "Syslog loggers" in vanessa_logger.h for
+ *              those that are honoured
  * post: Logger is opened
  * return: pointer to logger
  *         NULL on error
@@ -156,6 +257,230 @@ vanessa_logger_openlog_filename(const char *filename, const char *ident,
 		const int max_priority, const int flag);
 
 
+/**********************************************************************
+ * Flush policies for filename loggers
+ *
+ * VANESSA_LOGGER_FLUSH_LINE writes each line as it is logged. The others
+ * collect lines in a buffer and write them out together, one writev(2)
+ * at a time, when:
+ *   VANESSA_LOGGER_FLUSH_BYTES:    flush_value bytes are buffered
+ *   VANESSA_LOGGER_FLUSH_MESSAGES: flush_value lines are buffered
+ *   VANESSA_LOGGER_FLUSH_MSEC:     the oldest buffered line is flush_value
+ *                                  milliseconds old
+ * Lines are never split. The buffer is also written out when it is full,
+ * by vanessa_logger_flush(), vanessa_logger_reopen(),
+ * vanessa_logger_closelog() and before fork(2).
+ * The flush policy is not used by VANESSA_LOGGER_F_ASYNC loggers, whose
+ * writer thread already writes in batches.
+ **********************************************************************/
+
+#define VANESSA_LOGGER_FLUSH_LINE     0
+#define VANESSA_LOGGER_FLUSH_BYTES    1
+#define VANESSA_LOGGER_FLUSH_MESSAGES 2
+#define VANESSA_LOGGER_FLUSH_MSEC     3
+
+
+/**********************************************************************
+ * vanessa_logger_openlog_filename_flush
+ * Exported function to open a logger that will log to a filename
+ *          that will be opened, buffering lines according to a
+ *          flush policy
+ * pre: filename: filename to log to
+ *      ident: Identity to prepend to each log
+ *      max_priority: Maximum priority number to log
+ *                    Priorities are integers, the levels listed
+ *                    in syslog(3) should be used for a syslog logger
+ *      flag: flags for logger
+ *            See "Flags for filehandle or filename loggers"
+ *            in vanessa_logger.h for valid flags
+ *      flush: flush policy
+ *             See "Flush policies for filename loggers"
+ *             in vanessa_logger.h for valid policies
+ *      flush_value: bytes, messages or milliseconds for flush
+ * post: Logger is opened
+ * return: pointer to logger
+ *         NULL on error
+ **********************************************************************/
+
+vanessa_logger_t *
+vanessa_logger_openlog_filename_flush(const char *filename, 
+		const char *ident, const int max_priority, const int flag,
+		const int flush, const unsigned long flush_value);
+
+
+/**********************************************************************
+ * Memory mapped loggers
+ *
+ * A memory mapped logger writes lines into preallocated segment files,
+ * filename.00000000, filename.00000001 and so on, that are mapped into
+ * memory, so logging does not make a system call. Lines reach the page
+ * cache as soon as they are logged and the kernel writes them back.
+ *
+ * Each line is stored as a record with its length and a checksum, so
+ * the segment files are not plain text: use vanessa_logger_mmap_dump()
+ * to read them. When a logger is opened it carries on from the end of
+ * the newest segment, after discarding any record left incomplete by a
+ * crash. vanessa_logger_reopen() moves a logger on to a new segment.
+ * Only one process, and its children, should log to a set of segments.
+ **********************************************************************/
+
+#define VANESSA_LOGGER_MMAP_SEGMENT_SIZE ((size_t)16 << 20)
+
+
+/**********************************************************************
+ * vanessa_logger_openlog_mmap
+ * Exported function to open a logger that will log to memory mapped
+ *          segment files
+ * pre: filename: base name of segment files to log to
+ *      ident: Identity to prepend to each log
+ *      max_priority: Maximum priority number to log
+ *                    Priorities are integers, the levels listed
+ *                    in syslog(3) should be used for a syslog logger
+ *      flag: flags for logger
+ *            See "Flags for filehandle or filename loggers"
+ *            in vanessa_logger.h for valid flags.
+ *            VANESSA_LOGGER_F_ASYNC is ignored.
+ *      segment_size: size of each segment in bytes, rounded up to
+ *                    a whole number of pages.
+ *                    0 for VANESSA_LOGGER_MMAP_SEGMENT_SIZE
+ * post: Logger is opened
+ * return: pointer to logger
+ *         NULL on error
+ **********************************************************************/
+
+vanessa_logger_t *
+vanessa_logger_openlog_mmap(const char *filename, const char *ident,
+		const int max_priority, const int flag, 
+		const size_t segment_size);
+
+
+/**********************************************************************
+ * vanessa_logger_mmap_dump
+ * Exported function to write out the lines held in a segment written
+ * by a memory mapped logger. Torn records are skipped.
+ * pre: segment: name of segment file
+ *      fh: filehandle to write lines to
+ * post: lines of valid records are written to fh
+ * return: number of valid records
+ *         -1 on error
+ **********************************************************************/
+
+long
+vanessa_logger_mmap_dump(const char *segment, FILE *fh);
+
+
+/**********************************************************************
+ * Binary loggers
+ *
+ * A filename logger opened with VANESSA_LOGGER_F_BINARY records each
+ * message as an identifier for its format string, the time, the pid and
+ * the values of its arguments, with %s arguments copied, rather than
+ * formatting it. This is much cheaper than formatting and the files are
+ * smaller. The lines a text logger would have written are recovered
+ * using vanessa_logger_decode(), or the vanessa_logger_decode program.
+ *
+ * Format strings are recognised by their address and their contents.
+ * String constants are cheapest, a buffer that is reused for different
+ * formats works but each of them takes a place in the table of formats,
+ * and once that is full new formats are recorded as text. Each file
+ * starts with the ident and each format string is written to a file
+ * once, before the first message that uses it. Formats that can't be
+ * recorded this way, such as those using %n, %ls or positional
+ * arguments, are formatted when they are logged and recorded as text.
+ *
+ * Files can only be decoded on a host with the same byte order and
+ * type sizes as the one that wrote them.
+ **********************************************************************/
+
+typedef void vanessa_logger_decoder_t;
+
+
+/**********************************************************************
+ * vanessa_logger_decoder_create
+ * Exported function to create a decoder for the files written by
+ * VANESSA_LOGGER_F_BINARY loggers
+ * pre: none
+ * post: decoder is allocated
+ * return: decoder
+ *         NULL on error
+ **********************************************************************/
+
+vanessa_logger_decoder_t *
+vanessa_logger_decoder_create(void);
+
+
+/**********************************************************************
+ * vanessa_logger_decoder_destroy
+ * Exported function to free a decoder
+ * pre: decoder: decoder to free
+ * post: memory is freed
+ *       Nothing if decoder is NULL
+ * return: none
+ **********************************************************************/
+
+void
+vanessa_logger_decoder_destroy(vanessa_logger_decoder_t *decoder);
+
+
+/**********************************************************************
+ * vanessa_logger_decode
+ * Exported function to turn the records written by a
+ * VANESSA_LOGGER_F_BINARY logger back into lines of text
+ * pre: decoder: decoder, which remembers the format strings it has
+ *               seen so that a series of files can be decoded in turn
+ *      in: filehandle to read records from
+ *      out: filehandle to write lines to
+ * post: in is read to its end and lines are written to out.
+ *       Timestamps are rendered in the local time of the caller.
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+int
+vanessa_logger_decode(vanessa_logger_decoder_t *decoder, FILE *in, 
+		FILE *out);
+
+
+/**********************************************************************
+ * Fan-out loggers
+ *
+ * A fan-out logger sends each message to several other loggers, for
+ * instance a filename logger, a syslog logger and a filehandle logger
+ * for stderr, expanding the message from its format only once rather
+ * than once for each of them. Each child adds its own header and keeps
+ * its own max_priority and flags, so messages may be logged at more
+ * detail to a file than to syslog. A child that may be slow, such as a
+ * syslog logger, can be opened with VANESSA_LOGGER_F_ASYNC to give it
+ * its own queue and writer thread so that it does not hold up the
+ * others. This is the general form of VANESSA_LOGGER_F_PERROR.
+ *
+ * vanessa_logger_reopen(), vanessa_logger_flush() and
+ * vanessa_logger_closelog() act on all the children. Settings that are
+ * specific to a type of logger, such as vanessa_logger_set_sync(), are
+ * made on the children, before they are handed to the fan-out logger.
+ **********************************************************************/
+
+
+/**********************************************************************
+ * vanessa_logger_openlog_fanout
+ * Exported function to open a logger that will log to other loggers
+ * pre: child: loggers to log to, which must not be fan-out loggers
+ *      n: number of elements in child
+ *      max_priority: Maximum priority number to log
+ *                    Priorities are integers, the levels listed
+ *                    in syslog(3) should be used for a syslog logger
+ * post: Logger is opened and owns the loggers in child, which are
+ *       closed when it is closed
+ * return: pointer to logger
+ *         NULL on error, in which case the loggers in child still
+ *         belong to the caller
+ **********************************************************************/
+
+vanessa_logger_t *
+vanessa_logger_openlog_fanout(vanessa_logger_t **child, const int n,
+		const int max_priority);
+
+
 /**********************************************************************
  * vanessa_logger_openlog_function
  * Exported function to open a logger that will log to a given function
@@ -180,6 +505,8 @@ vanessa_logger_openlog_function(vanessa_logger_log_function_va_t log_function,
  * Exported function to close a logger
  * pre: vl: pointer to logger to close
  * post: logger is closed and memory is freed
+ *       Messages queued by a VANESSA_LOGGER_F_ASYNC logger are
+ *       written out before it is closed
  * return: none
  **********************************************************************/
 
@@ -231,7 +558,8 @@ vanessa_logger_change_max_priority(vanessa_logger_t * vl,
  **********************************************************************/
 
 void
-vanessa_logger_log(vanessa_logger_t * vl, int priority, const char *fmt, ...);
+vanessa_logger_log(vanessa_logger_t * vl, int priority, const char *fmt, ...)
+	VANESSA_LOGGER_FORMAT(3, 4);
 
 
 /**********************************************************************
@@ -243,7 +571,7 @@ vanessa_logger_log(vanessa_logger_t * vl, int priority, const char *fmt, ...);
 
 void 
 vanessa_logger_logv(vanessa_logger_t * vl, int priority, const char *fmt, 
-		va_list ap);
+		va_list ap) VANESSA_LOGGER_FORMAT(3, 0);
 
 
 /**********************************************************************
@@ -254,7 +582,417 @@ vanessa_logger_logv(vanessa_logger_t * vl, int priority, const char *fmt,
 
 void 
 _vanessa_logger_log_prefix(vanessa_logger_t * vl, int priority, 
-		const char *prefix, const char *fmt, ...);
+		const char *prefix, const char *fmt, ...)
+	VANESSA_LOGGER_FORMAT(4, 5);
+
+
+/**********************************************************************
+ * Structured logging
+ *
+ * vanessa_logger_logkv() logs a message along with key/value pairs,
+ * so that they need not be parsed out of the text again. The pairs are
+ * given as key, type, value triples ended by a NULL key:
+ *
+ *   vanessa_logger_logkv(vl, LOG_ERR, "connect failed",
+ *                        "host", VANESSA_LOGGER_KV_STR, host,
+ *                        "port", VANESSA_LOGGER_KV_INT, port,
+ *                        NULL);
+ *
+ * Filehandle, filename and mmap loggers with VANESSA_LOGGER_F_JSON set
+ * write each message as a line of JSON:
+ *
+ *   {"time":"...","ident":"prog","pid":123,"level":"err",
+ *    "msg":"connect failed","host":"db1","port":5432}
+ *
+ * "time" is only present if VANESSA_LOGGER_F_TIMESTAMP is set, "ident"
+ * and "pid" unless VANESSA_LOGGER_F_NO_IDENT_PID is set and "func" is
+ * added for messages with a function name, such as those logged by
+ * VANESSA_LOGGER_DEBUG(). Messages logged by vanessa_logger_log() and
+ * friends are written the same way without extra members.
+ *
+ * Other loggers, including binary ones, log the message as text
+ * followed by the pairs in logfmt, "connect failed host=db1 port=5432".
+ **********************************************************************/
+
+#define VANESSA_LOGGER_KV_STR    1  /* const char *, NULL for null */
+#define VANESSA_LOGGER_KV_INT    2  /* int */
+#define VANESSA_LOGGER_KV_LLONG  3  /* long long */
+#define VANESSA_LOGGER_KV_ULLONG 4  /* unsigned long long */
+#define VANESSA_LOGGER_KV_DOUBLE 5  /* double */
+#define VANESSA_LOGGER_KV_BOOL   6  /* int, 0 is false */
+
+
+/**********************************************************************
+ * vanessa_logger_logkv
+ * Exported function to log a message with key/value pairs
+ * pre: vl: pointer to logger to log to
+ *      priority: priority to log with
+ *      msg: message, which is not used as a format
+ *      ...: key, type, value triples ended by a NULL key
+ *           type is one of VANESSA_LOGGER_KV_*
+ * post: Message is logged
+ * return: none
+ **********************************************************************/
+
+void
+vanessa_logger_logkv(vanessa_logger_t * vl, int priority, const char *msg,
+		...);
+
+
+/**********************************************************************
+ * vanessa_logger_logkvv
+ * Exported function to log a message with key/value pairs
+ * Same as vanessa_logger_logkv but a va_list is given instead
+ * of a variable number of arguments.
+ **********************************************************************/
+
+void
+vanessa_logger_logkvv(vanessa_logger_t * vl, int priority, const char *msg,
+		va_list ap);
+
+
+/**********************************************************************
+ * Categories
+ *
+ * A category names a part of a program that logs through a logger,
+ * so that its level can be set apart from the rest. Names are made of
+ * components separated by '.', such as "net" and "net.tls", and a
+ * level given to a category also applies to those below it unless they
+ * are given one of their own.
+ *
+ * A category is registered once, for instance at start up, and the
+ * handle returned is then used for each message. The threshold of each
+ * category is worked out when levels are set, so checking whether a
+ * message should be logged costs a single comparison, as it does for
+ * vanessa_logger_log(). Categories without a level follow the
+ * max_priority of the logger.
+ *
+ * Categories, and the handles for them, are freed by
+ * vanessa_logger_closelog(). For fan-out loggers each child still
+ * applies its own max_priority.
+ **********************************************************************/
+
+typedef struct vanessa_logger_category_struct vanessa_logger_category_t;
+
+struct vanessa_logger_category_struct {
+	int max_priority;                /* Read only */
+	char *name;                      /* Read only */
+	vanessa_logger_t *vl;            /* Read only */
+	vanessa_logger_category_t *next; /* Private */
+};
+
+
+/**********************************************************************
+ * vanessa_logger_category
+ * Exported function to register a category of a logger
+ * pre: vl: logger that the category logs through
+ *      name: name of category, such as "net.tls"
+ * post: category is registered with vl if it was not already
+ * return: handle for the category
+ *         NULL on error
+ **********************************************************************/
+
+vanessa_logger_category_t *
+vanessa_logger_category(vanessa_logger_t * vl, const char *name);
+
+
+/**********************************************************************
+ * vanessa_logger_set_levels
+ * Exported function to set the levels of the categories of a logger
+ * pre: vl: logger to set levels of
+ *      rules: rules separated by ',' or white space, each of the form
+ *             pattern=level, for instance "*=warning,net.*=debug"
+ *             pattern is one of
+ *               name    the category name and those below it
+ *               name.*  only the categories below name
+ *               *       all categories
+ *             level is one of emerg, alert, crit, err, warning,
+ *             notice, info, debug, none or a number.
+ *             Where more than one pattern applies to a category
+ *             the most specific one is used.
+ *             NULL or "" removes all rules.
+ * post: rules of vl are replaced and the threshold of each of its
+ *       categories is worked out again
+ * return: 0 on success
+ *         -1 on error, in which case the rules are not changed
+ **********************************************************************/
+
+int
+vanessa_logger_set_levels(vanessa_logger_t * vl, const char *rules);
+
+
+/**********************************************************************
+ * vanessa_logger_category_enabled
+ * Macro to check whether a category would log a message of a given
+ * priority. May be used to avoid preparing arguments for a message
+ * that would not be logged.
+ **********************************************************************/
+
+#define vanessa_logger_category_enabled(cat, priority) \
+	((priority) <= (cat)->max_priority)
+
+
+/**********************************************************************
+ * vanessa_logger_log_category
+ * Exported function to log a message in a category
+ * pre: cat: category to log in
+ *      priority: priority to log with, the message is only logged
+ *                if it is no more than the threshold of cat.
+ *                The max_priority of the logger is not checked.
+ *      fmt: format of message to log
+ *      ...: data for fmt
+ * post: Message is logged
+ * return: none
+ **********************************************************************/
+
+void
+vanessa_logger_log_category(vanessa_logger_category_t * cat, int priority,
+		const char *fmt, ...) VANESSA_LOGGER_FORMAT(3, 4);
+
+
+/**********************************************************************
+ * vanessa_logger_logv_category
+ * Exported function to log a message in a category
+ * Same as vanessa_logger_log_category but a va_list is given instead
+ * of a variable number of arguments.
+ **********************************************************************/
+
+void
+vanessa_logger_logv_category(vanessa_logger_category_t * cat, int priority,
+		const char *fmt, va_list ap) VANESSA_LOGGER_FORMAT(3, 0);
+
+#define VANESSA_LOGGER_CATEGORY(cat, priority, fmt, ...) \
+	__VANESSA_LOGGER_IF(priority, \
+		(vanessa_logger_category_enabled(cat, \
+			__VANESSA_LOGGER_PRIORITY(priority)) ? \
+		 vanessa_logger_log_category(cat, \
+			 __VANESSA_LOGGER_PRIORITY(priority), fmt, \
+			 __VA_ARGS__) : (void)0))
+
+
+/**********************************************************************
+ * Rate limiting of call sites
+ *
+ * A call site that may be reached very often, such as one that logs
+ * each failure of a backend, can be given a site of its own. The
+ * macros VANESSA_LOGGER_LIMIT() and friends declare one for the place
+ * that they are used in.
+ *
+ * A site lets through at most rate messages each interval milliseconds,
+ * in bursts of up to rate messages. Further messages are dropped before
+ * they are expanded. A rate of 0 lets every message through.
+ *
+ * Like syslogd, a site also collapses identical consecutive messages.
+ * Only the first is logged.
+ *
+ * The number of messages dropped and repeated at a site is logged at
+ * its priority, at the latest interval milliseconds after the first of
+ * them, or 30 seconds if interval is 0. A count of repeats is also
+ * logged before the next different message from the site. Both counts
+ * are also logged by vanessa_logger_flush() and
+ * vanessa_logger_closelog().
+ *
+ * The state of a site is updated without locks. Checking the limit
+ * costs a read of the monotonic clock and an atomic compare and swap.
+ **********************************************************************/
+
+typedef struct vanessa_logger_site_struct vanessa_logger_site_t;
+
+struct vanessa_logger_site_struct {
+	const char *file;
+	int line;
+	unsigned int rate;
+	unsigned int interval;
+	/* Private */
+	unsigned long long tat;
+	unsigned long long hash;
+	unsigned int dropped;
+	unsigned int repeated;
+	int listed;
+	int priority;
+	unsigned long long report_at;
+	vanessa_logger_t *vl;
+	vanessa_logger_site_t *next;
+};
+
+#define VANESSA_LOGGER_SITE_INIT(rate, interval) \
+	{ __FILE__, __LINE__, (rate), (interval), 0, 0, 0, 0, 0, 0, 0, \
+		NULL, NULL }
+
+
+/**********************************************************************
+ * vanessa_logger_log_limit
+ * Exported function to log a message from a rate limited call site
+ * pre: site: site the message is logged from, usually declared static
+ *            and initialised using VANESSA_LOGGER_SITE_INIT()
+ *      vl: pointer to logger to log to
+ *      priority: priority to log with
+ *      fmt: format of message to log
+ *      ...: data for fmt
+ * post: Message is logged unless it is filtered out by priority,
+ *       dropped by the limit of site or is a repeat of the previous
+ *       message from site
+ * return: none
+ **********************************************************************/
+
+void
+vanessa_logger_log_limit(vanessa_logger_site_t * site, 
+		vanessa_logger_t * vl, int priority, const char *fmt, ...)
+	VANESSA_LOGGER_FORMAT(4, 5);
+
+
+/**********************************************************************
+ * Call site descriptors
+ *
+ * When built by gcc for an ELF platform, each use of the
+ * VANESSA_LOGGER_DEBUG(), VANESSA_LOGGER_INFO() and VANESSA_LOGGER_ERR()
+ * families of macros records a descriptor of the call site: its file,
+ * line, function, priority and format, and a message id, the 64 bit
+ * FNV-1a hash of the format. Descriptors are gathered by the linker
+ * and registered with the library as the programme, or a shared
+ * object, is loaded.
+ *
+ * Each site may be switched at run time:
+ *   VANESSA_LOGGER_DESC_OFF      the site logs nothing
+ *   VANESSA_LOGGER_DESC_DEFAULT  the site logs subject to the
+ *                                max_priority of the logger
+ *   VANESSA_LOGGER_DESC_ON       the site logs regardless of the
+ *                                max_priority of the logger
+ * So a single debug message may be turned on without lowering the
+ * max_priority of the logger to LOG_DEBUG. Sites start as
+ * VANESSA_LOGGER_DESC_DEFAULT, the behaviour without descriptors.
+ *
+ * Checking the state of a site costs a load of one byte, ahead of the
+ * call made for the message.
+ *
+ * Define VANESSA_LOGGER_NO_DESC before including this file to build
+ * without descriptors.
+ **********************************************************************/
+
+#define VANESSA_LOGGER_DESC_OFF     0
+#define VANESSA_LOGGER_DESC_DEFAULT 1
+#define VANESSA_LOGGER_DESC_ON      2
+
+typedef struct vanessa_logger_desc_struct vanessa_logger_desc_t;
+
+struct vanessa_logger_desc_struct {
+	const char *file;           /* Read only */
+	const char *func;           /* Read only */
+	const char *fmt;            /* Read only */
+	unsigned int line;          /* Read only */
+	unsigned int func_len;      /* Read only, strlen(func) */
+	int priority;               /* Read only */
+	unsigned char enabled;      /* VANESSA_LOGGER_DESC_* */
+	unsigned long long id;      /* Read only, set on registration */
+};
+
+
+/**********************************************************************
+ * vanessa_logger_desc_foreach
+ * Exported function to list the registered call sites
+ * pre: func: called for each site with its descriptor and data.
+ *            Returning non-zero stops the walk.
+ *      data: passed to func
+ * post: func has been called for the sites
+ * return: 0 if every site was visited
+ *         value returned by func if it stopped the walk
+ *
+ * Note: func must not register sites or call
+ *       vanessa_logger_desc_set()
+ **********************************************************************/
+
+typedef int (*vanessa_logger_desc_function_t)
+		(vanessa_logger_desc_t *desc, void *data);
+
+int
+vanessa_logger_desc_foreach(vanessa_logger_desc_function_t func,
+		void *data);
+
+
+/**********************************************************************
+ * vanessa_logger_desc_set
+ * Exported function to switch call sites on or off
+ * pre: pattern: sites to switch. Matched, as by fnmatch(3), against
+ *               the file of each site, with and without its
+ *               directory, file:line and the function of the site.
+ *               A pattern of the form #id matches the site or sites
+ *               with that message id, given in hexadecimal.
+ *      enabled: VANESSA_LOGGER_DESC_OFF, VANESSA_LOGGER_DESC_DEFAULT
+ *               or VANESSA_LOGGER_DESC_ON
+ * post: matching sites are switched
+ * return: number of sites matched
+ *         -1 on error
+ *
+ * Example: vanessa_logger_desc_set("server.c:412", VANESSA_LOGGER_DESC_ON)
+ **********************************************************************/
+
+int
+vanessa_logger_desc_set(const char *pattern, int enabled);
+
+
+/**********************************************************************
+ * vanessa_logger_desc_dump
+ * Exported function to write out the registered call sites
+ * pre: fh: filehandle to write to
+ * post: a line of the form
+ *         file:line func priority id state "fmt"
+ *       is written to fh for each site
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+int
+vanessa_logger_desc_dump(FILE *fh);
+
+
+/**********************************************************************
+ * _vanessa_logger_log_desc
+ * Exported function used by convenience macros to log a message
+ * from a call site with a descriptor
+ **********************************************************************/
+
+void
+_vanessa_logger_log_desc(vanessa_logger_t * vl, vanessa_logger_desc_t *desc,
+		const char *prefix, const char *fmt, ...)
+	VANESSA_LOGGER_FORMAT(4, 5);
+
+
+/**********************************************************************
+ * _vanessa_logger_desc_register, _vanessa_logger_desc_unregister
+ * Exported functions used to register and unregister the call sites
+ * of a programme or shared object
+ **********************************************************************/
+
+void
+_vanessa_logger_desc_register(vanessa_logger_desc_t **start,
+		vanessa_logger_desc_t **stop);
+
+void
+_vanessa_logger_desc_unregister(vanessa_logger_desc_t **start);
+
+#if defined(__GNUC__) && defined(__ELF__) && !defined(VANESSA_LOGGER_NO_DESC)
+#define __VANESSA_LOGGER_DESC
+
+/* Defined by the linker for each programme or shared object */
+extern vanessa_logger_desc_t *__start_vanessa_logger_sites[]
+	__attribute__ ((weak, visibility ("hidden")));
+extern vanessa_logger_desc_t *__stop_vanessa_logger_sites[]
+	__attribute__ ((weak, visibility ("hidden")));
+
+/* Each file registers the same sites, the library ignores repeats */
+static void __attribute__ ((constructor, unused))
+__vanessa_logger_desc_init(void)
+{
+	_vanessa_logger_desc_register(__start_vanessa_logger_sites,
+			__stop_vanessa_logger_sites);
+}
+
+static void __attribute__ ((destructor, unused))
+__vanessa_logger_desc_fini(void)
+{
+	_vanessa_logger_desc_unregister(__start_vanessa_logger_sites);
+}
+#endif
 
 
 /**********************************************************************
@@ -265,14 +1003,170 @@ _vanessa_logger_log_prefix(vanessa_logger_t * vl, int priority,
  * return: 0 on success
  *         -1 on error
  *
- * Note: May be used as part of a signal handler to reopen logger
- *       on for instance receiving a SIGHUP
+ * Note: Takes locks and may wait for other threads, so it must not be
+ *       called from a signal handler. To reopen a logger on, for
+ *       instance, receiving a SIGHUP use vanessa_logger_reopen_signal().
+ *       Messages queued by a VANESSA_LOGGER_F_ASYNC logger before
+ *       the call are written to the old file, messages logged while
+ *       the file is being reopened are written to the new one.
+ *       Other threads may carry on logging to a filename logger while
+ *       it is reopened. Each of their messages is written whole to
+ *       either the old file or the new one, and those that are not
+ *       buffered by a flush policy do not wait for the reopen.
  **********************************************************************/
 
 int 
 vanessa_logger_reopen(vanessa_logger_t * vl);
 
 
+/**********************************************************************
+ * vanessa_logger_reopen_signal
+ * Exported function to ask for a logger to be reopened.
+ * Safe to call from a signal handler.
+ * pre: vl: pointer to logger to reopen
+ * post: the logger is reopened, as by vanessa_logger_reopen(), the
+ *       next time a message is logged to it
+ * return: none
+ **********************************************************************/
+
+void
+vanessa_logger_reopen_signal(vanessa_logger_t * vl);
+
+
+/**********************************************************************
+ * vanessa_logger_flush
+ * Exported function to write out any messages a logger is holding
+ * pre: vl: pointer to logger to flush
+ * post: Counts kept by rate limited call sites are logged.
+ *       Messages buffered by a filename logger or queued by a
+ *       VANESSA_LOGGER_F_ASYNC logger are written and a filehandle
+ *       logger's filehandle is flushed.
+ *       Nothing for other loggers or if vl is NULL.
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+int
+vanessa_logger_flush(vanessa_logger_t * vl);
+
+
+/**********************************************************************
+ * Group commit for filename loggers
+ *
+ * A filename logger may be asked to make messages of sync_priority or
+ * lower (that is, more important) durable before vanessa_logger_log()
+ * and friends return. Such a caller waits until its line has been
+ * written and fdatasync(2) has completed on the file.
+ *
+ * Callers waiting at the same time share a single fdatasync(2). The
+ * first caller to find no fdatasync(2) under way waits window_usec
+ * microseconds for others to join it, then syncs the file on behalf of
+ * all of them. A longer window means fewer fdatasync(2) calls and more
+ * latency for each caller. Callers that arrive while an fdatasync(2) is
+ * under way are served by the next one.
+ *
+ * Messages of lower importance never wait, but are made durable by any
+ * fdatasync(2) that follows them.
+ **********************************************************************/
+
+#define VANESSA_LOGGER_SYNC_NONE -1
+
+typedef struct {
+	unsigned long syncs;          /* fdatasync(2) calls made */
+	unsigned long sync_errors;    /* fdatasync(2) calls that failed */
+	unsigned long commits;        /* callers that waited */
+	unsigned long long commit_usec_total; /* time they waited */
+	unsigned long commit_usec_max; /* longest single wait */
+} vanessa_logger_sync_stats_t;
+
+
+/**********************************************************************
+ * vanessa_logger_set_sync
+ * Exported function to set which messages a filename logger makes
+ * durable before returning to the caller
+ * pre: vl: pointer to logger to change
+ *      sync_priority: messages of this priority or lower are made
+ *                     durable. VANESSA_LOGGER_SYNC_NONE, the default,
+ *                     turns group commit off.
+ *      window_usec: microseconds to wait for other callers before
+ *                   calling fdatasync(2), may be 0
+ * post: group commit settings of logger are changed
+ * return: 0 on success
+ *         -1 on error, including if vl is not a filename logger
+ **********************************************************************/
+
+int
+vanessa_logger_set_sync(vanessa_logger_t * vl, int sync_priority,
+		unsigned long window_usec);
+
+
+/**********************************************************************
+ * vanessa_logger_get_sync_stats
+ * Exported function to read the group commit counters of a filename
+ * logger
+ * pre: vl: pointer to logger
+ *      stats: counters are written here
+ * post: stats is filled in
+ * return: 0 on success
+ *         -1 on error, including if vl is not a filename logger
+ **********************************************************************/
+
+int
+vanessa_logger_get_sync_stats(vanessa_logger_t * vl,
+		vanessa_logger_sync_stats_t *stats);
+
+
+/**********************************************************************
+ * Rotation for filename loggers
+ *
+ * A filename logger may rotate its file itself, once it reaches a given
+ * size, at wall-clock boundaries, or both, rather than relying on the
+ * file being renamed and vanessa_logger_reopen() being called. The file
+ * being logged to is always called filename. Rotated files are named:
+ *   VANESSA_LOGGER_ROTATE_NUMBER: filename.1, filename.2, ...,
+ *                                 filename.1 being the newest
+ *   VANESSA_LOGGER_ROTATE_DATE:   filename.YYYYMMDD-HHMMSS, after the
+ *                                 local time the file was rotated
+ *
+ * The next file is opened ahead of time, as filename.next, by a thread
+ * belonging to the logger. The switch to it is a single dup2(2), so
+ * rotating adds no latency to logging and no message is lost or split
+ * between files. Renaming, deleting old files and syncing them for
+ * group commit are left to that thread. vanessa_logger_reopen() rotates
+ * such a logger straight away.
+ *
+ * Only the process that turned rotation on rotates the files. In a
+ * child created by fork(2) rotation is turned off, the child may turn
+ * it on again or use vanessa_logger_reopen() to follow the parent.
+ **********************************************************************/
+
+#define VANESSA_LOGGER_ROTATE_NUMBER 0
+#define VANESSA_LOGGER_ROTATE_DATE   1
+
+
+/**********************************************************************
+ * vanessa_logger_set_rotate
+ * Exported function to set when a filename logger rotates its file
+ * pre: vl: pointer to logger to change
+ *      size: rotate once the file is this many bytes long, 0 for never.
+ *            The file may end up a few lines longer than this.
+ *      interval: rotate every interval seconds, counted from midnight
+ *                local time, 0 for never. For instance 3600 rotates
+ *                on the hour and 86400 at midnight.
+ *      naming: VANESSA_LOGGER_ROTATE_NUMBER or
+ *              VANESSA_LOGGER_ROTATE_DATE
+ *      keep: number of rotated files to keep, 0 to keep them all
+ * post: rotation settings of logger are changed. If size and interval
+ *       are both 0 rotation is turned off.
+ * return: 0 on success
+ *         -1 on error, including if vl is not a filename logger
+ **********************************************************************/
+
+int
+vanessa_logger_set_rotate(vanessa_logger_t * vl, unsigned long long size,
+		unsigned long interval, int naming, unsigned int keep);
+
+
 /**********************************************************************
  * vanessa_logger_strherror_r
  * Returns a string describing the error code present in errnum
@@ -304,6 +1198,9 @@ vanessa_logger_strherror_r(int errnum, char *buf, size_t n);
  *       if buf is too short then errno is set to -ERANGE
  * return: error string for errnum on success
  *         error string for newly set errno on error
+ *         The string is stored in a buffer that belongs to the
+ *         calling thread and is overwritten by the next call made
+ *         by that thread.
  **********************************************************************/
 
 char *
@@ -343,6 +1240,28 @@ vanessa_logger_flag_t
 vanessa_logger_get_flag(vanessa_logger_t * vl);
 
 
+/**********************************************************************
+ * vanessa_logger_set_max_len
+ * Exported function to set the length of the longest line a logger
+ * writes. Longer lines are cut short and end with "...[truncated]".
+ * pre: vl: logger to change
+ *      max_len: longest line in bytes, including the trailing '\n'
+ *               and a NUL. The default is VANESSA_LOGGER_MAX_LEN,
+ *               values below VANESSA_LOGGER_MIN_LEN are raised to it.
+ * post: max_len is set
+ * return: none
+ *
+ * Note: A syslog daemon may cut a long message short itself, often at
+ *       a few kilobytes.
+ **********************************************************************/
+
+#define VANESSA_LOGGER_MAX_LEN 1048576
+#define VANESSA_LOGGER_MIN_LEN 1024
+
+void
+vanessa_logger_set_max_len(vanessa_logger_t * vl, size_t max_len);
+
+
 /**********************************************************************
  * vanessa_logger_str_dump
  * Sanitise a buffer into ASCII
@@ -368,6 +1287,256 @@ vanessa_logger_str_dump(vanessa_logger_t * vl, const char *buffer,
 		const size_t buffer_length, vanessa_logger_flag_t flag);
 
 
+/**********************************************************************
+ * VANESSA_LOGGER_STR_DUMP_LEN
+ * Most bytes, including the trailing '\0', needed to sanitise
+ * length bytes with vanessa_logger_str_dump_r()
+ **********************************************************************/
+
+#define VANESSA_LOGGER_STR_DUMP_LEN(length, flag) \
+	((flag) == VANESSA_LOGGER_STR_DUMP_HEX ? \
+	 ((length) << 1) + ((length) >> 2) + 1 : (length) * 4 + 1)
+
+
+/**********************************************************************
+ * vanessa_logger_str_dump_r
+ * Sanitise a buffer into ASCII in memory provided by the caller
+ * pre: vl: Vanessa logger to log errors to. May be NULL.
+ *      buffer: buffer to sanitise
+ *      buffer_length: number of bytes in buffer to sanitise
+ *      flag: as for vanessa_logger_str_dump()
+ *      out: memory to write the result to, for instance a static
+ *           buffer or part of an arena, which is reused for each dump
+ *      out_len: size of out, which must be at least
+ *               VANESSA_LOGGER_STR_DUMP_LEN(buffer_length, flag)
+ * post: out holds the result of vanessa_logger_str_dump()
+ * return: out
+ *         NULL if out_len is too small
+ **********************************************************************/
+
+char *
+vanessa_logger_str_dump_r(vanessa_logger_t * vl, const char *buffer, 
+		const size_t buffer_length, vanessa_logger_flag_t flag,
+		char *out, const size_t out_len);
+
+
+/**********************************************************************
+ * vanessa_logger_log_hexdump
+ * Exported function to log a buffer as a hex dump, like xxd(1)
+ * pre: vl: pointer to logger to log to
+ *      priority: priority to log with
+ *      buffer: buffer to dump
+ *      buffer_length: number of bytes in buffer
+ * post: Each 16 bytes of buffer are logged as a line of their
+ *       offset, hex and ASCII:
+ *       "00000010: 6c6f 2077 6f72 6c64 0a                lo world."
+ *       Nothing if priority is filtered out
+ * return: none
+ *
+ * Note: Unlike logging the result of vanessa_logger_str_dump() no
+ *       memory is allocated, however large buffer is.
+ **********************************************************************/
+
+void
+vanessa_logger_log_hexdump(vanessa_logger_t * vl, int priority,
+		const void *buffer, size_t buffer_length);
+
+
+/**********************************************************************
+ * Statistics
+ *
+ * Once vanessa_logger_set_stats() turns them on a logger counts the
+ * messages it writes, drops and truncates and the errors it gets
+ * writing them, and times how long messages take to format and to
+ * write. Each thread bumps counters of its own, which are added
+ * together when they are read, so threads logging at the same time do
+ * not contend for them.
+ *
+ * Times are kept as histograms with buckets that double in width:
+ * bucket[i] counts times of at most 2^i ns that don't fit in
+ * bucket[i - 1], the last bucket also counts anything longer.
+ * For an asynchronous logger each write time is that of a batch
+ * written by the writer thread.
+ *
+ * Statistics are off by default, when they cost a single test
+ * per message.
+ **********************************************************************/
+
+#define VANESSA_LOGGER_STATS_BUCKETS 32
+
+typedef struct {
+	unsigned long long count;     /* times recorded */
+	unsigned long long sum_nsec;  /* their total */
+	unsigned long long bucket[VANESSA_LOGGER_STATS_BUCKETS];
+} vanessa_logger_histogram_t;
+
+typedef struct {
+	unsigned long long written;   /* messages handed to the sink */
+	unsigned long long bytes;     /* bytes in those messages */
+	unsigned long long dropped;   /* messages dropped as the logger
+					 was not ready */
+	unsigned long long truncated; /* messages that could not be
+					 formatted in full */
+	unsigned long long write_errors; /* failed writes */
+	vanessa_logger_histogram_t format; /* time to format messages */
+	vanessa_logger_histogram_t write;  /* time to write them */
+} vanessa_logger_stats_t;
+
+
+/**********************************************************************
+ * vanessa_logger_set_stats
+ * Exported function to turn the statistics of a logger on or off
+ * pre: vl: pointer to logger
+ *      enable: non-zero to turn statistics on, 0 to turn them off
+ * post: statistics are collected, or not. Counts are kept when
+ *       statistics are turned off and on again.
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+int
+vanessa_logger_set_stats(vanessa_logger_t * vl, int enable);
+
+
+/**********************************************************************
+ * vanessa_logger_get_stats
+ * Exported function to read the statistics of a logger
+ * pre: vl: pointer to logger
+ *      stats: statistics are written here
+ * post: stats is filled in, with zeros if statistics have never
+ *       been turned on
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+int
+vanessa_logger_get_stats(vanessa_logger_t * vl, vanessa_logger_stats_t *stats);
+
+
+/**********************************************************************
+ * vanessa_logger_export_stats
+ * Exported function to write the statistics of a logger to a file in
+ * the Prometheus text exposition format, for instance for the
+ * textfile collector of node_exporter. Metrics are named
+ * vanessa_logger_* and labelled with the ident of the logger.
+ * pre: vl: pointer to logger
+ *      filename: file to write to. It is written as filename.tmp
+ *                and renamed, so readers never see part of it.
+ * post: filename is replaced
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+int
+vanessa_logger_export_stats(vanessa_logger_t * vl, const char *filename);
+
+
+/**********************************************************************
+ * vanessa_logger_export_stats_function
+ * Exported function to hand the statistics of a logger, in the
+ * Prometheus text exposition format, to a function.
+ * For instance to serve them over HTTP.
+ * pre: vl: pointer to logger
+ *      func: called once with the text, its length and data
+ *      data: passed to func
+ * post: func has been called
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+typedef void (*vanessa_logger_stats_function_t)
+		(const char *text, size_t len, void *data);
+
+int
+vanessa_logger_export_stats_function(vanessa_logger_t * vl,
+		vanessa_logger_stats_function_t func, void *data);
+
+
+/**********************************************************************
+ * Flight recorder
+ *
+ * A logger may keep the messages that its max_priority filters out,
+ * such as debug messages, in memory so that they can be written out
+ * after something has gone wrong. Messages are recorded as binary
+ * logging does: the format is not expanded, only its arguments are
+ * copied. As for binary loggers, format strings are recognised by
+ * their address and their contents.
+ *
+ * Each thread records into a ring of its own without taking a lock.
+ * The oldest messages in a ring are overwritten once it is full.
+ * A ring is handed on to another thread once the thread that recorded
+ * into it exits, so the memory used is size bytes for each thread
+ * that records at once.
+ *
+ * The recorder is dumped, that is the messages recorded over the last
+ * seconds seconds are logged with their original priority and time
+ * and in the order they were recorded:
+ *   - before a message of priority trigger or lower is logged
+ *   - by vanessa_logger_dump_recorder()
+ *   - the next time a message is logged or recorded after
+ *     vanessa_logger_recorder_signal(), which may be called from
+ *     a signal handler
+ * Each message is dumped at most once.
+ *
+ * Messages logged using vanessa_logger_log(), vanessa_logger_logv()
+ * and the convenience macros are recorded. Those filtered out by a
+ * category or dropped by a rate limited call site are not.
+ **********************************************************************/
+
+#define VANESSA_LOGGER_RECORDER_SIZE (size_t)65536
+
+
+/**********************************************************************
+ * vanessa_logger_set_recorder
+ * Exported function to set up the flight recorder of a logger
+ * pre: vl: pointer to logger
+ *      priority: messages filtered out by the max_priority of vl
+ *                with this priority or lower are recorded.
+ *                -1 turns the recorder off.
+ *      size: size in bytes of the ring of each thread, rounded up
+ *            to a power of 2. 0 for VANESSA_LOGGER_RECORDER_SIZE.
+ *            Only used the first time the recorder is turned on.
+ *      seconds: age of the oldest message dumped, 0 for no limit
+ *      trigger: messages logged with this priority or lower dump
+ *               the recorder, for instance LOG_ERR. -1 for none.
+ * post: recorder is set up, messages already recorded are kept
+ * return: 0 on success
+ *         -1 on error
+ **********************************************************************/
+
+int
+vanessa_logger_set_recorder(vanessa_logger_t * vl, int priority,
+		size_t size, unsigned int seconds, int trigger);
+
+
+/**********************************************************************
+ * vanessa_logger_dump_recorder
+ * Exported function to log the messages in the flight recorder of a
+ * logger
+ * pre: vl: pointer to logger
+ * post: recorded messages that have not been dumped before are logged
+ * return: number of messages logged
+ *         -1 on error
+ **********************************************************************/
+
+int
+vanessa_logger_dump_recorder(vanessa_logger_t * vl);
+
+
+/**********************************************************************
+ * vanessa_logger_recorder_signal
+ * Exported function to ask for the flight recorder of a logger to
+ * be dumped. Safe to call from a signal handler.
+ * pre: vl: pointer to logger
+ * post: the recorder is dumped the next time a message is logged to,
+ *       or recorded by, vl
+ * return: none
+ **********************************************************************/
+
+void
+vanessa_logger_recorder_signal(vanessa_logger_t * vl);
+
+
 /**********************************************************************
  * The code below sets an internal logger and provides convenience
  * macros to use this logger. You may either use this, or keep
@@ -433,56 +1602,196 @@ extern vanessa_logger_t *__vanessa_logger_vl;
  * should be safe to use with user derived input.
  */
 
+/*
+ * Compile time priority filtering
+ *
+ * Messages logged by the macros below with a priority greater than
+ * VANESSA_LOGGER_COMPILE_MAX_PRIORITY are compiled out: their arguments,
+ * for instance strerror(errno), are never evaluated and no call is made,
+ * though the compiler still checks the arguments. To drop debug messages
+ * from a release build use, for example:
+ *
+ *   -DVANESSA_LOGGER_COMPILE_MAX_PRIORITY=LOG_INFO
+ *
+ * The default keeps everything up to and including LOG_DEBUG.
+ * Messages that survive this are still subject to the max_priority
+ * of the logger at run time.
+ *
+ * The priority is evaluated once, so it may be an expression with side
+ * effects. With gcc it is kept in a local, which call refers to as
+ * __VANESSA_LOGGER_PRIORITY(priority). Other compilers have no
+ * statement expressions, so there messages are only filtered at run
+ * time.
+ */
+
+#ifndef VANESSA_LOGGER_COMPILE_MAX_PRIORITY
+#define VANESSA_LOGGER_COMPILE_MAX_PRIORITY LOG_DEBUG
+#endif
+
+#ifdef __GNUC__
+#define __VANESSA_LOGGER_IF(priority, call) \
+	__extension__ ({ \
+		int __vanessa_logger_priority = (priority); \
+		if (__vanessa_logger_priority <= \
+				VANESSA_LOGGER_COMPILE_MAX_PRIORITY) \
+			call; \
+	})
+#define __VANESSA_LOGGER_PRIORITY(priority) __vanessa_logger_priority
+#else
+#define __VANESSA_LOGGER_IF(priority, call) (call)
+#define __VANESSA_LOGGER_PRIORITY(priority) (priority)
+#endif
+
 #define VANESSA_LOGGER_LOG_UNSAFE(priority, fmt, ...) \
-	vanessa_logger_log(__vanessa_logger_vl, priority, fmt, __VA_ARGS__)
+	__VANESSA_LOGGER_IF(priority, \
+		vanessa_logger_log(__vanessa_logger_vl, \
+			__VANESSA_LOGGER_PRIORITY(priority), fmt, __VA_ARGS__))
 
 #define VANESSA_LOGGER_LOG(priority, str) \
-	vanessa_logger_log(__vanessa_logger_vl, priority, "%s", str)
+	__VANESSA_LOGGER_IF(priority, \
+		vanessa_logger_log(__vanessa_logger_vl, \
+			__VANESSA_LOGGER_PRIORITY(priority), "%s", str))
+
+/*
+ * Call site descriptors
+ *
+ * The DEBUG, INFO and ERR macros below go through
+ * __VANESSA_LOGGER_SITE(), which gives each use a descriptor, when
+ * descriptors are available and the priority is not compiled out.
+ * A pointer to the descriptor, rather than the descriptor itself, is
+ * placed in the vanessa_logger_sites section so that the section is an
+ * array with no padding for the compiler to add.
+ *
+ * The format is part of the static descriptor, so it must be a
+ * constant. A use with any other format, say a const char * variable,
+ * has no descriptor, its slot in the section is NULL, and logs as if
+ * descriptors were not available.
+ */
+
+#ifdef __VANESSA_LOGGER_DESC
+#define __VANESSA_LOGGER_SITE(priority, prefix, fmt, ...) \
+	__extension__ ({ \
+		static vanessa_logger_desc_t __vanessa_logger_desc = { \
+			__FILE__, __func__, \
+			__builtin_constant_p(fmt) ? (fmt) : NULL, \
+			__LINE__, sizeof(__func__) - 1, priority, \
+			VANESSA_LOGGER_DESC_DEFAULT, 0 }; \
+		static vanessa_logger_desc_t *__vanessa_logger_desc_p \
+			__attribute__ ((section ("vanessa_logger_sites"), \
+						used)) = \
+			__builtin_constant_p(fmt) ? \
+			&__vanessa_logger_desc : NULL; \
+		if (!__builtin_constant_p(fmt)) \
+			_vanessa_logger_log_prefix(__vanessa_logger_vl, \
+					priority, prefix, fmt, \
+					__VA_ARGS__); \
+		else if (__atomic_load_n(&__vanessa_logger_desc.enabled, \
+					__ATOMIC_RELAXED)) \
+			_vanessa_logger_log_desc(__vanessa_logger_vl, \
+					&__vanessa_logger_desc, prefix, \
+					fmt, __VA_ARGS__); \
+	})
+#endif
+
+#if defined(__VANESSA_LOGGER_DESC) && \
+	LOG_DEBUG <= VANESSA_LOGGER_COMPILE_MAX_PRIORITY
+#define __VANESSA_LOGGER_DEBUG_SITE(prefix, fmt, ...) \
+	__VANESSA_LOGGER_SITE(LOG_DEBUG, prefix, fmt, __VA_ARGS__)
+#else
+#define __VANESSA_LOGGER_DEBUG_SITE(prefix, fmt, ...) \
+	__VANESSA_LOGGER_IF(LOG_DEBUG, \
+		_vanessa_logger_log_prefix(__vanessa_logger_vl, LOG_DEBUG, \
+			prefix, fmt, __VA_ARGS__))
+#endif
+
+#if defined(__VANESSA_LOGGER_DESC) && \
+	LOG_INFO <= VANESSA_LOGGER_COMPILE_MAX_PRIORITY
+#define __VANESSA_LOGGER_INFO_SITE(prefix, fmt, ...) \
+	__VANESSA_LOGGER_SITE(LOG_INFO, prefix, fmt, __VA_ARGS__)
+#else
+#define __VANESSA_LOGGER_INFO_SITE(prefix, fmt, ...) \
+	__VANESSA_LOGGER_IF(LOG_INFO, \
+		_vanessa_logger_log_prefix(__vanessa_logger_vl, LOG_INFO, \
+			prefix, fmt, __VA_ARGS__))
+#endif
+
+#if defined(__VANESSA_LOGGER_DESC) && \
+	LOG_ERR <= VANESSA_LOGGER_COMPILE_MAX_PRIORITY
+#define __VANESSA_LOGGER_ERR_SITE(prefix, fmt, ...) \
+	__VANESSA_LOGGER_SITE(LOG_ERR, prefix, fmt, __VA_ARGS__)
+#else
+#define __VANESSA_LOGGER_ERR_SITE(prefix, fmt, ...) \
+	__VANESSA_LOGGER_IF(LOG_ERR, \
+		_vanessa_logger_log_prefix(__vanessa_logger_vl, LOG_ERR, \
+			prefix, fmt, __VA_ARGS__))
+#endif
 
 #define VANESSA_LOGGER_DEBUG_UNSAFE(fmt, ...) \
-	_vanessa_logger_log_prefix(__vanessa_logger_vl, LOG_DEBUG, \
-		__func__, fmt, __VA_ARGS__)
+	__VANESSA_LOGGER_DEBUG_SITE(__func__, fmt, __VA_ARGS__)
 
 #define VANESSA_LOGGER_DEBUG(str) \
-	_vanessa_logger_log_prefix(__vanessa_logger_vl, LOG_DEBUG, \
-		__func__, "%s", str)
+	__VANESSA_LOGGER_DEBUG_SITE(__func__, "%s", str)
 
 #define VANESSA_LOGGER_DEBUG_ERRNO(str) \
-	_vanessa_logger_log_prefix(__vanessa_logger_vl, LOG_DEBUG, \
-		__func__, "%s: %s", str, strerror(errno))
+	__VANESSA_LOGGER_DEBUG_SITE(__func__, "%s: %s", str, strerror(errno))
 
 #define VANESSA_LOGGER_DEBUG_HERRNO(str) \
-	_vanessa_logger_log_prefix(__vanessa_logger_vl, LOG_DEBUG, \
-		__func__, "%s: %s", str, \
-		vanessa_logger_strherror(h_errno))
+	__VANESSA_LOGGER_DEBUG_SITE(__func__, "%s: %s", str, \
+			vanessa_logger_strherror(h_errno))
 
 #define VANESSA_LOGGER_DEBUG_RAW_UNSAFE(fmt, ...) \
-	vanessa_logger_log(__vanessa_logger_vl, LOG_DEBUG, \
-		fmt, __VA_ARGS__)
+	__VANESSA_LOGGER_DEBUG_SITE(NULL, fmt, __VA_ARGS__)
 
 #define VANESSA_LOGGER_DEBUG_RAW(str) \
-	vanessa_logger_log(__vanessa_logger_vl, LOG_DEBUG, "%s", str)
+	__VANESSA_LOGGER_DEBUG_SITE(NULL, "%s", str)
 
 #define VANESSA_LOGGER_INFO_UNSAFE(fmt, ...) \
-	vanessa_logger_log(__vanessa_logger_vl, LOG_INFO, fmt, __VA_ARGS__)
+	__VANESSA_LOGGER_INFO_SITE(NULL, fmt, __VA_ARGS__)
 
 #define VANESSA_LOGGER_INFO(str) \
-	vanessa_logger_log(__vanessa_logger_vl, LOG_INFO, "%s", str)
+	__VANESSA_LOGGER_INFO_SITE(NULL, "%s", str)
 
 #define VANESSA_LOGGER_ERR_UNSAFE(fmt, ...) \
-	vanessa_logger_log(__vanessa_logger_vl, LOG_ERR, fmt, __VA_ARGS__)
+	__VANESSA_LOGGER_ERR_SITE(NULL, fmt, __VA_ARGS__)
 
 #define VANESSA_LOGGER_ERR_RAW_UNSAFE(fmt, ...) \
-	vanessa_logger_log(__vanessa_logger_vl, LOG_ERR, fmt, __VA_ARGS__)
+	__VANESSA_LOGGER_ERR_SITE(NULL, fmt, __VA_ARGS__)
 
 #define VANESSA_LOGGER_ERR(str) \
-	vanessa_logger_log(__vanessa_logger_vl, LOG_ERR, "%s", str)
+	__VANESSA_LOGGER_ERR_SITE(NULL, "%s", str)
 
 #define VANESSA_LOGGER_RAW_ERR(str) \
-	vanessa_logger_log(__vanessa_logger_vl, LOG_ERR, "%s", str)
+	__VANESSA_LOGGER_ERR_SITE(NULL, "%s", str)
+
+#define VANESSA_LOGGER_LIMIT_UNSAFE(priority, rate, interval, fmt, ...) \
+	do { \
+		static vanessa_logger_site_t __vanessa_logger_site = \
+			VANESSA_LOGGER_SITE_INIT(rate, interval); \
+		__VANESSA_LOGGER_IF(priority, \
+			vanessa_logger_log_limit(&__vanessa_logger_site, \
+				__vanessa_logger_vl, \
+				__VANESSA_LOGGER_PRIORITY(priority), fmt, \
+				__VA_ARGS__)); \
+	} while (0)
+
+#define VANESSA_LOGGER_LIMIT(priority, rate, interval, str) \
+	VANESSA_LOGGER_LIMIT_UNSAFE(priority, rate, interval, "%s", str)
+
+#define VANESSA_LOGGER_ERR_LIMIT_UNSAFE(rate, interval, fmt, ...) \
+	VANESSA_LOGGER_LIMIT_UNSAFE(LOG_ERR, rate, interval, fmt, \
+		__VA_ARGS__)
+
+#define VANESSA_LOGGER_ERR_LIMIT(rate, interval, str) \
+	VANESSA_LOGGER_LIMIT_UNSAFE(LOG_ERR, rate, interval, "%s", str)
 
 #define VANESSA_LOGGER_DUMP(buffer, buffer_length, flag) \
 	vanessa_logger_str_dump(__vanessa_logger_vl, (buffer), \
 			(buffer_length), (flag))
 
+#define VANESSA_LOGGER_HEXDUMP(priority, buffer, buffer_length) \
+	__VANESSA_LOGGER_IF(priority, \
+		vanessa_logger_log_hexdump(__vanessa_logger_vl, \
+			__VANESSA_LOGGER_PRIORITY(priority), (buffer), \
+			(buffer_length)))
+
 #endif
@@ -0,0 +1,85 @@
+/**********************************************************************
+ * vanessa_logger_decode.c                                 October 2026
+ * Simon Horman                                      horms@verge.net.au
+ *
+ * vanessa_logger
+ * Generic logging layer
+ * Copyright (C) 2000-2008  Simon Horman <horms@verge.net.au>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307 USA
+ *
+ **********************************************************************/
+
+#include <vanessa_logger.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanessa_logger_sample_config.h"
+
+
+/**********************************************************************
+ * Muriel the main function
+ **********************************************************************/
+
+int main(int argc, char **argv)
+{
+	vanessa_logger_decoder_t *decoder;
+	FILE *in;
+	int status = 0;
+	int i;
+
+	if (argc > 1 && (!strcmp(argv[1], "-h") || 
+				!strcmp(argv[1], "--help"))) {
+		fprintf(stderr, "vanessa_logger_decode version %s\n"
+			"Usage: %s [file...]\n"
+			"Writes the lines held in files written by a "
+			"VANESSA_LOGGER_F_BINARY\n"
+			"logger to stdout. Files are decoded in the order "
+			"given, stdin if none are.\n", VERSION, argv[0]);
+		exit(-1);
+	}
+
+	decoder = vanessa_logger_decoder_create();
+	if (!decoder) {
+		fprintf(stderr, "Error: vanessa_logger_decoder_create\n");
+		exit(-1);
+	}
+
+	if (argc < 2) {
+		if (vanessa_logger_decode(decoder, stdin, stdout) < 0) {
+			status = -1;
+		}
+	}
+
+	for (i = 1; i < argc; i++) {
+		in = fopen(argv[i], "r");
+		if (!in) {
+			perror(argv[i]);
+			status = -1;
+			continue;
+		}
+		if (vanessa_logger_decode(decoder, in, stdout) < 0) {
+			fprintf(stderr, "Error: %s: vanessa_logger_decode\n",
+					argv[i]);
+			status = -1;
+		}
+		fclose(in);
+	}
+
+	vanessa_logger_decoder_destroy(decoder);
+
+	return (status);
+}
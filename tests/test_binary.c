@@ -0,0 +1,218 @@
+/**********************************************************************
+ * test_binary.c                                           October 2026
+ * Simon Horman                                      horms@verge.net.au
+ *
+ * vanessa_logger
+ * Generic logging layer
+ * Copyright (C) 2000-2008  Simon Horman <horms@verge.net.au>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307 USA
+ *
+ **********************************************************************/
+
+/*
+ * Binary loggers: the lines decoded from the records match those a
+ * text logger writes for the same messages, including when a buffer is
+ * reused for different formats, and VANESSA_LOGGER_F_PERROR echoes each
+ * line to stderr once. An asynchronous binary logger also logs from a
+ * forked child, more than its ring holds.
+ */
+
+#include <vanessa_logger.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "test_common.h"
+
+#define FORK_LINES 5000
+
+static vanessa_logger_t *vl_bin;
+static vanessa_logger_t *vl_txt;
+
+static void both(int priority, const char *fmt, ...)
+{
+	va_list ap;
+	int err = errno;
+
+	va_start(ap, fmt);
+	vanessa_logger_logv(vl_bin, priority, fmt, ap);
+	va_end(ap);
+
+	errno = err;
+	va_start(ap, fmt);
+	vanessa_logger_logv(vl_txt, priority, fmt, ap);
+	va_end(ap);
+}
+
+static char *decode(const char *file)
+{
+	vanessa_logger_decoder_t *dec;
+	char *got;
+	size_t len;
+	FILE *in;
+	FILE *out;
+
+	dec = vanessa_logger_decoder_create();
+	in = fopen(file, "r");
+	out = open_memstream(&got, &len);
+	TEST_ASSERT(dec && in && out);
+	TEST_ASSERT(vanessa_logger_decode(dec, in, out) == 0);
+	fclose(in);
+	fclose(out);
+	vanessa_logger_decoder_destroy(dec);
+
+	return (got);
+}
+
+static void test_fork(const char *dir)
+{
+	vanessa_logger_t *vl;
+	char *bin;
+	char *got;
+	char *p;
+	int status;
+	pid_t pid;
+	int i;
+
+	bin = test_path(dir, "fork");
+	vl = vanessa_logger_openlog_filename(bin, "test", LOG_DEBUG,
+			VANESSA_LOGGER_F_BINARY | VANESSA_LOGGER_F_ASYNC |
+			VANESSA_LOGGER_F_NO_IDENT_PID);
+	TEST_ASSERT(vl);
+	vanessa_logger_log(vl, LOG_INFO, "parent %d", 0);
+	vanessa_logger_flush(vl);
+
+	pid = fork();
+	TEST_ASSERT(pid >= 0);
+	if (!pid) {
+		/* Rather than hang if the writer thread is not running */
+		alarm(30);
+		for (i = 0; i < FORK_LINES; i++) {
+			vanessa_logger_log(vl, LOG_INFO, "child %d", i);
+		}
+		vanessa_logger_closelog(vl);
+		_exit(0);
+	}
+	TEST_ASSERT(waitpid(pid, &status, 0) == pid);
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		TEST_FAIL("child: status %d", status);
+	}
+	vanessa_logger_closelog(vl);
+
+	got = decode(bin);
+	TEST_ASSERT(test_lines(got) == FORK_LINES + 1);
+	TEST_ASSERT(!strncmp(got, "parent 0\n", 9));
+	for (i = 0, p = strchr(got, '\n') + 1; i < FORK_LINES; i++) {
+		TEST_ASSERT(atoi(p + 6) == i && !strncmp(p, "child ", 6));
+		p = strchr(p, '\n') + 1;
+	}
+
+	free(got);
+	free(bin);
+}
+
+int main(void)
+{
+	char *dir;
+	char *bin;
+	char *txt;
+	char *err;
+	char *expect;
+	char *got;
+	char *echo;
+	char buf[32];
+	int fd;
+	int saved;
+
+	dir = test_dir("test_binary");
+	bin = test_path(dir, "bin");
+	txt = test_path(dir, "txt");
+	err = test_path(dir, "err");
+
+	/* Catch what is echoed to stderr */
+	fflush(stderr);
+	saved = dup(STDERR_FILENO);
+	fd = open(err, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	TEST_ASSERT(saved >= 0 && fd >= 0 && dup2(fd, STDERR_FILENO) >= 0);
+	close(fd);
+
+	vl_bin = vanessa_logger_openlog_filename(bin, "test", LOG_DEBUG,
+			VANESSA_LOGGER_F_BINARY | VANESSA_LOGGER_F_PERROR);
+	vl_txt = vanessa_logger_openlog_filename(txt, "test", LOG_DEBUG,
+			VANESSA_LOGGER_F_NONE);
+	TEST_ASSERT(vl_bin && vl_txt);
+
+	both(LOG_INFO, "int %d %i %u %x %#o", -1, 2, 3u, 0xbeef, 8);
+	both(LOG_INFO, "long %ld %lld %zu %jd", -4L, 5LL, (size_t) 6,
+			(intmax_t) -7);
+	both(LOG_INFO, "str %s|%.3s|%-6s|%6s|", "one", "truncated", "l",
+			"r");
+	both(LOG_INFO, "null %s", (char *) NULL);
+	both(LOG_INFO, "double %.2f %g %e", 3.14159, 0.5, 1e10);
+	both(LOG_INFO, "width %*d|%-*.*s|", 5, 42, 6, 2, "abc");
+	both(LOG_INFO, "char %c percent %%", 'x');
+	errno = ENOENT;
+	both(LOG_ERR, "errno %m");
+	both(LOG_INFO, "%s", "plain");
+
+	/* The same buffer holding different formats */
+	strcpy(buf, "first %d");
+	both(LOG_INFO, buf, 1);
+	strcpy(buf, "second %s");
+	both(LOG_INFO, buf, "two");
+	strcpy(buf, "third %.1f");
+	both(LOG_INFO, buf, 3.0);
+	strcpy(buf, "first %d");
+	both(LOG_INFO, buf, 4);
+
+	vanessa_logger_closelog(vl_bin);
+	vanessa_logger_closelog(vl_txt);
+
+	fflush(stderr);
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+
+	got = decode(bin);
+	expect = test_read(txt, NULL);
+	echo = test_read(err, NULL);
+	TEST_ASSERT(test_lines(expect) == 13);
+	if (strcmp(got, expect)) {
+		TEST_FAIL("decoded:\n%s\nexpected:\n%s", got, expect);
+	}
+	if (strcmp(echo, expect)) {
+		TEST_FAIL("stderr:\n%s\nexpected:\n%s", echo, expect);
+	}
+
+	free(got);
+	free(expect);
+	free(echo);
+
+	test_fork(dir);
+
+	test_dir_remove(dir);
+	free(err);
+	free(txt);
+	free(bin);
+	free(dir);
+
+	return (0);
+}
@@ -0,0 +1,195 @@
+/**********************************************************************
+ * test_common.c                                           October 2026
+ * Simon Horman                                      horms@verge.net.au
+ *
+ * vanessa_logger
+ * Generic logging layer
+ * Copyright (C) 2000-2008  Simon Horman <horms@verge.net.au>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307 USA
+ *
+ **********************************************************************/
+
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "test_common.h"
+
+char *test_dir(const char *name)
+{
+	char *dir;
+
+	dir = (char *) malloc(strlen(name) + 8);
+	if (!dir) {
+		TEST_FAIL("malloc");
+	}
+	sprintf(dir, "%s.XXXXXX", name);
+	if (!mkdtemp(dir)) {
+		TEST_FAIL("mkdtemp: %s", dir);
+	}
+	return (dir);
+}
+
+void test_dir_remove(const char *dir)
+{
+	DIR *d;
+	struct dirent *ent;
+	char *path;
+
+	d = opendir(dir);
+	if (!d) {
+		return;
+	}
+	while ((ent = readdir(d))) {
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+			continue;
+		}
+		path = test_path(dir, ent->d_name);
+		unlink(path);
+		free(path);
+	}
+	closedir(d);
+	rmdir(dir);
+}
+
+char *test_path(const char *dir, const char *file)
+{
+	char *path;
+
+	path = (char *) malloc(strlen(dir) + strlen(file) + 2);
+	if (!path) {
+		TEST_FAIL("malloc");
+	}
+	sprintf(path, "%s/%s", dir, file);
+	return (path);
+}
+
+char *test_read(const char *file, size_t *len)
+{
+	FILE *fh;
+	struct stat st;
+	char *buf;
+	size_t n;
+
+	fh = fopen(file, "r");
+	if (!fh || fstat(fileno(fh), &st) < 0) {
+		TEST_FAIL("can't read %s", file);
+	}
+	buf = (char *) malloc(st.st_size + 1);
+	if (!buf) {
+		TEST_FAIL("malloc");
+	}
+	n = fread(buf, 1, st.st_size, fh);
+	fclose(fh);
+	buf[n] = '\0';
+	if (len) {
+		*len = n;
+	}
+	return (buf);
+}
+
+unsigned long test_lines(const char *buf)
+{
+	unsigned long n = 0;
+
+	for (; *buf; buf++) {
+		if (*buf == '\n') {
+			n++;
+		}
+	}
+	return (n);
+}
+
+static const char *test_json_string(const char *p, const char *end)
+{
+	int i;
+
+	if (p >= end || *p++ != '"') {
+		return (NULL);
+	}
+	while (p < end && *p != '"') {
+		if ((unsigned char) *p < 0x20) {
+			return (NULL);
+		}
+		if (*p++ != '\\') {
+			continue;
+		}
+		if (p >= end) {
+			return (NULL);
+		}
+		if (*p == 'u') {
+			for (i = 1; i <= 4; i++) {
+				if (p + i >= end || !isxdigit((unsigned char) p[i])) {
+					return (NULL);
+				}
+			}
+			p += 5;
+		}
+		else if (*p && strchr("\"\\/bfnrt", *p)) {
+			p++;
+		}
+		else {
+			return (NULL);
+		}
+	}
+	return (p < end ? p + 1 : NULL);
+}
+
+int test_json_line(const char *line, size_t len)
+{
+	const char *p = line;
+	const char *end = line + len;
+	size_t n;
+
+	if (!len || line[len - 1] != '\n') {
+		return (0);
+	}
+	end--;
+
+	if (p >= end || *p++ != '{') {
+		return (0);
+	}
+	while (1) {
+		p = test_json_string(p, end);
+		if (!p || p >= end || *p++ != ':') {
+			return (0);
+		}
+		if (p < end && *p == '"') {
+			p = test_json_string(p, end);
+		}
+		else {
+			n = strspn(p, "-+.0123456789eE");
+			if (!n) {
+				n = !strncmp(p, "true", 4) || 
+					!strncmp(p, "null", 4) ? 4 :
+					!strncmp(p, "false", 5) ? 5 : 0;
+			}
+			p = n ? p + n : NULL;
+		}
+		if (!p || p >= end) {
+			return (0);
+		}
+		if (*p == '}') {
+			return (p + 1 == end);
+		}
+		if (*p++ != ',') {
+			return (0);
+		}
+	}
+}
@@ -0,0 +1,69 @@
+/**********************************************************************
+ * test_common.h                                           October 2026
+ * Simon Horman                                      horms@verge.net.au
+ *
+ * vanessa_logger
+ * Generic logging layer
+ * Copyright (C) 2000-2008  Simon Horman <horms@verge.net.au>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307 USA
+ *
+ **********************************************************************/
+
+#ifndef _TEST_COMMON_H
+#define _TEST_COMMON_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Report a failure and exit with a status make check counts as failed */
+#define TEST_FAIL(...) \
+	do { \
+		fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+		fprintf(stderr, __VA_ARGS__); \
+		fputc('\n', stderr); \
+		exit(1); \
+	} while (0)
+
+#define TEST_ASSERT(cond) \
+	do { \
+		if (!(cond)) { \
+			TEST_FAIL("%s", #cond); \
+		} \
+	} while (0)
+
+/* Create a scratch directory in the current directory */
+char *test_dir(const char *name);
+
+/* Remove a scratch directory and the files in it */
+void test_dir_remove(const char *dir);
+
+/* Join a directory and a file name, the result must be freed */
+char *test_path(const char *dir, const char *file);
+
+/* Read a whole file, the result is '\0' terminated and must be freed */
+char *test_read(const char *file, size_t *len);
+
+/* Count the lines in buf */
+unsigned long test_lines(const char *buf);
+
+/*
+ * Check that line is a flat JSON object, whose values are strings,
+ * numbers, true, false or null, followed by a '\n'. Returns 1 if so.
+ */
+int test_json_line(const char *line, size_t len);
+
+#endif /* _TEST_COMMON_H */
@@ -0,0 +1,167 @@
+/**********************************************************************
+ * test_kv.c                                               October 2026
+ * Simon Horman                                      horms@verge.net.au
+ *
+ * vanessa_logger
+ * Generic logging layer
+ * Copyright (C) 2000-2008  Simon Horman <horms@verge.net.au>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307 USA
+ *
+ **********************************************************************/
+
+/*
+ * Structured logging: key/value pairs are escaped as JSON members or
+ * quoted in logfmt as need be, and the pairs of a message that triggers
+ * a flight recorder dump are not added to the dumped messages.
+ */
+
+#include <vanessa_logger.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "test_common.h"
+
+#define PAIRS(key) \
+	"s", VANESSA_LOGGER_KV_STR, "a\"b\\c\nd\te\001f", \
+	key, VANESSA_LOGGER_KV_STR, "plain", \
+	"null", VANESSA_LOGGER_KV_STR, (char *) NULL, \
+	"empty", VANESSA_LOGGER_KV_STR, "", \
+	"space", VANESSA_LOGGER_KV_STR, "a b", \
+	"i", VANESSA_LOGGER_KV_INT, -42, \
+	"ll", VANESSA_LOGGER_KV_LLONG, LLONG_MIN, \
+	"ull", VANESSA_LOGGER_KV_ULLONG, ULLONG_MAX, \
+	"d", VANESSA_LOGGER_KV_DOUBLE, 0.1, \
+	"inf", VANESSA_LOGGER_KV_DOUBLE, (double) INFINITY, \
+	"b", VANESSA_LOGGER_KV_BOOL, 1, \
+	(char *) NULL
+
+static const char json_expect[] =
+	"{\"level\":\"err\",\"msg\":\"say \\\"hi\\\"\","
+	"\"s\":\"a\\\"b\\\\c\\nd\\te\\u0001f\","
+	"\"k\\\"ey\":\"plain\",\"null\":null,\"empty\":\"\","
+	"\"space\":\"a b\",\"i\":-42,"
+	"\"ll\":-9223372036854775808,\"ull\":18446744073709551615,"
+	"\"d\":0.1,\"inf\":null,\"b\":true}\n";
+
+static const char text_expect[] =
+	"connect failed s=\"a\\\"b\\\\c\\nd\\te\\u0001f\" key=plain "
+	"null=null empty=\"\" space=\"a b\" i=-42 "
+	"ll=-9223372036854775808 ull=18446744073709551615 d=0.1 "
+	"inf=inf b=true\n";
+
+static void test_json(const char *dir)
+{
+	vanessa_logger_t *vl;
+	char *log;
+	char *got;
+
+	log = test_path(dir, "json");
+	vl = vanessa_logger_openlog_filename(log, "test", LOG_DEBUG,
+			VANESSA_LOGGER_F_NO_IDENT_PID | VANESSA_LOGGER_F_JSON);
+	TEST_ASSERT(vl);
+	vanessa_logger_logkv(vl, LOG_ERR, "say \"hi\"\n", PAIRS("k\"ey"));
+	vanessa_logger_closelog(vl);
+
+	got = test_read(log, NULL);
+	TEST_ASSERT(test_json_line(got, strlen(got)));
+	if (strcmp(got, json_expect)) {
+		TEST_FAIL("got %s expected %s", got, json_expect);
+	}
+
+	free(got);
+	free(log);
+}
+
+static void test_text(const char *dir)
+{
+	vanessa_logger_t *vl;
+	char *log;
+	char *got;
+
+	log = test_path(dir, "text");
+	vl = vanessa_logger_openlog_filename(log, "test", LOG_DEBUG,
+			VANESSA_LOGGER_F_NO_IDENT_PID);
+	TEST_ASSERT(vl);
+	vanessa_logger_logkv(vl, LOG_ERR, "connect failed", PAIRS("key"));
+	vanessa_logger_closelog(vl);
+
+	got = test_read(log, NULL);
+	if (strcmp(got, text_expect)) {
+		TEST_FAIL("got %s expected %s", got, text_expect);
+	}
+
+	free(got);
+	free(log);
+}
+
+static void test_recorder(const char *dir)
+{
+	vanessa_logger_t *vl;
+	char *log;
+	char *got;
+	char *p;
+	char *nl;
+	const char *last = NULL;
+	int n = 0;
+
+	log = test_path(dir, "recorder");
+	vl = vanessa_logger_openlog_filename(log, "test", LOG_INFO,
+			VANESSA_LOGGER_F_NO_IDENT_PID | VANESSA_LOGGER_F_JSON);
+	TEST_ASSERT(vl);
+	TEST_ASSERT(vanessa_logger_set_recorder(vl, LOG_DEBUG, 0, 0,
+				LOG_ERR) == 0);
+	vanessa_logger_log(vl, LOG_DEBUG, "recorded %d", 1);
+	vanessa_logger_log(vl, LOG_DEBUG, "recorded %d", 2);
+	vanessa_logger_logkv(vl, LOG_ERR, "failed",
+			"k", VANESSA_LOGGER_KV_STR, "v", (char *) NULL);
+	vanessa_logger_closelog(vl);
+
+	/* The dump and the two messages, then the message with the pair */
+	got = test_read(log, NULL);
+	TEST_ASSERT(test_lines(got) == 4);
+	for (p = got; *p; p = nl + 1) {
+		nl = strchr(p, '\n');
+		TEST_ASSERT(test_json_line(p, nl - p + 1));
+		*nl = '\0';
+		if (strstr(p, "\"k\":")) {
+			n++;
+		}
+		*nl = '\n';
+		last = p;
+	}
+	TEST_ASSERT(n == 1);
+	TEST_ASSERT(!strcmp(last, 
+			"{\"level\":\"err\",\"msg\":\"failed\",\"k\":\"v\"}\n"));
+
+	free(got);
+	free(log);
+}
+
+int main(void)
+{
+	char *dir;
+
+	dir = test_dir("test_kv");
+	test_json(dir);
+	test_text(dir);
+	test_recorder(dir);
+	test_dir_remove(dir);
+	free(dir);
+
+	return (0);
+}
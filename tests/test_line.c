@@ -0,0 +1,163 @@
+/**********************************************************************
+ * test_line.c                                             October 2026
+ * Simon Horman                                      horms@verge.net.au
+ *
+ * vanessa_logger
+ * Generic logging layer
+ * Copyright (C) 2000-2008  Simon Horman <horms@verge.net.au>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307 USA
+ *
+ **********************************************************************/
+
+/*
+ * Long lines: lines of any length up to max_len are written whole,
+ * whether or not the thread has rendered a long line before, and longer
+ * ones are cut short with a marker. Lines of JSON that are cut short
+ * are still valid JSON.
+ */
+
+#include <vanessa_logger.h>
+#include <string.h>
+
+#include "test_common.h"
+
+#define MAX_LEN      4096
+#define JSON_MAX_LEN 1024
+#define TRUNCATED    "...[truncated]"
+
+static char text[16384];
+
+/* Lengths of message, in the order they are logged */
+static const size_t text_len[] = {
+	10, 1000, 1022, 1023, 1024, 2000, 5, MAX_LEN - 2, MAX_LEN - 1,
+	10000, 3000, 1, MAX_LEN * 3, 100
+};
+
+#define NTEXT (sizeof(text_len) / sizeof(*text_len))
+
+static void test_text(const char *dir)
+{
+	vanessa_logger_t *vl;
+	char *log;
+	char *got;
+	char *p;
+	char *nl;
+	size_t i;
+
+	log = test_path(dir, "text");
+	vl = vanessa_logger_openlog_filename(log, "test", LOG_DEBUG,
+			VANESSA_LOGGER_F_NO_IDENT_PID);
+	TEST_ASSERT(vl);
+	vanessa_logger_set_max_len(vl, MAX_LEN);
+	for (i = 0; i < NTEXT; i++) {
+		vanessa_logger_log(vl, LOG_INFO, "%.*s", (int) text_len[i],
+				text);
+	}
+	vanessa_logger_closelog(vl);
+
+	got = test_read(log, NULL);
+	TEST_ASSERT(test_lines(got) == NTEXT);
+	for (i = 0, p = got; i < NTEXT; i++, p = nl + 1) {
+		nl = strchr(p, '\n');
+		if (text_len[i] + 2 <= MAX_LEN) {
+			TEST_ASSERT((size_t) (nl - p) == text_len[i]);
+			TEST_ASSERT(!strncmp(p, text, text_len[i]));
+			continue;
+		}
+		/* The '\n' and a NUL count towards MAX_LEN */
+		TEST_ASSERT(nl - p == MAX_LEN - 2);
+		TEST_ASSERT(!strncmp(nl - strlen(TRUNCATED), TRUNCATED,
+					strlen(TRUNCATED)));
+		TEST_ASSERT(!strncmp(p, text, MAX_LEN - 2 - 
+					strlen(TRUNCATED)));
+	}
+
+	free(got);
+	free(log);
+}
+
+static void test_json(const char *dir)
+{
+	vanessa_logger_t *vl;
+	char msg[4096];
+	char *log;
+	char *got;
+	char *p;
+	char *nl;
+	size_t len;
+	size_t i;
+	size_t n = 0;
+	size_t truncated = 0;
+
+	/* Characters that need escaping, in differing lengths */
+	for (i = 0; i < sizeof(msg) - 1; i++) {
+		msg[i] = "ab\"c\\d\001ef\n"[i % 10];
+	}
+	msg[i] = '\0';
+
+	log = test_path(dir, "json");
+	vl = vanessa_logger_openlog_filename(log, "test", LOG_DEBUG,
+			VANESSA_LOGGER_F_NO_IDENT_PID | VANESSA_LOGGER_F_JSON);
+	TEST_ASSERT(vl);
+	vanessa_logger_set_max_len(vl, JSON_MAX_LEN);
+	for (len = 0; len < sizeof(msg); len += len < 1200 ? 1 : 97) {
+		vanessa_logger_log(vl, LOG_INFO, "%.*s", (int) len, msg);
+		n++;
+	}
+	vanessa_logger_logkv(vl, LOG_INFO, "short", "long",
+			VANESSA_LOGGER_KV_STR, msg, "n", VANESSA_LOGGER_KV_INT,
+			1, NULL);
+	vanessa_logger_logkv(vl, LOG_INFO, msg, "n", VANESSA_LOGGER_KV_INT,
+			1, NULL);
+	n += 2;
+	vanessa_logger_closelog(vl);
+
+	got = test_read(log, NULL);
+	TEST_ASSERT(test_lines(got) == n);
+	for (p = got; *p; p = nl + 1) {
+		nl = strchr(p, '\n');
+		TEST_ASSERT((size_t) (nl - p) + 2 <= JSON_MAX_LEN);
+		if (!test_json_line(p, nl - p + 1)) {
+			TEST_FAIL("invalid JSON: %.*s", (int) (nl - p), p);
+		}
+		if (strstr(p, TRUNCATED "\"}\n") == nl - strlen(TRUNCATED) - 2) {
+			truncated++;
+		}
+	}
+	TEST_ASSERT(truncated > 0 && truncated < n);
+
+	free(got);
+	free(log);
+}
+
+int main(void)
+{
+	char *dir;
+	size_t i;
+
+	for (i = 0; i < sizeof(text) - 1; i++) {
+		text[i] = 'a' + i % 26;
+	}
+
+	dir = test_dir("test_line");
+	test_text(dir);
+	test_json(dir);
+	test_dir_remove(dir);
+	free(dir);
+
+	return (0);
+}
@@ -0,0 +1,114 @@
+/**********************************************************************
+ * test_macro.c                                            October 2026
+ * Simon Horman                                      horms@verge.net.au
+ *
+ * vanessa_logger
+ * Generic logging layer
+ * Copyright (C) 2000-2008  Simon Horman <horms@verge.net.au>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307 USA
+ *
+ **********************************************************************/
+
+/*
+ * Convenience macros: the priority given to those that take one is
+ * evaluated once, whether the message is compiled in or out, and
+ * messages above VANESSA_LOGGER_COMPILE_MAX_PRIORITY are compiled out.
+ */
+
+#define VANESSA_LOGGER_COMPILE_MAX_PRIORITY LOG_INFO
+
+#include <vanessa_logger.h>
+#include <string.h>
+
+#include "test_common.h"
+
+static const int priority[] = { LOG_ERR, LOG_DEBUG, LOG_INFO };
+
+#define NPRIORITY (sizeof(priority) / sizeof(*priority))
+
+static const char expect[] =
+	"log 0\n"
+	"log 2\n"
+	"unsafe 3\n"
+	"unsafe 5\n"
+	"category 6\n"
+	"category 8\n"
+	"limit 9\n"
+	"limit 11\n";
+
+int main(void)
+{
+	vanessa_logger_t *vl;
+	vanessa_logger_category_t *cat;
+	char str[16];
+	char *dir;
+	char *log;
+	char *got;
+	size_t n = 0;
+	size_t m;
+	size_t i;
+
+	dir = test_dir("test_macro");
+	log = test_path(dir, "log");
+	vl = vanessa_logger_openlog_filename(log, "test", LOG_DEBUG,
+			VANESSA_LOGGER_F_NO_IDENT_PID);
+	TEST_ASSERT(vl);
+	vanessa_logger_set(vl);
+	cat = vanessa_logger_category(vl, "test");
+	TEST_ASSERT(cat);
+
+	for (i = 0; i < NPRIORITY; i++) {
+		snprintf(str, sizeof(str), "log %zu", n);
+		VANESSA_LOGGER_LOG(priority[n++ % NPRIORITY], str);
+	}
+	TEST_ASSERT(n == NPRIORITY);
+	for (i = 0; i < NPRIORITY; i++) {
+		m = n;
+		VANESSA_LOGGER_LOG_UNSAFE(priority[n++ % NPRIORITY],
+				"unsafe %zu", m);
+	}
+	TEST_ASSERT(n == 2 * NPRIORITY);
+	for (i = 0; i < NPRIORITY; i++) {
+		m = n;
+		VANESSA_LOGGER_CATEGORY(cat, priority[n++ % NPRIORITY],
+				"category %zu", m);
+	}
+	TEST_ASSERT(n == 3 * NPRIORITY);
+	for (i = 0; i < NPRIORITY; i++) {
+		m = n;
+		VANESSA_LOGGER_LIMIT_UNSAFE(priority[n++ % NPRIORITY], 0, 0,
+				"limit %zu", m);
+	}
+	TEST_ASSERT(n == 4 * NPRIORITY);
+	VANESSA_LOGGER_HEXDUMP(priority[n++ % NPRIORITY], "", 0);
+	TEST_ASSERT(n == 4 * NPRIORITY + 1);
+
+	vanessa_logger_unset();
+	vanessa_logger_closelog(vl);
+
+	got = test_read(log, NULL);
+	if (strcmp(got, expect)) {
+		TEST_FAIL("got:\n%s", got);
+	}
+
+	free(got);
+	free(log);
+	test_dir_remove(dir);
+	free(dir);
+
+	return (0);
+}
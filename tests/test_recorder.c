@@ -0,0 +1,195 @@
+/**********************************************************************
+ * test_recorder.c                                         October 2026
+ * Simon Horman                                      horms@verge.net.au
+ *
+ * vanessa_logger
+ * Generic logging layer
+ * Copyright (C) 2000-2008  Simon Horman <horms@verge.net.au>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307 USA
+ *
+ **********************************************************************/
+
+/*
+ * Flight recorder: messages filtered out by max_priority are dumped
+ * ahead of the message that triggers the dump, oldest first whichever
+ * thread recorded them, with the arguments they were recorded with,
+ * including when a buffer is reused for different formats, and only
+ * once. A child forked while other threads record and dump can record
+ * and dump in its turn.
+ */
+
+#include <vanessa_logger.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "test_common.h"
+
+#define FORKS 200
+
+static vanessa_logger_t *vl;
+static int stop;
+
+static void *thread(void *data)
+{
+	int *i = (int *) data;
+
+	vanessa_logger_log(vl, LOG_DEBUG, "thread %d", (*i)++);
+	vanessa_logger_log(vl, LOG_DEBUG, "thread %d", (*i)++);
+
+	return (NULL);
+}
+
+static void *record(void *data)
+{
+	(void) data;
+
+	vanessa_logger_log(vl, LOG_DEBUG, "record");
+
+	return (NULL);
+}
+
+/* Each new thread takes a ring, each dump holds the recorder */
+static void *busy(void *data)
+{
+	pthread_t tid;
+
+	(void) data;
+
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		if (!pthread_create(&tid, NULL, record, NULL)) {
+			pthread_join(tid, NULL);
+		}
+		vanessa_logger_dump_recorder(vl);
+	}
+
+	return (NULL);
+}
+
+static void test_fork(const char *dir)
+{
+	pthread_t tid;
+	char *log;
+	int status;
+	pid_t pid;
+	int i;
+
+	log = test_path(dir, "fork");
+	vl = vanessa_logger_openlog_filename(log, "test", LOG_INFO,
+			VANESSA_LOGGER_F_NO_IDENT_PID);
+	TEST_ASSERT(vl);
+	TEST_ASSERT(vanessa_logger_set_recorder(vl, LOG_DEBUG, 0, 0,
+				LOG_ERR) == 0);
+	TEST_ASSERT(pthread_create(&tid, NULL, busy, NULL) == 0);
+
+	for (i = 0; i < FORKS; i++) {
+		pid = fork();
+		TEST_ASSERT(pid >= 0);
+		if (!pid) {
+			/* Rather than hang on a lock held by the parent */
+			alarm(10);
+			record(NULL);
+			vanessa_logger_dump_recorder(vl);
+			_exit(0);
+		}
+		TEST_ASSERT(waitpid(pid, &status, 0) == pid);
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			TEST_FAIL("child %d: status %d", i, status);
+		}
+	}
+
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	TEST_ASSERT(pthread_join(tid, NULL) == 0);
+	vanessa_logger_closelog(vl);
+	free(log);
+}
+
+int main(void)
+{
+	pthread_t tid;
+	char *dir;
+	char *log;
+	char *got;
+	char *p;
+	char buf[32];
+	int i = 0;
+
+	dir = test_dir("test_recorder");
+	log = test_path(dir, "log");
+
+	vl = vanessa_logger_openlog_filename(log, "test", LOG_INFO,
+			VANESSA_LOGGER_F_NO_IDENT_PID);
+	TEST_ASSERT(vl);
+	TEST_ASSERT(vanessa_logger_set_recorder(vl, LOG_DEBUG, 0, 0,
+				LOG_ERR) == 0);
+
+	vanessa_logger_log(vl, LOG_DEBUG, "main %d", i++);
+	vanessa_logger_log(vl, LOG_INFO, "logged");
+	vanessa_logger_log(vl, LOG_DEBUG, "main %d %s", i++, "str");
+	TEST_ASSERT(pthread_create(&tid, NULL, thread, &i) == 0);
+	TEST_ASSERT(pthread_join(tid, NULL) == 0);
+	vanessa_logger_log(vl, LOG_DEBUG, "main %d", i++);
+
+	/* The same buffer holding different formats */
+	strcpy(buf, "buffer %d");
+	vanessa_logger_log(vl, LOG_DEBUG, buf, i++);
+	strcpy(buf, "buffer %s");
+	vanessa_logger_log(vl, LOG_DEBUG, buf, "six");
+
+	vanessa_logger_log(vl, LOG_ERR, "trigger");
+	TEST_ASSERT(vanessa_logger_dump_recorder(vl) == 0);
+	vanessa_logger_closelog(vl);
+
+	/*
+	 * Dumped lines carry the time they were recorded, so only the
+	 * order of the messages and their text are checked
+	 */
+	got = test_read(log, NULL);
+	TEST_ASSERT(test_lines(got) == 10);
+	p = got;
+	p = strstr(p, "logged\n");
+	TEST_ASSERT(p);
+	p = strstr(p, "flight recorder: 7 messages\n");
+	TEST_ASSERT(p);
+	p = strstr(p, "main 0\n");
+	TEST_ASSERT(p);
+	p = strstr(p, "main 1 str\n");
+	TEST_ASSERT(p);
+	p = strstr(p, "thread 2\n");
+	TEST_ASSERT(p);
+	p = strstr(p, "thread 3\n");
+	TEST_ASSERT(p);
+	p = strstr(p, "main 4\n");
+	TEST_ASSERT(p);
+	p = strstr(p, "buffer 5\n");
+	TEST_ASSERT(p);
+	p = strstr(p, "buffer six\n");
+	TEST_ASSERT(p);
+	p = strstr(p, "trigger\n");
+	TEST_ASSERT(p && !p[strlen("trigger\n")]);
+
+	free(got);
+
+	test_fork(dir);
+
+	test_dir_remove(dir);
+	free(log);
+	free(dir);
+
+	return (0);
+}
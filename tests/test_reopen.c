@@ -0,0 +1,320 @@
+/**********************************************************************
+ * test_reopen.c                                           October 2026
+ * Simon Horman                                      horms@verge.net.au
+ *
+ * vanessa_logger
+ * Generic logging layer
+ * Copyright (C) 2000-2008  Simon Horman <horms@verge.net.au>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307 USA
+ *
+ **********************************************************************/
+
+/*
+ * Reopening filename loggers: a logger asked to reopen from a signal
+ * handler does so before it logs its next message, so lines logged
+ * before the signal stay in the file that has been moved aside and
+ * those logged after it go to a new file.
+ *
+ * Lines logged by several threads while the file is reopened or
+ * rotated over and over are each written whole, once, and in order,
+ * with every flush policy and by an asynchronous logger.
+ */
+
+#include <vanessa_logger.h>
+#include <string.h>
+#include <signal.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "test_common.h"
+
+#define WRITERS 4
+#define LINES   20000
+#define REOPENS 50
+#define ROTATE_SIZE 16384
+
+static vanessa_logger_t *reopen_vl;
+
+static void reopen_handler(int sig)
+{
+	(void) sig;
+
+	vanessa_logger_reopen_signal(reopen_vl);
+}
+
+static void test_signal(const char *dir, const char *name,
+		vanessa_logger_flag_t flag)
+{
+	char *log;
+	char *old;
+	char *got;
+	char *old_name;
+
+	log = test_path(dir, name);
+	old_name = (char *) malloc(strlen(name) + 3);
+	if (!old_name) {
+		TEST_FAIL("malloc");
+	}
+	sprintf(old_name, "%s.1", name);
+	old = test_path(dir, old_name);
+
+	reopen_vl = vanessa_logger_openlog_filename(log, "test", LOG_DEBUG,
+			VANESSA_LOGGER_F_NO_IDENT_PID | flag);
+	TEST_ASSERT(reopen_vl);
+	vanessa_logger_log(reopen_vl, LOG_INFO, "before");
+	vanessa_logger_flush(reopen_vl);
+	TEST_ASSERT(!rename(log, old));
+	vanessa_logger_log(reopen_vl, LOG_INFO, "moved");
+	TEST_ASSERT(!raise(SIGHUP));
+	vanessa_logger_log(reopen_vl, LOG_INFO, "after");
+	vanessa_logger_closelog(reopen_vl);
+	reopen_vl = NULL;
+
+	got = test_read(old, NULL);
+	if (strcmp(got, "before\nmoved\n")) {
+		TEST_FAIL("%s: got:\n%s", old, got);
+	}
+	free(got);
+	got = test_read(log, NULL);
+	if (strcmp(got, "after\n")) {
+		TEST_FAIL("%s: got:\n%s", log, got);
+	}
+	free(got);
+
+	free(old_name);
+	free(old);
+	free(log);
+}
+
+typedef struct {
+	vanessa_logger_t *vl;
+	int id;
+} writer_t;
+
+static void *writer(void *data)
+{
+	writer_t *w = (writer_t *) data;
+	int i;
+
+	for (i = 0; i < LINES; i++) {
+		vanessa_logger_log(w->vl, LOG_INFO, "writer %d line %d",
+				w->id, i);
+	}
+
+	return (NULL);
+}
+
+static void start_writers(vanessa_logger_t *vl, pthread_t *tid, writer_t *w)
+{
+	int i;
+
+	for (i = 0; i < WRITERS; i++) {
+		w[i].vl = vl;
+		w[i].id = i;
+		if (pthread_create(&tid[i], NULL, writer, &w[i])) {
+			TEST_FAIL("pthread_create");
+		}
+	}
+}
+
+static void join_writers(pthread_t *tid)
+{
+	int i;
+
+	for (i = 0; i < WRITERS; i++) {
+		pthread_join(tid[i], NULL);
+	}
+}
+
+/*
+ * Check the lines of files, oldest first: each must be whole and the
+ * lines of each writer must follow on from one another across files
+ */
+static void check_files(char **file, int n)
+{
+	int next[WRITERS] = { 0 };
+	char *got;
+	char *p;
+	char *nl;
+	int len;
+	int w;
+	int i;
+	int j;
+
+	for (j = 0; j < n; j++) {
+		got = test_read(file[j], NULL);
+		for (p = got; *p; p = nl + 1) {
+			nl = strchr(p, '\n');
+			if (!nl || sscanf(p, "writer %d line %d%n", &w, &i,
+						&len) != 2 || p + len != nl ||
+					w < 0 || w >= WRITERS) {
+				TEST_FAIL("%s: bad line: %.*s", file[j],
+						nl ? (int) (nl - p) : 
+						(int) strlen(p), p);
+			}
+			if (i != next[w]) {
+				TEST_FAIL("%s: writer %d: line %d, expected %d",
+						file[j], w, i, next[w]);
+			}
+			next[w]++;
+		}
+		free(got);
+	}
+
+	for (w = 0; w < WRITERS; w++) {
+		if (next[w] != LINES) {
+			TEST_FAIL("writer %d: %d lines, expected %d", w,
+					next[w], LINES);
+		}
+	}
+}
+
+static void test_reopen(int flag, int flush, unsigned long flush_value)
+{
+	vanessa_logger_t *vl;
+	pthread_t tid[WRITERS];
+	writer_t w[WRITERS];
+	char *file[REOPENS + 1];
+	char name[16];
+	char *dir;
+	int i;
+
+	dir = test_dir("test_reopen");
+	file[REOPENS] = test_path(dir, "log");
+	vl = vanessa_logger_openlog_filename_flush(file[REOPENS], "test",
+			LOG_DEBUG, VANESSA_LOGGER_F_NO_IDENT_PID | flag,
+			flush, flush_value);
+	TEST_ASSERT(vl);
+
+	start_writers(vl, tid, w);
+	for (i = 0; i < REOPENS; i++) {
+		sched_yield();
+		snprintf(name, sizeof(name), "log.%d", i);
+		file[i] = test_path(dir, name);
+		TEST_ASSERT(!rename(file[REOPENS], file[i]));
+		TEST_ASSERT(!vanessa_logger_reopen(vl));
+	}
+	join_writers(tid);
+	vanessa_logger_closelog(vl);
+
+	check_files(file, REOPENS + 1);
+
+	for (i = 0; i <= REOPENS; i++) {
+		free(file[i]);
+	}
+	test_dir_remove(dir);
+	free(dir);
+}
+
+static void test_rotate(int flag, int flush, unsigned long flush_value)
+{
+	vanessa_logger_t *vl;
+	pthread_t tid[WRITERS];
+	writer_t w[WRITERS];
+	DIR *d;
+	struct dirent *ent;
+	char **file;
+	char name[16];
+	char *log;
+	char *dir;
+	int n = 0;
+	int i;
+
+	dir = test_dir("test_reopen");
+	log = test_path(dir, "log");
+	vl = vanessa_logger_openlog_filename_flush(log, "test", LOG_DEBUG,
+			VANESSA_LOGGER_F_NO_IDENT_PID | flag, flush,
+			flush_value);
+	TEST_ASSERT(vl);
+	TEST_ASSERT(!vanessa_logger_set_rotate(vl, ROTATE_SIZE, 0,
+				VANESSA_LOGGER_ROTATE_NUMBER, 0));
+
+	/* Rotate by size, and now and then by reopening, as writers log */
+	start_writers(vl, tid, w);
+	for (i = 0; i < REOPENS; i++) {
+		sched_yield();
+		TEST_ASSERT(!vanessa_logger_reopen(vl));
+	}
+	join_writers(tid);
+	vanessa_logger_closelog(vl);
+
+	/* Only log and log.1 to log.n may be left, log.n is the oldest */
+	d = opendir(dir);
+	TEST_ASSERT(d);
+	while ((ent = readdir(d))) {
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..") ||
+				!strcmp(ent->d_name, "log")) {
+			continue;
+		}
+		if (sscanf(ent->d_name, "log.%d", &i) != 1 || i < 1) {
+			TEST_FAIL("unexpected file: %s", ent->d_name);
+		}
+		n++;
+	}
+	closedir(d);
+	/* Requests made while the next file is not ready make one switch */
+	TEST_ASSERT(n > 1);
+
+	file = (char **) malloc((n + 1) * sizeof(*file));
+	if (!file) {
+		TEST_FAIL("malloc");
+	}
+	for (i = 0; i < n; i++) {
+		snprintf(name, sizeof(name), "log.%d", n - i);
+		file[i] = test_path(dir, name);
+	}
+	file[n] = log;
+
+	check_files(file, n + 1);
+
+	for (i = 0; i <= n; i++) {
+		free(file[i]);
+	}
+	free(file);
+	test_dir_remove(dir);
+	free(dir);
+}
+
+int main(void)
+{
+	struct sigaction sa;
+	char *dir;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = reopen_handler;
+	sigemptyset(&sa.sa_mask);
+	TEST_ASSERT(!sigaction(SIGHUP, &sa, NULL));
+
+	dir = test_dir("test_reopen");
+	test_signal(dir, "sync", 0);
+	test_signal(dir, "async", VANESSA_LOGGER_F_ASYNC);
+	test_dir_remove(dir);
+	free(dir);
+
+	test_reopen(0, VANESSA_LOGGER_FLUSH_LINE, 0);
+	test_reopen(0, VANESSA_LOGGER_FLUSH_BYTES, 4096);
+	test_reopen(0, VANESSA_LOGGER_FLUSH_MSEC, 1);
+	test_reopen(VANESSA_LOGGER_F_ASYNC, VANESSA_LOGGER_FLUSH_LINE, 0);
+
+	test_rotate(0, VANESSA_LOGGER_FLUSH_LINE, 0);
+	test_rotate(0, VANESSA_LOGGER_FLUSH_BYTES, 4096);
+	test_rotate(VANESSA_LOGGER_F_ASYNC, VANESSA_LOGGER_FLUSH_LINE, 0);
+
+	return (0);
+}
@@ -0,0 +1,254 @@
+/**********************************************************************
+ * test_segment.c                                          October 2026
+ * Simon Horman                                      horms@verge.net.au
+ *
+ * vanessa_logger
+ * Generic logging layer
+ * Copyright (C) 2000-2008  Simon Horman <horms@verge.net.au>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307 USA
+ *
+ **********************************************************************/
+
+/*
+ * Memory mapped segment loggers: a hole left by a writer that reserved
+ * space but never filled it in must not lose the records after it when
+ * the segment is recovered, and a parent and child that move on to the
+ * same segment must not recover it from under each other.
+ */
+
+#include <vanessa_logger.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sched.h>
+
+#include "test_common.h"
+
+#define SEGMENT_HDR_LEN 16
+#define RECORD_HDR_LEN  8
+#define RECORD_LEN(len) ((RECORD_HDR_LEN + (len) + 7) & ~(size_t)7)
+
+#define FORK_LINES 2000
+
+/* Write out the lines of every segment in dir, return the count */
+
+static unsigned long dump_all(const char *dir, char **buf)
+{
+	DIR *d;
+	struct dirent *ent;
+	FILE *fh;
+	size_t len;
+	char *path;
+	long n;
+	unsigned long count = 0;
+
+	fh = open_memstream(buf, &len);
+	d = opendir(dir);
+	if (!fh || !d) {
+		TEST_FAIL("can't list %s", dir);
+	}
+	while ((ent = readdir(d))) {
+		if (strncmp(ent->d_name, "log.", 4)) {
+			continue;
+		}
+		path = test_path(dir, ent->d_name);
+		n = vanessa_logger_mmap_dump(path, fh);
+		free(path);
+		TEST_ASSERT(n >= 0);
+		count += n;
+	}
+	closedir(d);
+	fclose(fh);
+
+	return (count);
+}
+
+/* Zero record n of a segment, leaving a hole of the same length */
+
+static void punch(const char *seg, int n)
+{
+	char *map;
+	size_t offset;
+	uint32_t len;
+	struct stat st;
+	int fd;
+	int i;
+
+	fd = open(seg, O_RDWR);
+	TEST_ASSERT(fd >= 0 && fstat(fd, &st) == 0);
+	map = (char *) mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	TEST_ASSERT(map != MAP_FAILED);
+	offset = SEGMENT_HDR_LEN;
+	for (i = 0; i < n; i++) {
+		memcpy(&len, map + offset, sizeof(len));
+		offset += RECORD_LEN(len);
+	}
+	memcpy(&len, map + offset, sizeof(len));
+	memset(map + offset, 0, RECORD_LEN(len));
+	munmap(map, st.st_size);
+	close(fd);
+}
+
+static void test_hole(void)
+{
+	vanessa_logger_t *vl;
+	char *dir;
+	char *log;
+	char *seg;
+	char *buf;
+	int i;
+
+	dir = test_dir("test_segment");
+	log = test_path(dir, "log");
+	seg = test_path(dir, "log.00000000");
+
+	vl = vanessa_logger_openlog_mmap(log, "test",
+			LOG_DEBUG, VANESSA_LOGGER_F_NO_IDENT_PID, 65536);
+	TEST_ASSERT(vl);
+	for (i = 0; i < 100; i++) {
+		vanessa_logger_log(vl, LOG_INFO, "line %d", i);
+	}
+	vanessa_logger_closelog(vl);
+
+	/* Blank out the 11th record as if its writer had died */
+	punch(seg, 10);
+
+	vl = vanessa_logger_openlog_mmap(log, "test",
+			LOG_DEBUG, VANESSA_LOGGER_F_NO_IDENT_PID, 65536);
+	TEST_ASSERT(vl);
+	for (i = 0; i < 10; i++) {
+		vanessa_logger_log(vl, LOG_INFO, "after %d", i);
+	}
+	vanessa_logger_closelog(vl);
+
+	TEST_ASSERT(dump_all(dir, &buf) == 109);
+	TEST_ASSERT(!strstr(buf, "line 10\n"));
+	TEST_ASSERT(strstr(buf, "line 99\nafter 0\n"));
+	TEST_ASSERT(strstr(buf, "after 9\n"));
+	free(buf);
+
+	test_dir_remove(dir);
+	free(seg);
+	free(log);
+	free(dir);
+}
+
+/*
+ * A second opener of a segment that is in use, as a child that moved on
+ * to the same segment as its parent would be, must leave it alone.
+ * The hole stands for space the first writer has reserved but not yet
+ * filled in.
+ */
+
+static void test_live(void)
+{
+	vanessa_logger_t *vl;
+	vanessa_logger_t *vl2;
+	char *dir;
+	char *log;
+	char *seg;
+	char *buf;
+	int i;
+
+	dir = test_dir("test_segment");
+	log = test_path(dir, "log");
+	seg = test_path(dir, "log.00000000");
+
+	vl = vanessa_logger_openlog_mmap(log, "test",
+			LOG_DEBUG, VANESSA_LOGGER_F_NO_IDENT_PID, 65536);
+	TEST_ASSERT(vl);
+	for (i = 0; i < 20; i++) {
+		vanessa_logger_log(vl, LOG_INFO, "first %d", i);
+	}
+	punch(seg, 5);
+
+	vl2 = vanessa_logger_openlog_mmap(log, "test",
+			LOG_DEBUG, VANESSA_LOGGER_F_NO_IDENT_PID, 65536);
+	TEST_ASSERT(vl2);
+	for (i = 0; i < 5; i++) {
+		vanessa_logger_log(vl2, LOG_INFO, "second %d", i);
+		vanessa_logger_log(vl, LOG_INFO, "first %d", 20 + i);
+	}
+	vanessa_logger_closelog(vl2);
+	vanessa_logger_closelog(vl);
+
+	TEST_ASSERT(dump_all(dir, &buf) == 29);
+	TEST_ASSERT(strstr(buf, "first 19\nsecond 0\nfirst 20\n"));
+	free(buf);
+
+	test_dir_remove(dir);
+	free(seg);
+	free(log);
+	free(dir);
+}
+
+static void test_fork(void)
+{
+	vanessa_logger_t *vl;
+	char *dir;
+	char *log;
+	char *buf;
+	pid_t pid;
+	int status;
+	int i;
+
+	dir = test_dir("test_segment");
+	log = test_path(dir, "log");
+
+	/* Small segments so that both processes move on many times */
+	vl = vanessa_logger_openlog_mmap(log, "test",
+			LOG_DEBUG, VANESSA_LOGGER_F_NO_IDENT_PID, 4096);
+	TEST_ASSERT(vl);
+
+	pid = fork();
+	TEST_ASSERT(pid >= 0);
+	for (i = 0; i < FORK_LINES; i++) {
+		vanessa_logger_log(vl, LOG_INFO, "%s line %d",
+				pid ? "parent" : "child", i);
+		if (!(i % 64)) {
+			sched_yield();
+		}
+	}
+	vanessa_logger_closelog(vl);
+	if (!pid) {
+		_exit(0);
+	}
+	TEST_ASSERT(waitpid(pid, &status, 0) == pid);
+	TEST_ASSERT(WIFEXITED(status) && !WEXITSTATUS(status));
+
+	TEST_ASSERT(dump_all(dir, &buf) == 2 * FORK_LINES);
+	TEST_ASSERT(test_lines(buf) == 2 * FORK_LINES);
+	free(buf);
+
+	test_dir_remove(dir);
+	free(log);
+	free(dir);
+}
+
+int main(void)
+{
+	test_hole();
+	test_live();
+	test_fork();
+	return (0);
+}